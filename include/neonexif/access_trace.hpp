@@ -0,0 +1,83 @@
+#pragma once
+
+#include "async.hpp"
+#include "neonexif.hpp"
+
+#include <cstdint>
+#include <filesystem>
+#include <span>
+#include <vector>
+
+namespace nexif {
+
+/**
+ * The byte ranges of a file that parsing it read: every `read<T>()`,
+ * `data_view()` and `fetch_entry_value()` of the `Reader`s, and the raw
+ * accesses to magic bytes and headers. Overlapping and adjacent reads are
+ * coalesced into extents, which stay in the order of their first read. No
+ * contents are kept, so traces of customer files can be shared.
+ */
+struct AccessTrace {
+  FileType file_type{TIFF};
+  FileTypeVariant file_type_variant{STANDARD};
+  uint64_t file_size{0};
+  std::vector<FileExtent> extents;
+  uint64_t num_reads{0};  ///< Before coalescing.
+
+  void add(uint64_t offset, uint64_t length);
+  uint64_t bytes() const;
+};
+
+/**
+ * Records the reads of the parses on this thread into `trace`, while in
+ * scope. Scopes do not nest.
+ */
+class AccessTraceScope {
+ public:
+  explicit AccessTraceScope(AccessTrace &trace);
+  ~AccessTraceScope();
+
+  AccessTraceScope(const AccessTraceScope &) = delete;
+  AccessTraceScope &operator=(const AccessTraceScope &) = delete;
+};
+
+/** Parses `buffer` with `read_exif()`, and records the reads into a new trace. */
+AccessTrace trace_read_exif(const char *buffer, size_t length, ParseLevel level = ParseLevel::LENS_RESOLVED);
+
+/**
+ * Writes the traces in a compact binary format: the magic "NXAT", a version
+ * and the number of traces, then for each trace its file type, variant, size
+ * and extents. All integers are little endian.
+ */
+bool write_access_traces(const std::filesystem::path &path, std::span<const AccessTrace> traces);
+ParseResult<std::vector<AccessTrace>> read_access_traces(const std::filesystem::path &path);
+
+enum class ReplayBackend {
+  MMAP,      ///< Touches the pages of the extents in a mapping of the file, one file after the other.
+  PREAD,     ///< `make_thread_pool_backend()`, all files at once.
+  IO_URING,  ///< `make_io_uring_backend()`, all files at once.
+};
+
+const char *to_str(ReplayBackend backend);
+
+struct ReplayResult {
+  uint64_t files{0};
+  uint64_t extents{0};
+  uint64_t bytes{0};
+  uint64_t ns{0};  ///< From the first read to the last completion.
+};
+
+/**
+ * Reads the extents of `traces[i]` from `files[i]`, like the parse of the
+ * traced file did, to benchmark the I/O of parsing on some storage. With
+ * `cold_cache`, the files are dropped from the page cache first (which works
+ * for files without dirty pages); otherwise they are read once beforehand.
+ */
+ParseResult<ReplayResult> replay_access_traces(
+  std::span<const AccessTrace> traces,
+  std::span<const std::filesystem::path> files,
+  ReplayBackend backend,
+  bool cold_cache
+);
+
+}  // namespace nexif
@@ -0,0 +1,129 @@
+#pragma once
+
+#include "neonexif.hpp"
+
+#include <condition_variable>
+#include <coroutine>
+#include <cstdint>
+#include <deque>
+#include <filesystem>
+#include <functional>
+#include <memory>
+#include <mutex>
+#include <optional>
+#include <vector>
+
+namespace nexif {
+
+/** Where awaiting coroutines resume, e.g. the event loop of a server. */
+class Executor {
+ public:
+  virtual ~Executor() = default;
+  /** Runs `fn` on the executor. Called from any thread. */
+  virtual void post(std::function<void()> fn) = 0;
+};
+
+/** Runs the posted work on the thread that calls `run()`, until `stop()`. */
+class RunLoop : public Executor {
+ public:
+  void post(std::function<void()> fn) override;
+  void run();
+  void stop();
+
+ private:
+  std::mutex _mutex;
+  std::condition_variable _cv;
+  std::deque<std::function<void()>> _queue;
+  bool _stopping{false};
+};
+
+/** A byte range of a file. */
+struct FileExtent {
+  uint64_t offset{0};
+  uint64_t length{0};
+};
+
+/** The first bytes of a file, or the extents asked for, as read by an `IoBackend`. */
+struct FileRead {
+  std::optional<ParseError> error;
+  std::vector<char> data;
+  uint64_t file_size{0};
+};
+
+/**
+ * Reads files without blocking the caller. The completion runs on a thread of
+ * the backend, and should only hand the result over to an executor.
+ */
+class IoBackend {
+ public:
+  using Completion = std::function<void(FileRead &&read)>;
+
+  virtual ~IoBackend() = default;
+  /** Reads up to `max_length` bytes from the start of the file. */
+  virtual void read(const std::filesystem::path &path, size_t max_length, Completion done) = 0;
+  /**
+   * Reads the `extents` of the file, one after the other, into the data,
+   * back to back. Extents beyond the end of the file are cut off.
+   */
+  virtual void read_extents(const std::filesystem::path &path, std::vector<FileExtent> extents, Completion done) = 0;
+};
+
+/** Blocking reads on a pool of threads. Works everywhere. */
+std::unique_ptr<IoBackend> make_thread_pool_backend(int num_threads = 4);
+
+/**
+ * Reads through io_uring, with one thread reaping the completions. Null when
+ * the kernel does not support it, or when it is not allowed to be used.
+ */
+std::unique_ptr<IoBackend> make_io_uring_backend(unsigned queue_depth = 256);
+
+/** io_uring where available, else a pool of 4 threads. Created on first use. */
+IoBackend &default_io_backend();
+
+/**
+ * The result of `async_read_exif()`; `co_await` it. The file is read by the
+ * backend while the coroutine is suspended. The parse, and the resumption of
+ * the coroutine, run on the executor.
+ *
+ * Only the first `HEAD_SIZE` bytes are read at first, which holds the Exif
+ * data of all JPEGs and most raw files. If the parse of those fails, or has
+ * warnings, and the file is larger, the whole file is read and parsed again.
+ */
+class ExifAwaitable {
+ public:
+  static constexpr size_t HEAD_SIZE = 1 << 20;
+
+  ExifAwaitable(std::filesystem::path path, Executor &executor, ParseLevel level, IoBackend &backend) :
+    _path(std::move(path)), _executor(executor), _level(level), _backend(backend) {}
+
+  ExifAwaitable(const ExifAwaitable &) = delete;
+  ExifAwaitable &operator=(const ExifAwaitable &) = delete;
+
+  bool await_ready() const noexcept { return false; }
+  void await_suspend(std::coroutine_handle<> handle);
+  ParseResult<ExifData> await_resume() { return std::move(_result.value()); }
+
+ private:
+  void read(size_t max_length);
+  void parse(FileRead &head);
+
+  std::filesystem::path _path;
+  Executor &_executor;
+  ParseLevel _level;
+  IoBackend &_backend;
+  std::coroutine_handle<> _handle;
+  bool _read_whole_file{false};
+  std::optional<ParseResult<ExifData>> _result;
+};
+
+inline ExifAwaitable async_read_exif(
+  std::filesystem::path path,
+  Executor &executor,
+  ParseLevel level = ParseLevel::LENS_RESOLVED,
+  IoBackend &backend = default_io_backend()
+)
+{
+  return ExifAwaitable(std::move(path), executor, level, backend);
+}
+
+}  // namespace nexif
@@ -0,0 +1,108 @@
+#pragma once
+
+#include "neonexif.hpp"
+
+#include <cstddef>
+#include <filesystem>
+#include <memory>
+#include <span>
+#include <string_view>
+
+namespace nexif {
+
+/** A range of bytes in a file, relative to the start of the file. */
+struct ByteRange {
+  uint64_t offset{0};
+  uint64_t length{0};
+};
+
+/** An embedded preview (e.g. the JPEG thumbnail in IFD1 of a raw file). */
+struct PreviewRange {
+  int image_idx{-1};  ///< Index in `ExifData::images`.
+  uint32_t width{0};
+  uint32_t height{0};
+  ByteRange range;
+};
+
+/**
+ * RAII handle to the bytes of a file. Either owns a read-only mapping of the
+ * file and its descriptor (see `open()`), or refers to a caller-owned buffer
+ * (see `wrap()`), in which case the caller keeps the buffer alive for the
+ * lifetime of the handle.
+ *
+ * The handle answers several queries on the same mapping: the Exif data, the
+ * embedded previews and the strips of the raw image. They are computed on
+ * first use and cached, so that extracting a preview after reading the Exif
+ * data does not open, map or parse the file again. The handle can be moved
+ * to another thread, but must not be used by two threads at once.
+ */
+struct ExifFile {
+  ExifFile();
+  ~ExifFile();
+
+  ExifFile(const ExifFile &) = delete;
+  ExifFile &operator=(const ExifFile &) = delete;
+  ExifFile(ExifFile &&o);
+  ExifFile &operator=(ExifFile &&o);
+
+  static ParseResult<ExifFile> open(const std::filesystem::path &path);
+#ifndef _WIN32
+  /** Maps a file that is already open. Takes ownership of `fd`, also on failure. */
+  static ParseResult<ExifFile> open(int fd);
+#endif
+  static ExifFile wrap(const char *buffer, size_t length);
+
+  const char *data() const { return _data; }
+  size_t length() const { return _length; }
+  /** The descriptor of the file, or -1 for wrapped buffers. */
+  int fd() const { return _fd; }
+  explicit operator bool() const { return _data != nullptr; }
+
+  /**
+   * The Exif data of the file, parsed up to at least `level`. A later call
+   * with a higher level continues parsing with `upgrade()`; the warnings of
+   * all levels end up in the result.
+   *
+   * If the file is truncated while it is parsed, and the `MappingFaultPolicy`
+   * allows it, the mapping is replaced by the current contents of the file,
+   * read through the descriptor, and those are parsed instead.
+   */
+  const ParseResult<ExifData> &exif(ParseLevel level = ParseLevel::LENS_RESOLVED);
+
+  /**
+   * The embedded previews, i.e. all images but the full-resolution one that
+   * are stored as a single range of bytes. Ranges that do not lie within the
+   * file are left out. Empty if the file cannot be parsed.
+   */
+  std::span<const PreviewRange> previews();
+
+  /**
+   * The strips (or the single data range) of the full-resolution image, in
+   * file order of the strips. Empty if there is none, if the file cannot be
+   * parsed, or if any of the strips does not lie within the file.
+   */
+  std::span<const ByteRange> raw_ranges();
+
+  /**
+   * The bytes of `range`, or an empty view if it does not lie within the file.
+   * Reading them is not guarded against the file being truncated.
+   */
+  std::string_view bytes(ByteRange range) const;
+
+  void close();
+
+ private:
+  struct Queries;
+
+  char *_data{nullptr};
+  size_t _length{0};
+  int _fd{-1};
+  bool _owns_mapping{false};
+  std::unique_ptr<Queries> _queries;
+
+  Queries &queries();
+  bool in_file(ByteRange range) const;
+  bool replace_mapping_with_contents();
+};
+
+}  // namespace nexif
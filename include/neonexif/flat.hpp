@@ -0,0 +1,123 @@
+#pragma once
+
+#include "neonexif.hpp"
+
+#include <cstdint>
+#include <vector>
+
+namespace nexif {
+
+class InternPool;
+
+/**
+ * Flat, position-independent serialization of an `ExifData`, for shipping
+ * parse results between processes and persisting them.
+ *
+ * A record is a header followed by 8-byte aligned sections: the root tags
+ * (presence bitmask, packed values, origin table), the Exif IFD, the used
+ * images, the MakerNote, the parse state, the possible lens names and the
+ * string area. Every `CharData` points into the string area of the record, so
+ * a record can be copied or mapped anywhere and viewed with `FlatExifView`
+ * without deserializing it.
+ *
+ * Bump `FLAT_SCHEMA_VERSION` when the meaning of a field changes. Changes to
+ * the struct layouts are caught by `layout_hash`.
+ */
+constexpr uint32_t FLAT_SCHEMA_VERSION = 1;
+
+struct FlatHeader {
+  char magic[4];  ///< "NXFR"
+  uint32_t schema_version;
+  uint32_t layout_hash;
+  uint32_t record_size;  ///< Including the header, a multiple of 8.
+
+  uint8_t file_type;
+  uint8_t file_type_variant;
+  uint8_t big_endian;
+  uint8_t makernote_kind;  ///< Index in `ExifData::makernote`.
+  uint8_t num_images;
+  uint8_t num_possible_lenses;
+  uint16_t reserved{0};
+
+  uint32_t root_offset;
+  uint32_t exif_offset;
+  uint32_t images_offset;
+  uint32_t makernote_offset;
+  uint32_t parse_state_offset;
+  uint32_t lenses_offset;  ///< `num_possible_lenses` pairs of (string area offset, length).
+  uint32_t strings_offset;
+  uint32_t strings_size;
+};
+
+/** The root tags of an `ExifData`, as laid out in a record. */
+struct FlatRoot {
+  decltype(ExifData::present) present;
+  ExifData::Values values;
+  decltype(ExifData::parsed_from) parsed_from;
+};
+
+/** Hash over the sizes of the serialized structs. */
+uint32_t flat_layout_hash();
+
+/**
+ * Appends a record to `output`, padding it to 8-byte alignment first.
+ * Returns the offset of the record in `output`.
+ */
+size_t write_flat(const ExifData &data, std::vector<uint8_t> &output);
+
+/**
+ * Read-only view on a record in memory, e.g. in a mapped cache file. The
+ * record must stay alive and 8-byte aligned for the lifetime of the view.
+ */
+class FlatExifView {
+ public:
+  /**
+   * Checks the header and the bounds of all sections and strings. Records
+   * written by another schema version or struct layout are rejected with
+   * `UNKNOWN_FILE_TYPE`, without looking past the header.
+   */
+  static ParseResult<FlatExifView> open(const void *record, size_t length);
+
+  FileType file_type() const { return FileType(_header->file_type); }
+  FileTypeVariant file_type_variant() const { return FileTypeVariant(_header->file_type_variant); }
+  std::endian byte_order() const { return _header->big_endian ? std::endian::big : std::endian::little; }
+  size_t record_size() const { return _header->record_size; }
+
+#define NEXIF_FLAT_ROOT_ACCESSOR(_name, ...)                                                  \
+  TagView<__VA_ARGS__> _name() const                                                          \
+  {                                                                                           \
+    constexpr uint8_t i = uint8_t(ExifData::TagIdx::_name);                                   \
+    return {_root->values._name, bool(_root->present[i / 8] & (1 << (i % 8))), _root->parsed_from[i]}; \
+  }
+  NEXIF_EXIF_DATA_TAGS(NEXIF_FLAT_ROOT_ACCESSOR)
+#undef NEXIF_FLAT_ROOT_ACCESSOR
+
+  /** The Exif IFD. Its `possible_lenses` is empty, see `possible_lenses()`. */
+  const ExifIFD &exif() const { return *_exif; }
+  vla<std::string_view, 8> possible_lenses() const;
+
+  int num_images() const { return _header->num_images; }
+  const ImageData &image(int idx) const { return _images[idx]; }
+
+  const NikonMakernote *nikon_makernote() const;
+  const CanonMakernote *canon_makernote() const;
+  const ParseState &parse_state() const { return *_parse_state; }
+
+  /**
+   * Copies the record into a regular `ExifData`. Elsewhere, the possible
+   * lenses point into the static lens tables; here they are interned in
+   * `lens_names`, which must outlive the copy. Names that do not fit in a
+   * full pool are left out.
+   */
+  ExifData to_exif_data(InternPool &lens_names) const;
+
+ private:
+  const uint8_t *_base{nullptr};
+  const FlatHeader *_header{nullptr};
+  const FlatRoot *_root{nullptr};
+  const ExifIFD *_exif{nullptr};
+  const ImageData *_images{nullptr};
+  const ParseState *_parse_state{nullptr};
+};
+
+}  // namespace nexif
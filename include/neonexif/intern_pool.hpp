@@ -0,0 +1,105 @@
+#pragma once
+
+#include "neonexif.hpp"
+
+#include <array>
+#include <atomic>
+#include <memory>
+#include <mutex>
+#include <string_view>
+#include <vector>
+
+namespace nexif {
+
+/**
+ * Concurrent pool of unique strings, handing out 32-bit ids. Equal strings get
+ * equal ids, so that a batch of results can be grouped and filtered by integer
+ * compares, and stores every distinct make, model or lens name only once.
+ *
+ * The pool is split in shards by hash. Looking up a string that is already
+ * in the pool, and `str()`, never take a lock; only inserting a new string
+ * locks its shard. Strings and ids stay valid for the lifetime of the pool.
+ */
+class InternPool {
+ public:
+  /** Never handed out; stands for "not set". */
+  static constexpr uint32_t NONE = 0;
+  /** The most strings a pool can hold. */
+  static constexpr size_t MAX_CAPACITY = size_t(1) << 24;
+
+  /**
+   * A pool of at most `capacity` strings. They are spread over the shards by
+   * hash, each of which holds a sixteenth, so a pool can be full before it
+   * holds `capacity` strings.
+   */
+  explicit InternPool(size_t capacity = MAX_CAPACITY);
+  ~InternPool();
+  InternPool(const InternPool &) = delete;
+  InternPool &operator=(const InternPool &) = delete;
+
+  /** Returns the id of `s`, adding it to the pool if needed; `NONE` if the pool is full. */
+  uint32_t intern(std::string_view s);
+  /** Returns the id of `s`, or `NONE` if it is not in the pool. */
+  uint32_t find(std::string_view s) const;
+  /** The string of an id handed out by this pool. */
+  std::string_view str(uint32_t id) const;
+  /** Number of distinct strings. */
+  size_t size() const;
+
+ private:
+  static constexpr int SHARD_BITS = 4;
+  static constexpr int NUM_SHARDS = 1 << SHARD_BITS;
+  static constexpr int BLOCK_BITS = 8;
+  static constexpr int BLOCK_SIZE = 1 << BLOCK_BITS;
+  static constexpr int MAX_BLOCKS = 1 << 12;  ///< Up to 1M strings per shard.
+  static_assert(MAX_CAPACITY == size_t(NUM_SHARDS) * MAX_BLOCKS * BLOCK_SIZE);
+
+  struct Entry {
+    const char *data;
+    uint32_t length;
+    uint32_t hash;
+  };
+
+  /** Open-addressing table of ids. Replaced, never resized in place. */
+  struct Table {
+    uint32_t mask;
+    std::unique_ptr<std::atomic<uint32_t>[]> slots;
+  };
+
+  struct alignas(64) Shard {
+    std::atomic<Table *> table{nullptr};
+    std::atomic<uint32_t> count{0};
+    std::array<std::atomic<Entry *>, MAX_BLOCKS> blocks{};
+
+    std::mutex mutex;  ///< Guards everything below, and inserting.
+    std::vector<std::unique_ptr<Table>> tables;
+    std::vector<std::unique_ptr<char[]>> chunks;
+    uint32_t chunk_used{0};
+    uint32_t chunk_capacity{0};
+  };
+
+  std::array<Shard, NUM_SHARDS> _shards;
+  uint32_t _shard_capacity;
+
+  const Entry &entry(const Shard &shard, uint32_t local_idx) const;
+  uint32_t lookup(const Shard &shard, const Table *table, std::string_view s, uint32_t hash) const;
+  void grow(Shard &shard);
+  const char *store(Shard &shard, std::string_view s);
+};
+
+/**
+ * The identifying strings of an `ExifData`, as ids in an `InternPool`. A
+ * string that does not fit in a full pool is `NONE`, like one that is not set.
+ */
+struct InternedStrings {
+  uint32_t make{InternPool::NONE};
+  uint32_t model{InternPool::NONE};
+  uint32_t software{InternPool::NONE};
+  uint32_t lens_make{InternPool::NONE};
+  uint32_t lens_model{InternPool::NONE};
+  vla<uint32_t, 8> possible_lenses;
+};
+
+InternedStrings intern_strings(const ExifData &data, InternPool &pool);
+
+}  // namespace nexif
@@ -0,0 +1,92 @@
+#pragma once
+
+#include "neonexif.hpp"
+
+#include <cstdint>
+#include <memory>
+#include <mutex>
+#include <unordered_map>
+#include <vector>
+
+namespace nexif {
+
+/** The entries of one IFD that the parser did not skip. */
+struct IfdLayout {
+  uint32_t offset{0};  ///< Relative to the TIFF structure.
+  uint16_t num_entries{0};
+  uint64_t tag_checksum{0};  ///< Over the tag id and type of every entry.
+  std::vector<uint16_t> used_entries;
+};
+
+/** The IFDs that one parse of a file walked through. */
+struct LayoutTemplate {
+  std::vector<IfdLayout> ifds;
+
+  const IfdLayout *find(uint32_t offset) const
+  {
+    for (const IfdLayout &ifd : ifds) {
+      if (ifd.offset == offset) {
+        return &ifd;
+      }
+    }
+    return nullptr;
+  }
+};
+
+/**
+ * A parse's use of a `LayoutCache`: the template it replays or records. The
+ * parse runs inside `run_with_mapping_fault_guard()`, where a fault skips
+ * the destructors, so the caller of the guard owns these references and the
+ * parser only fills them in.
+ */
+struct LayoutSession {
+  LayoutCache *cache{nullptr};
+  std::shared_ptr<const LayoutTemplate> replay;
+  std::shared_ptr<LayoutTemplate> recording;
+};
+
+struct LayoutCacheStats {
+  uint64_t hits{0};        ///< Parses that found a template to replay.
+  uint64_t misses{0};      ///< Parses that learned a new template.
+  uint64_t mismatches{0};  ///< Replays that fell back to the full walk.
+  size_t templates{0};
+};
+
+/**
+ * Learned TIFF layouts, for parsing bursts of files from the same camera.
+ *
+ * The files one camera firmware writes have byte-identical IFD structures:
+ * the same IFD offsets, entry counts and tag order. A template is keyed by a
+ * fingerprint of the IFD0 entries (tag, type and count), and lists, for every
+ * IFD the parse visited, the entries that it used. A parse with a template
+ * checks the entry count and a checksum of the tag ids of each IFD, and then
+ * jumps straight to the used entries, skipping the dispatch of all others. On
+ * any mismatch, the parse starts over with the full walk and learns a new
+ * template.
+ *
+ * The MakerNote is parsed as usual, only the TIFF IFDs are replayed. The
+ * cache may be shared by threads parsing concurrently.
+ */
+class LayoutCache {
+ public:
+  explicit LayoutCache(size_t capacity = 64) : _capacity(capacity) {}
+
+  LayoutCache(const LayoutCache &) = delete;
+  LayoutCache &operator=(const LayoutCache &) = delete;
+
+  std::shared_ptr<const LayoutTemplate> find(uint64_t fingerprint);
+  void insert(uint64_t fingerprint, std::shared_ptr<const LayoutTemplate> layout);
+  /** Drops a template that did not match the file it was fingerprinted for. */
+  void evict(uint64_t fingerprint);
+
+  LayoutCacheStats stats() const;
+  void clear();
+
+ private:
+  size_t _capacity;
+  mutable std::mutex _mutex;
+  std::unordered_map<uint64_t, std::shared_ptr<const LayoutTemplate>> _templates;
+  LayoutCacheStats _stats;
+};
+
+}  // namespace nexif
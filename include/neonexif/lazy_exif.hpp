@@ -0,0 +1,161 @@
+#pragma once
+
+#include "neonexif.hpp"
+#include "exif_file.hpp"
+
+#include <array>
+#include <list>
+#include <optional>
+
+namespace nexif {
+
+struct Reader;
+namespace tiff {
+struct ifd_entry;
+}
+
+// clang-format off
+#define NEXIF_LAZY_ROOT_TAGS(x)  \
+  x(copyright)                   \
+  x(artist)                      \
+  x(make)                        \
+  x(model)                       \
+  x(software)                    \
+  x(processing_software)         \
+  x(apex_aperture_value)         \
+  x(apex_shutter_speed_value)    \
+  x(color_matrix_1)              \
+  x(color_matrix_2)              \
+  x(reduction_matrix_1)          \
+  x(reduction_matrix_2)          \
+  x(calibration_matrix_1)        \
+  x(calibration_matrix_2)        \
+  x(calibration_illuminant_1)    \
+  x(calibration_illuminant_2)    \
+  x(as_shot_neutral)             \
+  x(as_shot_white_xy)            \
+  x(analog_balance)
+
+#define NEXIF_LAZY_EXIF_TAGS(x)  \
+  x(exposure_time)               \
+  x(f_number)                    \
+  x(iso)                         \
+  x(exposure_program)            \
+  x(exif_version)                \
+  x(camera_owner_name)           \
+  x(lens_make)                   \
+  x(lens_serial_number)          \
+  x(image_title)                 \
+  x(photographer)                \
+  x(image_editor)                \
+  x(raw_developing_software)     \
+  x(image_editing_software)      \
+  x(metadata_editing_software)
+
+/** Exif tags which the MakerNote parsers can fill in or override. */
+#define NEXIF_LAZY_MAKERNOTE_EXIF_TAGS(x) \
+  x(lens_specification)                   \
+  x(lens_model)                           \
+  x(body_serial_number)
+// clang-format on
+
+/**
+ * A view on the Exif data of a file that decodes tags on first access.
+ *
+ * Creating the view only walks the IFD structure: it records where every IFD
+ * lives and which tag ids it contains. Accessing a tag looks up the entry in
+ * that index, decodes it with the same `parse_tag<TagInfo>` code as the full
+ * parser does, and caches the result. The MakerNote is decoded as a whole, the
+ * first time any field is requested that it can influence.
+ *
+ * The returned views stay valid for the lifetime of the view. The view
+ * holds on to the bytes of the file through its `ExifFile`.
+ */
+struct LazyExif {
+  struct IFDLocation {
+    uint32_t offset;        ///< Offset of the IFD within the TIFF structure.
+    uint16_t ifd_bits;      ///< tiff::IFD0, IFD1, IFD_EXIF bits.
+    uint16_t num_entries;   ///< Number of indexed entries.
+    uint16_t first_entry;   ///< Index of the first tag id in `entry_tags`.
+    int16_t image_idx{-1};  ///< Index of the image this IFD describes, if any.
+  };
+
+  ExifFile file;
+  FileType file_type;
+  FileTypeVariant file_type_variant;
+  std::endian byte_order;
+  uint32_t tiff_offset{0};
+  uint32_t tiff_length{0};
+
+  vla<IFDLocation, 16> ifds;
+  uint16_t num_entry_tags{0};
+  std::array<uint16_t, 1024> entry_tags;  ///< Tag ids, per IFD, in file order.
+
+  uint32_t makernote_offset{0};
+  uint32_t makernote_length{0};
+
+  std::list<ParseWarning> warnings;
+
+#define NEXIF_LAZY_DECLARE_ACCESSOR(_name) decltype(std::declval<const ExifData &>()._name()) _name();
+#define NEXIF_LAZY_DECLARE_EXIF_ACCESSOR(_name) decltype(std::declval<const ExifIFD &>()._name()) _name();
+  NEXIF_LAZY_ROOT_TAGS(NEXIF_LAZY_DECLARE_ACCESSOR)
+  NEXIF_LAZY_EXIF_TAGS(NEXIF_LAZY_DECLARE_EXIF_ACCESSOR)
+  NEXIF_LAZY_MAKERNOTE_EXIF_TAGS(NEXIF_LAZY_DECLARE_EXIF_ACCESSOR)
+#undef NEXIF_LAZY_DECLARE_EXIF_ACCESSOR
+#undef NEXIF_LAZY_DECLARE_ACCESSOR
+
+  // Date-time tags get their sub-second and timezone tags merged in.
+  TagView<DateTime> date_time();
+  TagView<DateTime> date_time_original();
+  TagView<DateTime> date_time_digitized();
+  TagView<rational64u> focal_length();
+  TagView<vla<std::string_view, 8>> possible_lenses();
+
+  int num_images() const { return _num_images; }
+  const ImageData &image(int idx);
+  const decltype(ExifData::makernote) &makernote();
+
+ private:
+  enum Field : uint8_t {
+#define NEXIF_LAZY_FIELD_ENUM(_name) FIELD_##_name,
+    NEXIF_LAZY_ROOT_TAGS(NEXIF_LAZY_FIELD_ENUM)
+    NEXIF_LAZY_EXIF_TAGS(NEXIF_LAZY_FIELD_ENUM)
+    NEXIF_LAZY_MAKERNOTE_EXIF_TAGS(NEXIF_LAZY_FIELD_ENUM)
+#undef NEXIF_LAZY_FIELD_ENUM
+    FIELD_date_time,
+    FIELD_date_time_original,
+    FIELD_date_time_digitized,
+    FIELD_focal_length,
+    FIELD_makernote,
+    NUM_FIELDS
+  };
+  std::array<uint64_t, (NUM_FIELDS + 63) / 64> _decoded{};
+  uint8_t _num_images{0};
+  uint8_t _images_decoded{0};  ///< Bitmask over `_cache.images`.
+
+  /** Decoded tags and storage for their string data. */
+  ExifData _cache{};
+
+  bool is_decoded(Field f) const { return _decoded[f / 64] & (uint64_t(1) << (f % 64)); }
+  void mark_decoded(Field f) { _decoded[f / 64] |= uint64_t(1) << (f % 64); }
+
+  std::optional<ParseError> discover();
+  std::optional<ParseError> index_ifd(Reader &r, uint32_t offset, uint16_t ifd_bits, int16_t image_idx, uint32_t *next_offset);
+  void init_reader(Reader &r);
+  bool find_entry(Reader &r, uint16_t tag, uint16_t ifd_mask, tiff::ifd_entry *entry);
+  template <typename TagInfo>
+  void decode_tag(Reader &r, const TagRef<typename TagInfo::cpp_type> &tag, uint16_t ifd_mask);
+  void decode_subsectime(Reader &r, uint16_t tag, uint16_t *millis);
+  void decode_makernote();
+
+  friend ParseResult<LazyExif> read_exif_lazy(ExifFile &&file);
+};
+
+/**
+ * Walks the IFD structure of the file and returns a view which decodes tags on
+ * demand. The file is kept alive by the returned view.
+ */
+ParseResult<LazyExif> read_exif_lazy(ExifFile &&file);
+ParseResult<LazyExif> read_exif_lazy(const std::filesystem::path &path);
+
+}  // namespace nexif
@@ -0,0 +1,91 @@
+#pragma once
+
+#include "neonexif.hpp"
+
+#include <cstddef>
+#include <filesystem>
+#include <vector>
+
+#ifndef _WIN32
+#include <csetjmp>
+#endif
+
+namespace nexif {
+
+/**
+ * What the path-based parse functions and `ExifFile` do when the file they
+ * mapped is truncated while they parse it. Touching a page of a `MAP_SHARED`
+ * mapping past the new end of the file raises SIGBUS; inside a parse, the
+ * `MappingFaultGuard` turns that into a `CORRUPT_DATA` error instead.
+ */
+enum class MappingFaultPolicy : uint8_t {
+  FAIL,              ///< Return the `CORRUPT_DATA` error.
+  RETRY_WITH_PREAD,  ///< Read the current contents of the file with pread() and parse those.
+};
+
+/** Process-wide. Defaults to `RETRY_WITH_PREAD`. */
+void set_mapping_fault_policy(MappingFaultPolicy policy);
+MappingFaultPolicy mapping_fault_policy();
+
+/** The error of a parse that was cut short by a fault on its buffer. */
+ParseError mapping_fault_error();
+bool is_mapping_fault(const ParseError &error);
+
+/** Reads the whole file into `out` with pread(). Returns false on errors. */
+bool read_file_contents(int fd, std::vector<char> &out);
+bool read_file_contents(const std::filesystem::path &path, std::vector<char> &out);
+
+/**
+ * While alive, a SIGBUS on this thread at an address in the guarded range
+ * jumps back to `env`. Faults outside the range, and faults on other threads,
+ * go to the handler that was installed before ours.
+ *
+ * The jump skips the destructors of everything between `sigsetjmp()` and the
+ * fault, so code that reads the guarded buffer must not:
+ *  - own memory or other resources in locals (`std::shared_ptr`, containers,
+ *    ...): keep them in storage of the caller instead, as the parser does with
+ *    the `ExifData`, the warning list and the `LayoutSession`;
+ *  - hold a lock while it reads the buffer.
+ * With tracing on, the `IFD_ENTER` events of the IFDs being read at the fault
+ * get no `IFD_EXIT`; `run_with_mapping_fault_guard()` restores the indent of
+ * the `ParseContext`. Use through that function.
+ */
+struct MappingFaultGuard {
+#ifndef _WIN32
+  sigjmp_buf env;
+  const char *begin;
+  const char *end;
+  MappingFaultGuard *outer;
+
+  MappingFaultGuard(const char *buffer, size_t length);
+  ~MappingFaultGuard();
+  MappingFaultGuard(const MappingFaultGuard &) = delete;
+  MappingFaultGuard &operator=(const MappingFaultGuard &) = delete;
+#endif
+};
+
+/**
+ * Runs `f`, which reads from `buffer`. Returns false if that faulted, in
+ * which case `f` did not complete.
+ */
+template <typename F>
+[[nodiscard]] bool run_with_mapping_fault_guard(const char *buffer, size_t length, F &&f)
+{
+#ifndef _WIN32
+  MappingFaultGuard guard(buffer, length);
+  // The trace scopes that would lower it again are skipped by the jump.
+  const int indent = parse_context ? parse_context->indent : 0;
+  // Not saving the signal mask avoids a syscall per parse; the handler runs
+  // with SA_NODEFER, so SIGBUS is not left blocked after the jump.
+  if (sigsetjmp(guard.env, 0) != 0) {
+    if (parse_context) {
+      parse_context->indent = indent;
+    }
+    return false;
+  }
+#endif
+  f();
+  return true;
+}
+
+}  // namespace nexif
@@ -0,0 +1,114 @@
+#pragma once
+
+#include "neonexif.hpp"
+
+#include <array>
+#include <chrono>
+#include <cstdint>
+#include <filesystem>
+#include <string>
+#include <vector>
+
+/**
+ * Library-wide metrics of the parses, for dashboards: latency histograms per
+ * file type and MakerNote vendor, and counts of errors per code. Off until
+ * `enable_metrics()`; then `read_exif()`, `read_exif_into()` and
+ * `read_exif_many()` record every parse into a shard of their thread,
+ * without locks. `scrape_metrics()` merges the shards.
+ */
+namespace nexif {
+
+/**
+ * A log-linear ("HDR") histogram of durations in nanoseconds. Values below
+ * 2^SUB_BUCKET_BITS are exact; every higher power of two is split into
+ * 2^SUB_BUCKET_BITS buckets, so quantiles are within about 6% of the values.
+ * Values from 2^MAX_BITS ns (18 minutes) on go into the last bucket.
+ */
+struct LatencyHistogram {
+  static constexpr int SUB_BUCKET_BITS = 4;
+  static constexpr int SUB_BUCKETS = 1 << SUB_BUCKET_BITS;
+  static constexpr int MAX_BITS = 40;
+  static constexpr int NUM_BUCKETS = (MAX_BITS - SUB_BUCKET_BITS + 1) * SUB_BUCKETS;
+
+  std::array<uint64_t, NUM_BUCKETS> buckets{};
+  uint64_t count{0};
+  uint64_t sum_ns{0};
+
+  static int bucket_of(uint64_t ns);
+  /** The highest value that goes into `bucket`. */
+  static uint64_t bucket_upper_bound(int bucket);
+
+  void record(uint64_t ns);
+  void merge(const LatencyHistogram &o);
+
+  /** The upper bound of the bucket of the `q`-th quantile, or 0 when empty. */
+  uint64_t quantile(double q) const;
+};
+
+constexpr int NUM_PARSE_ERROR_CODES = ParseError::CANCELLED + 1;
+
+/** Name of the MakerNote vendor of `data`; "none" without a MakerNote. */
+const char *makernote_vendor(const ExifData &data);
+
+struct MetricsSnapshot {
+  /** The successful parses of one kind of file. */
+  struct Series {
+    FileType file_type;
+    FileTypeVariant file_type_variant;
+    const char *vendor;  ///< See `makernote_vendor()`.
+    LatencyHistogram latency;
+  };
+  std::vector<Series> series;
+  std::array<uint64_t, NUM_PARSE_ERROR_CODES> errors{};  ///< Indexed by `ParseError::Code`.
+  uint64_t warnings{0};
+
+  const Series *find(FileType ft, FileTypeVariant ftv, const char *vendor) const;
+};
+
+void enable_metrics(bool enabled = true);
+bool metrics_enabled();
+
+/**
+ * Merges what all threads recorded since the start of the process, including
+ * threads that have exited. The counts only go up, like Prometheus expects.
+ */
+MetricsSnapshot scrape_metrics();
+
+/**
+ * Formats the snapshot in the Prometheus text exposition format: the latency
+ * as a summary per file type, variant and vendor, with the p50, p90, p99 and
+ * p999; and counters for the errors per code and the warnings.
+ */
+std::string format_prometheus(const MetricsSnapshot &snapshot);
+
+/**
+ * Writes `format_prometheus(scrape_metrics())` to `path`, through a temporary
+ * file and a rename, so that a reader never sees half a file.
+ */
+bool write_prometheus_file(const std::filesystem::path &path);
+
+/** Records one parse. Used by the parse functions, when metrics are enabled. */
+void record_parse_metrics(const ExifData &data, const std::optional<ParseError> &error, size_t num_warnings, uint64_t ns);
+
+/** Records a parse that failed before there was data to parse, like a file that cannot be opened. */
+void record_parse_error(ParseError::Code code);
+
+/** Times a parse for the metrics, without reading the clock when they are disabled. */
+struct ParseMetricsTimer {
+  bool enabled{metrics_enabled()};
+  std::chrono::steady_clock::time_point start{enabled ? std::chrono::steady_clock::now() : std::chrono::steady_clock::time_point{}};
+
+  uint64_t elapsed_ns() const
+  {
+    return std::chrono::duration_cast<std::chrono::nanoseconds>(std::chrono::steady_clock::now() - start).count();
+  }
+
+  void record(const ExifData &data, const std::optional<ParseError> &error, size_t num_warnings) const
+  {
+    if (enabled) {
+      record_parse_metrics(data, error, num_warnings, elapsed_ns());
+    }
+  }
+};
+
+}  // namespace nexif
@@ -1,8 +1,13 @@
 #pragma once
 
+#include <algorithm>
 #include <cstdint>
+#include <cstdio>
 #include <filesystem>
+#include <functional>
 #include <list>
+#include <optional>
+#include <span>
 #include <variant>
 #include <vector>
 #include <cassert>
@@ -12,23 +17,58 @@
 
 namespace nexif {
 
-inline int __indent = 0;
-inline bool enable_debug_print = false;
 inline int default_debug_print(const char *v)
 {
   return std::printf("\033[2m[NeonEXIF] %s\033[0m\n", v);
 }
-inline int (*debug_print_fn)(const char *) = default_debug_print;
-struct Indenter {
-  Indenter() { __indent++; }
-  ~Indenter() { __indent--; }
+
+/** Categories of trace events, for `ParseContext::trace`. See trace.hpp. */
+enum TraceCategory : uint32_t {
+  TRACE_IFD = 1 << 0,        ///< Entering and leaving IFDs.
+  TRACE_TAG = 1 << 1,        ///< Every IFD entry that is read.
+  TRACE_WARNING = 1 << 2,    ///< Warnings, as they are added to the result.
+  TRACE_MAKERNOTE = 1 << 3,  ///< Which MakerNote parser is used.
+  TRACE_MESSAGE = 1 << 4,    ///< Free-form text about the decisions of the parsers.
+  TRACE_ALL = 0x1f,
+};
+
+/**
+ * The options and tracing of the parses on one thread. Install one with a
+ * `ParseContextScope`; without one, parses are lenient and record nothing.
+ *
+ * Thread safety: all functions that parse (`read_exif()`, `read_exif_into()`,
+ * `upgrade()`, ...) can run concurrently on different threads, as long as each
+ * thread parses into its own `ExifData`. The parsers keep no mutable global
+ * state: the lens tables are constant, and everything else that changes during
+ * a parse lives in its `Reader` or in this context. A `ParseContext` itself is
+ * for one thread at a time.
+ */
+struct ParseContext {
+  /** The `TraceCategory` bits of the events to record. */
+  uint32_t trace{0};
+  /** Also receives each recorded event right away, formatted as a line. */
+  std::function<void(const char *line)> log;
+  /** Fail on recoverable problems, instead of turning them into warnings. */
+  bool strict_mode{false};
+  /** Nesting depth of the trace events, maintained by the parser. */
+  int indent{0};
+};
+
+/** The context of the parses on this thread; null for the defaults. */
+inline thread_local ParseContext *parse_context = nullptr;
+
+/** Installs a `ParseContext` for the parses on this thread, while in scope. */
+class ParseContextScope {
+ public:
+  explicit ParseContextScope(ParseContext &context) : _previous(parse_context) { parse_context = &context; }
+  ~ParseContextScope() { parse_context = _previous; }
+
+  ParseContextScope(const ParseContextScope &) = delete;
+  ParseContextScope &operator=(const ParseContextScope &) = delete;
+
+ private:
+  ParseContext *_previous;
 };
-#define DEBUG_PRINT(fmt, args...)                                           \
-  if (enable_debug_print) {                                                 \
-    char _buf[1024];                                                        \
-    std::snprintf(_buf, sizeof(_buf), "%*s" fmt, __indent * 4, "", ##args); \
-    debug_print_fn(_buf);                                                   \
-  }
 
 template <typename T>
 inline T byteswap_first_n(T t, int first_n)
@@ -101,6 +141,7 @@ struct ParseError {
     CORRUPT_DATA,
     TAG_NOT_FOUND,
     INTERNAL_ERROR,
+    CANCELLED,
   } code;
   const char *message{nullptr};
   const char *what{nullptr};
@@ -114,6 +155,7 @@ inline const char *to_str(ParseError::Code c)
     case ParseError::CORRUPT_DATA: return "Corrupt data";
     case ParseError::TAG_NOT_FOUND: return "Tag not found";
     case ParseError::INTERNAL_ERROR: return "Internal error";
+    case ParseError::CANCELLED: return "Cancelled";
   }
   std::abort();
 }
@@ -129,7 +171,8 @@ struct [[nodiscard]] ParseResult {
   std::list<ParseWarning> warnings;
 
   // clang-format off
-  ParseResult(T t) : _v(t) {}
+  ParseResult(std::in_place_t) : _v(std::in_place_index<0>) {}
+  ParseResult(T t) : _v(std::move(t)) {}
   ParseResult(ParseError::Code code, const char *msg) : _v(ParseError(code, msg)) {}
   ParseResult(ParseError err) : _v(err) {}
   // clang-format on
@@ -142,12 +185,52 @@ struct [[nodiscard]] ParseResult {
   {
     return std::get<0>(_v);
   }
+  T &value()
+  {
+    return std::get<0>(_v);
+  }
   const ParseError &error() const
   {
     return std::get<1>(_v);
   }
 };
 
+/**
+ * Outcome of the in-place parse functions. The warnings live in thread-local
+ * storage, and stay valid until the next in-place parse on the same thread.
+ */
+struct ParseStatus {
+  std::optional<ParseError> error;
+  std::span<const ParseWarning> warnings;
+
+  explicit operator bool() const
+  {
+    return !error.has_value();
+  }
+};
+
+/**
+ * Where one `read_exif()` spends its time, and how much of the file it reads.
+ * Filled when passed; collecting costs a few clock reads per parse, and a
+ * test per read when not passed.
+ */
+struct ParseStats {
+  // Nanoseconds per phase, of the steady clock.
+  uint64_t detect_ns{0};        ///< Detecting the file type, and locating the TIFF structure in its container.
+  uint64_t tiff_walk_ns{0};     ///< IFD0, its chain and SubIFDs (ParseLevel::CORE).
+  uint64_t exif_ifd_ns{0};      ///< The Exif, GPS and Interop IFDs (ParseLevel::STANDARD).
+  uint64_t makernote_ns{0};     ///< ParseLevel::MAKERNOTE.
+  uint64_t lens_resolve_ns{0};  ///< ParseLevel::LENS_RESOLVED, including `lens_lookup_ns`.
+  uint64_t lens_lookup_ns{0};   ///< Searching the lens tables.
+
+  uint32_t num_ifds{0};        ///< Visited, including those of the MakerNote.
+  uint32_t num_entries{0};     ///< In the visited IFDs.
+  uint64_t bytes_touched{0};   ///< Read through the parsers, counting every read.
+  uint64_t highest_offset{0};  ///< One past the last byte read: the prefix of the file the parse needed.
+  uint64_t string_bytes{0};    ///< Stored in the `ExifData`.
+  uint32_t num_warnings{0};
+};
+
 #define DECL_OR_RETURN(_type, _var, _call) \
   _type _var;                              \
   {                                        \
@@ -218,8 +301,12 @@ inline const char *to_str(FileType ft, FileTypeVariant v)
 }
 
 /** Data struct holding relative to `this` pointer to a const char*, meant for
- * refering to string data stored in a buffer closeby. */
+ * refering to string data stored in a buffer closeby, or in the spill chunks
+ * of the owning `ExifData`. The offset is 48 bits wide, which covers the
+ * distance between any two user-space addresses. */
 struct CharData {
+  static constexpr uint32_t MAX_LENGTH = 0xffff;  ///< The length is 16 bits.
+
   CharData() = default;
 
   CharData(const CharData &o) = delete;
@@ -227,7 +314,7 @@ struct CharData {
 
   CharData &operator=(const std::string_view &sv)
   {
-    assert(sv.length() <= 0xffff && "string too long");
+    assert(sv.length() <= MAX_LENGTH && "string too long");
     set(sv.data(), sv.length());
     return *this;
   }
@@ -239,12 +326,12 @@ struct CharData {
 
   explicit CharData(const std::string_view &sv)
   {
-    assert(sv.length() <= 0xffff && "string too long");
+    assert(sv.length() <= MAX_LENGTH && "string too long");
     set(sv.data(), sv.length());
   }
 
-  int16_t ptr_offset{0};
-  uint16_t length{0};
+  int64_t ptr_offset : 48 {0};
+  uint64_t length : 16 {0};
 
   CharData &set(const char *ptr, uint16_t len)
   {
@@ -253,8 +340,8 @@ struct CharData {
       assert(len == 0);
     } else {
       ptrdiff_t ptrdiff = (ptr - (const char *)this);
-      assert(static_cast<int16_t>(ptrdiff) == ptrdiff && "data not close enough in memory to the CharData");
       ptr_offset = ptrdiff;
+      assert(ptr_offset == ptrdiff && "data too far away from the CharData");
     }
     length = len;
     return *this;
@@ -269,14 +356,15 @@ struct CharData {
 
   const std::string_view view() const
   {
-    return {data(), length};
+    return {data(), size_t(length)};
   }
 
   const std::string str() const
   {
-    return {data(), length};
+    return {data(), size_t(length)};
   }
 };
+static_assert(sizeof(CharData) == 8);
 
 template <typename T>
 struct rational {
@@ -459,16 +547,64 @@ inline void illuminant_chromaticity(Illuminant i, double *x, double *y)
   std::abort();
 }
 
+/**
+ * Reference to one bit of a presence bitmask. Copying rebinds to the same
+ * bit; assigning writes through to the bit that is referred to.
+ */
+struct PresenceBit {
+  uint8_t *byte;
+  uint8_t mask;
+
+  PresenceBit(uint8_t *byte, uint8_t mask) : byte(byte), mask(mask) {}
+  PresenceBit(const PresenceBit &) = default;
+
+  operator bool() const
+  {
+    return (*byte & mask) != 0;
+  }
+
+  PresenceBit &operator=(bool v)
+  {
+    if (v) {
+      *byte |= mask;
+    } else {
+      *byte &= ~mask;
+    }
+    return *this;
+  }
+
+  PresenceBit &operator=(const PresenceBit &o)
+  {
+    return operator=(bool(o));
+  }
+};
+
 template <typename T>
-struct Tag {
-  bool is_set{false};
-  uint16_t parsed_from{0};
-  T value{};
+struct TagView;
+
+/**
+ * Mutable view on a tag stored in one of the Exif structs: the value lives in
+ * the struct's `values`, the flag in its `present` bitmask, and the origin in
+ * its `parsed_from` table. Behaves like a `Tag<T>`.
+ *
+ * Like a reference, a copy refers to the same tag, while assigning one
+ * `TagRef` to another copies the tag: `a = b` writes the value, flag and
+ * origin of `b` into the tag of `a`.
+ */
+template <typename T>
+struct TagRef {
+  T &value;
+  PresenceBit is_set;
+  uint16_t &parsed_from;
 
-  Tag &operator=(T v)
+  TagRef(T &value, PresenceBit is_set, uint16_t &parsed_from) :
+    value(value), is_set(is_set), parsed_from(parsed_from) {}
+  TagRef(const TagRef &) = default;
+
+  TagRef &operator=(T v)
   {
     if constexpr (std::is_same_v<CharData, T>) {
-      if (v.data() == nullptr || v.len == 0) {
+      if (v.data() == nullptr || v.length == 0) {
         value.set(nullptr, 0);
         is_set = false;
         return *this;
@@ -480,7 +616,7 @@ struct Tag {
   }
 
   template <typename O>
-  Tag &operator=(O v)
+  TagRef &operator=(O v)
   {
     if constexpr (std::is_same_v<std::string_view, O>) {
       if (v.data() == nullptr) {
@@ -494,6 +630,23 @@ struct Tag {
     return *this;
   }
 
+  /** Copies value, flag and origin. */
+  TagRef &operator=(const TagView<T> &o)
+    requires(std::is_copy_assignable_v<T>)
+  {
+    value = o.value;
+    is_set = o.is_set;
+    parsed_from = o.parsed_from;
+    return *this;
+  }
+
+  /** Copies value, flag and origin; does not rebind. */
+  TagRef &operator=(const TagRef &o)
+    requires(std::is_copy_assignable_v<T>)
+  {
+    return operator=(TagView<T>(o));
+  }
+
   explicit operator bool() const
     requires(!std::is_same_v<T, bool>)
   {
@@ -515,19 +668,159 @@ struct Tag {
     }
   }
 
-  T &operator->() { return value; }
-  const T operator->() const { return value; }
-  T &operator*() { return value; }
-  const T operator*() const { return value; }
+  T &operator*() const { return value; }
 
   void clear()
   {
     is_set = false;
     parsed_from = 0;
-    value = {};
+    std::memset((void *)&value, 0, sizeof(T));
   }
 };
 
+/** Read-only view on a tag, see `TagRef`. */
+template <typename T>
+struct TagView {
+  const T &value;
+  bool is_set;
+  uint16_t parsed_from;
+
+  TagView(const T &value, bool is_set, uint16_t parsed_from) :
+    value(value), is_set(is_set), parsed_from(parsed_from) {}
+  TagView(const TagRef<T> &r) :
+    value(r.value), is_set(r.is_set), parsed_from(r.parsed_from) {}
+
+  explicit operator bool() const
+    requires(!std::is_same_v<T, bool>)
+  {
+    return is_set;
+  }
+
+  operator const T &() const
+    requires(!std::is_same_v<T, bool>)
+  {
+    return value;
+  }
+
+  const T &value_or(const T &fallback) const
+  {
+    if (is_set) {
+      return value;
+    } else {
+      return fallback;
+    }
+  }
+
+  const T &operator*() const { return value; }
+};
+
+/** A standalone tag, for values that do not live in one of the Exif structs. */
+template <typename T>
+struct Tag {
+  bool is_set{false};
+  uint16_t parsed_from{0};
+  T value{};
+
+  TagRef<T> ref()
+  {
+    return {value, {(uint8_t *)&is_set, 1}, parsed_from};
+  }
+  operator TagRef<T>() { return ref(); }
+  operator TagView<T>() const { return {value, is_set, parsed_from}; }
+
+  template <typename O>
+  Tag &operator=(O v)
+  {
+    ref() = v;
+    return *this;
+  }
+
+  explicit operator bool() const
+    requires(!std::is_same_v<T, bool>)
+  {
+    return is_set;
+  }
+
+  operator const T &() const
+    requires(!std::is_same_v<T, bool>)
+  {
+    return value;
+  }
+
+  const T &value_or(const T &fallback) const
+  {
+    if (is_set) {
+      return value;
+    } else {
+      return fallback;
+    }
+  }
+
+  void clear()
+  {
+    ref().clear();
+  }
+};
+
+// clang-format off
+#define NEXIF_TAG_IDX(_name, ...) _name,
+#define NEXIF_TAG_VALUE(_name, ...) __VA_ARGS__ _name{};
+#define NEXIF_TAG_VISIT(_name, ...) f(values._name);
+#define NEXIF_TAG_ACCESSORS(_name, ...)                     \
+  TagRef<__VA_ARGS__> _name()                               \
+  {                                                         \
+    constexpr uint8_t i = uint8_t(TagIdx::_name);           \
+    return {values._name, {&present[i / 8], uint8_t(1 << (i % 8))}, parsed_from[i]}; \
+  }                                                         \
+  TagView<__VA_ARGS__> _name() const                        \
+  {                                                         \
+    constexpr uint8_t i = uint8_t(TagIdx::_name);           \
+    return {values._name, bool(present[i / 8] & (1 << (i % 8))), parsed_from[i]}; \
+  }
+// clang-format on
+
+/**
+ * Declares the tag storage of one of the Exif structs: a presence bitmask,
+ * the values (in the order of the list, so put the most-queried tags first),
+ * and the table of tag ids they were parsed from. Every tag gets a pair of
+ * accessors, returning a `TagRef` or a `TagView`.
+ */
+#define NEXIF_DECLARE_TAGS(_tags)                                               \
+  enum class TagIdx : uint8_t { _tags(NEXIF_TAG_IDX) NUM_TAGS };                \
+  static constexpr int num_tags = int(TagIdx::NUM_TAGS);                        \
+  std::array<uint8_t, (num_tags + 7) / 8> present{};                            \
+  struct Values {                                                               \
+    _tags(NEXIF_TAG_VALUE)                                                      \
+  } values;                                                                     \
+  std::array<uint16_t, num_tags> parsed_from{};                                 \
+  _tags(NEXIF_TAG_ACCESSORS)                                                    \
+  bool any_present() const                                                      \
+  {                                                                             \
+    for (uint8_t b : present) {                                                 \
+      if (b) {                                                                  \
+        return true;                                                            \
+      }                                                                         \
+    }                                                                           \
+    return false;                                                               \
+  }                                                                             \
+  void clear_tags()                                                             \
+  {                                                                             \
+    present.fill(0);                                                            \
+    std::memset((void *)&values, 0, sizeof(values));                            \
+    parsed_from.fill(0);                                                        \
+  }                                                                             \
+  /** Calls `f` on every value, set or not. */                                  \
+  template <typename F>                                                         \
+  void for_each_value(F &&f)                                                    \
+  {                                                                             \
+    _tags(NEXIF_TAG_VISIT)                                                      \
+  }                                                                             \
+  template <typename F>                                                         \
+  void for_each_value(F &&f) const                                              \
+  {                                                                             \
+    _tags(NEXIF_TAG_VISIT)                                                      \
+  }
+
 struct DateTime {
   int32_t year{0};
   int8_t month{0};
@@ -553,126 +846,193 @@ namespace tiff {
 ParseResult<DateTime> parse_date_time(std::string_view str);
 }
 
+// clang-format off
+#define NEXIF_IMAGE_DATA_TAGS(x)                   \
+  x(image_width               , uint32_t) \
+  x(image_height              , uint32_t) \
+  x(orientation               , Orientation) \
+  x(compression               , uint16_t) \
+  x(photometric_interpretation, uint16_t) \
+  x(samples_per_pixel         , uint16_t) \
+  x(resolution_unit           , uint16_t) \
+  x(planar_configuration      , uint16_t) \
+  x(bits_per_sample           , vla<uint16_t, 8>) \
+  x(x_resolution              , rational64u) \
+  x(y_resolution              , rational64u) \
+  x(data_offset               , uint32_t) \
+  x(data_length               , uint32_t) \
+  x(rows_per_strip            , uint32_t) \
+  x(strip_offsets             , vla<uint32_t, 32>) \
+  x(strip_byte_counts         , vla<uint32_t, 32>)
+// clang-format on
+
 struct ImageData {
   SubfileType type{NONE};
-  Tag<uint32_t> image_width;
-  Tag<uint32_t> image_height;
-  Tag<vla<uint16_t, 8>> bits_per_sample;
-  Tag<uint16_t> compression;
-  Tag<uint16_t> photometric_interpretation;
-  Tag<Orientation> orientation;
-  Tag<uint16_t> samples_per_pixel;
-  Tag<rational64u> x_resolution;
-  Tag<rational64u> y_resolution;
-  Tag<uint16_t> resolution_unit;
-
-  Tag<uint32_t> data_offset;
-  Tag<uint32_t> data_length;
-
-  Tag<uint16_t> planar_configuration;
-  Tag<uint32_t> rows_per_strip;
-  Tag<vla<uint32_t, 32>> strip_offsets;
-  Tag<vla<uint32_t, 32>> strip_byte_counts;
+  NEXIF_DECLARE_TAGS(NEXIF_IMAGE_DATA_TAGS)
 };
 
+// clang-format off
+#define NEXIF_EXIF_IFD_TAGS(x)                                   \
+  x(exposure_time             , rational64u) \
+  x(f_number                  , rational64u) \
+  x(focal_length              , rational64u) \
+  x(date_time_original        , DateTime) \
+  x(iso                       , uint16_t) \
+  x(exposure_program          , uint16_t) \
+  x(date_time_digitized       , DateTime) \
+  x(exif_version              , CharData) \
+  x(camera_owner_name         , CharData) \
+  x(body_serial_number        , CharData) \
+  /* (MinFocalLen, MaxFocalLen, MinFNum@MinFL, MinFNum@MaxFL) */ \
+  x(lens_specification        , std::array<rational64u, 4>) \
+  x(lens_make                 , CharData) \
+  /* Whatever the file says, or the only option identified by NeonEXIF. */ \
+  x(lens_model                , CharData) \
+  x(lens_serial_number        , CharData) \
+  x(image_title               , CharData) \
+  x(photographer              , CharData) \
+  /* A person. */                                                \
+  x(image_editor              , CharData) \
+  x(raw_developing_software   , CharData) \
+  x(image_editing_software    , CharData) \
+  x(metadata_editing_software , CharData) \
+  /* All options identified by NeonEXIF. */                      \
+  x(possible_lenses           , vla<std::string_view, 8>)
+// clang-format on
+
 struct ExifIFD {
-  Tag<rational64u> exposure_time;
-  Tag<rational64u> focal_length;
-  Tag<rational64u> f_number;
-  Tag<uint16_t> iso;
-  Tag<uint16_t> exposure_program;
-  Tag<DateTime> date_time_original;
-  Tag<DateTime> date_time_digitized;
-
-  Tag<CharData> exif_version;
-
-  Tag<CharData> camera_owner_name;
-  Tag<CharData> body_serial_number;
-
-  Tag<std::array<rational64u, 4>> lens_specification;  ///< (MinFocalLen, MaxFocalLen, MinFNum@MinFL, MinFNum@MaxFL)
-  Tag<CharData> lens_make;
-  Tag<CharData> lens_model; // Whatever the file says, or the only option identified by NeonEXIF.
-  Tag<CharData> lens_serial_number;
-  Tag<vla<std::string_view, 8>> possible_lenses; // All options identified by NeonEXIF.
-
-  Tag<CharData> image_title;
-  Tag<CharData> photographer;
-  Tag<CharData> image_editor;  ///< A person.
-  Tag<CharData> raw_developing_software;
-  Tag<CharData> image_editing_software;
-  Tag<CharData> metadata_editing_software;
+  NEXIF_DECLARE_TAGS(NEXIF_EXIF_IFD_TAGS)
 };
 
-struct NikonMakernote {
-  Tag<std::array<char, 4>> version;
-  Tag<std::array<uint16_t, 2>> iso;
-  Tag<CharData> color_mode;
-  Tag<CharData> quality;
-  Tag<CharData> white_balance;
-  Tag<CharData> sharpness;
-  Tag<CharData> focus_mode;
-  Tag<CharData> flash_setting;
-  Tag<CharData> flash_type;
-  Tag<uint8_t> lens_type;
-  Tag<std::array<rational64u, 4>> lens_specification;
-  Tag<uint16_t> nef_compression;
-  Tag<CharData> linearization_table;
-  Tag<uint32_t> shutter_count;
-  Tag<CharData> serial_number;
-  Tag<std::array<uint8_t, 8>> f_mount_lens_identifier;
-  Tag<uint16_t> z_mount_lens_identifier;
+// clang-format off
+#define NEXIF_NIKON_MAKERNOTE_TAGS(x)                        \
+  x(version                   , std::array<char, 4>) \
+  x(iso                       , std::array<uint16_t, 2>) \
+  x(color_mode                , CharData) \
+  x(quality                   , CharData) \
+  x(white_balance             , CharData) \
+  x(sharpness                 , CharData) \
+  x(focus_mode                , CharData) \
+  x(flash_setting             , CharData) \
+  x(flash_type                , CharData) \
+  x(lens_type                 , uint8_t) \
+  x(lens_specification        , std::array<rational64u, 4>) \
+  x(nef_compression           , uint16_t) \
+  x(linearization_table       , CharData) \
+  x(shutter_count             , uint32_t) \
+  x(serial_number             , CharData) \
+  x(f_mount_lens_identifier   , std::array<uint8_t, 8>) \
+  x(z_mount_lens_identifier   , uint16_t) \
+  x(lens_mount                , NikonMount)
+// clang-format on
 
+struct NikonMakernote {
   enum NikonMount {
     F_Mount,
     Z_Mount,
     One_Mount
   };
-  Tag<NikonMount> lens_mount;
+  NEXIF_DECLARE_TAGS(NEXIF_NIKON_MAKERNOTE_TAGS)
 };
 
+// clang-format off
+#define NEXIF_CANON_MAKERNOTE_TAGS(x)                    \
+  x(lens_type                 , uint16_t) \
+  x(min_focal_length          , uint16_t) \
+  x(max_focal_length          , uint16_t) \
+  /* As f-number, i.e. the smallest f-number of the lens. */ \
+  x(max_aperture              , float) \
+  /* As f-number, i.e. the largest f-number of the lens. */  \
+  x(min_aperture              , float) \
+  x(serial_number             , uint32_t) \
+  x(internal_serial_number    , CharData) \
+  x(lens_serial_number        , CharData)
+// clang-format on
+
 struct CanonMakernote {
-  Tag<uint16_t> lens_type;
-  Tag<uint16_t> min_focal_length;
-  Tag<uint16_t> max_focal_length;
+  NEXIF_DECLARE_TAGS(NEXIF_CANON_MAKERNOTE_TAGS)
+};
 
-  Tag<uint32_t> serial_number;
-  Tag<CharData> internal_serial_number;
-  Tag<CharData> lens_serial_number;
+/**
+ * How far `read_exif()` goes. Each level includes the previous ones. The
+ * MakerNote and lens identification are by far the most expensive part of
+ * parsing a raw file, and are not needed to show a file in a listing.
+ */
+enum class ParseLevel : uint8_t {
+  CORE,           ///< IFD0-chain and SubIFDs: make, model, date, images, color matrices.
+  STANDARD,       ///< + Exif IFD.
+  MAKERNOTE,      ///< + MakerNote tags, without lens identification.
+  LENS_RESOLVED,  ///< + Nikon lens data decryption and the lens table lookups.
 };
 
-struct ExifData {
-  FileType file_type;
-  FileTypeVariant file_type_variant;
-  std::endian byte_order;
+inline const char *to_str(ParseLevel l)
+{
+  switch (l) {
+    case ParseLevel::CORE: return "Core";
+    case ParseLevel::STANDARD: return "Standard";
+    case ParseLevel::MAKERNOTE: return "MakerNote";
+    case ParseLevel::LENS_RESOLVED: return "Lens resolved";
+  }
+  std::abort();
+}
 
-  std::array<ImageData, 5> images;
-  int num_images{0};
+/**
+ * What `upgrade()` needs to continue parsing where `read_exif()` stopped,
+ * without walking the IFDs that were already parsed.
+ */
+struct ParseState {
+  ParseLevel level{ParseLevel::LENS_RESOLVED};
+  uint32_t tiff_offset{0};  ///< Offset of the TIFF structure in the file.
+  uint32_t tiff_length{0};
+  vla<uint32_t, 4> exif_ifd_offsets;  ///< Relative to the TIFF structure.
+  uint32_t makernote_offset{0};       ///< Relative to the TIFF structure.
+  uint32_t makernote_length{0};
+  uint32_t lens_data_offset{0};  ///< Nikon LensData or Canon CameraInfo. Relative to the MakerNote.
+  uint32_t lens_data_length{0};
+};
 
-  Tag<CharData> copyright;
-  Tag<CharData> artist;
-  Tag<CharData> make;
-  Tag<CharData> model;
-  Tag<CharData> software;
-  Tag<CharData> processing_software;
-  Tag<DateTime> date_time;
-
-  Tag<vla<rational64s, 12>> color_matrix_1;
-  Tag<vla<rational64s, 12>> color_matrix_2;
-  Tag<vla<rational64s, 12>> reduction_matrix_1;
-  Tag<vla<rational64s, 12>> reduction_matrix_2;
-  Tag<vla<rational64s, 12>> calibration_matrix_1;
-  Tag<vla<rational64s, 12>> calibration_matrix_2;
-  Tag<Illuminant> calibration_illuminant_1;
-  Tag<Illuminant> calibration_illuminant_2;
-  Tag<vla<rational64u, 4>> as_shot_neutral;
-  Tag<std::array<rational64u, 2>> as_shot_white_xy;
-  Tag<vla<rational64u, 4>> analog_balance;
-
-  Tag<rational64s> apex_aperture_value;
-  Tag<rational64s> apex_shutter_speed_value;
+// clang-format off
+#define NEXIF_EXIF_DATA_TAGS(x)                                  \
+  x(make                      , CharData) \
+  x(model                     , CharData) \
+  x(date_time                 , DateTime) \
+  x(copyright                 , CharData) \
+  x(artist                    , CharData) \
+  x(software                  , CharData) \
+  x(processing_software       , CharData) \
+  x(apex_aperture_value       , rational64s) \
+  x(apex_shutter_speed_value  , rational64s) \
+  x(calibration_illuminant_1  , Illuminant) \
+  x(calibration_illuminant_2  , Illuminant) \
+  x(as_shot_white_xy          , std::array<rational64u, 2>) \
+  x(as_shot_neutral           , vla<rational64u, 4>) \
+  x(analog_balance            , vla<rational64u, 4>) \
+  x(color_matrix_1            , vla<rational64s, 12>) \
+  x(color_matrix_2            , vla<rational64s, 12>) \
+  x(reduction_matrix_1        , vla<rational64s, 12>) \
+  x(reduction_matrix_2        , vla<rational64s, 12>) \
+  x(calibration_matrix_1      , vla<rational64s, 12>) \
+  x(calibration_matrix_2      , vla<rational64s, 12>)
+// clang-format on
+
+/**
+ * The layout puts the most-queried tags up front: the header and the hot
+ * Exif tags (exposure, aperture, focal length, date, ISO) share the first
+ * cache line; the root tags follow, starting with make, model and date. The
+ * color matrices, the images, the MakerNote and the string data come after.
+ */
+struct ExifData {
+  FileType file_type{TIFF};
+  FileTypeVariant file_type_variant{STANDARD};
+  std::endian byte_order{std::endian::little};
 
   ExifIFD exif;
 
+  NEXIF_DECLARE_TAGS(NEXIF_EXIF_DATA_TAGS)
+
+  int num_images{0};
+  std::array<ImageData, 5> images;
+
   // clang-format off
   std::variant<std::monostate
     , NikonMakernote
@@ -680,18 +1040,66 @@ struct ExifData {
   > makernote;
   // clang-format on
 
+  ParseState parse_state;
+
+  /** Sections the parser wrote to, which `reset()` has to clear. */
+  enum DirtySection : uint8_t {
+    DIRTY_ROOT = 0x1,
+    DIRTY_EXIF = 0x2,
+    DIRTY_MAKERNOTE = 0x4,
+    DIRTY_ALL = 0x7,
+  };
+  uint8_t dirty{DIRTY_ALL};
+
+  /**
+   * Heap chunk for the strings that do not fit in `string_data`. Chunks never
+   * move, so the `CharData` referring into them only have to be rebased when
+   * the `ExifData` is copied or moved.
+   */
+  struct StringSpill {
+    StringSpill *next;
+    uint32_t capacity;
+    uint32_t used;
+
+    char *data() { return (char *)(this + 1); }
+    const char *data() const { return (const char *)(this + 1); }
+    bool contains(const char *ptr) const { return ptr >= data() && ptr < data() + used; }
+  };
+  static constexpr uint32_t SPILL_CHUNK_SIZE = 4096;
+
   uint32_t string_data_ptr{0};
-  char string_data[4096];
+  char string_data[512];  ///< Only the first `string_data_ptr` bytes are initialized.
+  StringSpill *string_spill{nullptr};  ///< Most recent chunk first.
 
-  ExifData() = default;
+  ExifData() {}
+  ~ExifData()
+  {
+    free_string_spill(string_spill);
+  }
   ExifData &operator=(const ExifData &o)
   {
+    if (this == &o) {
+      return *this;
+    }
+    free_string_spill(string_spill);
     std::memcpy((void *)this, (void *)&o, sizeof(ExifData));
+    string_spill = nullptr;
+    if (o.string_spill) {
+      copy_spilled_strings(o);
+    }
     return *this;
   }
   ExifData &operator=(ExifData &&o)
   {
+    if (this == &o) {
+      return *this;
+    }
+    free_string_spill(string_spill);
     std::memcpy((void *)this, (void *)&o, sizeof(ExifData));
+    if (o.string_spill) {
+      o.string_spill = nullptr;
+      rebase_spilled_strings(o, nullptr, nullptr);
+    }
     return *this;
   }
   ExifData(const ExifData &o)
@@ -703,6 +1111,35 @@ struct ExifData {
     operator=(std::move(o));
   }
 
+  /**
+   * Brings the data back to its default state, for reuse by the next parse.
+   * Only clears the dirty sections, the used images, and forgets the string
+   * data without touching it.
+   */
+  void reset()
+  {
+    if (dirty & DIRTY_ROOT) {
+      clear_tags();
+    }
+    if (dirty & DIRTY_EXIF) {
+      exif.clear_tags();
+    }
+    if (dirty & DIRTY_MAKERNOTE) {
+      makernote = std::monostate{};
+    }
+    std::memset((void *)images.data(), 0, num_images * sizeof(ImageData));
+    num_images = 0;
+    parse_state = {};
+    string_data_ptr = 0;
+    if (string_spill) {
+      // Keep one chunk around for the next file.
+      free_string_spill(string_spill->next);
+      string_spill->next = nullptr;
+      string_spill->used = 0;
+    }
+    dirty = 0;
+  }
+
   const ImageData *full_resolution_image(bool relaxed) const
   {
     for (int i = 0; i < num_images; ++i) {
@@ -714,7 +1151,7 @@ struct ExifData {
       uint64_t max_pixels = 0;
       int max_idx = 0;
       for (int i = 0; i < num_images; ++i) {
-        uint64_t pc = images[i].image_width * images[i].image_height;
+        uint64_t pc = images[i].image_width() * images[i].image_height();
         if (pc > max_pixels) {
           max_pixels = pc;
           max_idx = i;
@@ -725,6 +1162,7 @@ struct ExifData {
     return nullptr;
   }
 
+  /** Copies the string, truncated to what a `CharData` can refer to. */
   std::string_view store_string_data(const char *ptr, uint32_t count = 0)
   {
     if (count == 0) {
@@ -733,17 +1171,143 @@ struct ExifData {
         return {nullptr, 0};
       }
     }
+    count = std::min(count, CharData::MAX_LENGTH);
+    char *dst;
     if (string_data_ptr + count < sizeof(string_data)) {
-      char *dst = &string_data[string_data_ptr];
-      std::memcpy(dst, ptr, count);
-      string_data[string_data_ptr + count] = 0;
+      dst = &string_data[string_data_ptr];
       string_data_ptr += count + 1;
-      return {dst, (size_t)count};
     } else {
-      return {};
+      if (string_spill == nullptr || string_spill->used + count + 1 > string_spill->capacity) {
+        uint32_t capacity = std::max(SPILL_CHUNK_SIZE, count + 1);
+        StringSpill *chunk = (StringSpill *)::operator new(sizeof(StringSpill) + capacity);
+        *chunk = {string_spill, capacity, 0};
+        string_spill = chunk;
+      }
+      dst = string_spill->data() + string_spill->used;
+      string_spill->used += count + 1;
+    }
+    std::memcpy(dst, ptr, count);
+    dst[count] = 0;
+    return {dst, (size_t)count};
+  }
+
+  /**
+   * Adds a spill chunk with `size` bytes in use, at least `SPILL_CHUNK_SIZE`
+   * large, for the caller to fill with a whole area of strings at once. Unlike
+   * `store_string_data()`, the area is not limited to what one `CharData` can
+   * refer to.
+   */
+  char *spill_string_area(uint32_t size)
+  {
+    uint32_t capacity = std::max(SPILL_CHUNK_SIZE, size);
+    StringSpill *chunk = (StringSpill *)::operator new(sizeof(StringSpill) + capacity);
+    *chunk = {string_spill, capacity, size};
+    string_spill = chunk;
+    return chunk->data();
+  }
+
+  /** Number of bytes of string data in use, inline and spilled. */
+  size_t string_data_used() const
+  {
+    size_t total = string_data_ptr;
+    for (const StringSpill *c = string_spill; c != nullptr; c = c->next) {
+      total += c->used;
+    }
+    return total;
+  }
+
+  /** Calls `f` on every `CharData` value, set or not. */
+  template <typename F>
+  void for_each_char_data(F &&f)
+  {
+    visit_char_data(*this, f);
+  }
+  template <typename F>
+  void for_each_char_data(F &&f) const
+  {
+    visit_char_data(*this, f);
+  }
+
+ private:
+  template <typename Self, typename F>
+  static void visit_char_data(Self &self, F &f)
+  {
+    auto visit = [&f](auto &v) {
+      if constexpr (std::is_same_v<std::remove_cvref_t<decltype(v)>, CharData>) {
+        f(v);
+      }
+    };
+    self.for_each_value(visit);
+    self.exif.for_each_value(visit);
+    for (int i = 0; i < self.num_images; ++i) {
+      self.images[i].for_each_value(visit);
     }
+    std::visit(
+      [&visit](auto &mn) {
+        if constexpr (!std::is_same_v<std::remove_cvref_t<decltype(mn)>, std::monostate>) {
+          mn.for_each_value(visit);
+        }
+      },
+      self.makernote
+    );
   }
 
+  static void free_string_spill(StringSpill *chunk)
+  {
+    while (chunk != nullptr) {
+      StringSpill *next = chunk->next;
+      ::operator delete((void *)chunk);
+      chunk = next;
+    }
+  }
+
+  /**
+   * After a memcpy from `o`: points the `CharData` that referred to the spill
+   * chunks of `o` to the same strings in `copy`, a single chunk holding the
+   * chunks of `o` back to back (`offsets` tells where each chunk starts), or to
+   * the original chunks when `copy` is null.
+   */
+  void rebase_spilled_strings(const ExifData &o, const StringSpill *copy, const uint32_t *offsets)
+  {
+    for_each_char_data([&](CharData &cd) {
+      const CharData &ocd = *(const CharData *)((const char *)&o + ((const char *)&cd - (const char *)this));
+      const char *ptr = ocd.data();
+      if (ptr == nullptr || (ptr >= o.string_data && ptr < o.string_data + sizeof(string_data))) {
+        return;  // Inline data moved along with the CharData.
+      }
+      if (copy != nullptr) {
+        int ci = 0;
+        for (const StringSpill *c = o.string_spill; c != nullptr; c = c->next, ++ci) {
+          if (c->contains(ptr)) {
+            ptr = copy->data() + offsets[ci] + (ptr - c->data());
+            break;
+          }
+        }
+      }
+      cd.set(ptr, ocd.length);
+    });
+  }
+
+  void copy_spilled_strings(const ExifData &o)
+  {
+    uint32_t total = 0;
+    std::vector<uint32_t> offsets;
+    for (const StringSpill *c = o.string_spill; c != nullptr; c = c->next) {
+      offsets.push_back(total);
+      total += c->used;
+    }
+    uint32_t capacity = std::max(SPILL_CHUNK_SIZE, total);
+    StringSpill *chunk = (StringSpill *)::operator new(sizeof(StringSpill) + capacity);
+    *chunk = {nullptr, capacity, total};
+    int ci = 0;
+    for (const StringSpill *c = o.string_spill; c != nullptr; c = c->next, ++ci) {
+      std::memcpy(chunk->data() + offsets[ci], c->data(), c->used);
+    }
+    string_spill = chunk;
+    rebase_spilled_strings(o, chunk, offsets.data());
+  }
+
+ public:
   std::string_view store_string_data(const std::string &str)
   {
     return store_string_data(str.data(), str.length());
@@ -759,21 +1323,89 @@ ParseResult<ExifData> read_exif(
   const char *buffer,
   size_t length,
   FileType *ft = nullptr,
-  FileTypeVariant *fvt = nullptr
+  FileTypeVariant *fvt = nullptr,
+  ParseStats *stats = nullptr
 );
 
 ParseResult<ExifData> read_exif(
   const std::filesystem::path &path,
   FileType *ft = nullptr,
-  FileTypeVariant *fvt = nullptr
+  FileTypeVariant *fvt = nullptr,
+  ParseStats *stats = nullptr
 );
 
 /**
- * This function combines information in exif.lens_model, and exif.possible_lenses.
+ * Parses only up to the given level. The remaining levels can be parsed later
+ * with `upgrade()`, given the same file contents.
+ */
+ParseResult<ExifData> read_exif(
+  const char *buffer,
+  size_t length,
+  ParseLevel level,
+  FileType *ft = nullptr,
+  FileTypeVariant *fvt = nullptr,
+  ParseStats *stats = nullptr
+);
+
+ParseResult<ExifData> read_exif(
+  const std::filesystem::path &path,
+  ParseLevel level,
+  FileType *ft = nullptr,
+  FileTypeVariant *fvt = nullptr,
+  ParseStats *stats = nullptr
+);
+
+class LayoutCache;
+
+/**
+ * Parses into caller-owned storage, to avoid constructing and copying an
+ * `ExifData` per file. `data` is `reset()` first, so that a worker can reuse
+ * the same, cache-hot, object for every file. With a `layout_cache`, the TIFF
+ * layouts of earlier files are reused when this file has the same one.
+ */
+ParseStatus read_exif_into(
+  ExifData &data,
+  const char *buffer,
+  size_t length,
+  ParseLevel level = ParseLevel::LENS_RESOLVED,
+  LayoutCache *layout_cache = nullptr
+);
+
+ParseStatus read_exif_into(
+  ExifData &data,
+  const std::filesystem::path &path,
+  ParseLevel level = ParseLevel::LENS_RESOLVED,
+  LayoutCache *layout_cache = nullptr
+);
+
+/**
+ * Parses a batch of in-memory files, with the same results as `read_exif()`
+ * on each buffer. The work runs in stages, each over the whole batch: detect
+ * the file types, locate the TIFF structures in their containers, parse the
+ * IFD0 chains, and then every further parse level. A stage runs the same code
+ * for every buffer, which keeps the instruction cache and branch predictors
+ * warm, instead of cycling through all parsers per file.
+ */
+std::vector<ParseResult<ExifData>> read_exif_many(
+  std::span<const std::span<const char>> buffers,
+  ParseLevel level = ParseLevel::LENS_RESOLVED
+);
+
+/**
+ * Continues parsing `data` up to `level`, starting from `data.parse_state`.
+ * The IFDs parsed for the earlier levels are not read again. The buffer must
+ * hold the same file contents as the one `data` was read from. Returns the
+ * level that was reached; warnings of the new levels are in the result.
+ */
+ParseResult<ParseLevel> upgrade(ExifData &data, ParseLevel level, const char *buffer, size_t length);
+ParseResult<ParseLevel> upgrade(ExifData &data, ParseLevel level, const std::filesystem::path &path);
+
+/**
+ * This function combines information in exif.lens_model(), and exif.possible_lenses().
  * It's goal is to use real-world known lenses indicated in possible_lenses with
- * whatever is in the exif.lens_model. Some cameras actually write which lens it is
+ * whatever is in the exif.lens_model(). Some cameras actually write which lens it is
  * dispite the fact that the possible_lenses mechanism identifies multiple options.
- * We can't just use what exif.lens_model says if it's present, because some cameras
+ * We can't just use what exif.lens_model() says if it's present, because some cameras
  * also store a generic name, such as "24-70mm", as a best effort without actually knowing
  * the commercial name of the lens. Possible lenses is guaranteed to list existing lenses.
  */
@@ -783,6 +1415,17 @@ std::pair<std::string_view, std::string_view> normalize_maker_and_model(std::str
 
 size_t write_exif_data(const ExifData &data, std::vector<uint8_t> &output);
 
+/**
+ * Serializes `data` as it is in memory, but without the unused part of the
+ * string buffer: the fixed part of the struct, followed by only the used
+ * inline and spilled string bytes. Meant to keep many parse results around
+ * in little memory, within the same process: the lens names in
+ * `possible_lenses` are stored as pointers into the lens tables.
+ * Appends to `output` and returns the number of bytes written.
+ */
+size_t write_compact(const ExifData &data, std::vector<uint8_t> &output);
+ParseResult<ExifData> read_compact(const uint8_t *buffer, size_t length);
+
 std::vector<uint8_t> generate_exif_jpeg_binary_data(const ExifData &data);
 
 }  // namespace nexif
@@ -0,0 +1,62 @@
+#pragma once
+
+#include "neonexif.hpp"
+
+#include <cstdint>
+#include <filesystem>
+#include <functional>
+#include <span>
+#include <string>
+#include <unordered_map>
+#include <vector>
+
+namespace nexif {
+
+struct ProfileStats {
+  std::string key;  ///< File type, make and model.
+  uint64_t files{0};             ///< Files that were prefetched with this profile.
+  uint64_t prefetched_pages{0};
+  uint64_t touched_pages{0};     ///< Pages the parse of those files touched.
+  uint64_t hit_pages{0};         ///< Touched pages that had been prefetched.
+
+  double hit_rate() const { return touched_pages ? double(hit_pages) / touched_pages : 0.0; }
+};
+
+/**
+ * Parses a batch of files in order, while asking the kernel to read ahead
+ * the parts of the next files that the parse will need.
+ *
+ * Files of the same camera model put their IFDs, Exif IFD and MakerNote at
+ * nearly the same offsets. While parsing, the pages the `Reader` touches are
+ * recorded in an access profile per (file type, make, model). The next
+ * `lookahead` files are opened early, and get a posix_fadvise(WILLNEED) for
+ * the pages of the profile they are predicted to have: that of the last file
+ * parsed from the same directory, or else the last file parsed. On cold
+ * network mounts, their I/O then overlaps with parsing the current file.
+ */
+class PrefetchingReader {
+ public:
+  using Sink = std::function<void(size_t idx, const ExifData &data, const ParseStatus &status)>;
+
+  explicit PrefetchingReader(int lookahead = 8) : _lookahead(lookahead) {}
+
+  /** Calls `sink` for every file, in order, on the calling thread. */
+  void read_all(std::span<const std::filesystem::path> paths, const Sink &sink, ParseLevel level = ParseLevel::LENS_RESOLVED);
+
+  /** The profiles learned so far, with their prefetch hit rates. */
+  std::vector<ProfileStats> profile_stats() const;
+
+ private:
+  struct Profile {
+    vla<uint32_t, 64> pages;
+    ProfileStats stats;
+  };
+
+  int _lookahead;
+  std::unordered_map<std::string, Profile> _profiles;
+  std::unordered_map<std::string, std::string> _last_key_in_dir;
+  std::string _last_key;
+  ExifData _data;
+};
+
+}  // namespace nexif
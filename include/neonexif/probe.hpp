@@ -0,0 +1,79 @@
+#pragma once
+
+#include "neonexif.hpp"
+#include "exif_file.hpp"
+
+#include <cstddef>
+#include <filesystem>
+
+namespace nexif {
+
+/** Formats `probe()` recognizes. Only some of them can be parsed. */
+enum class ProbeFormat : uint8_t {
+  UNKNOWN,
+  TIFF,  ///< Including ORF and RW2.
+  BIG_TIFF,
+  CIFF,
+  JPEG,
+  FUJIFILM_RAF,
+  MRW,
+  SIGMA_FOVB,
+  BMFF,  ///< ISO base media file format: CR3, HEIF, AVIF, ...
+  PNG,
+  WEBP,
+};
+
+inline const char *to_str(ProbeFormat f)
+{
+  switch (f) {
+    case ProbeFormat::UNKNOWN: return "Unknown";
+    case ProbeFormat::TIFF: return "TIFF";
+    case ProbeFormat::BIG_TIFF: return "BigTIFF";
+    case ProbeFormat::CIFF: return "CIFF";
+    case ProbeFormat::JPEG: return "JPEG";
+    case ProbeFormat::FUJIFILM_RAF: return "RAF";
+    case ProbeFormat::MRW: return "MRW";
+    case ProbeFormat::SIGMA_FOVB: return "FOVb";
+    case ProbeFormat::BMFF: return "BMFF";
+    case ProbeFormat::PNG: return "PNG";
+    case ProbeFormat::WEBP: return "WebP";
+  }
+  std::abort();
+}
+
+/** `probe()` reads this many bytes from the start of the file. */
+constexpr size_t PROBE_SIZE = 64;
+
+struct ProbeResult {
+  ProbeFormat format{ProbeFormat::UNKNOWN};
+  /** `read_exif()` can parse the file; `file_type` and `file_type_variant` are valid. */
+  bool parsable{false};
+  FileType file_type{TIFF};
+  FileTypeVariant file_type_variant{STANDARD};
+  char brand[5]{};  ///< Major brand of BMFF files, e.g. "crx " for CR3, or "heic".
+  uint64_t file_size{0};
+
+  /**
+   * The structures the full parse reads first, as far as the first bytes
+   * tell: the IFD0 of a TIFF, the Exif APP1 segment of a JPEG, the pointer to
+   * the embedded JPEG of a RAF, ... A length of 0 means that the extent is
+   * only known once the structure at the offset has been read.
+   */
+  vla<ByteRange, 2> ranges;
+};
+
+/**
+ * Classifies a file by its first bytes, without mapping it. The magic bytes
+ * of every type `read_exif()` supports are recognized, like in
+ * `guess_file_type()`, plus a few formats it cannot parse yet. Files too
+ * small to hold Exif data are recognized, but not `parsable`.
+ */
+ProbeResult probe(const char *head, size_t length, uint64_t file_size);
+
+#ifndef _WIN32
+/** One fstat() and one pread() of `PROBE_SIZE` bytes. */
+ParseResult<ProbeResult> probe(int fd);
+#endif
+ParseResult<ProbeResult> probe(const std::filesystem::path &path);
+
+}  // namespace nexif
@@ -2,14 +2,23 @@
 
 #include "neonexif.hpp"
 #include "mappedfile.hpp"
+#include "sdt.h"
+#include "timeline.hpp"
+#include "trace.hpp"
 
+#include <algorithm>
+#include <atomic>
 #include <cstring>
 #include <cassert>
+#include <chrono>
 #include <optional>
 #include <bit>
 
 namespace nexif {
 
+struct LayoutSession;
+struct LayoutTemplate;
+
 namespace {
 
 #define PARSE_ERROR(code, msg, what)      \
@@ -28,7 +37,8 @@ namespace {
 #define LOG_WARNING(reader, msg, what)                      \
   do {                                                      \
     reader.warnings.push_back(ParseWarning((msg), (what))); \
-    DEBUG_PRINT("Warning: %s (what: %s)", (msg), (what));   \
+    NEXIF_TRACE_WARNING((msg), (what));                     \
+    STAP_PROBE2(neonexif, warning, (msg), (what));          \
   } while (false)
 
 }  // namespace
@@ -38,10 +48,62 @@ namespace {
     if (r.strict_mode) {                                                \
       return PARSE_ERROR(code, (msg), (what));                          \
     } else {                                                            \
-      r.warnings.emplace_back(msg, what);                               \
+      LOG_WARNING(r, msg, what);                                        \
     }                                                                   \
   }
 
+/**
+ * The pages of a file that the parses on this thread touch, at the places
+ * where they move through the file (`seek()` and `data_view()`). Used to
+ * learn access profiles for prefetching; see `PrefetchingReader`.
+ */
+struct TouchedPages {
+  static constexpr int PAGE_BITS = 12;
+
+  const char *begin{nullptr};
+  const char *end{nullptr};
+  vla<uint32_t, 64> pages;  ///< In order of first touch.
+
+  void touch(const char *p, size_t length)
+  {
+    if (p < begin || p >= end) {
+      return;
+    }
+    uint32_t first = uint32_t((p - begin) >> PAGE_BITS);
+    uint32_t last = uint32_t((std::min(p + length, end) - 1 - begin) >> PAGE_BITS);
+    for (uint32_t page = first; page <= last; ++page) {
+      if (std::find(pages.values.begin(), pages.values.begin() + pages.num, page) == pages.values.begin() + pages.num &&
+          pages.num < pages.values.size()) {
+        pages.push_back(page);
+      }
+    }
+  }
+};
+
+/** Set while a `TouchedPages` is recording; null otherwise. */
+inline thread_local TouchedPages *touched_pages = nullptr;
+
+struct AccessTrace;
+
+/**
+ * Set while an `AccessTraceScope` is recording; null otherwise. Unlike
+ * `touched_pages`, every read of the parsers is recorded, as it happens.
+ */
+inline thread_local AccessTrace *access_trace = nullptr;
+
+/** Adds a read at the file `offset` to the trace. Defined in access_trace.cpp. */
+void record_access(AccessTrace *trace, uint64_t offset, uint64_t length);
+
+/**
+ * Set while the parse on this thread can be cancelled; null otherwise. The
+ * parsers check it between IFDs, with `RETURN_IF_CANCELLED()`.
+ */
+inline thread_local const std::atomic<bool> *cancellation_flag = nullptr;
+
+#define RETURN_IF_CANCELLED()                                                              \
+  if (cancellation_flag && cancellation_flag->load(std::memory_order_relaxed)) [[unlikely]] \
+  return PARSE_ERROR(CANCELLED, "Parse was cancelled", nullptr)
+
 struct Reader {
   std::list<ParseWarning> &warnings;
   Reader(std::list<ParseWarning> &warnings) :
@@ -50,7 +112,7 @@ struct Reader {
   const char *data{nullptr};
   size_t file_length{0};
   std::endian byte_order;
-  bool strict_mode{false};
+  bool strict_mode{parse_context && parse_context->strict_mode};
 
   FileType file_type;
   FileTypeVariant file_type_variant;
@@ -64,23 +126,31 @@ struct Reader {
   Reader &operator=(const Reader &) = delete;
   Reader &operator=(Reader &&) = delete;
 
-  int ptr{0};
+  uint32_t ptr{0};
 
-  [[nodiscard]] inline std::optional<ParseError> seek(int offset)
+  [[nodiscard]] inline std::optional<ParseError> seek(uint32_t offset)
   {
-    ASSERT_OR_PARSE_ERROR(offset < (int)file_length, CORRUPT_DATA, "Seek out of bounds", nullptr);
+    ASSERT_OR_PARSE_ERROR(offset < file_length, CORRUPT_DATA, "Seek out of bounds", nullptr);
     ptr = offset;
+    if (touched_pages) [[unlikely]] {
+      // What follows a seek is typically an IFD or a short value.
+      touched_pages->touch(data + offset, 256);
+    }
     return std::nullopt;
   }
   [[nodiscard]] inline std::optional<ParseError> skip(int num)
   {
-    ASSERT_OR_PARSE_ERROR(ptr + num < (int)file_length, CORRUPT_DATA, "Skip out of bounds", nullptr);
+    ASSERT_OR_PARSE_ERROR(int64_t(ptr) + num < int64_t(file_length), CORRUPT_DATA, "Skip out of bounds", nullptr);
     ptr += num;
     return std::nullopt;
   }
 
   inline ParseResult<std::string_view> data_view(uint32_t offset, uint32_t size) {
-    ASSERT_OR_PARSE_ERROR(offset + size <= file_length, CORRUPT_DATA, "Data view out of bounds", nullptr);
+    ASSERT_OR_PARSE_ERROR(uint64_t(offset) + size <= file_length, CORRUPT_DATA, "Data view out of bounds", nullptr);
+    if (touched_pages) [[unlikely]] {
+      touched_pages->touch(data + offset, size);
+    }
+    count_read(offset, size);
     return std::string_view{data + offset, size};
   }
 
@@ -91,6 +161,7 @@ struct Reader {
     // memcpy to avoid UB with unaligned addresses.
     // optimizes to a simple `mov` on x86 anyway.
     std::memcpy(&t, &data[ptr], sizeof(T));
+    count_read(ptr, sizeof(T));
     ptr += sizeof(T);
     if (byte_order != std::endian::native) {
       return nexif::byteswap(t);
@@ -102,6 +173,7 @@ struct Reader {
   inline void read_4bytes(uint8_t *dst)
   {
     std::memcpy(dst, &data[ptr], 4);
+    count_read(ptr, 4);
     ptr += 4;
   }
 
@@ -118,6 +190,46 @@ struct Reader {
 
   ExifData *exif_data;
 
+  /**
+   * Where `read_exif()` collects its `ParseStats`; optional. Nested readers
+   * share it, and their offsets are made relative to `file_begin`, the start
+   * of the file.
+   */
+  ParseStats *stats{nullptr};
+  const char *file_begin{nullptr};
+  AccessTrace *access_trace{nexif::access_trace};
+
+  /** Starts a reader on a part of this one's file, sharing the stats. */
+  void nest_into(Reader &sub, uint32_t offset, uint32_t length) const
+  {
+    sub.data = data + offset;
+    sub.file_length = length;
+    sub.stats = stats;
+    sub.file_begin = file_begin;
+  }
+
+  inline void count_read(uint32_t offset, uint32_t size)
+  {
+    if (stats || access_trace) [[unlikely]] {
+      uint64_t file_offset = (data - (file_begin ? file_begin : data)) + offset;
+      if (stats) {
+        stats->bytes_touched += size;
+        stats->highest_offset = std::max<uint64_t>(stats->highest_offset, file_offset + size);
+      }
+      if (access_trace) {
+        record_access(access_trace, file_offset, size);
+      }
+    }
+  }
+
+  inline void count_ifd(uint16_t num_entries)
+  {
+    if (stats) [[unlikely]] {
+      stats->num_ifds++;
+      stats->num_entries += num_entries;
+    }
+  }
+
   struct SubIFDRef {
     uint32_t offset;
     uint32_t length;
@@ -131,8 +243,67 @@ struct Reader {
     bool parsed{false};
   };
   vla<SubIFDRef, 16> subifd_refs;
+
+  /** Learned layouts `tiff::read_tiff()` looks up and records; optional. */
+  LayoutSession *layout_session{nullptr};
+  const LayoutTemplate *layout_replay{nullptr};
+  LayoutTemplate *layout_recording{nullptr};
+  bool layout_mismatch{false};  ///< An IFD did not match `layout_replay`.
 };
 
+/**
+ * Adds the time of its scope, or until `stop()`, to a `ParseStats` field, and
+ * records it as the span `name` on the timeline, when enabled. Does not read
+ * the clock without either.
+ */
+struct PhaseTimer {
+  uint64_t *ns{nullptr};
+  const char *name{nullptr};
+  std::chrono::steady_clock::time_point start;
+
+  PhaseTimer(ParseStats *stats, uint64_t ParseStats::*field, const char *name)
+  {
+    if (stats) [[unlikely]] {
+      ns = &(stats->*field);
+    }
+    if (timeline_enabled()) [[unlikely]] {
+      this->name = name;
+    }
+    if (ns || this->name) [[unlikely]] {
+      start = std::chrono::steady_clock::now();
+    }
+  }
+  ~PhaseTimer() { stop(); }
+
+  void stop()
+  {
+    if (ns || name) [[unlikely]] {
+      auto end = std::chrono::steady_clock::now();
+      if (ns) {
+        *ns += std::chrono::duration_cast<std::chrono::nanoseconds>(end - start).count();
+      }
+      if (name) {
+        auto since_epoch = [](std::chrono::steady_clock::time_point t) {
+          return std::chrono::duration_cast<std::chrono::nanoseconds>(t.time_since_epoch()).count();
+        };
+        record_timeline_span(name, since_epoch(start), since_epoch(end));
+      }
+      ns = nullptr;
+      name = nullptr;
+    }
+  }
+};
+
+/** Detects the file type from the magic bytes at the start of `r.data`. */
+bool guess_file_type(Reader &r);
+
+/**
+ * Locates the TIFF structure inside the container format detected by
+ * `guess_file_type()` (JPEG APP1, RAF, MRW, FOVb, ...). The resulting
+ * range is relative to `r.data`. For plain TIFF files, this is the whole file.
+ */
+std::optional<ParseError> locate_tiff(Reader &r, uint32_t *tiff_offset, uint32_t *tiff_length, int depth = 0);
+
 struct Writer {
   std::vector<uint8_t> &dst;
   size_t pos{0};
@@ -178,7 +349,7 @@ struct Writer {
   inline size_t write_string(const char *str, uint32_t len)
   {
     size_t old_pos = pos;
-    DEBUG_PRINT("Storing string at %zu data %u: %s", pos, len, str);
+    NEXIF_TRACE_MESSAGE("Storing string at %zu data %u: %s", pos, len, str);
     dst.insert(dst.begin() + old_pos, str, str + len);
     pos += len;
     return old_pos;
@@ -0,0 +1,69 @@
+#pragma once
+
+#include "neonexif.hpp"
+#include "probe.hpp"
+
+#include <cstdint>
+#include <filesystem>
+#include <functional>
+#include <string>
+#include <vector>
+
+namespace nexif {
+
+struct ScanOptions {
+  int walker_threads{4};      ///< Threads enumerating directories.
+  int sink_threads{0};        ///< Threads calling the sink; 0 for one per core.
+  size_t queue_capacity{1024};  ///< Files found but not yet handed to the sink.
+  uint64_t min_file_size{0};
+
+  /**
+   * Lower-case, with the dot. Files with another extension are skipped
+   * without any syscall. Empty for the default list of raw and JPEG
+   * extensions.
+   */
+  std::vector<std::string> extensions;
+  /** `probe()` every candidate, and skip the files `read_exif()` cannot parse. */
+  bool check_magic{true};
+};
+
+struct ScannedFile {
+  std::filesystem::path path;
+  uint64_t size{0};
+  ProbeResult probe;  ///< Only with `ScanOptions::check_magic`.
+};
+
+struct ScanStats {
+  uint64_t directories{0};
+  uint64_t entries{0};  ///< Directory entries seen, of any type.
+  uint64_t files{0};    ///< Files handed to the sink.
+  uint64_t rejected_by_extension{0};
+  uint64_t rejected_by_size{0};
+  uint64_t rejected_by_magic{0};
+  uint64_t errors{0};  ///< Directories and files that could not be opened.
+};
+
+/**
+ * Walks the tree under `root` and calls `sink` for every file that passes
+ * the filters of `options`.
+ *
+ * Directories are enumerated breadth-first by a pool of walker threads, with
+ * getdents64() on Linux, and opened relative to their parent's descriptor so
+ * that the kernel does not resolve the full path again for every directory.
+ * Found files go through a bounded queue to the sink threads, which is where
+ * the parsing should happen: walkers block when the sink falls behind.
+ *
+ * `sink` is called concurrently from `sink_threads` threads. Symbolic links
+ * are not followed. Returns once all files have been handed to the sink and
+ * it returned for each of them.
+ */
+ParseResult<ScanStats> scan_tree(
+  const std::filesystem::path &root,
+  const ScanOptions &options,
+  const std::function<void(const ScannedFile &)> &sink
+);
+
+/** The extensions `scan_tree()` accepts by default. */
+const std::vector<std::string> &default_scan_extensions();
+
+}  // namespace nexif
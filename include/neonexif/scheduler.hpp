@@ -0,0 +1,107 @@
+#pragma once
+
+#include "neonexif.hpp"
+
+#include <atomic>
+#include <condition_variable>
+#include <cstdint>
+#include <filesystem>
+#include <functional>
+#include <map>
+#include <memory>
+#include <mutex>
+#include <thread>
+#include <vector>
+
+namespace nexif {
+
+enum class Priority : uint8_t {
+  INTERACTIVE,  ///< Always taken before any background request.
+  BACKGROUND,
+};
+
+/**
+ * A flag shared by all its copies. Cancelling it cancels every request that
+ * was submitted with a copy: queued ones are skipped without being read, and
+ * running ones stop at the next IFD with a `CANCELLED` error.
+ */
+class CancellationToken {
+ public:
+  CancellationToken() : _flag(std::make_shared<std::atomic<bool>>(false)) {}
+
+  void cancel() const { _flag->store(true, std::memory_order_relaxed); }
+  bool cancelled() const { return _flag->load(std::memory_order_relaxed); }
+  const std::atomic<bool> *flag() const { return _flag.get(); }
+
+ private:
+  std::shared_ptr<std::atomic<bool>> _flag;
+};
+
+/**
+ * Makes the parses on this thread check `token` between IFDs, for as long
+ * as the scope lives. For use with `read_exif()` outside of a scheduler.
+ */
+class CancellationScope {
+ public:
+  explicit CancellationScope(const CancellationToken &token);
+  ~CancellationScope();
+
+  CancellationScope(const CancellationScope &) = delete;
+  CancellationScope &operator=(const CancellationScope &) = delete;
+
+ private:
+  const std::atomic<bool> *_previous;
+};
+
+/**
+ * Parses files on a pool of worker threads, in order of priority: a worker
+ * only takes a background request when no interactive one is queued. Within
+ * a priority class, requests run in the order they were submitted. A queued
+ * request can be promoted, e.g. when its thumbnail scrolls into view.
+ *
+ * Callbacks run on the worker threads. Their `ExifData` and warnings are only
+ * valid during the call. Cancelled requests get a `CANCELLED` error.
+ */
+class ParseScheduler {
+ public:
+  using RequestId = uint64_t;
+  using Callback = std::function<void(const ExifData &data, const ParseStatus &status)>;
+
+  explicit ParseScheduler(int num_threads = 4, ParseLevel level = ParseLevel::LENS_RESOLVED);
+  /** Waits for the running requests. Queued requests are dropped without calling back. */
+  ~ParseScheduler();
+
+  ParseScheduler(const ParseScheduler &) = delete;
+  ParseScheduler &operator=(const ParseScheduler &) = delete;
+
+  RequestId submit(std::filesystem::path path, Priority priority, Callback callback, CancellationToken token = {});
+
+  /** Moves a queued request to the interactive class. False if it is no longer queued. */
+  bool promote(RequestId id);
+
+  /** Blocks until no requests are queued or running. */
+  void wait_idle();
+
+  size_t num_queued(Priority priority) const;
+
+ private:
+  struct Request {
+    std::filesystem::path path;
+    Callback callback;
+    CancellationToken token;
+  };
+
+  void work();
+
+  ParseLevel _level;
+  mutable std::mutex _mutex;
+  std::condition_variable _work_cv;
+  std::condition_variable _idle_cv;
+  std::map<RequestId, Request> _queues[2];  ///< By `Priority`; ids increase, so in order of submission.
+  RequestId _next_id{1};
+  int _running{0};
+  bool _stopping{false};
+  std::vector<std::thread> _threads;
+};
+
+}  // namespace nexif
@@ -0,0 +1,128 @@
+#pragma once
+
+/**
+ * Statically defined tracepoints (USDT), for bpftrace, perf, SystemTap and
+ * the other tools that read the `.note.stapsdt` ELF notes.
+ *
+ * A minimal implementation of the `STAP_PROBE*()` macros of SystemTap's
+ * <sys/sdt.h>, so that there is no dependency on it: it emits the same
+ * version 3 notes, but has no semaphores, and takes up to 6 arguments. A
+ * probe site is a single `nop`; a tool that attaches to it replaces the nop
+ * with a breakpoint, and reads the arguments from where the note says they
+ * are. So arguments should be values at hand: they are computed whether or
+ * not anything is attached.
+ *
+ * Arguments are integers or pointers. With NEXIF_USDT set to 0 (the
+ * NEONEXIF_USDT CMake option), or on targets other than ELF, the probes
+ * compile to nothing.
+ *
+ *   bpftrace -e 'usdt:./libneonexif.so:neonexif:parse__done { @[arg2] = count(); }'
+ *   perf buildid-cache --add ./my_app && perf record -e sdt_neonexif:ifd__enter ./my_app
+ */
+
+#ifndef NEXIF_USDT
+#define NEXIF_USDT 1
+#endif
+
+#if NEXIF_USDT && defined(__ELF__) && defined(__GNUC__) && (defined(__x86_64__) || defined(__i386__) || defined(__aarch64__))
+
+#include <cstdint>
+#include <type_traits>
+
+namespace nexif::sdt {
+
+/**
+ * The size in the argument description: negative for signed integers, which
+ * `%n` prints negated. Enums count as their underlying type.
+ */
+template <typename T>
+constexpr int arg_size()
+{
+  using U = std::decay_t<T>;
+  if constexpr (std::is_enum_v<U>) {
+    return arg_size<std::underlying_type_t<U>>();
+  } else if constexpr (std::is_pointer_v<U> || std::is_null_pointer_v<U>) {
+    return -int(sizeof(void *));
+  } else {
+    return std::is_signed_v<U> ? int(sizeof(U)) : -int(sizeof(U));
+  }
+}
+
+}  // namespace nexif::sdt
+
+#if defined(__LP64__)
+#define _SDT_ASM_ADDR ".8byte"
+#else
+#define _SDT_ASM_ADDR ".4byte"
+#endif
+
+#define _SDT_ARG(n, x) [_SDT_S##n] "n"(::nexif::sdt::arg_size<decltype(x)>()), [_SDT_A##n] "nor"(x)
+#define _SDT_ARGFMT(n) "%n[_SDT_S" #n "]@%[_SDT_A" #n "]"
+
+// The note: where the nop is, the base to correct that address for
+// prelinking, the semaphore (none), and the names and argument descriptions.
+#define _SDT_PROBE(provider, name, args, ...)                                       \
+  __asm__ __volatile__(                                                             \
+    "990: nop\n"                                                                    \
+    ".pushsection .note.stapsdt,\"?\",\"note\"\n"                                   \
+    ".balign 4\n"                                                                   \
+    ".4byte 992f-991f, 994f-993f, 3\n"                                              \
+    "991: .asciz \"stapsdt\"\n"                                                     \
+    "992: .balign 4\n"                                                              \
+    "993: " _SDT_ASM_ADDR " 990b\n"                                                 \
+    _SDT_ASM_ADDR " _.stapsdt.base\n"                                               \
+    _SDT_ASM_ADDR " 0\n"                                                            \
+    ".asciz \"" #provider "\"\n"                                                    \
+    ".asciz \"" #name "\"\n"                                                        \
+    ".asciz \"" args "\"\n"                                                         \
+    "994: .balign 4\n"                                                              \
+    ".popsection\n"                                                                 \
+    ".ifndef _.stapsdt.base\n"                                                      \
+    ".pushsection .stapsdt.base,\"aG\",\"progbits\",.stapsdt.base,comdat\n"         \
+    ".weak _.stapsdt.base\n"                                                        \
+    ".hidden _.stapsdt.base\n"                                                      \
+    "_.stapsdt.base: .space 1\n"                                                    \
+    ".size _.stapsdt.base, 1\n"                                                     \
+    ".popsection\n"                                                                 \
+    ".endif\n"                                                                      \
+    :                                                                               \
+    : __VA_ARGS__)
+
+#define STAP_PROBE(provider, name) \
+  _SDT_PROBE(provider, name, "", )
+#define STAP_PROBE1(provider, name, a1) \
+  _SDT_PROBE(provider, name, _SDT_ARGFMT(1), _SDT_ARG(1, a1))
+#define STAP_PROBE2(provider, name, a1, a2) \
+  _SDT_PROBE(provider, name, _SDT_ARGFMT(1) " " _SDT_ARGFMT(2), _SDT_ARG(1, a1), _SDT_ARG(2, a2))
+#define STAP_PROBE3(provider, name, a1, a2, a3)                                             \
+  _SDT_PROBE(provider, name, _SDT_ARGFMT(1) " " _SDT_ARGFMT(2) " " _SDT_ARGFMT(3),          \
+             _SDT_ARG(1, a1), _SDT_ARG(2, a2), _SDT_ARG(3, a3))
+#define STAP_PROBE4(provider, name, a1, a2, a3, a4)                                                \
+  _SDT_PROBE(provider, name, _SDT_ARGFMT(1) " " _SDT_ARGFMT(2) " " _SDT_ARGFMT(3) " " _SDT_ARGFMT(4), \
+             _SDT_ARG(1, a1), _SDT_ARG(2, a2), _SDT_ARG(3, a3), _SDT_ARG(4, a4))
+#define STAP_PROBE5(provider, name, a1, a2, a3, a4, a5)                                                                   \
+  _SDT_PROBE(provider, name, _SDT_ARGFMT(1) " " _SDT_ARGFMT(2) " " _SDT_ARGFMT(3) " " _SDT_ARGFMT(4) " " _SDT_ARGFMT(5), \
+             _SDT_ARG(1, a1), _SDT_ARG(2, a2), _SDT_ARG(3, a3), _SDT_ARG(4, a4), _SDT_ARG(5, a5))
+#define STAP_PROBE6(provider, name, a1, a2, a3, a4, a5, a6)                                                                                      \
+  _SDT_PROBE(provider, name, _SDT_ARGFMT(1) " " _SDT_ARGFMT(2) " " _SDT_ARGFMT(3) " " _SDT_ARGFMT(4) " " _SDT_ARGFMT(5) " " _SDT_ARGFMT(6), \
+             _SDT_ARG(1, a1), _SDT_ARG(2, a2), _SDT_ARG(3, a3), _SDT_ARG(4, a4), _SDT_ARG(5, a5), _SDT_ARG(6, a6))
+
+#else
+
+#define STAP_PROBE(provider, name)
+#define STAP_PROBE1(provider, name, a1)
+#define STAP_PROBE2(provider, name, a1, a2)
+#define STAP_PROBE3(provider, name, a1, a2, a3)
+#define STAP_PROBE4(provider, name, a1, a2, a3, a4)
+#define STAP_PROBE5(provider, name, a1, a2, a3, a4, a5)
+#define STAP_PROBE6(provider, name, a1, a2, a3, a4, a5, a6)
+
+#endif
+
+#define DTRACE_PROBE(provider, name) STAP_PROBE(provider, name)
+#define DTRACE_PROBE1(provider, name, a1) STAP_PROBE1(provider, name, a1)
+#define DTRACE_PROBE2(provider, name, a1, a2) STAP_PROBE2(provider, name, a1, a2)
+#define DTRACE_PROBE3(provider, name, a1, a2, a3) STAP_PROBE3(provider, name, a1, a2, a3)
+#define DTRACE_PROBE4(provider, name, a1, a2, a3, a4) STAP_PROBE4(provider, name, a1, a2, a3, a4)
+#define DTRACE_PROBE5(provider, name, a1, a2, a3, a4, a5) STAP_PROBE5(provider, name, a1, a2, a3, a4, a5)
+#define DTRACE_PROBE6(provider, name, a1, a2, a3, a4, a5, a6) STAP_PROBE6(provider, name, a1, a2, a3, a4, a5, a6)
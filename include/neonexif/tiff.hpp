@@ -179,9 +179,6 @@ static_assert(sizeof(ifd_entry) == ifd_entry::BINARY_SIZE);
 
 ifd_entry read_ifd_entry(Reader &r);
 
-void debug_print_ifd_entry(Reader &r, const ifd_entry &e, const char *(*to_str)(uint16_t tag));
-void debug_print_ifd_entry(Reader &r, const ifd_entry &e, const char *tag_name);
-
 namespace {
 template <typename T, bool is_enum = std::is_enum_v<T>>
 struct base_type {
@@ -207,6 +204,7 @@ ParseResult<T> fetch_entry_value_raw_offset(const ifd_entry &entry, int offset,
     uint32_t r_offset = entry.offset(r) + offset;
     if (r_offset + sizeof(T) <= r.file_length) {
       std::memcpy(&t, r.data + r_offset, sizeof(T));
+      r.count_read(r_offset, sizeof(T));
     } else {
       return PARSE_ERROR(CORRUPT_DATA, "data offset out of bounds", nullptr);
     }
@@ -237,6 +235,7 @@ ParseResult<T> fetch_entry_value(const ifd_entry &entry, int idx, Reader &r)
     uint32_t offset = entry.offset(r) + elem_size * idx;
     if (offset + elem_size <= r.file_length) {
       std::memcpy(&t, r.data + offset, elem_size);
+      r.count_read(offset, elem_size);
     } else {
       return PARSE_ERROR(CORRUPT_DATA, "data offset out of bounds", nullptr);
     }
@@ -253,7 +252,7 @@ ParseResult<T> fetch_entry_value(const ifd_entry &entry, int idx, Reader &r)
 }
 
 template <typename TagInfo>
-inline ParseResult<bool> parse_tag(Reader &r, Tag<typename TagInfo::cpp_type> &tag, const ifd_entry &entry)
+inline ParseResult<bool> parse_tag(Reader &r, TagRef<typename TagInfo::cpp_type> tag, const ifd_entry &entry)
 {
   using BType = base_type<typename TagInfo::scalar_cpp_type>::type;
   const char *tag_str = TagInfo::name;
@@ -271,10 +270,6 @@ inline ParseResult<bool> parse_tag(Reader &r, Tag<typename TagInfo::cpp_type> &t
         LOG_WARNING(r, "Warning: dtype did not match, but fits.", tag_str);
       }
       if constexpr (std::is_same_v<BType, CharData>) {
-        ASSERT_OR_PARSE_ERROR(
-          r.exif_data->string_data_ptr + entry.count < sizeof(r.exif_data->string_data),
-          INTERNAL_ERROR, "Internal error: no enough string space.", tag_str
-        );
         int cnt = entry.count;
         DECL_OR_RETURN(std::string_view, sv, entry.data_view(r));
         if (entry.type == DType::ASCII) {
@@ -288,18 +283,22 @@ inline ParseResult<bool> parse_tag(Reader &r, Tag<typename TagInfo::cpp_type> &t
           tag.is_set = false;
           return true;
         }
+        if (sv.length() > CharData::MAX_LENGTH) {
+          LOG_WARNING(r, "String truncated to 64 KiB", tag_str);
+          sv = sv.substr(0, CharData::MAX_LENGTH);
+        }
         tag.value = r.exif_data->store_string_data(sv);
         if (entry.type == DType::ASCII) {
-          DEBUG_PRINT("store string data of length %d: %.*s", cnt, cnt, tag.value.data());
+          NEXIF_TRACE_MESSAGE("store string data of length %d: %.*s", cnt, cnt, tag.value.data());
         } else {
-          DEBUG_PRINT("store byte-data of length %d", cnt);
+          NEXIF_TRACE_MESSAGE("store byte-data of length %d", cnt);
         }
-        DEBUG_PRINT("CharData %p: %+d  (len %u)", (void *)&tag.value, tag.value.ptr_offset, tag.value.length);
+        NEXIF_TRACE_MESSAGE("CharData %p: %+lld  (len %u)", (void *)&tag.value, (long long)tag.value.ptr_offset, unsigned(tag.value.length));
         tag.parsed_from = tag_idval;
         tag.is_set = true;
         return true;
       } else if constexpr (std::is_same_v<BType, rational64s> || std::is_same_v<BType, rational64u>) {
-        int mark = r.ptr;
+        uint32_t mark = r.ptr;
         RETURN_IF_OPT_ERROR(r.seek(entry.offset(r)));
         tag.value = {};
         if constexpr (TagInfo::count_spec::exif_count == 1) {
@@ -369,7 +368,7 @@ inline ParseResult<bool> parse_tag(Reader &r, Tag<typename TagInfo::cpp_type> &t
     using tag_info = TagInfo<(uint16_t)TagId::_name, _ifd_bits>; \
     assert(&(_struct) != nullptr);                               \
     auto tag_result = parse_tag<tag_info>(                       \
-      r, _struct._name, _entry                                   \
+      r, _struct._name(), _entry                                 \
     );                                                           \
     if (!tag_result)                                             \
       return tag_result.error();                                 \
@@ -390,10 +389,45 @@ inline ParseResult<bool> parse_tag(Reader &r, Tag<typename TagInfo::cpp_type> &t
 
 std::optional<ParseError> read_tiff(
   Reader &r,
-  ExifData &data
+  ExifData &data,
+  ParseLevel level = ParseLevel::LENS_RESOLVED
 );
 
+/**
+ * Parses the levels between `data.parse_state.level` and `level`. The reader
+ * must span the TIFF structure `data` was read from.
+ */
+std::optional<ParseError> upgrade_tiff(Reader &r, ExifData &data, ParseLevel level);
+
+/**
+ * Registers the Exif, SubIFD and MakerNote pointers in `r.subifd_refs`.
+ * Returns true if the entry was one of those pointers.
+ */
+ParseResult<bool> find_subifd(Reader &r, const ifd_entry &entry);
+
+/**
+ * Parses a single IFD of the IFD0-chain or a SubIFD. Image tags go into
+ * `current_image` (if not null), root tags into `data` (only if `ifd_type`
+ * has the IFD0 or IFD1 bit set).
+ */
+std::optional<ParseError> parse_tiff_ifd(Reader &r, ExifData &data, uint32_t ifd_offset, ImageData *current_image, int16_t ifd_type, uint32_t *next_offset);
+std::optional<ParseError> parse_exif_ifd(Reader &r, ExifData &data, uint32_t exif_offset, uint32_t *next_offset);
+std::optional<ParseError> parse_makernote(Reader &r, ExifData &data, uint32_t offset, uint32_t length);
+/** Identifies the lens from the MakerNote data recorded by `parse_makernote()`. */
+std::optional<ParseError> resolve_makernote_lens(Reader &r, ExifData &data);
+std::optional<ParseError> parse_subsectime_to_millis(Reader &r, const ifd_entry &entry, uint16_t *millis);
+
 size_t write_tiff(Writer &w, const ExifData &data);
 
 }  // namespace tiff
+
+namespace makernote::nikon {
+/**
+ * Deciphers the LensData of version 0201 and up, from the fifth byte on, with
+ * the key made from the serial number and the shutter count. The cipher is
+ * an XOR stream, so this enciphers too.
+ */
+void crypt_lens_data(uint8_t *lens_data, uint32_t length, std::string_view serial_number, uint32_t shutter_count);
+}  // namespace makernote::nikon
+
 }  // namespace nexif
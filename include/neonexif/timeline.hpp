@@ -0,0 +1,89 @@
+#pragma once
+
+#include "neonexif.hpp"
+
+#include <cstdint>
+#include <filesystem>
+#include <string>
+#include <string_view>
+
+/**
+ * A timeline of where the time of a batch goes, in the Chrome trace-event
+ * format, to view in Perfetto (ui.perfetto.dev) or chrome://tracing.
+ *
+ * Once `enable_timeline()` is called, the layers that run parses record spans
+ * and counters into a ring buffer of the recording thread, without locks:
+ *
+ *  - every parse: its phases, `guess_file_type`, `locate_tiff`, `read_tiff`,
+ *    `exif_ifd`, `makernote`, `lens_resolve` and `lens_lookup`;
+ *  - `ParseScheduler`: a `file` span per request, and the `scheduler_queued`
+ *    counter;
+ *  - `read_exif_many()`: a `group` span, and a `file` span per file and stage
+ *    (the stages of a group run one after the other, so the files take turns);
+ *  - `scan_tree()`: `directory`, `probe` and `file` spans, spans for the waits
+ *    on the file queue, and the `scan_queued` counter;
+ *  - the thread pool `IoBackend`: a `read` span per file.
+ *
+ * Each thread gets its own track, named by the layer that started it.
+ * `format_chrome_trace()` takes the events out of the rings, so call it once
+ * in a while during long batches: a full ring drops the newest events.
+ */
+
+namespace nexif {
+
+enum class TimelineEventType : uint8_t {
+  SPAN,
+  COUNTER,
+};
+
+struct TimelineEvent {
+  TimelineEventType type;
+  const char *name{nullptr};  ///< A string literal.
+  uint64_t begin_ns{0};       ///< Of the steady clock.
+  uint64_t end_ns{0};         ///< SPAN
+  int64_t value{0};           ///< COUNTER
+  char detail[56]{};          ///< SPAN: e.g. the file; the end of it, when too long.
+};
+
+void enable_timeline(bool enabled = true);
+bool timeline_enabled();
+
+/** The steady clock, as in `TimelineEvent`. */
+uint64_t timeline_now_ns();
+
+/** Names the track of the current thread. */
+void set_timeline_thread_name(const char *name);
+
+void record_timeline_span(const char *name, uint64_t begin_ns, uint64_t end_ns, std::string_view detail = {});
+void record_timeline_counter(const char *name, int64_t value);
+
+/** Records a span from its construction to its destruction, when the timeline is enabled. */
+struct TimelineSpan {
+  const char *name;
+  std::string_view detail;  ///< Must outlive the span.
+  bool active{timeline_enabled()};
+  uint64_t begin_ns{active ? timeline_now_ns() : 0};
+
+  explicit TimelineSpan(const char *name, std::string_view detail = {}) : name(name), detail(detail) {}
+  ~TimelineSpan()
+  {
+    if (active) [[unlikely]] {
+      record_timeline_span(name, begin_ns, timeline_now_ns(), detail);
+    }
+  }
+
+  TimelineSpan(const TimelineSpan &) = delete;
+  TimelineSpan &operator=(const TimelineSpan &) = delete;
+};
+
+/**
+ * Takes the recorded events of all threads out of their rings, and formats
+ * them as a Chrome trace-event JSON object, with a named track per thread.
+ * The number of dropped events is in `otherData`.
+ */
+std::string format_chrome_trace();
+
+/** Writes `format_chrome_trace()` to `path`, through a temporary file. */
+bool write_chrome_trace(const std::filesystem::path &path);
+
+}  // namespace nexif
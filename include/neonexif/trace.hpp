@@ -0,0 +1,162 @@
+#pragma once
+
+#include "neonexif.hpp"
+
+#include <cstdint>
+#include <functional>
+
+/**
+ * Tracing of the parsers. With NEXIF_TRACING set to 0 (the NEONEXIF_TRACING
+ * CMake option), every NEXIF_TRACE_* macro compiles to nothing. Otherwise, each
+ * costs a test of the thread's `ParseContext::trace` categories, and records
+ * a binary `TraceEvent` when its category is enabled. The events go into a
+ * ring buffer of the recording thread, without locks, and are only formatted
+ * when they are read with `drain_trace_events()`, or when a `ParseContext::log`
+ * wants every line right away.
+ */
+#ifndef NEXIF_TRACING
+#define NEXIF_TRACING 1
+#endif
+
+namespace nexif {
+
+enum class TraceEventType : uint8_t {
+  IFD_ENTER,
+  IFD_EXIT,
+  TAG,
+  WARNING,
+  MAKERNOTE,
+  MESSAGE,
+};
+
+const char *to_str(TraceEventType t);
+
+using TagNameFn = const char *(*)(uint16_t tag, uint16_t ifd_bit);
+
+/**
+ * A fixed-size record of something the parser did. The pointers are to static
+ * data (string literals and tag name tables), so that the event stays valid
+ * after the parse, and the names can be looked up when it is formatted.
+ */
+struct TraceEvent {
+  uint64_t time_ns{0};  ///< Of the steady clock.
+  TraceEventType type;
+  uint8_t depth{0};     ///< Nesting of IFDs, for the formatting.
+  uint16_t tag{0};      ///< TAG: the tag id.
+  uint16_t dtype{0};    ///< TAG: the DType.
+  uint16_t ifd_bit{0};  ///< TAG: the kind of IFD, to look up the tag name.
+  uint32_t count{0};    ///< IFD_ENTER: the number of entries. TAG: the number of values. MAKERNOTE: the length.
+  uint32_t offset{0};   ///< IFD_ENTER, TAG, MAKERNOTE: where it starts. IFD_EXIT: the next IFD, if any.
+  uint8_t data[4]{};    ///< TAG: the value, or the offset to it.
+  const char *name{nullptr};    ///< IFD_ENTER: the kind of IFD. WARNING: the message. MAKERNOTE: the vendor.
+  const char *detail{nullptr};  ///< WARNING: what it is about.
+  TagNameFn tag_name{nullptr};  ///< TAG
+  char text[40]{};              ///< MESSAGE: truncated to fit.
+};
+
+/** Writes the event as one line of text. Returns the length, like snprintf. */
+int format_trace_event(const TraceEvent &e, char *buffer, size_t size);
+
+/**
+ * Passes the recorded events of all threads to `fn`, and removes them. The
+ * events of one thread come in order. Returns the number of events that were
+ * dropped since the last drain, because a ring buffer was full.
+ */
+uint64_t drain_trace_events(const std::function<void(const TraceEvent &)> &fn);
+
+/** Records `e` for the current thread. Use the NEXIF_TRACE_* macros instead. */
+void record_trace_event(TraceEvent e);
+void record_trace_message(const char *fmt, ...) __attribute__((format(printf, 1, 2)));
+
+inline bool tracing(uint32_t categories)
+{
+  return NEXIF_TRACING && parse_context && (parse_context->trace & categories);
+}
+
+/** Nests the trace events of its scope one level deeper. */
+struct Indenter {
+  ParseContext *context{parse_context};
+  Indenter()
+  {
+    if (context) {
+      context->indent++;
+    }
+  }
+  ~Indenter()
+  {
+    if (context) {
+      context->indent--;
+    }
+  }
+};
+
+/** Records the entering and leaving of an IFD, and nests the events in between. */
+struct TraceIfdScope {
+  bool active{tracing(TRACE_IFD)};
+  uint32_t next_offset{0};
+
+  TraceIfdScope(const char *kind, uint32_t offset, uint32_t num_entries)
+  {
+    if (active) [[unlikely]] {
+      record_trace_event({.type = TraceEventType::IFD_ENTER, .count = num_entries, .offset = offset, .name = kind});
+      parse_context->indent++;
+    }
+  }
+  ~TraceIfdScope()
+  {
+    if (active) [[unlikely]] {
+      parse_context->indent--;
+      record_trace_event({.type = TraceEventType::IFD_EXIT, .offset = next_offset});
+    }
+  }
+};
+
+}  // namespace nexif
+
+#if NEXIF_TRACING
+#define NEXIF_TRACE_MESSAGE(fmt, args...)     \
+  if (tracing(TRACE_MESSAGE)) [[unlikely]] { \
+    record_trace_message(fmt, ##args);       \
+  }
+#define NEXIF_TRACE_IFD(_kind, _offset, _num_entries) \
+  TraceIfdScope _trace_ifd((_kind), (_offset), (_num_entries))
+#define NEXIF_TRACE_IFD_NEXT(_next_offset) \
+  _trace_ifd.next_offset = (_next_offset)
+// For the IFD entry that the Reader `r` just read.
+#define NEXIF_TRACE_TAG(_entry, _ifd_bit)                                 \
+  if (tracing(TRACE_TAG)) [[unlikely]] {                                  \
+    record_trace_event({                                                  \
+      .type = TraceEventType::TAG,                                        \
+      .tag = (_entry).tag,                                                \
+      .dtype = uint16_t((_entry).type),                                   \
+      .ifd_bit = (_ifd_bit),                                              \
+      .count = (_entry).count,                                            \
+      .offset = uint32_t(r.ptr - 12),                                     \
+      .data = {(_entry).data[0], (_entry).data[1],                        \
+               (_entry).data[2], (_entry).data[3]},                       \
+      .tag_name = static_cast<TagNameFn>(&to_str),                        \
+    });                                                                   \
+  }
+#define NEXIF_TRACE_WARNING(_msg, _what)                                                      \
+  if (tracing(TRACE_WARNING)) [[unlikely]] {                                                  \
+    record_trace_event({.type = TraceEventType::WARNING, .name = (_msg), .detail = (_what)}); \
+  }
+#define NEXIF_TRACE_MAKERNOTE(_vendor, _offset, _length) \
+  if (tracing(TRACE_MAKERNOTE)) [[unlikely]] {          \
+    record_trace_event({                                 \
+      .type = TraceEventType::MAKERNOTE,                 \
+      .count = uint32_t(_length),                        \
+      .offset = uint32_t(_offset),                       \
+      .name = (_vendor),                                 \
+    });                                                  \
+  }
+#define NEXIF_TRACE_INDENT() Indenter _trace_indenter
+#else
+#define NEXIF_TRACE_MESSAGE(fmt, args...)
+#define NEXIF_TRACE_IFD(_kind, _offset, _num_entries)
+#define NEXIF_TRACE_IFD_NEXT(_next_offset)
+#define NEXIF_TRACE_TAG(_entry, _ifd_bit)
+#define NEXIF_TRACE_WARNING(_msg, _what)
+#define NEXIF_TRACE_MAKERNOTE(_vendor, _offset, _length)
+#define NEXIF_TRACE_INDENT()
+#endif
@@ -0,0 +1,300 @@
+#include "neonexif/access_trace.hpp"
+#include "neonexif/mappedfile.hpp"
+#include "neonexif/mapping_guard.hpp"
+#include "neonexif/reader.hpp"
+
+#include <chrono>
+#include <condition_variable>
+#include <cstring>
+#include <fstream>
+#include <mutex>
+#include <string>
+
+#ifndef _WIN32
+#include <fcntl.h>
+#include <unistd.h>
+#endif
+
+namespace nexif {
+
+void AccessTrace::add(uint64_t offset, uint64_t length)
+{
+  num_reads++;
+  if (length == 0) {
+    return;
+  }
+  // Merge with every extent it overlaps or touches. The merged extent takes
+  // the place of the first of those.
+  uint64_t begin = offset, end = offset + length;
+  size_t merged_into = extents.size();
+  for (size_t i = 0; i < extents.size();) {
+    const FileExtent &e = extents[i];
+    if (begin <= e.offset + e.length && e.offset <= end) {
+      begin = std::min(begin, e.offset);
+      end = std::max(end, e.offset + e.length);
+      if (merged_into == extents.size()) {
+        merged_into = i++;
+      } else {
+        extents.erase(extents.begin() + i);
+      }
+    } else {
+      ++i;
+    }
+  }
+  if (merged_into == extents.size()) {
+    extents.push_back({begin, end - begin});
+  } else {
+    extents[merged_into] = {begin, end - begin};
+  }
+}
+
+uint64_t AccessTrace::bytes() const
+{
+  uint64_t total = 0;
+  for (const FileExtent &e : extents) {
+    total += e.length;
+  }
+  return total;
+}
+
+void record_access(AccessTrace *trace, uint64_t offset, uint64_t length)
+{
+  trace->add(offset, length);
+}
+
+AccessTraceScope::AccessTraceScope(AccessTrace &trace)
+{
+  access_trace = &trace;
+}
+
+AccessTraceScope::~AccessTraceScope()
+{
+  access_trace = nullptr;
+}
+
+AccessTrace trace_read_exif(const char *buffer, size_t length, ParseLevel level)
+{
+  AccessTrace trace;
+  trace.file_size = length;
+  {
+    AccessTraceScope scope(trace);
+    (void)read_exif(buffer, length, level, &trace.file_type, &trace.file_type_variant);
+  }
+  return trace;
+}
+
+namespace {
+
+constexpr char TRACE_MAGIC[4] = {'N', 'X', 'A', 'T'};
+constexpr uint32_t TRACE_VERSION = 1;
+
+template <typename T>
+void put(std::string &out, T v)
+{
+  if constexpr (std::endian::native != std::endian::little) {
+    v = nexif::byteswap(v);
+  }
+  out.append((const char *)&v, sizeof(T));
+}
+
+/** Reads the integers of a trace file, until the first one out of bounds. */
+struct TraceFileReader {
+  const std::vector<char> &data;
+  size_t pos{0};
+  bool ok{true};
+
+  template <typename T>
+  T get()
+  {
+    T v{0};
+    if (pos + sizeof(T) > data.size()) {
+      ok = false;
+      return v;
+    }
+    std::memcpy(&v, data.data() + pos, sizeof(T));
+    pos += sizeof(T);
+    if constexpr (std::endian::native != std::endian::little) {
+      v = nexif::byteswap(v);
+    }
+    return v;
+  }
+};
+
+bool drop_from_page_cache(const std::filesystem::path &path)
+{
+#ifndef _WIN32
+  int fd = ::open(path.c_str(), O_RDONLY | O_CLOEXEC);
+  if (fd < 0) {
+    return false;
+  }
+  // Dirty pages are not dropped, so they are written back first.
+  fdatasync(fd);
+  bool ok = posix_fadvise(fd, 0, 0, POSIX_FADV_DONTNEED) == 0;
+  ::close(fd);
+  return ok;
+#else
+  return false;
+#endif
+}
+
+/** Reads the pages of the extents from a mapping of the file. */
+ParseResult<uint64_t> touch_extents(const std::filesystem::path &path, const std::vector<FileExtent> &extents)
+{
+  size_t length;
+  char *data = map_file(path, &length);
+  ASSERT_OR_PARSE_ERROR(data != NULL, CANNOT_OPEN_FILE, "Cannot open file.", nullptr);
+  constexpr uint64_t PAGE_SIZE = 4096;
+  volatile char sink = 0;
+  uint64_t bytes = 0;
+  bool ok = run_with_mapping_fault_guard(data, length, [&] {
+    for (const FileExtent &e : extents) {
+      uint64_t begin = std::min<uint64_t>(e.offset, length);
+      uint64_t end = std::min<uint64_t>(e.offset + e.length, length);
+      for (uint64_t p = begin; p < end; p = (p / PAGE_SIZE + 1) * PAGE_SIZE) {
+        sink = sink + data[p];
+      }
+      bytes += end - begin;
+    }
+  });
+  unmap_file(data, length);
+  if (!ok) {
+    return mapping_fault_error();
+  }
+  return bytes;
+}
+
+}  // namespace
+
+bool write_access_traces(const std::filesystem::path &path, std::span<const AccessTrace> traces)
+{
+  std::string out(TRACE_MAGIC, sizeof(TRACE_MAGIC));
+  put<uint32_t>(out, TRACE_VERSION);
+  put<uint32_t>(out, traces.size());
+  for (const AccessTrace &t : traces) {
+    put<uint8_t>(out, t.file_type);
+    put<uint8_t>(out, t.file_type_variant);
+    put<uint16_t>(out, 0);
+    put<uint32_t>(out, t.extents.size());
+    put<uint64_t>(out, t.file_size);
+    put<uint64_t>(out, t.num_reads);
+    for (const FileExtent &e : t.extents) {
+      put<uint64_t>(out, e.offset);
+      put<uint64_t>(out, e.length);
+    }
+  }
+  std::ofstream file(path, std::ios::binary | std::ios::trunc);
+  return file && file.write(out.data(), out.size());
+}
+
+ParseResult<std::vector<AccessTrace>> read_access_traces(const std::filesystem::path &path)
+{
+  std::vector<char> data;
+  ASSERT_OR_PARSE_ERROR(read_file_contents(path, data), CANNOT_OPEN_FILE, "Cannot open file.", nullptr);
+  ASSERT_OR_PARSE_ERROR(
+    data.size() >= sizeof(TRACE_MAGIC) && std::memcmp(data.data(), TRACE_MAGIC, sizeof(TRACE_MAGIC)) == 0,
+    UNKNOWN_FILE_TYPE, "Not an access trace file", nullptr
+  );
+  TraceFileReader r{data, sizeof(TRACE_MAGIC)};
+  ASSERT_OR_PARSE_ERROR(r.get<uint32_t>() == TRACE_VERSION, UNKNOWN_FILE_TYPE, "Unsupported access trace version", nullptr);
+  uint32_t num_traces = r.get<uint32_t>();
+
+  std::vector<AccessTrace> traces;
+  for (uint32_t i = 0; i < num_traces && r.ok; ++i) {
+    AccessTrace &t = traces.emplace_back();
+    uint8_t file_type = r.get<uint8_t>();
+    uint8_t variant = r.get<uint8_t>();
+    r.get<uint16_t>();
+    uint32_t num_extents = r.get<uint32_t>();
+    t.file_size = r.get<uint64_t>();
+    t.num_reads = r.get<uint64_t>();
+    ASSERT_OR_PARSE_ERROR(file_type <= SIGMA_FOVB && variant <= TIFF_RW2, CORRUPT_DATA, "Unknown file type in access trace", nullptr);
+    ASSERT_OR_PARSE_ERROR(uint64_t(num_extents) * 16 <= data.size() - std::min(r.pos, data.size()), CORRUPT_DATA, "Access trace is truncated", nullptr);
+    t.file_type = FileType(file_type);
+    t.file_type_variant = FileTypeVariant(variant);
+    t.extents.resize(num_extents);
+    for (FileExtent &e : t.extents) {
+      e.offset = r.get<uint64_t>();
+      e.length = r.get<uint64_t>();
+    }
+  }
+  ASSERT_OR_PARSE_ERROR(r.ok, CORRUPT_DATA, "Access trace is truncated", nullptr);
+  return traces;
+}
+
+const char *to_str(ReplayBackend backend)
+{
+  switch (backend) {
+    case ReplayBackend::MMAP: return "mmap";
+    case ReplayBackend::PREAD: return "pread";
+    case ReplayBackend::IO_URING: return "io_uring";
+  }
+  return "?";
+}
+
+ParseResult<ReplayResult> replay_access_traces(
+  std::span<const AccessTrace> traces,
+  std::span<const std::filesystem::path> files,
+  ReplayBackend backend,
+  bool cold_cache
+)
+{
+  ASSERT_OR_PARSE_ERROR(traces.size() == files.size(), INTERNAL_ERROR, "Need one file per access trace", nullptr);
+  std::unique_ptr<IoBackend> io;
+  if (backend == ReplayBackend::PREAD) {
+    io = make_thread_pool_backend();
+  } else if (backend == ReplayBackend::IO_URING) {
+    io = make_io_uring_backend();
+    ASSERT_OR_PARSE_ERROR(io != nullptr, INTERNAL_ERROR, "io_uring is not available", nullptr);
+  }
+
+  for (const std::filesystem::path &path : files) {
+    if (cold_cache) {
+      ASSERT_OR_PARSE_ERROR(drop_from_page_cache(path), CANNOT_OPEN_FILE, "Cannot drop file from the page cache", nullptr);
+    } else {
+      std::vector<char> contents;
+      ASSERT_OR_PARSE_ERROR(read_file_contents(path, contents), CANNOT_OPEN_FILE, "Cannot open file.", nullptr);
+    }
+  }
+
+  ReplayResult result;
+  result.files = traces.size();
+  for (const AccessTrace &t : traces) {
+    result.extents += t.extents.size();
+  }
+
+  auto t0 = std::chrono::steady_clock::now();
+  if (backend == ReplayBackend::MMAP) {
+    for (size_t i = 0; i < traces.size(); ++i) {
+      DECL_OR_RETURN(uint64_t, bytes, touch_extents(files[i], traces[i].extents));
+      result.bytes += bytes;
+    }
+  } else {
+    std::mutex mutex;
+    std::condition_variable cv;
+    size_t remaining = traces.size();
+    std::optional<ParseError> error;
+    for (size_t i = 0; i < traces.size(); ++i) {
+      io->read_extents(files[i], traces[i].extents, [&](FileRead &&read) {
+        // Notify under the lock, as the waiter returns, and destroys it, right after.
+        std::lock_guard lock(mutex);
+        if (read.error && !error) {
+          error = read.error;
+        }
+        result.bytes += read.data.size();
+        if (--remaining == 0) {
+          cv.notify_one();
+        }
+      });
+    }
+    std::unique_lock lock(mutex);
+    cv.wait(lock, [&] { return remaining == 0; });
+    if (error) {
+      return error.value();
+    }
+  }
+  auto t1 = std::chrono::steady_clock::now();
+  result.ns = std::chrono::duration_cast<std::chrono::nanoseconds>(t1 - t0).count();
+  return result;
+}
+
+}  // namespace nexif
@@ -0,0 +1,561 @@
+#include "neonexif/async.hpp"
+#include "neonexif/reader.hpp"
+#include "neonexif/timeline.hpp"
+
+#include <atomic>
+#include <thread>
+
+#ifndef _WIN32
+#include <cerrno>
+#include <fcntl.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#else
+#include <fstream>
+#endif
+
+#ifdef __linux__
+#include <linux/io_uring.h>
+#include <sys/mman.h>
+#include <sys/syscall.h>
+#endif
+
+namespace nexif {
+
+void RunLoop::post(std::function<void()> fn)
+{
+  // Notify under the lock: the last posted work may stop the loop, after
+  // which its owner is free to destroy it.
+  std::lock_guard lock(_mutex);
+  _queue.push_back(std::move(fn));
+  _cv.notify_one();
+}
+
+void RunLoop::run()
+{
+  std::unique_lock lock(_mutex);
+  while (true) {
+    _cv.wait(lock, [this] { return _stopping || !_queue.empty(); });
+    if (_stopping) {
+      _stopping = false;
+      return;
+    }
+    std::function<void()> fn = std::move(_queue.front());
+    _queue.pop_front();
+    lock.unlock();
+    fn();
+    lock.lock();
+  }
+}
+
+void RunLoop::stop()
+{
+  std::lock_guard lock(_mutex);
+  _stopping = true;
+  _cv.notify_one();
+}
+
+namespace {
+
+/** Cuts the extents off at the end of the file. Returns their total length. */
+uint64_t clip_extents(std::vector<FileExtent> &extents, uint64_t file_size)
+{
+  uint64_t total = 0;
+  for (FileExtent &e : extents) {
+    e.offset = std::min(e.offset, file_size);
+    e.length = std::min(e.length, file_size - e.offset);
+    total += e.length;
+  }
+  return total;
+}
+
+#ifndef _WIN32
+/** The blocking read of the thread pool backend. */
+FileRead read_blocking(const std::filesystem::path &path, std::vector<FileExtent> extents)
+{
+  FileRead read;
+  int fd = ::open(path.c_str(), O_RDONLY | O_CLOEXEC);
+  if (fd < 0) {
+    read.error = PARSE_ERROR(CANNOT_OPEN_FILE, "Cannot open file.", nullptr);
+    return read;
+  }
+  struct stat st;
+  if (fstat(fd, &st) != 0) {
+    read.error = PARSE_ERROR(CANNOT_OPEN_FILE, "Cannot stat file.", nullptr);
+  } else {
+    read.file_size = st.st_size;
+    read.data.resize(clip_extents(extents, read.file_size));
+    size_t filled = 0;
+    for (const FileExtent &e : extents) {
+      uint64_t extent_filled = 0;
+      while (extent_filled < e.length) {
+        ssize_t n = pread(fd, read.data.data() + filled, e.length - extent_filled, e.offset + extent_filled);
+        if (n < 0 && errno == EINTR) {
+          continue;
+        }
+        if (n <= 0) {
+          break;
+        }
+        filled += n;
+        extent_filled += n;
+      }
+      if (extent_filled < e.length) {
+        break;
+      }
+    }
+    read.data.resize(filled);
+  }
+  ::close(fd);
+  return read;
+}
+#else
+FileRead read_blocking(const std::filesystem::path &path, std::vector<FileExtent> extents)
+{
+  FileRead read;
+  std::ifstream in(path, std::ios::binary);
+  std::error_code ec;
+  read.file_size = std::filesystem::file_size(path, ec);
+  if (!in || ec) {
+    read.error = PARSE_ERROR(CANNOT_OPEN_FILE, "Cannot open file.", nullptr);
+    return read;
+  }
+  read.data.resize(clip_extents(extents, read.file_size));
+  size_t filled = 0;
+  for (const FileExtent &e : extents) {
+    in.seekg(e.offset);
+    in.read(read.data.data() + filled, e.length);
+    filled += in.gcount();
+    if (uint64_t(in.gcount()) < e.length) {
+      break;
+    }
+  }
+  read.data.resize(filled);
+  return read;
+}
+#endif
+
+class ThreadPoolBackend : public IoBackend {
+ public:
+  explicit ThreadPoolBackend(int num_threads)
+  {
+    for (int i = 0; i < std::max(1, num_threads); ++i) {
+      _threads.emplace_back([this] { work(); });
+    }
+  }
+
+  ~ThreadPoolBackend() override
+  {
+    {
+      std::lock_guard lock(_mutex);
+      _stopping = true;
+    }
+    _cv.notify_all();
+    for (std::thread &t : _threads) {
+      t.join();
+    }
+  }
+
+  void read(const std::filesystem::path &path, size_t max_length, Completion done) override
+  {
+    read_extents(path, {{0, max_length}}, std::move(done));
+  }
+
+  void read_extents(const std::filesystem::path &path, std::vector<FileExtent> extents, Completion done) override
+  {
+    {
+      std::lock_guard lock(_mutex);
+      _jobs.push_back({path, std::move(extents), std::move(done)});
+    }
+    _cv.notify_one();
+  }
+
+ private:
+  struct Job {
+    std::filesystem::path path;
+    std::vector<FileExtent> extents;
+    Completion done;
+  };
+
+  void work()
+  {
+    set_timeline_thread_name("io worker");
+    std::unique_lock lock(_mutex);
+    while (true) {
+      _cv.wait(lock, [this] { return _stopping || !_jobs.empty(); });
+      if (_jobs.empty()) {
+        return;
+      }
+      Job job = std::move(_jobs.front());
+      _jobs.pop_front();
+      lock.unlock();
+      FileRead read;
+      {
+        std::string path = timeline_enabled() ? job.path.string() : std::string();
+        TimelineSpan span("read", path);
+        read = read_blocking(job.path, std::move(job.extents));
+      }
+      job.done(std::move(read));
+      lock.lock();
+    }
+  }
+
+  std::mutex _mutex;
+  std::condition_variable _cv;
+  std::deque<Job> _jobs;
+  bool _stopping{false};
+  std::vector<std::thread> _threads;
+};
+
+#ifdef __linux__
+/**
+ * A minimal io_uring client on the raw system calls. Every request is a
+ * chain of an openat, reads until its extents are filled, and a plain close().
+ * At most `queue_depth` requests are in flight, so that each has room for its
+ * one outstanding submission, and the completion queue cannot overflow.
+ */
+class IoUringBackend : public IoBackend {
+ public:
+  ~IoUringBackend() override
+  {
+    if (_reaper.joinable()) {
+      // The requests still waiting for room are cancelled; the reaper
+      // completes the ones in flight before it returns.
+      std::deque<Request *> waiting;
+      {
+        std::lock_guard lock(_mutex);
+        waiting.swap(_waiting);
+      }
+      for (Request *request : waiting) {
+        request->read.error = PARSE_ERROR(CANCELLED, "The io_uring backend was destroyed.", nullptr);
+        request->done(std::move(request->read));
+        delete request;
+      }
+      {
+        std::lock_guard lock(_mutex);
+        submit_locked(IORING_OP_NOP, -1, nullptr, 0, 0, nullptr);
+      }
+      _reaper.join();
+    }
+    if (_sq_ring != MAP_FAILED) {
+      munmap(_sq_ring, _sq_ring_size);
+    }
+    if (_cq_ring != MAP_FAILED && _cq_ring != _sq_ring) {
+      munmap(_cq_ring, _cq_ring_size);
+    }
+    if (_sqes != MAP_FAILED) {
+      munmap(_sqes, _sqes_size);
+    }
+    if (_ring_fd >= 0) {
+      ::close(_ring_fd);
+    }
+  }
+
+  static std::unique_ptr<IoUringBackend> create(unsigned queue_depth)
+  {
+    std::unique_ptr<IoUringBackend> b{new IoUringBackend};
+    io_uring_params p{};
+    b->_ring_fd = syscall(__NR_io_uring_setup, queue_depth, &p);
+    if (b->_ring_fd < 0 || !(p.features & IORING_FEAT_SINGLE_MMAP) || !(p.features & IORING_FEAT_NODROP)) {
+      return nullptr;
+    }
+    if (!supports_opcodes(b->_ring_fd, {IORING_OP_OPENAT, IORING_OP_READ})) {
+      return nullptr;  // Older than 5.6: the feature flags alone do not tell.
+    }
+    b->_sq_ring_size = p.sq_off.array + p.sq_entries * sizeof(unsigned);
+    b->_cq_ring_size = p.cq_off.cqes + p.cq_entries * sizeof(io_uring_cqe);
+    b->_sq_ring_size = b->_cq_ring_size = std::max(b->_sq_ring_size, b->_cq_ring_size);
+    b->_sq_ring = mmap(nullptr, b->_sq_ring_size, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE, b->_ring_fd, IORING_OFF_SQ_RING);
+    b->_cq_ring = b->_sq_ring;
+    b->_sqes_size = p.sq_entries * sizeof(io_uring_sqe);
+    b->_sqes = mmap(nullptr, b->_sqes_size, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE, b->_ring_fd, IORING_OFF_SQES);
+    if (b->_sq_ring == MAP_FAILED || b->_sqes == MAP_FAILED) {
+      return nullptr;
+    }
+    char *sq = (char *)b->_sq_ring, *cq = (char *)b->_cq_ring;
+    b->_sq_tail = (unsigned *)(sq + p.sq_off.tail);
+    b->_sq_mask = *(unsigned *)(sq + p.sq_off.ring_mask);
+    b->_sq_array = (unsigned *)(sq + p.sq_off.array);
+    b->_cq_head = (unsigned *)(cq + p.cq_off.head);
+    b->_cq_tail = (unsigned *)(cq + p.cq_off.tail);
+    b->_cq_mask = *(unsigned *)(cq + p.cq_off.ring_mask);
+    b->_cqes = (io_uring_cqe *)(cq + p.cq_off.cqes);
+    b->_max_in_flight = p.sq_entries;
+    b->_reaper = std::thread([b = b.get()] { b->reap(); });
+    return b;
+  }
+
+  void read(const std::filesystem::path &path, size_t max_length, Completion done) override
+  {
+    read_extents(path, {{0, max_length}}, std::move(done));
+  }
+
+  void read_extents(const std::filesystem::path &path, std::vector<FileExtent> extents, Completion done) override
+  {
+    Request *request = new Request{path, std::move(extents), std::move(done)};
+    {
+      std::lock_guard lock(_mutex);
+      if (_in_flight >= _max_in_flight) {
+        _waiting.push_back(request);
+        return;
+      }
+      if (start_locked(request)) {
+        return;
+      }
+    }
+    fail(request);
+  }
+
+ private:
+  struct Request {
+    std::filesystem::path path;
+    std::vector<FileExtent> extents;
+    Completion done;
+    int fd{-1};
+    size_t filled{0};
+    size_t extent{0};  ///< The one being read.
+    uint64_t extent_filled{0};
+    FileRead read;
+  };
+
+  IoUringBackend() = default;
+
+  static bool supports_opcodes(int ring_fd, std::initializer_list<uint8_t> opcodes)
+  {
+    constexpr unsigned MAX_OPS = 256;
+    std::vector<uint8_t> storage(sizeof(io_uring_probe) + MAX_OPS * sizeof(io_uring_probe_op));
+    io_uring_probe *probe = (io_uring_probe *)storage.data();
+    if (syscall(__NR_io_uring_register, ring_fd, IORING_REGISTER_PROBE, probe, MAX_OPS) < 0) {
+      return false;  // The probe itself is 5.6.
+    }
+    for (uint8_t op : opcodes) {
+      if (op > probe->last_op || op >= probe->ops_len || !(probe->ops[op].flags & IO_URING_OP_SUPPORTED)) {
+        return false;
+      }
+    }
+    return true;
+  }
+
+  bool start_locked(Request *request)
+  {
+    _in_flight++;
+    return submit_locked(IORING_OP_OPENAT, AT_FDCWD, request->path.c_str(), 0, 0, request);
+  }
+
+  /**
+   * The caller holds `_mutex`, which makes this the only producer. Returns
+   * false when the kernel refused the submission; no completion will come.
+   */
+  bool submit_locked(uint8_t opcode, int fd, const void *addr, uint32_t length, uint64_t offset, Request *request)
+  {
+    unsigned tail = *_sq_tail;
+    unsigned idx = tail & _sq_mask;
+    io_uring_sqe &sqe = ((io_uring_sqe *)_sqes)[idx];
+    sqe = {};
+    sqe.opcode = opcode;
+    sqe.fd = fd;
+    sqe.addr = (uint64_t)addr;
+    sqe.len = length;
+    sqe.off = offset;
+    sqe.user_data = (uint64_t)request;
+    if (opcode == IORING_OP_OPENAT) {
+      sqe.open_flags = O_RDONLY | O_CLOEXEC;
+    }
+    _sq_array[idx] = idx;
+    __atomic_store_n(_sq_tail, tail + 1, __ATOMIC_RELEASE);
+    while (syscall(__NR_io_uring_enter, _ring_fd, 1, 0, 0, nullptr, 0) < 0) {
+      if (errno != EINTR) {
+        // A failed enter consumed nothing, so the entry is still ours.
+        __atomic_store_n(_sq_tail, tail, __ATOMIC_RELEASE);
+        return false;
+      }
+    }
+    return true;
+  }
+
+  void reap()
+  {
+    std::vector<std::pair<Request *, int32_t>> completions;
+    bool stopping = false;
+    while (true) {
+      if (stopping) {
+        std::lock_guard lock(_mutex);
+        if (_in_flight == 0) {
+          return;
+        }
+      }
+      if (syscall(__NR_io_uring_enter, _ring_fd, 0, 1, IORING_ENTER_GETEVENTS, nullptr, 0) < 0 && errno != EINTR) {
+        return;
+      }
+      // The completions are taken under the lock that their submissions were
+      // made under. This orders them for tools that cannot see the kernel.
+      completions.clear();
+      {
+        std::lock_guard lock(_mutex);
+        unsigned head = *_cq_head;
+        unsigned tail = __atomic_load_n(_cq_tail, __ATOMIC_ACQUIRE);
+        for (; head != tail; ++head) {
+          const io_uring_cqe &cqe = _cqes[head & _cq_mask];
+          completions.emplace_back((Request *)cqe.user_data, cqe.res);
+        }
+        __atomic_store_n(_cq_head, head, __ATOMIC_RELEASE);
+      }
+      for (auto [request, res] : completions) {
+        if (request == nullptr) {
+          stopping = true;  // The NOP of the destructor: complete what is in flight, then return.
+          continue;
+        }
+        advance(request, res);
+      }
+    }
+  }
+
+  /** Handles the completion of the request's openat or read. */
+  void advance(Request *request, int32_t res)
+  {
+    FileRead &read = request->read;
+    if (request->fd < 0) {
+      if (res < 0) {
+        read.error = PARSE_ERROR(CANNOT_OPEN_FILE, "Cannot open file.", nullptr);
+        return finish(request);
+      }
+      request->fd = res;
+      struct stat st;
+      if (fstat(request->fd, &st) != 0) {
+        read.error = PARSE_ERROR(CANNOT_OPEN_FILE, "Cannot stat file.", nullptr);
+        return finish(request);
+      }
+      read.file_size = st.st_size;
+      read.data.resize(clip_extents(request->extents, read.file_size));
+    } else if (res > 0) {
+      request->filled += res;
+      request->extent_filled += res;
+    } else {
+      read.data.resize(request->filled);  // An error, or the file was truncated.
+      return finish(request);
+    }
+
+    while (request->extent < request->extents.size() && request->extent_filled == request->extents[request->extent].length) {
+      request->extent++;
+      request->extent_filled = 0;
+    }
+    if (request->extent < request->extents.size()) {
+      const FileExtent &e = request->extents[request->extent];
+      {
+        std::lock_guard lock(_mutex);
+        uint32_t length = std::min<uint64_t>(e.length - request->extent_filled, 1 << 30);
+        if (submit_locked(IORING_OP_READ, request->fd, read.data.data() + request->filled, length, e.offset + request->extent_filled, request)) {
+          return;
+        }
+      }
+      return fail(request);
+    }
+    finish(request);
+  }
+
+  /** Completes a request whose submission was refused. */
+  void fail(Request *request)
+  {
+    request->read.error = PARSE_ERROR(INTERNAL_ERROR, "Cannot submit the read to io_uring.", nullptr);
+    finish(request);
+  }
+
+  void finish(Request *request)
+  {
+    // A loop rather than recursion through fail(): when the ring refuses
+    // everything, every waiting request ends up here.
+    while (request != nullptr) {
+      if (request->fd >= 0) {
+        ::close(request->fd);
+      }
+      request->done(std::move(request->read));
+      delete request;
+      request = nullptr;
+
+      std::lock_guard lock(_mutex);
+      _in_flight--;
+      if (!_waiting.empty()) {
+        Request *next = _waiting.front();
+        _waiting.pop_front();
+        if (!start_locked(next)) {
+          next->read.error = PARSE_ERROR(INTERNAL_ERROR, "Cannot submit the read to io_uring.", nullptr);
+          request = next;
+        }
+      }
+    }
+  }
+
+  int _ring_fd{-1};
+  void *_sq_ring{MAP_FAILED};
+  void *_cq_ring{MAP_FAILED};
+  void *_sqes{MAP_FAILED};
+  size_t _sq_ring_size{0}, _cq_ring_size{0}, _sqes_size{0};
+  unsigned *_sq_tail{nullptr}, *_sq_array{nullptr};
+  unsigned _sq_mask{0};
+  unsigned *_cq_head{nullptr}, *_cq_tail{nullptr};
+  unsigned _cq_mask{0};
+  io_uring_cqe *_cqes{nullptr};
+
+  std::mutex _mutex;
+  unsigned _in_flight{0};
+  unsigned _max_in_flight{0};
+  std::deque<Request *> _waiting;
+  std::thread _reaper;
+};
+#endif
+
+}  // namespace
+
+std::unique_ptr<IoBackend> make_thread_pool_backend(int num_threads)
+{
+  return std::make_unique<ThreadPoolBackend>(num_threads);
+}
+
+std::unique_ptr<IoBackend> make_io_uring_backend(unsigned queue_depth)
+{
+#ifdef __linux__
+  return IoUringBackend::create(queue_depth);
+#else
+  return nullptr;
+#endif
+}
+
+IoBackend &default_io_backend()
+{
+  static std::unique_ptr<IoBackend> backend = [] {
+    std::unique_ptr<IoBackend> b = make_io_uring_backend();
+    return b ? std::move(b) : make_thread_pool_backend();
+  }();
+  return *backend;
+}
+
+void ExifAwaitable::await_suspend(std::coroutine_handle<> handle)
+{
+  _handle = handle;
+  read(HEAD_SIZE);
+}
+
+void ExifAwaitable::read(size_t max_length)
+{
+  _backend.read(_path, max_length, [this](FileRead &&read) {
+    _executor.post([this, read = std::move(read)]() mutable { parse(read); });
+  });
+}
+
+void ExifAwaitable::parse(FileRead &head)
+{
+  if (head.error) {
+    _result.emplace(head.error.value());
+  } else {
+    _result.emplace(read_exif(head.data.data(), head.data.size(), _level));
+    if (!_read_whole_file && head.data.size() < head.file_size && (!_result.value() || !_result->warnings.empty())) {
+      // What the parse missed may lie beyond the head.
+      _read_whole_file = true;
+      _result.reset();
+      read(head.file_size);
+      return;
+    }
+  }
+  _handle.resume();
+}
+
+}  // namespace nexif
@@ -0,0 +1,28 @@
+#pragma once
+
+#include <filesystem>
+#include <fstream>
+#include <string_view>
+
+namespace nexif {
+
+/**
+ * Replaces the file at `path` with `contents`, through a temporary file next
+ * to it and a rename, so that a reader never sees half a file.
+ */
+inline bool write_file_atomically(const std::filesystem::path &path, std::string_view contents)
+{
+  std::filesystem::path tmp = path;
+  tmp += ".tmp";
+  {
+    std::ofstream file(tmp, std::ios::binary | std::ios::trunc);
+    if (!file || !file.write(contents.data(), contents.size())) {
+      return false;
+    }
+  }
+  std::error_code ec;
+  std::filesystem::rename(tmp, path, ec);
+  return !ec;
+}
+
+}  // namespace nexif
@@ -2,6 +2,7 @@
 #include "neonexif/tiff.hpp"
 #include "neonexif/tag_helpers.hpp"
 #include <cmath>
+#include <regex>
 
 #include "canon_lens_id.cpp"
 
@@ -30,6 +31,8 @@ NEXIF_ALL_MAKERNOTE_CANON_TAGS(NEXIF_TEMPLATE_TAG_INFO);
 NEXIF_MAKE_TAG_ENUM(NEXIF_ALL_MAKERNOTE_CANON_TAGS);
 NEXIF_MAKE_TAG_CMP;
 
+// Constant, and only used through const references: matching a const
+// std::regex is safe from multiple threads at once.
 struct ParseInfo {
   std::regex models;
 
@@ -39,7 +42,7 @@ struct ParseInfo {
   } lens_type,
     min_focal, max_focal,
     lens_model;
-} parse_infos[] = {
+} const parse_infos[] = {
   {.models = std::regex{"EOS-1Ds?"},
    .lens_type = {13, true},
    .min_focal = {14},
@@ -158,21 +161,19 @@ float f_number_from_aperture(float aperture_val)
 
 std::optional<ParseError> parse_makernote(Reader &r, ExifData &data)
 {
-  DEBUG_PRINT("Parse Canon Makernote");
+  RETURN_IF_CANCELLED();
   CanonMakernote &mn = data.makernote.emplace<CanonMakernote>();
 
-  float min_aperture = 0;
-  float max_aperture = 0;
-
-  std::string_view lens_model;
-
+  uint32_t ifd_offset = r.ptr;
   uint16_t num_entries = r.read_u16();
+  NEXIF_TRACE_IFD("Canon", ifd_offset, num_entries);
+  STAP_PROBE3(neonexif, ifd__enter, "Canon", ifd_offset, num_entries);
+  r.count_ifd(num_entries);
 
   for (int i = 0; i < num_entries; ++i) {
     // Read IFD entry.
     tiff::ifd_entry entry = tiff::read_ifd_entry(r);
-    const char *tag_str = to_str(entry.tag, IFD_MAKERNOTE_CANON);
-    debug_print_ifd_entry(r, entry, tag_str);
+    NEXIF_TRACE_TAG(entry, IFD_MAKERNOTE_CANON);
 
 #define PARSE_CANON_TAG(_name) NEXIF_PARSE_TAG(mn, _name, entry, IFD_MAKERNOTE_CANON)
 
@@ -180,59 +181,46 @@ std::optional<ParseError> parse_makernote(Reader &r, ExifData &data)
 
     if (entry.tag == tag_camera_settings::TagId) {
       if (auto pr = tiff::fetch_entry_value<uint16_t>(entry, 22, r)) {
-        mn.lens_type = pr.value();
-        mn.lens_type.parsed_from = entry.tag;
-        DEBUG_PRINT("lens type from CS: %d", mn.lens_type.value);
+        mn.lens_type() = pr.value();
+        mn.lens_type().parsed_from = entry.tag;
+        NEXIF_TRACE_MESSAGE("lens type from CS: %d", mn.lens_type().value);
       }
       float focal_units = 1.0f;  // units / mm
       if (auto pr = tiff::fetch_entry_value<uint16_t>(entry, 25, r)) {
         focal_units = pr.value();
       }
       if (auto pr = tiff::fetch_entry_value<uint16_t>(entry, 23, r)) {
-        mn.max_focal_length = pr.value() / focal_units;
-        mn.max_focal_length.parsed_from = entry.tag;
+        mn.max_focal_length() = pr.value() / focal_units;
+        mn.max_focal_length().parsed_from = entry.tag;
       }
       if (auto pr = tiff::fetch_entry_value<uint16_t>(entry, 24, r)) {
-        mn.min_focal_length = pr.value() / focal_units;
-        mn.min_focal_length.parsed_from = entry.tag;
+        mn.min_focal_length() = pr.value() / focal_units;
+        mn.min_focal_length().parsed_from = entry.tag;
       }
       if (auto pr = tiff::fetch_entry_value<int16_t>(entry, 26, r)) {
-        max_aperture = f_number_from_aperture(ev_from_s16<false>(pr.value()));
+        mn.max_aperture() = f_number_from_aperture(ev_from_s16<false>(pr.value()));
+        mn.max_aperture().parsed_from = entry.tag;
       }
       if (auto pr = tiff::fetch_entry_value<uint16_t>(entry, 27, r)) {
-        min_aperture = f_number_from_aperture(ev_from_s16<false>(pr.value()));
+        mn.min_aperture() = f_number_from_aperture(ev_from_s16<false>(pr.value()));
+        mn.min_aperture().parsed_from = entry.tag;
       }
     } else if (entry.tag == tag_camera_info::TagId) {
-      int lens_id_offset = 0;
-      if (data.model) {
-        std::string_view model = data.model.value.view();
-        for (ParseInfo pi : parse_infos) {
-          if (std::regex_search(model.begin(), model.end(), pi.models)) {
-            if (!mn.lens_type.is_set) {
-              if (auto pr = tiff::fetch_entry_value_raw_offset<uint16_t>(entry, pi.lens_type.offset, r)) {
-                if (pi.lens_type.rev) {
-                  mn.lens_type = nexif::byteswap(pr.value());
-                } else {
-                  mn.lens_type = pr.value();
-                }
-                mn.lens_type.parsed_from = entry.tag;
-                DEBUG_PRINT("lens type from CI: %d", mn.lens_type.value);
-              }
-            }
-            break;
-          }
-        }
+      // The layout depends on the model; looked up in resolve_lens().
+      if (entry.size() > 4) {
+        data.parse_state.lens_data_offset = entry.offset(r) - data.parse_state.makernote_offset;
+        data.parse_state.lens_data_length = entry.size();
       }
     } else if (entry.tag == canon::tag_lens_model::TagId) {
-      if (auto result = tiff::parse_tag<canon::tag_lens_model>(r, data.exif.lens_model, entry)) {
-        auto name = data.exif.lens_model.value.view();
-        DEBUG_PRINT("lens model:  %.*s", int(name.length()), name.data());
+      if (auto result = tiff::parse_tag<canon::tag_lens_model>(r, data.exif.lens_model(), entry)) {
+        auto name = data.exif.lens_model().value.view();
+        NEXIF_TRACE_MESSAGE("lens model:  %.*s", int(name.length()), name.data());
       }
     } else if (entry.tag == 0x0096) {
       if (entry.type == tiff::DType::ASCII) {
         if (auto v = entry.data_view(r)) {
-          mn.internal_serial_number = data.store_string_data(v.value());
-          DEBUG_PRINT("serial number: %.*s", int(v.value().length()), v.value().data());
+          mn.internal_serial_number() = data.store_string_data(v.value());
+          NEXIF_TRACE_MESSAGE("serial number: %.*s", int(v.value().length()), v.value().data());
         }
       }
     } else if (entry.tag == 0x4019) {
@@ -247,29 +235,80 @@ std::optional<ParseError> parse_makernote(Reader &r, ExifData &data)
             v.value().data()[3],
             v.value().data()[4]
           );
-          if (!mn.lens_serial_number) {
-            mn.lens_serial_number = data.store_string_data(buf);
-            mn.lens_serial_number.parsed_from = entry.tag;
+          if (!mn.lens_serial_number()) {
+            mn.lens_serial_number() = data.store_string_data(buf);
+            mn.lens_serial_number().parsed_from = entry.tag;
           }
-          DEBUG_PRINT("lens serial number: %s", buf);
+          NEXIF_TRACE_MESSAGE("lens serial number: %s", buf);
         }
       }
     }
   }
 
-  DEBUG_PRINT("Min focal: %d", mn.min_focal_length.value_or(0));
-  DEBUG_PRINT("Max focal: %d", mn.min_focal_length.value_or(0));
-  DEBUG_PRINT("Max aperture: %f", max_aperture);
-  DEBUG_PRINT("Min aperture: %f", min_aperture);
-  DEBUG_PRINT("Lens type: %d", mn.lens_type.value_or(0));
+  NEXIF_TRACE_MESSAGE("Min focal: %d", mn.min_focal_length().value_or(0));
+  NEXIF_TRACE_MESSAGE("Max focal: %d", mn.min_focal_length().value_or(0));
+  NEXIF_TRACE_MESSAGE("Max aperture: %f", mn.max_aperture().value_or(0));
+  NEXIF_TRACE_MESSAGE("Min aperture: %f", mn.min_aperture().value_or(0));
+  NEXIF_TRACE_MESSAGE("Lens type: %d", mn.lens_type().value_or(0));
+
+  if (mn.min_focal_length() && mn.max_focal_length()) {
+    if (!data.exif.lens_specification()) {
+      data.exif.lens_specification() = std::array<rational64u, 4>{
+        rational64u{mn.min_focal_length(), 1},
+        rational64u{mn.min_focal_length(), 1},
+        0, 0
+      };
+    }
+  }
 
-  std::array<CanonLensID *, 8> candidates;
+  if (!data.exif.body_serial_number().is_set) {
+    if (mn.serial_number()) {
+      char buf[32];
+      std::snprintf(buf, sizeof(buf), "%u", mn.serial_number().value);
+      data.exif.body_serial_number() = data.store_string_data(buf);
+    } else if (mn.internal_serial_number()) {
+      data.exif.body_serial_number() = mn.internal_serial_number().value.view();
+    }
+  }
+
+  return {};
+}
+
+std::optional<ParseError> resolve_lens(Reader &r, ExifData &data)
+{
+  CanonMakernote &mn = std::get<CanonMakernote>(data.makernote);
+  const ParseState &state = data.parse_state;
+
+  if (state.lens_data_length > 0 && data.model() && !mn.lens_type().is_set) {
+    uint32_t camera_info_offset = state.makernote_offset + state.lens_data_offset;
+    std::string_view model = data.model().value.view();
+    for (const ParseInfo &pi : parse_infos) {
+      if (std::regex_search(model.begin(), model.end(), pi.models)) {
+        if (pi.lens_type.offset >= 0 && pi.lens_type.offset + 2 <= state.lens_data_length) {
+          RETURN_IF_OPT_ERROR(r.seek(camera_info_offset + pi.lens_type.offset));
+          uint16_t lens_type = r.read_u16();
+          if (pi.lens_type.rev) {
+            mn.lens_type() = nexif::byteswap(lens_type);
+          } else {
+            mn.lens_type() = lens_type;
+          }
+          mn.lens_type().parsed_from = tag_camera_info::TagId;
+          NEXIF_TRACE_MESSAGE("lens type from CI: %d", mn.lens_type().value);
+        }
+        break;
+      }
+    }
+  }
+
+  float max_aperture = mn.max_aperture().value_or(0);
+  std::array<const CanonLensID *, 8> candidates;
   uint32_t num_cand = 0;
 
-  if (mn.lens_type && mn.min_focal_length && mn.max_focal_length) {
-    parse_all_lenses();
-    for (CanonLensID &lens : canon_lenses) {
-      // DEBUG_PRINT(
+  if (mn.lens_type() && mn.min_focal_length() && mn.max_focal_length()) {
+    RETURN_IF_CANCELLED();
+    PhaseTimer timer(r.stats, &ParseStats::lens_lookup_ns, "lens_lookup");
+    for (const CanonLensID &lens : canon_lenses) {
+      // NEXIF_TRACE_MESSAGE(
       //   "testing lens: %.*s  (%d %d %f %f)",
       //   (int)lens.name.length(), lens.name.data(),
       //   lens.min_focal, lens.max_focal,
@@ -277,35 +316,26 @@ std::optional<ParseError> parse_makernote(Reader &r, ExifData &data)
       //);
       if (true
           && num_cand < 8
-          && lens.id == mn.lens_type.value
-          && lens.min_focal == mn.min_focal_length.value
-          && lens.max_focal == mn.max_focal_length.value
+          && lens.id == mn.lens_type().value
+          && lens.min_focal == mn.min_focal_length().value
+          && lens.max_focal == mn.max_focal_length().value
           && std::abs(lens.min_fnum_at_min_focal - max_aperture) < 0.05f) {
-        DEBUG_PRINT("Could be lens: %.*s", (int)lens.name.length(), lens.name.data());
+        NEXIF_TRACE_MESSAGE("Could be lens: %.*s", (int)lens.name.length(), lens.name.data());
         candidates[num_cand++] = &lens;
       }
     }
   }
 
-  if (num_cand == 1 && !data.exif.lens_model.is_set) {
-    CanonLensID &lens = *candidates[0];
-    data.exif.lens_model = data.store_string_data(lens.name);
-    data.exif.lens_specification = std::array<rational64u, 4>{
-      rational64u{mn.min_focal_length.value, 1},
-      rational64u{mn.max_focal_length.value, 1},
+  if (num_cand == 1 && !data.exif.lens_model().is_set) {
+    const CanonLensID &lens = *candidates[0];
+    data.exif.lens_model() = data.store_string_data(lens.name);
+    data.exif.lens_specification() = std::array<rational64u, 4>{
+      rational64u{mn.min_focal_length().value, 1},
+      rational64u{mn.max_focal_length().value, 1},
       rational64u{(uint32_t)(lens.min_fnum_at_min_focal * 10), 10},
       rational64u{(uint32_t)(lens.min_fnum_at_max_focal * 10), 10},
     };
   }
-  if (mn.min_focal_length && mn.max_focal_length) {
-    if (!data.exif.lens_specification) {
-      data.exif.lens_specification = std::array<rational64u, 4>{
-        rational64u{mn.min_focal_length, 1},
-        rational64u{mn.min_focal_length, 1},
-        0, 0
-      };
-    }
-  }
 
   // Let's set the candidates anyway
   if (num_cand > 0) {
@@ -313,21 +343,11 @@ std::optional<ParseError> parse_makernote(Reader &r, ExifData &data)
     for (int i = 0; i < num_cand; ++i) {
       cand_names[i] = candidates[i]->name;
     }
-    data.exif.possible_lenses = {cand_names, num_cand};
-    data.exif.possible_lenses.parsed_from = tag_camera_info::TagId;
-  }
-
-  if (!data.exif.body_serial_number.is_set) {
-    if (mn.serial_number) {
-      char buf[32];
-      std::snprintf(buf, sizeof(buf), "%u", mn.serial_number.value);
-      data.exif.body_serial_number = data.store_string_data(buf);
-    } else if (mn.internal_serial_number) {
-      data.exif.body_serial_number = mn.internal_serial_number.value.view();
-    }
+    data.exif.possible_lenses() = {cand_names, num_cand};
+    data.exif.possible_lenses().parsed_from = tag_camera_info::TagId;
   }
 
-  return {};
+  return std::nullopt;
 }
 
 }  // namespace makernote::canon
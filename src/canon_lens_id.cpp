@@ -1,8 +1,6 @@
+#include <algorithm>
 #include <string_view>
 #include <cstdint>
-#include <mutex>
-
-#include "neonexif/lens_name_parser.hpp"
 
 namespace nexif {
 namespace makernote {
@@ -16,15 +14,6 @@ struct CanonLensID {
   uint16_t min_focal{0}, max_focal{0};
   float min_fnum_at_min_focal{0.0f};
   float min_fnum_at_max_focal{0.0f};
-
-  void parse(LensNameParser &parser)
-  {
-    ParsedLensName r = parser.parse_lens_name(name);
-    min_focal = r.min_focal;
-    max_focal = r.max_focal;
-    min_fnum_at_min_focal = r.min_fnum_at_min_focal;
-    min_fnum_at_max_focal = r.min_fnum_at_max_focal;
-  }
 };
 
 // Database taken from: https://exiftool.org/TagNames/Canon.html
@@ -36,8 +25,10 @@ struct CanonLensID {
 // of the options right below it.
 //
 // Additionally, the database is augmented with pre-extracted lens properties
-// from the name. This saves us the runtime cost of the regex stuff.
-CanonLensID canon_lenses[] = {
+// from the name (with `LensNameParser`). This saves us the runtime cost of the
+// regex stuff, and keeps the table constant, so it is safe to share between
+// parsing threads.
+constexpr CanonLensID canon_lenses[] = {
   {1, "Canon EF 50mm f/1.8"sv, 50, 50, 1.80f, 1.80f},
   {2, "Canon EF 28mm f/2.8"sv, 28, 28, 2.80f, 2.80f},
   {2, "Sigma 24mm f/2.8 Super Wide II"sv, 24, 24, 2.80f, 2.80f},
@@ -572,28 +563,10 @@ CanonLensID canon_lenses[] = {
   {61496, "Canon CN-E 35mm T1.5 L F"sv, 35, 35, 1.50f, 1.50f},
 };
 
-void parse_all_lenses()
-{
-  static std::once_flag once;
-  std::call_once(once, []() {
-    std::optional<LensNameParser> p;  // In an std::optional to avoid creating one
-                                      // if all lenses are pre-extracted.
-    for (CanonLensID &l : canon_lenses) {
-      if (l.min_focal == 0) {
-        if (!p.has_value()) {
-          p.emplace();
-        }
-        l.parse(p.value());
-        std::printf(
-          "{%d, \"%.*s\"sv, %d, %d, %.2ff, %.2ff},\n",
-          l.id, (int)l.name.length(), l.name.data(),
-          l.min_focal, l.max_focal,
-          l.min_fnum_at_min_focal, l.min_fnum_at_max_focal
-        );
-      }
-    }
-  });
-}
+static_assert(
+  std::ranges::all_of(canon_lenses, [](const CanonLensID &l) { return l.min_focal != 0; }),
+  "Every lens needs its pre-extracted properties."
+);
 
 }  // namespace canon
 }  // namespace makernote
@@ -0,0 +1,50 @@
+#pragma once
+
+#include <atomic>
+#include <cstdint>
+#include <functional>
+#include <memory>
+
+namespace nexif {
+
+/**
+ * The events of one thread. Only that thread writes, and only a drain, under
+ * the mutex of the registry that holds the rings, reads; so the two indices
+ * are enough to hand the slots back and forth. When the ring is full, new
+ * events are dropped, and counted.
+ */
+template <typename Event, uint64_t CAPACITY>
+class EventRing {
+ public:
+  void push(const Event &e)
+  {
+    uint64_t write = _write.load(std::memory_order_relaxed);
+    if (write - _read.load(std::memory_order_acquire) == CAPACITY) {
+      _dropped.fetch_add(1, std::memory_order_relaxed);
+      return;
+    }
+    _events[write % CAPACITY] = e;
+    _write.store(write + 1, std::memory_order_release);
+  }
+
+  uint64_t drain(const std::function<void(const Event &)> &fn)
+  {
+    uint64_t read = _read.load(std::memory_order_relaxed);
+    uint64_t write = _write.load(std::memory_order_acquire);
+    for (; read != write; ++read) {
+      fn(_events[read % CAPACITY]);
+    }
+    _read.store(read, std::memory_order_release);
+    return _dropped.exchange(0, std::memory_order_relaxed);
+  }
+
+  bool empty() const { return _read.load(std::memory_order_relaxed) == _write.load(std::memory_order_acquire); }
+
+ private:
+  std::atomic<uint64_t> _write{0};
+  std::atomic<uint64_t> _read{0};
+  std::atomic<uint64_t> _dropped{0};
+  std::unique_ptr<Event[]> _events{new Event[CAPACITY]};
+};
+
+}  // namespace nexif
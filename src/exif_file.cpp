@@ -0,0 +1,249 @@
+#include "neonexif/exif_file.hpp"
+#include "neonexif/mapping_guard.hpp"
+#include "neonexif/mappedfile.hpp"
+#include "neonexif/reader.hpp"
+
+#include <optional>
+#include <utility>
+
+#ifndef _WIN32
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#endif
+
+namespace nexif {
+
+/** The cached answers of the queries. Allocated on the first query. */
+struct ExifFile::Queries {
+  std::optional<ParseResult<ExifData>> exif;
+  bool ranges_done{false};
+  vla<PreviewRange, 5> previews;
+  vla<ByteRange, 32> raw_ranges;
+  std::vector<char> contents;  ///< Read with pread() after the mapping faulted; replaces it.
+};
+
+ExifFile::ExifFile() = default;
+
+ExifFile::~ExifFile()
+{
+  close();
+}
+
+ExifFile::ExifFile(ExifFile &&o)
+{
+  operator=(std::move(o));
+}
+
+ExifFile &ExifFile::operator=(ExifFile &&o)
+{
+  if (this != &o) {
+    close();
+    _data = std::exchange(o._data, nullptr);
+    _length = std::exchange(o._length, 0);
+    _fd = std::exchange(o._fd, -1);
+    _owns_mapping = std::exchange(o._owns_mapping, false);
+    _queries = std::move(o._queries);
+  }
+  return *this;
+}
+
+ParseResult<ExifFile> ExifFile::open(const std::filesystem::path &path)
+{
+#ifdef _WIN32
+  ExifFile f;
+  f._data = map_file(path, &f._length);
+  ASSERT_OR_PARSE_ERROR(f._data != NULL, CANNOT_OPEN_FILE, "Cannot open file.", nullptr);
+  f._owns_mapping = true;
+  return f;
+#else
+  // Unlike map_file(), keep the descriptor: it stays usable for reads next to
+  // the mapping, and identifies the file for as long as the handle lives.
+  int fd = ::open(path.c_str(), O_RDONLY | O_CLOEXEC);
+  ASSERT_OR_PARSE_ERROR(fd >= 0, CANNOT_OPEN_FILE, "Cannot open file.", nullptr);
+  return open(fd);
+#endif
+}
+
+#ifndef _WIN32
+ParseResult<ExifFile> ExifFile::open(int fd)
+{
+  ExifFile f;
+  f._fd = fd;
+  struct stat st;
+  ASSERT_OR_PARSE_ERROR(fstat(f._fd, &st) == 0 && st.st_size > 0, CANNOT_OPEN_FILE, "Cannot open file.", nullptr);
+  f._length = st.st_size;
+  void *mapping = mmap(nullptr, f._length, PROT_READ, MAP_SHARED, f._fd, 0);
+  ASSERT_OR_PARSE_ERROR(mapping != MAP_FAILED, CANNOT_OPEN_FILE, "Cannot map file.", nullptr);
+  f._data = (char *)mapping;
+  f._owns_mapping = true;
+  return f;
+}
+#endif
+
+ExifFile ExifFile::wrap(const char *buffer, size_t length)
+{
+  ExifFile f;
+  f._data = const_cast<char *>(buffer);
+  f._length = length;
+  f._owns_mapping = false;
+  return f;
+}
+
+void ExifFile::close()
+{
+  if (_data != nullptr && _owns_mapping) {
+#ifdef _WIN32
+    unmap_file(_data, _length);
+#else
+    munmap(_data, _length);
+#endif
+  }
+#ifndef _WIN32
+  if (_fd >= 0) {
+    ::close(_fd);
+  }
+#endif
+  _data = nullptr;
+  _length = 0;
+  _fd = -1;
+  _owns_mapping = false;
+  _queries.reset();
+}
+
+ExifFile::Queries &ExifFile::queries()
+{
+  if (!_queries) {
+    _queries = std::make_unique<Queries>();
+  }
+  return *_queries;
+}
+
+const ParseResult<ExifData> &ExifFile::exif(ParseLevel level)
+{
+  std::optional<ParseResult<ExifData>> &exif = queries().exif;
+  if (!exif) {
+    exif.emplace(read_exif(_data, _length, level));
+    if (!*exif && is_mapping_fault(exif->error()) && replace_mapping_with_contents()) {
+      exif.emplace(read_exif(_data, _length, level));
+    }
+  } else if (*exif && exif->value().parse_state.level < level) {
+    ParseResult<ParseLevel> upgraded = upgrade(exif->value(), level, _data, _length);
+    if (!upgraded && is_mapping_fault(upgraded.error()) && replace_mapping_with_contents()) {
+      upgraded = upgrade(exif->value(), level, _data, _length);
+    }
+    exif->warnings.splice(exif->warnings.end(), upgraded.warnings);
+    if (!upgraded) {
+      // Keep what was parsed for the lower levels.
+      exif->warnings.push_back({upgraded.error().message, upgraded.error().what});
+    }
+  }
+  return *exif;
+}
+
+bool ExifFile::replace_mapping_with_contents()
+{
+  if (!_owns_mapping || _fd < 0 || mapping_fault_policy() != MappingFaultPolicy::RETRY_WITH_PREAD) {
+    return false;
+  }
+  std::vector<char> &contents = queries().contents;
+  if (!read_file_contents(_fd, contents)) {
+    return false;
+  }
+#ifndef _WIN32
+  munmap(_data, _length);
+#endif
+  _data = contents.data();
+  _length = contents.size();
+  _owns_mapping = false;
+  return true;
+}
+
+bool ExifFile::in_file(ByteRange range) const
+{
+  return range.offset <= _length && range.length <= _length - range.offset;
+}
+
+std::string_view ExifFile::bytes(ByteRange range) const
+{
+  if (!in_file(range)) {
+    return {};
+  }
+  return {_data + range.offset, range.length};
+}
+
+namespace {
+/** The single range of bytes of an image, relative to the TIFF structure. */
+std::optional<ByteRange> single_range(const ImageData &image)
+{
+  if (image.data_offset().is_set && image.data_length().is_set) {
+    return ByteRange{image.data_offset().value, image.data_length().value};
+  }
+  const auto &offsets = image.strip_offsets().value;
+  const auto &counts = image.strip_byte_counts().value;
+  if (offsets.num == 1 && counts.num == 1) {
+    return ByteRange{offsets.values[0], counts.values[0]};
+  }
+  return std::nullopt;
+}
+}  // namespace
+
+std::span<const PreviewRange> ExifFile::previews()
+{
+  Queries &q = queries();
+  if (!q.ranges_done) {
+    // Strips and previews are found at the core level already.
+    const ParseResult<ExifData> &exif = q.exif ? *q.exif : this->exif(ParseLevel::CORE);
+    q.ranges_done = true;
+    if (!exif) {
+      return {};
+    }
+    const ExifData &data = exif.value();
+    uint64_t tiff_offset = data.parse_state.tiff_offset;
+    const ImageData *raw = data.full_resolution_image(true);
+
+    for (int i = 0; i < data.num_images; ++i) {
+      const ImageData &image = data.images[i];
+      if (&image == raw || image.type == FULL_RESOLUTION) {
+        continue;
+      }
+      std::optional<ByteRange> range = single_range(image);
+      if (!range || range->length == 0) {
+        continue;
+      }
+      range->offset += tiff_offset;
+      if (!in_file(*range) || q.previews.num == q.previews.values.size()) {
+        continue;
+      }
+      q.previews.push_back({i, image.image_width().value, image.image_height().value, *range});
+    }
+
+    if (raw) {
+      const auto &offsets = raw->strip_offsets().value;
+      const auto &counts = raw->strip_byte_counts().value;
+      if (offsets.num > 0 && offsets.num == counts.num) {
+        for (uint32_t s = 0; s < offsets.num; ++s) {
+          q.raw_ranges.push_back({tiff_offset + offsets.values[s], counts.values[s]});
+        }
+      } else if (std::optional<ByteRange> range = single_range(*raw)) {
+        q.raw_ranges.push_back({tiff_offset + range->offset, range->length});
+      }
+      for (uint32_t s = 0; s < q.raw_ranges.num; ++s) {
+        if (!in_file(q.raw_ranges.values[s])) {
+          q.raw_ranges.num = 0;
+          break;
+        }
+      }
+    }
+  }
+  return {q.previews.values.data(), q.previews.num};
+}
+
+std::span<const ByteRange> ExifFile::raw_ranges()
+{
+  previews();
+  return {_queries->raw_ranges.values.data(), _queries->raw_ranges.num};
+}
+
+}  // namespace nexif
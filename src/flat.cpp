@@ -0,0 +1,335 @@
+#include "neonexif/flat.hpp"
+#include "neonexif/intern_pool.hpp"
+#include "neonexif/reader.hpp"
+
+#include <cstddef>
+#include <cstring>
+
+namespace nexif {
+
+namespace {
+
+constexpr char FLAT_MAGIC[4] = {'N', 'X', 'F', 'R'};
+
+size_t align8(size_t v)
+{
+  return (v + 7) & ~size_t(7);
+}
+
+enum class Section {
+  ROOT,
+  EXIF,
+  IMAGE,
+  NIKON,
+  CANON,
+};
+
+/** Calls `f(offset)` for every `CharData` in a struct of type `S`. */
+template <typename S, typename F>
+void char_data_offsets(F &&f)
+{
+  static const S proto{};
+  const char *base = (const char *)&proto;
+  if constexpr (std::is_same_v<S, ExifData>) {
+    base = (const char *)&proto.values;  // Only the root tags are one section.
+  }
+  proto.for_each_value([&](const auto &v) {
+    if constexpr (std::is_same_v<std::remove_cvref_t<decltype(v)>, CharData>) {
+      f(size_t((const char *)&v - base));
+    }
+  });
+}
+
+template <typename F>
+void section_char_data_offsets(Section s, F &&f)
+{
+  switch (s) {
+    case Section::ROOT: return char_data_offsets<ExifData>(f);
+    case Section::EXIF: return char_data_offsets<ExifIFD>(f);
+    case Section::IMAGE: return char_data_offsets<ImageData>(f);
+    case Section::NIKON: return char_data_offsets<NikonMakernote>(f);
+    case Section::CANON: return char_data_offsets<CanonMakernote>(f);
+  }
+}
+
+/** Calls `f(section, index, record_offset)` for every section holding tags. */
+template <typename F>
+void for_each_section(const FlatHeader &h, F &&f)
+{
+  f(Section::ROOT, 0, h.root_offset + offsetof(FlatRoot, values));
+  f(Section::EXIF, 0, h.exif_offset);
+  for (int i = 0; i < h.num_images; ++i) {
+    f(Section::IMAGE, i, h.images_offset + i * sizeof(ImageData));
+  }
+  if (h.makernote_kind == 1) {
+    f(Section::NIKON, 0, h.makernote_offset);
+  } else if (h.makernote_kind == 2) {
+    f(Section::CANON, 0, h.makernote_offset);
+  }
+}
+
+/** Where a section lives in an `ExifData`. */
+template <typename D>
+auto *section_base(D &data, Section s, int idx)
+{
+  using C = std::conditional_t<std::is_const_v<D>, const char, char>;
+  switch (s) {
+    case Section::ROOT: return (C *)&data.values;
+    case Section::EXIF: return (C *)&data.exif;
+    case Section::IMAGE: return (C *)&data.images[idx];
+    case Section::NIKON: return (C *)&std::get<NikonMakernote>(data.makernote);
+    case Section::CANON: return (C *)&std::get<CanonMakernote>(data.makernote);
+  }
+  std::abort();
+}
+
+size_t makernote_size(uint8_t kind)
+{
+  switch (kind) {
+    case 1: return sizeof(NikonMakernote);
+    case 2: return sizeof(CanonMakernote);
+    default: return 0;
+  }
+}
+
+}  // namespace
+
+uint32_t flat_layout_hash()
+{
+  uint32_t h = 2166136261u;
+  for (size_t v : {
+         sizeof(FlatHeader), sizeof(FlatRoot), size_t(ExifData::num_tags), sizeof(ExifIFD),
+         sizeof(ImageData), sizeof(NikonMakernote), sizeof(CanonMakernote), sizeof(ParseState),
+         sizeof(CharData), std::variant_size_v<decltype(ExifData::makernote)>,
+       }) {
+    h = (h ^ uint32_t(v)) * 16777619u;
+  }
+  return h;
+}
+
+size_t write_flat(const ExifData &data, std::vector<uint8_t> &output)
+{
+  FlatHeader h{};
+  std::memcpy(h.magic, FLAT_MAGIC, 4);
+  h.schema_version = FLAT_SCHEMA_VERSION;
+  h.layout_hash = flat_layout_hash();
+  h.file_type = data.file_type;
+  h.file_type_variant = data.file_type_variant;
+  h.big_endian = data.byte_order == std::endian::big;
+  h.makernote_kind = data.makernote.index();
+  h.num_images = data.num_images;
+  const auto &lenses = data.exif.possible_lenses().value;
+  h.num_possible_lenses = lenses.num;
+
+  size_t pos = align8(sizeof(FlatHeader));
+  h.root_offset = pos;
+  pos = align8(pos + sizeof(FlatRoot));
+  h.exif_offset = pos;
+  pos = align8(pos + sizeof(ExifIFD));
+  h.images_offset = pos;
+  pos = align8(pos + data.num_images * sizeof(ImageData));
+  h.makernote_offset = pos;
+  pos = align8(pos + makernote_size(h.makernote_kind));
+  h.parse_state_offset = pos;
+  pos = align8(pos + sizeof(ParseState));
+  h.lenses_offset = pos;
+  pos = align8(pos + lenses.num * 2 * sizeof(uint32_t));
+  h.strings_offset = pos;
+
+  h.strings_size = 0;
+  for_each_section(h, [&](Section s, int idx, size_t) {
+    const char *src = section_base(data, s, idx);
+    section_char_data_offsets(s, [&](size_t o) {
+      const CharData &cd = *(const CharData *)(src + o);
+      if (cd.data() != nullptr) {
+        h.strings_size += cd.length + 1;
+      }
+    });
+  });
+  for (uint32_t i = 0; i < lenses.num; ++i) {
+    h.strings_size += lenses.values[i].length() + 1;
+  }
+  h.record_size = align8(h.strings_offset + h.strings_size);
+
+  size_t start = align8(output.size());
+  output.resize(start + h.record_size, 0);
+  uint8_t *rec = output.data() + start;
+
+  std::memcpy(rec, &h, sizeof(h));
+  FlatRoot *root = (FlatRoot *)(rec + h.root_offset);
+  std::memcpy((void *)&root->present, &data.present, sizeof(data.present));
+  std::memcpy((void *)&root->values, &data.values, sizeof(data.values));
+  std::memcpy((void *)&root->parsed_from, &data.parsed_from, sizeof(data.parsed_from));
+  std::memcpy(rec + h.exif_offset, (const void *)&data.exif, sizeof(ExifIFD));
+  ((ExifIFD *)(rec + h.exif_offset))->values.possible_lenses = {};
+  std::memcpy(rec + h.images_offset, (const void *)data.images.data(), data.num_images * sizeof(ImageData));
+  if (h.makernote_kind != 0) {
+    std::memcpy(rec + h.makernote_offset, section_base(data, h.makernote_kind == 1 ? Section::NIKON : Section::CANON, 0), makernote_size(h.makernote_kind));
+  }
+  std::memcpy(rec + h.parse_state_offset, (const void *)&data.parse_state, sizeof(ParseState));
+
+  char *strings = (char *)rec + h.strings_offset;
+  uint32_t used = 0;
+  auto store = [&](const char *str, size_t length) {
+    char *dst = strings + used;
+    std::memcpy(dst, str, length);
+    dst[length] = 0;
+    used += length + 1;
+    return dst;
+  };
+  for_each_section(h, [&](Section s, int idx, size_t record_offset) {
+    const char *src = section_base(data, s, idx);
+    section_char_data_offsets(s, [&](size_t o) {
+      const CharData &cd = *(const CharData *)(src + o);
+      CharData &dst = *(CharData *)(rec + record_offset + o);
+      if (cd.data() == nullptr) {
+        dst.set(nullptr, 0);
+      } else {
+        dst.set(store(cd.data(), cd.length), cd.length);
+      }
+    });
+  });
+  uint32_t *lens_table = (uint32_t *)(rec + h.lenses_offset);
+  for (uint32_t i = 0; i < lenses.num; ++i) {
+    lens_table[2 * i + 0] = store(lenses.values[i].data(), lenses.values[i].length()) - strings;
+    lens_table[2 * i + 1] = lenses.values[i].length();
+  }
+  assert(used == h.strings_size);
+  return start;
+}
+
+ParseResult<FlatExifView> FlatExifView::open(const void *record, size_t length)
+{
+  const uint8_t *base = (const uint8_t *)record;
+  ASSERT_OR_PARSE_ERROR(base != nullptr, CANNOT_OPEN_FILE, "No record provided.", nullptr);
+  ASSERT_OR_PARSE_ERROR(length >= sizeof(FlatHeader), CORRUPT_DATA, "Record too small.", nullptr);
+  ASSERT_OR_PARSE_ERROR((uintptr_t(base) & 7) == 0, INTERNAL_ERROR, "Record not 8-byte aligned.", nullptr);
+  const FlatHeader &h = *(const FlatHeader *)base;
+  ASSERT_OR_PARSE_ERROR(std::memcmp(h.magic, FLAT_MAGIC, 4) == 0, UNKNOWN_FILE_TYPE, "Not a flat record.", nullptr);
+  ASSERT_OR_PARSE_ERROR(h.schema_version == FLAT_SCHEMA_VERSION, UNKNOWN_FILE_TYPE, "Flat record of another schema version.", nullptr);
+  ASSERT_OR_PARSE_ERROR(h.layout_hash == flat_layout_hash(), UNKNOWN_FILE_TYPE, "Flat record of another struct layout.", nullptr);
+
+  ASSERT_OR_PARSE_ERROR(h.record_size <= length, CORRUPT_DATA, "Record truncated.", nullptr);
+  ASSERT_OR_PARSE_ERROR(h.num_images <= std::tuple_size_v<decltype(ExifData::images)>, CORRUPT_DATA, "Too many images.", nullptr);
+  ASSERT_OR_PARSE_ERROR(h.makernote_kind < std::variant_size_v<decltype(ExifData::makernote)>, CORRUPT_DATA, "Unknown MakerNote.", nullptr);
+  ASSERT_OR_PARSE_ERROR(h.num_possible_lenses <= 8, CORRUPT_DATA, "Too many lenses.", nullptr);
+  auto section_ok = [&](uint32_t offset, size_t size) {
+    return (offset & 7) == 0 && offset >= sizeof(FlatHeader) && size_t(offset) + size <= h.record_size;
+  };
+  ASSERT_OR_PARSE_ERROR(
+    section_ok(h.root_offset, sizeof(FlatRoot))
+      && section_ok(h.exif_offset, sizeof(ExifIFD))
+      && section_ok(h.images_offset, h.num_images * sizeof(ImageData))
+      && section_ok(h.makernote_offset, makernote_size(h.makernote_kind))
+      && section_ok(h.parse_state_offset, sizeof(ParseState))
+      && section_ok(h.lenses_offset, h.num_possible_lenses * 2 * sizeof(uint32_t))
+      && section_ok(h.strings_offset, h.strings_size),
+    CORRUPT_DATA, "Section out of bounds.", nullptr
+  );
+
+  // All strings have to lie in the string area.
+  int64_t strings_begin = h.strings_offset;
+  int64_t strings_end = int64_t(h.strings_offset) + h.strings_size;
+  bool strings_ok = true;
+  for_each_section(h, [&](Section s, int, size_t record_offset) {
+    section_char_data_offsets(s, [&](size_t o) {
+      const CharData &cd = *(const CharData *)(base + record_offset + o);
+      int64_t target = int64_t(record_offset + o) + cd.ptr_offset;
+      if (cd.ptr_offset != 0 && (target < strings_begin || target + cd.length > strings_end)) {
+        strings_ok = false;
+      }
+    });
+  });
+  const uint32_t *lens_table = (const uint32_t *)(base + h.lenses_offset);
+  for (int i = 0; i < h.num_possible_lenses; ++i) {
+    if (size_t(lens_table[2 * i]) + lens_table[2 * i + 1] > h.strings_size) {
+      strings_ok = false;
+    }
+  }
+  ASSERT_OR_PARSE_ERROR(strings_ok, CORRUPT_DATA, "String out of bounds.", nullptr);
+
+  FlatExifView view;
+  view._base = base;
+  view._header = &h;
+  view._root = (const FlatRoot *)(base + h.root_offset);
+  view._exif = (const ExifIFD *)(base + h.exif_offset);
+  view._images = (const ImageData *)(base + h.images_offset);
+  view._parse_state = (const ParseState *)(base + h.parse_state_offset);
+  return view;
+}
+
+vla<std::string_view, 8> FlatExifView::possible_lenses() const
+{
+  vla<std::string_view, 8> result;
+  const uint32_t *lens_table = (const uint32_t *)(_base + _header->lenses_offset);
+  const char *strings = (const char *)_base + _header->strings_offset;
+  for (int i = 0; i < _header->num_possible_lenses; ++i) {
+    result.push_back({strings + lens_table[2 * i], lens_table[2 * i + 1]});
+  }
+  return result;
+}
+
+const NikonMakernote *FlatExifView::nikon_makernote() const
+{
+  return _header->makernote_kind == 1 ? (const NikonMakernote *)(_base + _header->makernote_offset) : nullptr;
+}
+
+const CanonMakernote *FlatExifView::canon_makernote() const
+{
+  return _header->makernote_kind == 2 ? (const CanonMakernote *)(_base + _header->makernote_offset) : nullptr;
+}
+
+ExifData FlatExifView::to_exif_data(InternPool &lens_names) const
+{
+  const FlatHeader &h = *_header;
+  ExifData data;
+  data.file_type = file_type();
+  data.file_type_variant = file_type_variant();
+  data.byte_order = byte_order();
+  data.dirty = ExifData::DIRTY_ALL;
+
+  std::memcpy(&data.present, &_root->present, sizeof(data.present));
+  std::memcpy((void *)&data.values, &_root->values, sizeof(data.values));
+  std::memcpy(&data.parsed_from, &_root->parsed_from, sizeof(data.parsed_from));
+  std::memcpy((void *)&data.exif, _exif, sizeof(ExifIFD));
+  data.num_images = h.num_images;
+  std::memcpy((void *)data.images.data(), _images, h.num_images * sizeof(ImageData));
+  if (const NikonMakernote *mn = nikon_makernote()) {
+    std::memcpy((void *)&data.makernote.emplace<NikonMakernote>(), mn, sizeof(NikonMakernote));
+  } else if (const CanonMakernote *mn = canon_makernote()) {
+    std::memcpy((void *)&data.makernote.emplace<CanonMakernote>(), mn, sizeof(CanonMakernote));
+  }
+  std::memcpy((void *)&data.parse_state, _parse_state, sizeof(ParseState));
+
+  // Move the whole string area over at once, and point the strings into it.
+  const char *strings = nullptr;
+  if (h.strings_size > 0) {
+    char *area = data.spill_string_area(h.strings_size);
+    std::memcpy(area, _base + h.strings_offset, h.strings_size);
+    strings = area;
+  }
+  for_each_section(h, [&](Section s, int idx, size_t record_offset) {
+    char *dst = section_base(data, s, idx);
+    section_char_data_offsets(s, [&](size_t o) {
+      CharData &cd = *(CharData *)(dst + o);
+      if (cd.ptr_offset != 0) {
+        int64_t target = int64_t(record_offset + o) + cd.ptr_offset;
+        cd.set(strings + (target - h.strings_offset), cd.length);
+      }
+    });
+  });
+
+  // Point the possible lenses into the pool instead of into the record.
+  vla<std::string_view, 8> names = possible_lenses();
+  vla<std::string_view, 8> lenses;
+  for (uint32_t i = 0; i < names.num; ++i) {
+    if (uint32_t id = lens_names.intern(names.values[i]); id != InternPool::NONE) {
+      lenses.push_back(lens_names.str(id));
+    }
+  }
+  data.exif.possible_lenses() = lenses;
+  data.exif.possible_lenses().is_set = _exif->possible_lenses().is_set;
+  return data;
+}
+
+}  // namespace nexif
@@ -0,0 +1,183 @@
+#include "neonexif/intern_pool.hpp"
+
+#include <algorithm>
+#include <cstring>
+
+namespace nexif {
+
+namespace {
+uint32_t hash_string(std::string_view s)
+{
+  // FNV-1a
+  uint32_t h = 2166136261u;
+  for (char c : s) {
+    h = (h ^ uint8_t(c)) * 16777619u;
+  }
+  return h;
+}
+}  // namespace
+
+InternPool::InternPool(size_t capacity) :
+  _shard_capacity(uint32_t((std::min(capacity, MAX_CAPACITY) + NUM_SHARDS - 1) / NUM_SHARDS))
+{
+  for (Shard &shard : _shards) {
+    auto table = std::make_unique<Table>();
+    table->mask = 63;
+    table->slots = std::make_unique<std::atomic<uint32_t>[]>(64);
+    shard.table.store(table.get(), std::memory_order_release);
+    shard.tables.push_back(std::move(table));
+  }
+}
+
+InternPool::~InternPool()
+{
+  for (Shard &shard : _shards) {
+    for (auto &block : shard.blocks) {
+      delete[] block.load(std::memory_order_relaxed);
+    }
+  }
+}
+
+const InternPool::Entry &InternPool::entry(const Shard &shard, uint32_t local_idx) const
+{
+  const Entry *block = shard.blocks[local_idx >> BLOCK_BITS].load(std::memory_order_acquire);
+  return block[local_idx & (BLOCK_SIZE - 1)];
+}
+
+uint32_t InternPool::lookup(const Shard &shard, const Table *table, std::string_view s, uint32_t hash) const
+{
+  for (uint32_t i = hash;; ++i) {
+    uint32_t id = table->slots[i & table->mask].load(std::memory_order_acquire);
+    if (id == NONE) {
+      return NONE;
+    }
+    const Entry &e = entry(shard, (id >> SHARD_BITS) - 1);
+    if (e.hash == hash && e.length == s.length() && std::memcmp(e.data, s.data(), s.length()) == 0) {
+      return id;
+    }
+  }
+}
+
+uint32_t InternPool::find(std::string_view s) const
+{
+  uint32_t hash = hash_string(s);
+  const Shard &shard = _shards[hash >> (32 - SHARD_BITS)];
+  return lookup(shard, shard.table.load(std::memory_order_acquire), s, hash);
+}
+
+uint32_t InternPool::intern(std::string_view s)
+{
+  uint32_t hash = hash_string(s);
+  Shard &shard = _shards[hash >> (32 - SHARD_BITS)];
+  if (uint32_t id = lookup(shard, shard.table.load(std::memory_order_acquire), s, hash)) {
+    return id;
+  }
+
+  std::lock_guard lock(shard.mutex);
+  // Someone might have inserted it while we were waiting.
+  Table *table = shard.table.load(std::memory_order_relaxed);
+  if (uint32_t id = lookup(shard, table, s, hash)) {
+    return id;
+  }
+
+  uint32_t local_idx = shard.count.load(std::memory_order_relaxed);
+  if (local_idx >= _shard_capacity) {
+    return NONE;
+  }
+  std::atomic<Entry *> &block = shard.blocks[local_idx >> BLOCK_BITS];
+  if (block.load(std::memory_order_relaxed) == nullptr) {
+    block.store(new Entry[BLOCK_SIZE], std::memory_order_release);
+  }
+  block.load(std::memory_order_relaxed)[local_idx & (BLOCK_SIZE - 1)] = {store(shard, s), uint32_t(s.length()), hash};
+  shard.count.store(local_idx + 1, std::memory_order_release);
+
+  uint32_t shard_idx = hash >> (32 - SHARD_BITS);
+  uint32_t id = ((local_idx + 1) << SHARD_BITS) | shard_idx;
+  // Keep the load factor under one half.
+  if ((local_idx + 1) * 2 > table->mask) {
+    grow(shard);
+    table = shard.table.load(std::memory_order_relaxed);
+  }
+  uint32_t i = hash;
+  while (table->slots[i & table->mask].load(std::memory_order_relaxed) != NONE) {
+    ++i;
+  }
+  // Publishes the entry written above.
+  table->slots[i & table->mask].store(id, std::memory_order_release);
+  return id;
+}
+
+void InternPool::grow(Shard &shard)
+{
+  const Table *old = shard.table.load(std::memory_order_relaxed);
+  auto table = std::make_unique<Table>();
+  table->mask = old->mask * 2 + 1;
+  table->slots = std::make_unique<std::atomic<uint32_t>[]>(table->mask + 1);
+  for (uint32_t s = 0; s <= old->mask; ++s) {
+    uint32_t id = old->slots[s].load(std::memory_order_relaxed);
+    if (id == NONE) {
+      continue;
+    }
+    uint32_t i = entry(shard, (id >> SHARD_BITS) - 1).hash;
+    while (table->slots[i & table->mask].load(std::memory_order_relaxed) != NONE) {
+      ++i;
+    }
+    table->slots[i & table->mask].store(id, std::memory_order_relaxed);
+  }
+  // Readers might still be probing the old table, so it lives on until the
+  // pool is destroyed.
+  shard.table.store(table.get(), std::memory_order_release);
+  shard.tables.push_back(std::move(table));
+}
+
+const char *InternPool::store(Shard &shard, std::string_view s)
+{
+  if (shard.chunk_used + s.length() + 1 > shard.chunk_capacity) {
+    shard.chunk_capacity = std::max<uint32_t>(16 * 1024, s.length() + 1);
+    shard.chunks.push_back(std::make_unique<char[]>(shard.chunk_capacity));
+    shard.chunk_used = 0;
+  }
+  char *dst = shard.chunks.back().get() + shard.chunk_used;
+  std::memcpy(dst, s.data(), s.length());
+  dst[s.length()] = 0;
+  shard.chunk_used += s.length() + 1;
+  return dst;
+}
+
+std::string_view InternPool::str(uint32_t id) const
+{
+  if (id == NONE) {
+    return {};
+  }
+  const Entry &e = entry(_shards[id & (NUM_SHARDS - 1)], (id >> SHARD_BITS) - 1);
+  return {e.data, e.length};
+}
+
+size_t InternPool::size() const
+{
+  size_t total = 0;
+  for (const Shard &shard : _shards) {
+    total += shard.count.load(std::memory_order_relaxed);
+  }
+  return total;
+}
+
+InternedStrings intern_strings(const ExifData &data, InternPool &pool)
+{
+  auto intern = [&pool](TagView<CharData> tag) {
+    return tag.is_set ? pool.intern(tag.value.view()) : InternPool::NONE;
+  };
+  InternedStrings result;
+  result.make = intern(data.make());
+  result.model = intern(data.model());
+  result.software = intern(data.software());
+  result.lens_make = intern(data.exif.lens_make());
+  result.lens_model = intern(data.exif.lens_model());
+  const auto &lenses = data.exif.possible_lenses().value;
+  for (uint32_t i = 0; i < lenses.num; ++i) {
+    result.possible_lenses.push_back(pool.intern(lenses.values[i]));
+  }
+  return result;
+}
+
+}  // namespace nexif
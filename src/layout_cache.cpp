@@ -0,0 +1,49 @@
+#include "neonexif/layout_cache.hpp"
+
+namespace nexif {
+
+std::shared_ptr<const LayoutTemplate> LayoutCache::find(uint64_t fingerprint)
+{
+  std::lock_guard lock(_mutex);
+  auto it = _templates.find(fingerprint);
+  if (it == _templates.end()) {
+    _stats.misses++;
+    return nullptr;
+  }
+  _stats.hits++;
+  return it->second;
+}
+
+void LayoutCache::insert(uint64_t fingerprint, std::shared_ptr<const LayoutTemplate> layout)
+{
+  std::lock_guard lock(_mutex);
+  if (_templates.size() >= _capacity && !_templates.empty() && !_templates.contains(fingerprint)) {
+    // Bursts are rarely interleaved with more than a few cameras; any victim will do.
+    _templates.erase(_templates.begin());
+  }
+  _templates[fingerprint] = std::move(layout);
+}
+
+void LayoutCache::evict(uint64_t fingerprint)
+{
+  std::lock_guard lock(_mutex);
+  _stats.mismatches++;
+  _templates.erase(fingerprint);
+}
+
+LayoutCacheStats LayoutCache::stats() const
+{
+  std::lock_guard lock(_mutex);
+  LayoutCacheStats stats = _stats;
+  stats.templates = _templates.size();
+  return stats;
+}
+
+void LayoutCache::clear()
+{
+  std::lock_guard lock(_mutex);
+  _templates.clear();
+  _stats = {};
+}
+
+}  // namespace nexif
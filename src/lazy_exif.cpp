@@ -0,0 +1,373 @@
+#include "neonexif/lazy_exif.hpp"
+#include "neonexif/reader.hpp"
+#include "neonexif/tiff.hpp"
+#include "neonexif/tiff_tags.hpp"
+
+#include <cassert>
+#include <utility>
+#include <optional>
+
+namespace nexif {
+
+void LazyExif::init_reader(Reader &r)
+{
+  r.data = file.data() + tiff_offset;
+  r.file_length = tiff_length;
+  r.byte_order = byte_order;
+  r.file_type = file_type;
+  r.file_type_variant = file_type_variant;
+  r.exif_data = &_cache;
+}
+
+std::optional<ParseError> LazyExif::index_ifd(Reader &r, uint32_t offset, uint16_t ifd_bits, int16_t image_idx, uint32_t *next_offset)
+{
+  ASSERT_OR_PARSE_ERROR(ifds.num < ifds.values.size(), INTERNAL_ERROR, "Too many IFDs to index", nullptr);
+  RETURN_IF_OPT_ERROR(r.seek(offset));
+  ASSERT_OR_PARSE_ERROR(offset + sizeof(uint16_t) <= r.file_length, CORRUPT_DATA, "IFD out of bounds", nullptr);
+  uint16_t num_entries = r.read_u16();
+  ASSERT_OR_PARSE_ERROR(
+    offset + sizeof(uint16_t) + num_entries * tiff::ifd_entry::BINARY_SIZE + sizeof(uint32_t) <= r.file_length,
+    CORRUPT_DATA, "IFD entries out of bounds", nullptr
+  );
+  NEXIF_TRACE_MESSAGE("Index IFD at offset: %d -> Num entries: %d", offset, num_entries);
+
+  IFDLocation loc;
+  loc.offset = offset;
+  loc.ifd_bits = ifd_bits;
+  loc.num_entries = 0;
+  loc.first_entry = num_entry_tags;
+  loc.image_idx = image_idx;
+
+  for (int i = 0; i < num_entries; ++i) {
+    tiff::ifd_entry entry = tiff::read_ifd_entry(r);
+    if (num_entry_tags < entry_tags.size()) {
+      entry_tags[num_entry_tags++] = entry.tag;
+      loc.num_entries++;
+    } else if (loc.num_entries == i) {
+      LOG_WARNING(r, "Entry index full, remaining entries are not indexed", nullptr);
+    }
+    DECL_OR_RETURN(bool, found, tiff::find_subifd(r, entry));
+    (void)found;
+  }
+  ifds.push_back(loc);
+
+  *next_offset = r.read_u32();
+  return std::nullopt;
+}
+
+std::optional<ParseError> LazyExif::discover()
+{
+  Reader r{warnings};
+  r.data = file.data();
+  r.file_length = file.length();
+  if (!guess_file_type(r)) {
+    return PARSE_ERROR(UNKNOWN_FILE_TYPE, "Cannot determine file type.", nullptr);
+  }
+  file_type = r.file_type;
+  file_type_variant = r.file_type_variant;
+  _cache.file_type = file_type;
+  _cache.file_type_variant = file_type_variant;
+  RETURN_IF_OPT_ERROR(locate_tiff(r, &tiff_offset, &tiff_length));
+
+  Reader tr{warnings};
+  init_reader(tr);
+  if (tr.data[0] == 'I' && tr.data[1] == 'I') {
+    tr.byte_order = std::endian::little;
+  } else if (tr.data[0] == 'M' && tr.data[1] == 'M') {
+    tr.byte_order = std::endian::big;
+  } else {
+    return PARSE_ERROR(CORRUPT_DATA, "Not a TIFF file", "II or MM header not found");
+  }
+  byte_order = tr.byte_order;
+  _cache.byte_order = byte_order;
+  RETURN_IF_OPT_ERROR(tr.seek(4));
+  uint32_t ifd_offset = tr.read_u32();
+
+  // Same traversal order as tiff::read_tiff(), such that the last IFD
+  // containing a tag wins, just like it does in the full parse.
+  uint16_t ifd_bits = tiff::IFD0;
+  for (;;) {
+    if (_num_images >= _cache.images.size()) {
+      LOG_WARNING(tr, "Not reading subIFD", "There are too many SubImages");
+      break;
+    }
+    uint32_t next_ifd_offset;
+    RETURN_IF_OPT_ERROR(index_ifd(tr, ifd_offset, ifd_bits, _num_images++, &next_ifd_offset));
+    if (next_ifd_offset < tr.file_length && next_ifd_offset != 0) {
+      ifd_offset = next_ifd_offset;
+      ifd_bits = tiff::IFD1;
+    } else {
+      break;
+    }
+  }
+
+  for (int i = 0; i < tr.subifd_refs.num; ++i) {
+    auto &ref = tr.subifd_refs.values[i];
+    uint32_t next_offset = ref.offset;
+    switch (ref.type) {
+      case Reader::SubIFDRef::EXIF:
+        do {
+          if (auto error = index_ifd(tr, next_offset, tiff::IFD_EXIF, -1, &next_offset)) {
+            LOG_WARNING(tr, error->message, error->what);
+            break;
+          }
+        } while (next_offset != 0);
+        break;
+      case Reader::SubIFDRef::OTHER:
+        do {
+          if (_num_images >= _cache.images.size()) {
+            LOG_WARNING(tr, "Not reading subIFD", "There are too many SubImages");
+            break;
+          }
+          if (auto error = index_ifd(tr, next_offset, ifd_bits, _num_images, &next_offset)) {
+            LOG_WARNING(tr, error->message, error->what);
+            break;
+          }
+          _num_images++;
+        } while (next_offset != 0);
+        break;
+      case Reader::SubIFDRef::MAKERNOTE:
+        makernote_offset = ref.offset;
+        makernote_length = ref.length;
+        break;
+      case Reader::SubIFDRef::GPS:
+      case Reader::SubIFDRef::INTEROP:
+        break;
+    }
+    ref.parsed = true;
+  }
+  _cache.num_images = _num_images;
+
+  return std::nullopt;
+}
+
+bool LazyExif::find_entry(Reader &r, uint16_t tag, uint16_t ifd_mask, tiff::ifd_entry *entry)
+{
+  int found_ifd = -1;
+  int found_entry = -1;
+  for (int i = 0; i < ifds.num; ++i) {
+    const IFDLocation &loc = ifds.values[i];
+    if ((loc.ifd_bits & ifd_mask) == 0) {
+      continue;
+    }
+    const uint16_t *tags = &entry_tags[loc.first_entry];
+    for (int e = 0; e < loc.num_entries; ++e) {
+      if (tags[e] == tag) {
+        found_ifd = i;
+        found_entry = e;
+      }
+    }
+  }
+  if (found_ifd < 0) {
+    return false;
+  }
+  uint32_t entry_offset = ifds.values[found_ifd].offset + sizeof(uint16_t) + found_entry * tiff::ifd_entry::BINARY_SIZE;
+  if (r.seek(entry_offset)) {
+    return false;
+  }
+  *entry = tiff::read_ifd_entry(r);
+  return true;
+}
+
+template <typename TagInfo>
+void LazyExif::decode_tag(Reader &r, const TagRef<typename TagInfo::cpp_type> &tag, uint16_t ifd_mask)
+{
+  tiff::ifd_entry entry;
+  if (find_entry(r, TagInfo::TagId, ifd_mask, &entry)) {
+    if (auto result = tiff::parse_tag<TagInfo>(r, tag, entry); !result) {
+      LOG_WARNING(r, result.error().message, result.error().what);
+    }
+  }
+}
+
+void LazyExif::decode_subsectime(Reader &r, uint16_t tag, uint16_t *millis)
+{
+  tiff::ifd_entry entry;
+  if (find_entry(r, tag, tiff::IFD_EXIF, &entry)) {
+    if (auto error = tiff::parse_subsectime_to_millis(r, entry, millis)) {
+      LOG_WARNING(r, error->message, error->what);
+    }
+  }
+}
+
+#define NEXIF_LAZY_DEFINE_ROOT_ACCESSOR(_name)                    \
+  decltype(std::declval<const ExifData &>()._name()) LazyExif::_name() \
+  {                                                               \
+    if (!is_decoded(FIELD_##_name)) {                             \
+      Reader r{warnings};                                         \
+      init_reader(r);                                             \
+      decode_tag<tiff::tag_##_name>(r, _cache._name(), tiff::IFD_01); \
+      mark_decoded(FIELD_##_name);                                \
+    }                                                             \
+    return std::as_const(_cache)._name();                         \
+  }
+
+#define NEXIF_LAZY_DEFINE_EXIF_ACCESSOR(_name)                             \
+  decltype(std::declval<const ExifIFD &>()._name()) LazyExif::_name()      \
+  {                                                                        \
+    if (!is_decoded(FIELD_##_name)) {                                      \
+      Reader r{warnings};                                                  \
+      init_reader(r);                                                      \
+      decode_tag<tiff::tag_##_name>(r, _cache.exif._name(), tiff::IFD_EXIF); \
+      mark_decoded(FIELD_##_name);                                         \
+    }                                                                      \
+    return std::as_const(_cache.exif)._name();                             \
+  }
+
+#define NEXIF_LAZY_DEFINE_MAKERNOTE_EXIF_ACCESSOR(_name) \
+  decltype(std::declval<const ExifIFD &>()._name()) LazyExif::_name() \
+  {                                                      \
+    decode_makernote();                                  \
+    return std::as_const(_cache.exif)._name();           \
+  }
+
+NEXIF_LAZY_ROOT_TAGS(NEXIF_LAZY_DEFINE_ROOT_ACCESSOR)
+NEXIF_LAZY_EXIF_TAGS(NEXIF_LAZY_DEFINE_EXIF_ACCESSOR)
+NEXIF_LAZY_MAKERNOTE_EXIF_TAGS(NEXIF_LAZY_DEFINE_MAKERNOTE_EXIF_ACCESSOR)
+
+#undef NEXIF_LAZY_DEFINE_MAKERNOTE_EXIF_ACCESSOR
+#undef NEXIF_LAZY_DEFINE_EXIF_ACCESSOR
+#undef NEXIF_LAZY_DEFINE_ROOT_ACCESSOR
+
+TagView<DateTime> LazyExif::date_time()
+{
+  if (!is_decoded(FIELD_date_time)) {
+    Reader r{warnings};
+    init_reader(r);
+    decode_tag<tiff::tag_date_time>(r, _cache.date_time(), tiff::IFD_01);
+    decode_subsectime(r, tiff::tag_subsectime::TagId, &_cache.date_time().value.millis);
+    mark_decoded(FIELD_date_time);
+  }
+  return std::as_const(_cache).date_time();
+}
+
+TagView<DateTime> LazyExif::date_time_original()
+{
+  if (!is_decoded(FIELD_date_time_original)) {
+    Reader r{warnings};
+    init_reader(r);
+    auto dt = _cache.exif.date_time_original();
+    decode_tag<tiff::tag_date_time_original>(r, dt, tiff::IFD_EXIF);
+    decode_subsectime(r, tiff::tag_subsectime_original::TagId, &dt.value.millis);
+    tiff::ifd_entry entry;
+    if (find_entry(r, tiff::tag_timezone_offset::TagId, tiff::IFD_EXIF, &entry)) {
+      if (auto tz = tiff::fetch_entry_value<int16_t>(entry, 0, r)) {
+        dt.value.timezone_offset = tz.value();
+      }
+    }
+    mark_decoded(FIELD_date_time_original);
+  }
+  return std::as_const(_cache.exif).date_time_original();
+}
+
+TagView<DateTime> LazyExif::date_time_digitized()
+{
+  if (!is_decoded(FIELD_date_time_digitized)) {
+    Reader r{warnings};
+    init_reader(r);
+    auto dt = _cache.exif.date_time_digitized();
+    decode_tag<tiff::tag_date_time_digitized>(r, dt, tiff::IFD_EXIF);
+    decode_subsectime(r, tiff::tag_subsectime_digitized::TagId, &dt.value.millis);
+    mark_decoded(FIELD_date_time_digitized);
+  }
+  return std::as_const(_cache.exif).date_time_digitized();
+}
+
+TagView<rational64u> LazyExif::focal_length()
+{
+  if (!is_decoded(FIELD_focal_length)) {
+    Reader r{warnings};
+    init_reader(r);
+    decode_tag<tiff::tag_focal_length>(r, _cache.exif.focal_length(), tiff::IFD_ALL);
+    mark_decoded(FIELD_focal_length);
+  }
+  return std::as_const(_cache.exif).focal_length();
+}
+
+TagView<vla<std::string_view, 8>> LazyExif::possible_lenses()
+{
+  decode_makernote();
+  return std::as_const(_cache.exif).possible_lenses();
+}
+
+const decltype(ExifData::makernote) &LazyExif::makernote()
+{
+  decode_makernote();
+  return _cache.makernote;
+}
+
+void LazyExif::decode_makernote()
+{
+  if (is_decoded(FIELD_makernote)) {
+    return;
+  }
+  // The MakerNote parsers dispatch on, and read from, these tags.
+  make();
+  model();
+
+  Reader r{warnings};
+  init_reader(r);
+  // Decode the Exif tags first, as the MakerNote might override them.
+#define DECODE_EXIF_TAG(_name)                                                \
+  if (!is_decoded(FIELD_##_name)) {                                           \
+    decode_tag<tiff::tag_##_name>(r, _cache.exif._name(), tiff::IFD_EXIF);    \
+    mark_decoded(FIELD_##_name);                                              \
+  }
+  NEXIF_LAZY_MAKERNOTE_EXIF_TAGS(DECODE_EXIF_TAG)
+#undef DECODE_EXIF_TAG
+
+  if (makernote_length > 0) {
+    if (auto error = tiff::parse_makernote(r, _cache, makernote_offset, makernote_length)) {
+      LOG_WARNING(r, error->message, error->what);
+    } else if (auto error = tiff::resolve_makernote_lens(r, _cache)) {
+      LOG_WARNING(r, error->message, error->what);
+    }
+  }
+  mark_decoded(FIELD_makernote);
+}
+
+const ImageData &LazyExif::image(int idx)
+{
+  assert(idx >= 0 && idx < _num_images);
+  if ((_images_decoded & (1u << idx)) == 0) {
+    for (int i = 0; i < ifds.num; ++i) {
+      const IFDLocation &loc = ifds.values[i];
+      if (loc.image_idx != idx) {
+        continue;
+      }
+      Reader r{warnings};
+      init_reader(r);
+      uint32_t next_offset;
+      // Without IFD0/IFD1 bits, only the image tags are parsed.
+      if (auto error = tiff::parse_tiff_ifd(r, _cache, loc.offset, &_cache.images[idx], 0, &next_offset)) {
+        LOG_WARNING(r, error->message, error->what);
+      }
+    }
+    _images_decoded |= (1u << idx);
+  }
+  return _cache.images[idx];
+}
+
+ParseResult<LazyExif> read_exif_lazy(ExifFile &&file)
+{
+  ASSERT_OR_PARSE_ERROR(file.data() != nullptr, CANNOT_OPEN_FILE, "No buffer provided.", nullptr);
+  ASSERT_OR_PARSE_ERROR(file.length() > 100, CORRUPT_DATA, "Buffer too small.", nullptr);
+
+  LazyExif lazy;
+  lazy.file = std::move(file);
+  if (auto error = lazy.discover()) {
+    return error.value();
+  }
+  return lazy;
+}
+
+ParseResult<LazyExif> read_exif_lazy(const std::filesystem::path &path)
+{
+  auto file = ExifFile::open(path);
+  if (!file) {
+    return file.error();
+  }
+  return read_exif_lazy(std::move(file.value()));
+}
+
+}  // namespace nexif
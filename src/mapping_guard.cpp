@@ -0,0 +1,133 @@
+#include "neonexif/mapping_guard.hpp"
+#include "neonexif/reader.hpp"
+
+#include <atomic>
+#include <cerrno>
+#include <mutex>
+
+#ifndef _WIN32
+#include <csignal>
+#include <fcntl.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#endif
+
+namespace nexif {
+
+namespace {
+std::atomic<MappingFaultPolicy> fault_policy{MappingFaultPolicy::RETRY_WITH_PREAD};
+const char *const fault_message = "File was truncated while reading.";
+
+#ifndef _WIN32
+thread_local MappingFaultGuard *innermost_guard = nullptr;
+struct sigaction previous_action;
+std::once_flag install_once;
+
+void on_sigbus(int sig, siginfo_t *info, void *context)
+{
+  const char *addr = (const char *)info->si_addr;
+  for (MappingFaultGuard *g = innermost_guard; g != nullptr; g = g->outer) {
+    if (addr >= g->begin && addr < g->end) {
+      siglongjmp(g->env, 1);
+    }
+  }
+  // Not ours.
+  if (previous_action.sa_flags & SA_SIGINFO) {
+    previous_action.sa_sigaction(sig, info, context);
+  } else if (previous_action.sa_handler != SIG_DFL && previous_action.sa_handler != SIG_IGN) {
+    previous_action.sa_handler(sig);
+  } else {
+    // Returning retries the faulting access, which then gets the default action.
+    sigaction(sig, &previous_action, nullptr);
+  }
+}
+
+void install_handler()
+{
+  struct sigaction action{};
+  action.sa_sigaction = on_sigbus;
+  action.sa_flags = SA_SIGINFO | SA_NODEFER | SA_ONSTACK;
+  sigemptyset(&action.sa_mask);
+  sigaction(SIGBUS, &action, &previous_action);
+}
+#endif
+}  // namespace
+
+void set_mapping_fault_policy(MappingFaultPolicy policy)
+{
+  fault_policy.store(policy, std::memory_order_relaxed);
+}
+
+MappingFaultPolicy mapping_fault_policy()
+{
+  return fault_policy.load(std::memory_order_relaxed);
+}
+
+ParseError mapping_fault_error()
+{
+  return PARSE_ERROR(CORRUPT_DATA, fault_message, nullptr);
+}
+
+bool is_mapping_fault(const ParseError &error)
+{
+  return error.code == ParseError::CORRUPT_DATA && error.message == fault_message;
+}
+
+#ifndef _WIN32
+MappingFaultGuard::MappingFaultGuard(const char *buffer, size_t length) :
+  begin(buffer), end(buffer + length), outer(innermost_guard)
+{
+  std::call_once(install_once, install_handler);
+  innermost_guard = this;
+}
+
+MappingFaultGuard::~MappingFaultGuard()
+{
+  innermost_guard = outer;
+}
+
+bool read_file_contents(int fd, std::vector<char> &out)
+{
+  struct stat st;
+  if (fstat(fd, &st) != 0) {
+    return false;
+  }
+  out.resize(st.st_size);
+  size_t done = 0;
+  while (done < out.size()) {
+    ssize_t n = pread(fd, out.data() + done, out.size() - done, done);
+    if (n < 0 && errno == EINTR) {
+      continue;
+    }
+    if (n <= 0) {
+      break;  // Shrunk since the fstat().
+    }
+    done += n;
+  }
+  out.resize(done);
+  return true;
+}
+
+bool read_file_contents(const std::filesystem::path &path, std::vector<char> &out)
+{
+  int fd = open(path.c_str(), O_RDONLY | O_CLOEXEC);
+  if (fd < 0) {
+    return false;
+  }
+  bool ok = read_file_contents(fd, out);
+  close(fd);
+  return ok;
+}
+#else
+bool read_file_contents(int fd, std::vector<char> &out)
+{
+  return false;
+}
+
+bool read_file_contents(const std::filesystem::path &path, std::vector<char> &out)
+{
+  return false;
+}
+#endif
+
+}  // namespace nexif
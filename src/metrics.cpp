@@ -0,0 +1,327 @@
+#include "neonexif/metrics.hpp"
+#include "atomic_file.hpp"
+
+#include <algorithm>
+#include <atomic>
+#include <bit>
+#include <cmath>
+#include <cstdio>
+#include <cstring>
+#include <memory>
+#include <mutex>
+
+namespace nexif {
+
+int LatencyHistogram::bucket_of(uint64_t ns)
+{
+  if (ns < SUB_BUCKETS) {
+    return int(ns);
+  }
+  int exponent = std::min<int>(std::bit_width(ns) - 1, MAX_BITS - 1);
+  if (exponent == MAX_BITS - 1 && ns >= (uint64_t(1) << MAX_BITS)) {
+    return NUM_BUCKETS - 1;
+  }
+  int shift = exponent - SUB_BUCKET_BITS;
+  int sub = int(ns >> shift) & (SUB_BUCKETS - 1);
+  return (shift + 1) * SUB_BUCKETS + sub;
+}
+
+uint64_t LatencyHistogram::bucket_upper_bound(int bucket)
+{
+  if (bucket < SUB_BUCKETS) {
+    return bucket;
+  }
+  int shift = bucket / SUB_BUCKETS - 1;
+  uint64_t lower = uint64_t(SUB_BUCKETS + bucket % SUB_BUCKETS) << shift;
+  return lower + (uint64_t(1) << shift) - 1;
+}
+
+void LatencyHistogram::record(uint64_t ns)
+{
+  buckets[bucket_of(ns)]++;
+  count++;
+  sum_ns += ns;
+}
+
+void LatencyHistogram::merge(const LatencyHistogram &o)
+{
+  for (int i = 0; i < NUM_BUCKETS; ++i) {
+    buckets[i] += o.buckets[i];
+  }
+  count += o.count;
+  sum_ns += o.sum_ns;
+}
+
+uint64_t LatencyHistogram::quantile(double q) const
+{
+  if (count == 0) {
+    return 0;
+  }
+  // The rank of the value, counting from 1.
+  uint64_t rank = std::max<uint64_t>(1, uint64_t(std::ceil(std::clamp(q, 0.0, 1.0) * count)));
+  uint64_t seen = 0;
+  for (int i = 0; i < NUM_BUCKETS; ++i) {
+    seen += buckets[i];
+    if (seen >= rank) {
+      return bucket_upper_bound(i);
+    }
+  }
+  return bucket_upper_bound(NUM_BUCKETS - 1);
+}
+
+const MetricsSnapshot::Series *MetricsSnapshot::find(FileType ft, FileTypeVariant ftv, const char *vendor) const
+{
+  for (const Series &s : series) {
+    if (s.file_type == ft && s.file_type_variant == ftv && std::strcmp(s.vendor, vendor) == 0) {
+      return &s;
+    }
+  }
+  return nullptr;
+}
+
+namespace {
+
+constexpr int NUM_FILE_TYPES = SIGMA_FOVB + 1;
+constexpr int NUM_FILE_TYPE_VARIANTS = TIFF_RW2 + 1;
+// In the order of the alternatives of `ExifData::makernote`.
+constexpr const char *VENDORS[] = {"none", "Nikon", "Canon"};
+constexpr int NUM_VENDORS = std::size(VENDORS);
+constexpr int NUM_SERIES = NUM_FILE_TYPES * NUM_FILE_TYPE_VARIANTS * NUM_VENDORS;
+static_assert(std::variant_size_v<decltype(ExifData::makernote)> == NUM_VENDORS);
+
+/**
+ * Counts that only one thread adds to, and a scrape reads concurrently. A
+ * relaxed load and store is enough to add, as there is no other writer.
+ */
+struct Counter {
+  std::atomic<uint64_t> value{0};
+
+  void add(uint64_t n) { value.store(value.load(std::memory_order_relaxed) + n, std::memory_order_relaxed); }
+  uint64_t load() const { return value.load(std::memory_order_relaxed); }
+};
+
+struct ShardHistogram {
+  std::array<Counter, LatencyHistogram::NUM_BUCKETS> buckets;
+  Counter count;
+  Counter sum_ns;
+
+  void merge_into(LatencyHistogram &h) const
+  {
+    for (int i = 0; i < LatencyHistogram::NUM_BUCKETS; ++i) {
+      h.buckets[i] += buckets[i].load();
+    }
+    h.count += count.load();
+    h.sum_ns += sum_ns.load();
+  }
+};
+
+/**
+ * What one thread recorded. The histogram of a series is allocated by the
+ * thread on its first parse of that kind of file, and published with a
+ * release store for the scrapes.
+ */
+class MetricsShard {
+ public:
+  ~MetricsShard()
+  {
+    for (std::atomic<ShardHistogram *> &s : _series) {
+      delete s.load(std::memory_order_relaxed);
+    }
+  }
+
+  void record_error(ParseError::Code code) { _errors[code].add(1); }
+
+  void record(int series, const std::optional<ParseError> &error, size_t num_warnings, uint64_t ns)
+  {
+    _warnings.add(num_warnings);
+    if (error) {
+      record_error(error->code);
+      return;
+    }
+    ShardHistogram *h = _series[series].load(std::memory_order_relaxed);
+    if (h == nullptr) {
+      h = new ShardHistogram;
+      _series[series].store(h, std::memory_order_release);
+    }
+    h->buckets[LatencyHistogram::bucket_of(ns)].add(1);
+    h->count.add(1);
+    h->sum_ns.add(ns);
+  }
+
+  /** Adds the counts of the shard to `histograms`, one per series, and the snapshot. */
+  void merge_into(std::vector<std::unique_ptr<LatencyHistogram>> &histograms, MetricsSnapshot &snapshot) const
+  {
+    for (int i = 0; i < NUM_SERIES; ++i) {
+      if (const ShardHistogram *h = _series[i].load(std::memory_order_acquire)) {
+        if (!histograms[i]) {
+          histograms[i] = std::make_unique<LatencyHistogram>();
+        }
+        h->merge_into(*histograms[i]);
+      }
+    }
+    for (int c = 0; c < NUM_PARSE_ERROR_CODES; ++c) {
+      snapshot.errors[c] += _errors[c].load();
+    }
+    snapshot.warnings += _warnings.load();
+  }
+
+ private:
+  std::array<std::atomic<ShardHistogram *>, NUM_SERIES> _series{};
+  std::array<Counter, NUM_PARSE_ERROR_CODES> _errors;
+  Counter _warnings;
+};
+
+struct Registry {
+  std::atomic<bool> enabled{false};
+  std::mutex mutex;
+  std::vector<std::shared_ptr<MetricsShard>> shards;
+  /** The counts of the shards of threads that have exited. */
+  std::vector<std::unique_ptr<LatencyHistogram>> retired_histograms = std::vector<std::unique_ptr<LatencyHistogram>>(NUM_SERIES);
+  MetricsSnapshot retired;
+};
+
+Registry &registry()
+{
+  static Registry r;
+  return r;
+}
+
+/** Created on the first parse of a thread, and kept until a scrape after the thread exits. */
+MetricsShard &thread_shard()
+{
+  thread_local std::shared_ptr<MetricsShard> shard = [] {
+    auto shard = std::make_shared<MetricsShard>();
+    Registry &reg = registry();
+    std::lock_guard lock(reg.mutex);
+    reg.shards.push_back(shard);
+    return shard;
+  }();
+  return *shard;
+}
+
+const char *to_label(FileTypeVariant v)
+{
+  switch (v) {
+    case STANDARD: return "standard";
+    case TIFF_ORF: return "ORF";
+    case TIFF_RW2: return "RW2";
+  }
+  return "?";
+}
+
+const char *to_label(ParseError::Code c)
+{
+  switch (c) {
+    case ParseError::CANNOT_OPEN_FILE: return "cannot_open_file";
+    case ParseError::UNKNOWN_FILE_TYPE: return "unknown_file_type";
+    case ParseError::CORRUPT_DATA: return "corrupt_data";
+    case ParseError::TAG_NOT_FOUND: return "tag_not_found";
+    case ParseError::INTERNAL_ERROR: return "internal_error";
+    case ParseError::CANCELLED: return "cancelled";
+  }
+  return "?";
+}
+
+}  // namespace
+
+const char *makernote_vendor(const ExifData &data)
+{
+  return VENDORS[data.makernote.index()];
+}
+
+void enable_metrics(bool enabled)
+{
+  registry().enabled.store(enabled, std::memory_order_relaxed);
+}
+
+bool metrics_enabled()
+{
+  return registry().enabled.load(std::memory_order_relaxed);
+}
+
+void record_parse_metrics(const ExifData &data, const std::optional<ParseError> &error, size_t num_warnings, uint64_t ns)
+{
+  int vendor = int(data.makernote.index());
+  int series = (int(data.file_type) * NUM_FILE_TYPE_VARIANTS + int(data.file_type_variant)) * NUM_VENDORS + vendor;
+  thread_shard().record(series, error, num_warnings, ns);
+}
+
+void record_parse_error(ParseError::Code code)
+{
+  thread_shard().record_error(code);
+}
+
+MetricsSnapshot scrape_metrics()
+{
+  Registry &reg = registry();
+  std::lock_guard lock(reg.mutex);
+  // Threads that have exited no longer write; their counts are moved out.
+  std::erase_if(reg.shards, [&](const std::shared_ptr<MetricsShard> &shard) {
+    if (shard.use_count() > 1) {
+      return false;
+    }
+    shard->merge_into(reg.retired_histograms, reg.retired);
+    return true;
+  });
+
+  MetricsSnapshot snapshot = reg.retired;
+  std::vector<std::unique_ptr<LatencyHistogram>> histograms(NUM_SERIES);
+  for (int i = 0; i < NUM_SERIES; ++i) {
+    if (reg.retired_histograms[i]) {
+      histograms[i] = std::make_unique<LatencyHistogram>(*reg.retired_histograms[i]);
+    }
+  }
+  for (const std::shared_ptr<MetricsShard> &shard : reg.shards) {
+    shard->merge_into(histograms, snapshot);
+  }
+
+  for (int i = 0; i < NUM_SERIES; ++i) {
+    if (histograms[i]) {
+      int vendor = i % NUM_VENDORS;
+      int variant = i / NUM_VENDORS % NUM_FILE_TYPE_VARIANTS;
+      int file_type = i / NUM_VENDORS / NUM_FILE_TYPE_VARIANTS;
+      snapshot.series.push_back({FileType(file_type), FileTypeVariant(variant), VENDORS[vendor], *histograms[i]});
+    }
+  }
+  return snapshot;
+}
+
+std::string format_prometheus(const MetricsSnapshot &snapshot)
+{
+  std::string out;
+  char line[256];
+  auto append = [&](const char *fmt, auto... args) {
+    int len = std::snprintf(line, sizeof(line), fmt, args...);
+    out.append(line, std::clamp(len, 0, int(sizeof(line)) - 1));
+  };
+
+  append("# HELP nexif_parse_duration_seconds Time to parse the Exif data of a file, of the successful parses.\n");
+  append("# TYPE nexif_parse_duration_seconds summary\n");
+  for (const MetricsSnapshot::Series &s : snapshot.series) {
+    char labels[128];
+    std::snprintf(labels, sizeof(labels), "file_type=\"%s\",variant=\"%s\",vendor=\"%s\"", to_str(s.file_type), to_label(s.file_type_variant), s.vendor);
+    for (double q : {0.5, 0.9, 0.99, 0.999}) {
+      append("nexif_parse_duration_seconds{%s,quantile=\"%g\"} %.9f\n", labels, q, s.latency.quantile(q) * 1e-9);
+    }
+    append("nexif_parse_duration_seconds_sum{%s} %.9f\n", labels, s.latency.sum_ns * 1e-9);
+    append("nexif_parse_duration_seconds_count{%s} %lu\n", labels, s.latency.count);
+  }
+
+  append("# HELP nexif_parse_errors_total Parses that failed, by error code.\n");
+  append("# TYPE nexif_parse_errors_total counter\n");
+  for (int c = 0; c < NUM_PARSE_ERROR_CODES; ++c) {
+    append("nexif_parse_errors_total{code=\"%s\"} %lu\n", to_label(ParseError::Code(c)), snapshot.errors[c]);
+  }
+
+  append("# HELP nexif_parse_warnings_total Warnings of all parses.\n");
+  append("# TYPE nexif_parse_warnings_total counter\n");
+  append("nexif_parse_warnings_total %lu\n", snapshot.warnings);
+  return out;
+}
+
+bool write_prometheus_file(const std::filesystem::path &path)
+{
+  return write_file_atomically(path, format_prometheus(scrape_metrics()));
+}
+
+}  // namespace nexif
@@ -1,4 +1,7 @@
 #include "neonexif/neonexif.hpp"
+#include "neonexif/layout_cache.hpp"
+#include "neonexif/mapping_guard.hpp"
+#include "neonexif/metrics.hpp"
 #include "neonexif/reader.hpp"
 #include "neonexif/tiff.hpp"
 #include "neonexif/levenshtein.hpp"
@@ -11,8 +14,6 @@
 
 namespace nexif {
 
-bool debug_print_enabled = false;
-
 /**
  * Taken from https://stackoverflow.com/a/42197629/155137
  * Translated by ChatGPT here:
@@ -57,12 +58,11 @@ rational64u double_to_rational64u(double value, double accuracy)
   return {uint32_t(r.num), uint32_t(r.denom)};
 }
 
-namespace {
-
 bool guess_file_type(Reader &reader)
 {
   using namespace std::string_view_literals;
   const char *data = reader.data;
+  reader.count_read(0, std::min<size_t>(16, reader.file_length));  // The magic bytes below.
 
   const std::string_view fujifilm_magic = "FUJIFILMCCD-RAW"sv;
   if (std::memcmp(data, fujifilm_magic.data(), fujifilm_magic.length()) == 0) {
@@ -90,7 +90,7 @@ bool guess_file_type(Reader &reader)
   if (std::memcmp(data + ciff_magic_offset, ciff_magic.data(), ciff_magic.length()) == 0) {
     reader.file_type = CIFF;
     reader.file_type_variant = STANDARD;
-    DEBUG_PRINT("Detected CIFF (CRW)");
+    NEXIF_TRACE_MESSAGE("Detected CIFF (CRW)");
     return true;
   }
 
@@ -103,10 +103,10 @@ bool guess_file_type(Reader &reader)
   } else if ((data[0] == 'I' && data[1] == 'I') || (data[0] == 'M' && data[1] == 'M')) {
     if (data[0] == 'I') {
       reader.byte_order = std::endian::little;
-      DEBUG_PRINT("Byte order Intel");
+      NEXIF_TRACE_MESSAGE("Byte order Intel");
     } else {
       reader.byte_order = std::endian::big;
-      DEBUG_PRINT("Byte order Minolta");
+      NEXIF_TRACE_MESSAGE("Byte order Minolta");
     }
     if (reader.skip(2)) {
       return false;
@@ -116,17 +116,17 @@ bool guess_file_type(Reader &reader)
     if (magic == 42) {
       reader.file_type = TIFF;
       reader.file_type_variant = STANDARD;
-      DEBUG_PRINT("Detected TIFF");
+      NEXIF_TRACE_MESSAGE("Detected TIFF");
       return true;
     } else if (magic == 0x4f52 || magic == 0x5352) {
       reader.file_type = TIFF;
       reader.file_type_variant = TIFF_ORF;
-      DEBUG_PRINT("Detected TIFF/ORF");
+      NEXIF_TRACE_MESSAGE("Detected TIFF/ORF");
       return true;
     } else if (magic == 0x55) {
       reader.file_type = TIFF;
       reader.file_type_variant = TIFF_RW2;
-      DEBUG_PRINT("Detected TIFF/RW2");
+      NEXIF_TRACE_MESSAGE("Detected TIFF/RW2");
       return true;
     }
   }
@@ -134,18 +134,26 @@ bool guess_file_type(Reader &reader)
   return false;
 }
 
-}  // namespace
+namespace {
 
-std::optional<ParseError> read_exif(
-  Reader &r,
-  ExifData &data,
-  FileType *ft,
-  FileTypeVariant *ftv
-);
+/** Fires the parse__done probe; the error code is -1 on success. */
+inline void probe_parse_done(const ExifData &data, const std::optional<ParseError> &error, size_t length, size_t num_warnings)
+{
+  STAP_PROBE5(neonexif, parse__done, data.file_type, data.file_type_variant, error ? int(error->code) : -1, length, num_warnings);
+}
+
+/** Counts the errors of the path overloads, that occur before there is anything to parse. */
+ParseError count_error(ParseError error)
+{
+  if (metrics_enabled()) {
+    record_parse_error(error.code);
+  }
+  return error;
+}
 
-std::optional<ParseError> find_and_parse_tiff_style_exif_segment(Reader &r, ExifData &data)
+std::optional<ParseError> find_tiff_style_exif_segment(Reader &r, uint32_t *segment_offset)
 {
-  DEBUG_PRINT("Searching for Exif00 marker");
+  NEXIF_TRACE_MESSAGE("Searching for Exif00 marker");
   // Hard to parse for now.
   using namespace std::string_view_literals;
   std::string_view file_view{r.data, r.file_length};
@@ -163,45 +171,55 @@ std::optional<ParseError> find_and_parse_tiff_style_exif_segment(Reader &r, Exif
     } else if (file_view.substr(offset, 8) == exif_header_mm) {
       break;
     }
+    offset++;
   }
+  r.count_read(0, std::min<size_t>(offset, r.file_length - 8) + 8);
   if (offset == std::string_view::npos) {
     return ParseError{ParseError::UNKNOWN_FILE_TYPE, "Cannot find Exif marker.", nullptr};
   }
 
-  DEBUG_PRINT("Found Exif00 marker at offset %zu", offset);
-  Reader tiff_reader{r.warnings};
-  tiff_reader.data = r.data + offset + 6;
-  tiff_reader.file_length = r.file_length - offset - 6;
-  if (auto error = read_exif(tiff_reader, data, nullptr, nullptr)) {
-    return error.value();
-  } else {
-    return std::nullopt;
-  }
+  NEXIF_TRACE_MESSAGE("Found Exif00 marker at offset %zu", offset);
+  *segment_offset = offset + exif_header.length();
+  return std::nullopt;
 }
 
-std::optional<ParseError> read_exif(
+/**
+ * The container formats wrap a (possibly again wrapped) TIFF structure.
+ * Recurse into the segment we found and translate the offsets back.
+ */
+std::optional<ParseError> locate_tiff_in_segment(
   Reader &r,
-  ExifData &data,
-  FileType *ft,
-  FileTypeVariant *ftv
+  uint32_t segment_offset,
+  size_t segment_length,
+  uint32_t *tiff_offset,
+  uint32_t *tiff_length,
+  int depth
 )
 {
-  DEBUG_PRINT("Input size: %zu\n", r.file_length);
-  r.exif_data = &data;
-  if (!guess_file_type(r)) {
-    return PARSE_ERROR(UNKNOWN_FILE_TYPE, "Cannot determine file type.", nullptr);
+  ASSERT_OR_PARSE_ERROR(depth < 4, CORRUPT_DATA, "Too deeply nested container", nullptr);
+  ASSERT_OR_PARSE_ERROR(segment_offset < r.file_length, CORRUPT_DATA, "Segment out of bounds", nullptr);
+  segment_length = std::min<size_t>({segment_length, r.file_length - segment_offset, UINT32_MAX});
+  ASSERT_OR_PARSE_ERROR(segment_length >= 16, CORRUPT_DATA, "Segment too small", nullptr);
+
+  Reader sub{r.warnings};
+  r.nest_into(sub, segment_offset, segment_length);
+  if (!guess_file_type(sub)) {
+    return PARSE_ERROR(UNKNOWN_FILE_TYPE, "Cannot determine file type of embedded segment.", nullptr);
   }
-  if (ft)
-    *ft = r.file_type;
-  if (ftv)
-    *ftv = r.file_type_variant;
-  data.file_type = r.file_type;
-  data.file_type_variant = r.file_type_variant;
-  switch (data.file_type) {
+  RETURN_IF_OPT_ERROR(locate_tiff(sub, tiff_offset, tiff_length, depth + 1));
+  *tiff_offset += segment_offset;
+  return std::nullopt;
+}
+
+}  // namespace
+
+std::optional<ParseError> locate_tiff(Reader &r, uint32_t *tiff_offset, uint32_t *tiff_length, int depth)
+{
+  switch (r.file_type) {
     case TIFF: {
-      if (auto error = tiff::read_tiff(r, data)) {
-        return error.value();
-      }
+      // TIFF offsets are 32 bits: nothing past 4 GB can be referenced.
+      *tiff_offset = 0;
+      *tiff_length = std::min<size_t>(r.file_length, UINT32_MAX);
       return std::nullopt;
     }
     case JPEG: {
@@ -209,7 +227,7 @@ std::optional<ParseError> read_exif(
       while (segment_offset < r.file_length) {
         RETURN_IF_OPT_ERROR(r.seek(segment_offset));
         int marker = r.read_u16();
-        DEBUG_PRINT("JPEG marker: %x", marker);
+        NEXIF_TRACE_MESSAGE("JPEG marker: %x", marker);
         if (marker == 0xFFD9 /* EOF */) {
           break;
         } else if (marker == 0xFFD8 /* SOI */) {
@@ -223,14 +241,12 @@ std::optional<ParseError> read_exif(
         } else {
           uint16_t length = r.read_u16();
           if (marker == 0xFFE1 /* APP1 */) {
-            Reader tiff_reader{r.warnings};
-            tiff_reader.data = r.data + 12;
-            tiff_reader.file_length = length - sizeof(uint16_t);
-            if (auto error = read_exif(tiff_reader, data, nullptr, nullptr)) {
-              return error.value();
-            } else {
-              return std::nullopt;
-            }
+            // Skip the marker, the length field and the "Exif\0\0" header.
+            constexpr uint32_t app1_header = 2 * sizeof(uint16_t) + 6;
+            return locate_tiff_in_segment(
+              r, segment_offset + app1_header, length - sizeof(uint16_t) - 6,
+              tiff_offset, tiff_length, depth
+            );
           }
           segment_offset += length + sizeof(uint16_t);  // Length includes the length field.
         }
@@ -240,101 +256,647 @@ std::optional<ParseError> read_exif(
     case FUJIFILM_RAF: {
       r.byte_order = std::endian::big;
       RETURN_IF_OPT_ERROR(r.seek(0x54));
-      int offset = r.read_u32() + 12;
-      int length = r.read_u32();
-      DEBUG_PRINT("Fujifilm IFD0 offset: %x len=%x\n", offset, length);
-
-      Reader tiff_reader{r.warnings};
-      tiff_reader.data = r.data + offset;
-      tiff_reader.file_length = r.file_length - offset;
-      if (auto error = read_exif(tiff_reader, data, nullptr, nullptr)) {
-        return error.value();
-      } else {
-        return std::nullopt;
-      }
+      uint32_t offset = r.read_u32() + 12;
+      uint32_t length = r.read_u32();
+      NEXIF_TRACE_MESSAGE("Fujifilm IFD0 offset: %x len=%x\n", offset, length);
+      return locate_tiff_in_segment(r, offset, r.file_length - std::min<size_t>(offset, r.file_length), tiff_offset, tiff_length, depth);
     }
     case MRW: {
       r.byte_order = std::endian::big;
       RETURN_IF_OPT_ERROR(r.seek(4));
       int header_len = r.read_u32();
-      bool tiff_found = false;
       while (header_len > 0) {
         uint32_t pos = r.ptr;
         uint32_t tag = r.read_u32();
         uint32_t len = r.read_u32();
-        DEBUG_PRINT("MRW tag=%x len=%x", tag, len);
+        NEXIF_TRACE_MESSAGE("MRW tag=%x len=%x", tag, len);
         switch (tag) {
           case 0x505244:
-            DEBUG_PRINT("MRW::PRD");
+            NEXIF_TRACE_MESSAGE("MRW::PRD");
             break;
           case 0x545457:
-            DEBUG_PRINT("MRW::TTW");
-
-            Reader tiff_reader{r.warnings};
-            tiff_reader.data = r.data + r.ptr;
-            tiff_reader.file_length = len;
-            if (auto error = read_exif(tiff_reader, data, nullptr, nullptr)) {
-              return error.value();
-            } else {
-              tiff_found = true;
-            }
+            NEXIF_TRACE_MESSAGE("MRW::TTW");
+            return locate_tiff_in_segment(r, r.ptr, len, tiff_offset, tiff_length, depth);
         }
         header_len -= 8 + len;
         RETURN_IF_OPT_ERROR(r.seek(pos + len + 2 * sizeof(uint32_t)));
       }
-      if (tiff_found) {
-        return std::nullopt;
-      }
     }
+      [[fallthrough]];
     case SIGMA_FOVB: {
-      return find_and_parse_tiff_style_exif_segment(r, data);
+      uint32_t segment_offset;
+      RETURN_IF_OPT_ERROR(find_tiff_style_exif_segment(r, &segment_offset));
+      return locate_tiff_in_segment(r, segment_offset, r.file_length - segment_offset, tiff_offset, tiff_length, depth);
     }
     default: {
       // We don't know, let's just try to find it.
-      auto err = find_and_parse_tiff_style_exif_segment(r, data);
-      if (!err) {
+      uint32_t segment_offset;
+      if (!find_tiff_style_exif_segment(r, &segment_offset)) {
         // It worked!
-        return std::nullopt;
+        return locate_tiff_in_segment(r, segment_offset, r.file_length - segment_offset, tiff_offset, tiff_length, depth);
       }
     }
   }
 
-  return PARSE_ERROR(UNKNOWN_FILE_TYPE, "Parser not implemented", to_str(data.file_type, data.file_type_variant));
+  return PARSE_ERROR(UNKNOWN_FILE_TYPE, "Parser not implemented", to_str(r.file_type, r.file_type_variant));
+}
+
+std::optional<ParseError> read_exif(
+  Reader &r,
+  ExifData &data,
+  ParseLevel level,
+  FileType *ft,
+  FileTypeVariant *ftv
+)
+{
+  NEXIF_TRACE_MESSAGE("Input size: %zu\n", r.file_length);
+  r.exif_data = &data;
+  PhaseTimer guess_timer(r.stats, &ParseStats::detect_ns, "guess_file_type");
+  if (!guess_file_type(r)) {
+    return PARSE_ERROR(UNKNOWN_FILE_TYPE, "Cannot determine file type.", nullptr);
+  }
+  guess_timer.stop();
+  if (ft)
+    *ft = r.file_type;
+  if (ftv)
+    *ftv = r.file_type_variant;
+  data.file_type = r.file_type;
+  data.file_type_variant = r.file_type_variant;
+
+  uint32_t tiff_offset;
+  uint32_t tiff_length;
+  PhaseTimer locate_timer(r.stats, &ParseStats::detect_ns, "locate_tiff");
+  RETURN_IF_OPT_ERROR(locate_tiff(r, &tiff_offset, &tiff_length));
+  locate_timer.stop();
+  NEXIF_TRACE_MESSAGE("TIFF structure at offset %u (length %u)", tiff_offset, tiff_length);
+  data.parse_state.tiff_offset = tiff_offset;
+  data.parse_state.tiff_length = tiff_length;
+
+  Reader tiff_reader{r.warnings};
+  r.nest_into(tiff_reader, tiff_offset, tiff_length);
+  tiff_reader.exif_data = &data;
+  tiff_reader.layout_session = r.layout_session;
+  return tiff::read_tiff(tiff_reader, data, level);
+}
+
+namespace {
+
+/**
+ * Parses a buffer into the fresh `result`, but leaves recording the metrics and firing
+ * the parse__done probe to the caller: a path overload that retries after a
+ * mapping fault records the file once, not once per attempt.
+ */
+std::optional<ParseError> parse_buffer(
+  ParseResult<ExifData> &result,
+  const char *buffer,
+  size_t length,
+  ParseLevel level,
+  FileType *ft,
+  FileTypeVariant *ftv,
+  ParseStats *stats
+)
+{
+  ExifData &data = std::get<0>(result._v);
+  data.dirty = 0;
+  if (stats) {
+    *stats = {};
+  }
+  std::optional<ParseError> error;
+  if (buffer == nullptr) {
+    error = PARSE_ERROR(CANNOT_OPEN_FILE, "No buffer provided.", nullptr);
+  } else if (length <= 100) {
+    error = PARSE_ERROR(CORRUPT_DATA, "Buffer too small.", nullptr);
+  } else {
+    Reader r{result.warnings};
+    r.data = buffer;
+    r.file_length = length;
+    r.stats = stats;
+    r.file_begin = buffer;
+    if (!run_with_mapping_fault_guard(buffer, length, [&] { error = read_exif(r, data, level, ft, ftv); })) {
+      error = mapping_fault_error();
+    }
+  }
+  if (stats) {
+    stats->string_bytes = data.string_data_used();
+    stats->num_warnings = result.warnings.size();
+  }
+  return error;
+}
+
+/** Records the parse, and turns `result` into its error, if any. */
+void finish_parse(ParseResult<ExifData> &result, const std::optional<ParseError> &error, size_t length, const ParseMetricsTimer &metrics)
+{
+  const ExifData &data = std::get<0>(result._v);
+  metrics.record(data, error, result.warnings.size());
+  probe_parse_done(data, error, length, result.warnings.size());
+  if (error) {
+    result._v = error.value();
+  }
 }
 
+/** `read_exif_into()` of a buffer, without recording it; see `parse_buffer()`. */
+ParseStatus parse_buffer_into(
+  ExifData &data,
+  const char *buffer,
+  size_t length,
+  ParseLevel level,
+  LayoutCache *layout_cache
+)
+{
+  // Allocates nothing when there are no warnings. Otherwise the Reader's list
+  // allocates a node per warning, and the vector they are copied into for the
+  // caller only grows when a parse has more warnings than any before it.
+  thread_local std::list<ParseWarning> scratch_warnings;
+  thread_local std::vector<ParseWarning> warnings;
+  warnings.clear();
+
+  data.reset();
+  ParseStatus status;
+  LayoutSession layout_session{layout_cache};
+  if (buffer == nullptr) {
+    status.error = PARSE_ERROR(CANNOT_OPEN_FILE, "No buffer provided.", nullptr);
+  } else if (length <= 100) {
+    status.error = PARSE_ERROR(CORRUPT_DATA, "Buffer too small.", nullptr);
+  } else {
+    Reader r{scratch_warnings};
+    r.data = buffer;
+    r.file_length = length;
+    r.file_begin = buffer;
+    r.layout_session = layout_cache ? &layout_session : nullptr;
+    if (!run_with_mapping_fault_guard(buffer, length, [&] { status.error = read_exif(r, data, level, nullptr, nullptr); })) {
+      status.error = mapping_fault_error();
+    }
+  }
+
+  warnings.assign(scratch_warnings.begin(), scratch_warnings.end());
+  scratch_warnings.clear();
+  status.warnings = warnings;
+  return status;
+}
+
+}  // namespace
+
 ParseResult<ExifData> read_exif(
   const std::filesystem::path &path,
+  ParseLevel level,
   FileType *ft,
-  FileTypeVariant *ftv
+  FileTypeVariant *ftv,
+  ParseStats *stats
 )
 {
   size_t file_length;
   char *data = map_file(path, &file_length);
-  ASSERT_OR_PARSE_ERROR(data != NULL, CANNOT_OPEN_FILE, "Cannot open file.", nullptr);
-  ASSERT_OR_PARSE_ERROR(file_length > 100, CORRUPT_DATA, "File too small.", nullptr);
+  if (data == NULL) {
+    return count_error(PARSE_ERROR(CANNOT_OPEN_FILE, "Cannot open file.", nullptr));
+  }
+  if (file_length <= 100) {
+    unmap_file(data, file_length);
+    return count_error(PARSE_ERROR(CORRUPT_DATA, "File too small.", nullptr));
+  }
 
-  ParseResult<ExifData> result = read_exif(data, file_length, ft, ftv);
+  STAP_PROBE2(neonexif, parse__start, data, file_length);
+  ParseMetricsTimer metrics;
+  ParseResult<ExifData> result{std::in_place};
+  std::optional<ParseError> error = parse_buffer(result, data, file_length, level, ft, ftv, stats);
   unmap_file(data, file_length);
+  if (error && is_mapping_fault(error.value()) && mapping_fault_policy() == MappingFaultPolicy::RETRY_WITH_PREAD) {
+    std::vector<char> contents;
+    if (!read_file_contents(path, contents)) {
+      return count_error(PARSE_ERROR(CANNOT_OPEN_FILE, "Cannot open file.", nullptr));
+    }
+    result._v.emplace<0>();
+    result.warnings.clear();
+    error = parse_buffer(result, contents.data(), contents.size(), level, ft, ftv, stats);
+  }
+  finish_parse(result, error, file_length, metrics);
   return result;
 }
 
 ParseResult<ExifData> read_exif(
   const char *buffer,
   size_t length,
+  ParseLevel level,
   FileType *ft,
-  FileTypeVariant *ftv
+  FileTypeVariant *ftv,
+  ParseStats *stats
 )
 {
+  STAP_PROBE2(neonexif, parse__start, buffer, length);
+  ParseMetricsTimer metrics;
+  ParseResult<ExifData> result{std::in_place};
+  std::optional<ParseError> error = parse_buffer(result, buffer, length, level, ft, ftv, stats);
+  finish_parse(result, error, length, metrics);
+  return result;
+}
+
+ParseResult<ExifData> read_exif(
+  const std::filesystem::path &path,
+  FileType *ft,
+  FileTypeVariant *ftv,
+  ParseStats *stats
+)
+{
+  return read_exif(path, ParseLevel::LENS_RESOLVED, ft, ftv, stats);
+}
+
+ParseResult<ExifData> read_exif(
+  const char *buffer,
+  size_t length,
+  FileType *ft,
+  FileTypeVariant *ftv,
+  ParseStats *stats
+)
+{
+  return read_exif(buffer, length, ParseLevel::LENS_RESOLVED, ft, ftv, stats);
+}
+
+ParseStatus read_exif_into(
+  ExifData &data,
+  const char *buffer,
+  size_t length,
+  ParseLevel level,
+  LayoutCache *layout_cache
+)
+{
+  STAP_PROBE2(neonexif, parse__start, buffer, length);
+  ParseMetricsTimer metrics;
+  ParseStatus status = parse_buffer_into(data, buffer, length, level, layout_cache);
+  metrics.record(data, status.error, status.warnings.size());
+  probe_parse_done(data, status.error, length, status.warnings.size());
+  return status;
+}
+
+ParseStatus read_exif_into(
+  ExifData &data,
+  const std::filesystem::path &path,
+  ParseLevel level,
+  LayoutCache *layout_cache
+)
+{
+  size_t file_length;
+  char *buffer = map_file(path, &file_length);
+  if (buffer == nullptr) {
+    data.reset();
+    return {.error = count_error(PARSE_ERROR(CANNOT_OPEN_FILE, "Cannot open file.", nullptr))};
+  }
+  STAP_PROBE2(neonexif, parse__start, buffer, file_length);
+  ParseMetricsTimer metrics;
+  ParseStatus status = parse_buffer_into(data, buffer, file_length, level, layout_cache);
+  unmap_file(buffer, file_length);
+  if (!status && is_mapping_fault(status.error.value()) && mapping_fault_policy() == MappingFaultPolicy::RETRY_WITH_PREAD) {
+    std::vector<char> contents;
+    if (!read_file_contents(path, contents)) {
+      data.reset();
+      return {.error = count_error(PARSE_ERROR(CANNOT_OPEN_FILE, "Cannot open file.", nullptr))};
+    }
+    status = parse_buffer_into(data, contents.data(), contents.size(), level, layout_cache);
+  }
+  metrics.record(data, status.error, status.warnings.size());
+  probe_parse_done(data, status.error, file_length, status.warnings.size());
+  return status;
+}
+
+std::vector<ParseResult<ExifData>> read_exif_many(
+  std::span<const std::span<const char>> buffers,
+  ParseLevel level
+)
+{
+  // The stages run over groups of buffers, so that the `ExifData` of a group
+  // stay in the L2 cache from one stage to the next.
+  constexpr size_t GROUP_SIZE = 32;
+
+  std::vector<ParseResult<ExifData>> results;
+  results.reserve(buffers.size());
+
+  // With metrics, the latency of a file is the sum of its stages.
+  const bool metrics = metrics_enabled();
+  std::vector<uint64_t> parse_ns(metrics ? buffers.size() : 0);
+  const bool timeline = timeline_enabled();
+
+  size_t group_begin = 0, group_end = 0;
+  // Runs `stage` on every buffer of the group that did not fail yet.
+  auto run_stage = [&](auto &&stage) {
+    for (size_t i = group_begin; i < group_end; ++i) {
+      if (!results[i]) {
+        continue;
+      }
+      ParseMetricsTimer timer{metrics};
+      char index[24] = "";
+      if (timeline) {
+        std::snprintf(index, sizeof(index), "#%zu", i);
+      }
+      TimelineSpan span("file", index);
+      ExifData &data = std::get<0>(results[i]._v);
+      std::span<const char> buffer = buffers[i];
+      std::optional<ParseError> error;
+      if (!run_with_mapping_fault_guard(buffer.data(), buffer.size(), [&] { error = stage(buffer, data, results[i].warnings); })) {
+        error = mapping_fault_error();
+      }
+      if (metrics) {
+        parse_ns[i] += timer.elapsed_ns();
+        if (error) {
+          record_parse_metrics(data, error, results[i].warnings.size(), parse_ns[i]);
+        }
+      }
+      if (error) {
+        probe_parse_done(data, error, buffer.size(), results[i].warnings.size());
+        results[i]._v = error.value();
+      }
+    }
+  };
+
+  for (; group_begin < buffers.size(); group_begin = group_end) {
+    group_end = std::min(group_begin + GROUP_SIZE, buffers.size());
+    while (results.size() < group_end) {
+      std::get<0>(results.emplace_back(std::in_place)._v).dirty = 0;
+    }
+    TimelineSpan group_span("group");
+
+    run_stage([](std::span<const char> buffer, ExifData &data, std::list<ParseWarning> &warnings) -> std::optional<ParseError> {
+      STAP_PROBE2(neonexif, parse__start, buffer.data(), buffer.size());
+      ASSERT_OR_PARSE_ERROR(buffer.data() != NULL, CANNOT_OPEN_FILE, "No buffer provided.", nullptr);
+      ASSERT_OR_PARSE_ERROR(buffer.size() > 100, CORRUPT_DATA, "Buffer too small.", nullptr);
+      Reader r{warnings};
+      r.data = buffer.data();
+      r.file_length = buffer.size();
+      r.file_begin = buffer.data();
+      PhaseTimer timer(nullptr, &ParseStats::detect_ns, "guess_file_type");
+      if (!guess_file_type(r)) {
+        return PARSE_ERROR(UNKNOWN_FILE_TYPE, "Cannot determine file type.", nullptr);
+      }
+      data.file_type = r.file_type;
+      data.file_type_variant = r.file_type_variant;
+      data.byte_order = r.byte_order;  // Of the container, until the TIFF header is read.
+      return std::nullopt;
+    });
+
+    run_stage([](std::span<const char> buffer, ExifData &data, std::list<ParseWarning> &warnings) -> std::optional<ParseError> {
+      Reader r{warnings};
+      r.data = buffer.data();
+      r.file_length = buffer.size();
+      r.file_begin = buffer.data();
+      r.file_type = data.file_type;
+      r.file_type_variant = data.file_type_variant;
+      r.byte_order = data.byte_order;
+      uint32_t tiff_offset;
+      uint32_t tiff_length;
+      PhaseTimer timer(nullptr, &ParseStats::detect_ns, "locate_tiff");
+      RETURN_IF_OPT_ERROR(locate_tiff(r, &tiff_offset, &tiff_length));
+      data.parse_state.tiff_offset = tiff_offset;
+      data.parse_state.tiff_length = tiff_length;
+      return std::nullopt;
+    });
+
+    run_stage([](std::span<const char> buffer, ExifData &data, std::list<ParseWarning> &warnings) -> std::optional<ParseError> {
+      Reader r{warnings};
+      r.data = buffer.data() + data.parse_state.tiff_offset;
+      r.file_length = data.parse_state.tiff_length;
+      r.file_begin = buffer.data();
+      r.exif_data = &data;
+      return tiff::read_tiff(r, data, ParseLevel::CORE);
+    });
+
+    for (ParseLevel next : {ParseLevel::STANDARD, ParseLevel::MAKERNOTE, ParseLevel::LENS_RESOLVED}) {
+      if (next > level) {
+        break;
+      }
+      run_stage([next](std::span<const char> buffer, ExifData &data, std::list<ParseWarning> &warnings) -> std::optional<ParseError> {
+        Reader r{warnings};
+        r.data = buffer.data() + data.parse_state.tiff_offset;
+        r.file_length = data.parse_state.tiff_length;
+        r.file_begin = buffer.data();
+        r.byte_order = data.byte_order;
+        r.exif_data = &data;
+        return tiff::upgrade_tiff(r, data, next);
+      });
+    }
+
+    for (size_t i = group_begin; i < group_end; ++i) {
+      if (results[i]) {
+        const ExifData &data = std::get<0>(results[i]._v);
+        probe_parse_done(data, std::nullopt, buffers[i].size(), results[i].warnings.size());
+        if (metrics) {
+          record_parse_metrics(data, std::nullopt, results[i].warnings.size(), parse_ns[i]);
+        }
+      }
+    }
+  }
+  return results;
+}
+
+ParseResult<ParseLevel> upgrade(ExifData &data, ParseLevel level, const char *buffer, size_t length)
+{
+  const ParseState &state = data.parse_state;
   ASSERT_OR_PARSE_ERROR(buffer != NULL, CANNOT_OPEN_FILE, "No buffer provided.", nullptr);
-  ASSERT_OR_PARSE_ERROR(length > 100, CORRUPT_DATA, "Buffer too small.", nullptr);
+  if (state.level >= level) {
+    return state.level;
+  }
+  ASSERT_OR_PARSE_ERROR(
+    state.tiff_length >= 8 && uint64_t(state.tiff_offset) + state.tiff_length <= length,
+    CORRUPT_DATA, "Buffer does not hold the TIFF structure that was parsed.", nullptr
+  );
+  const char *tiff = buffer + state.tiff_offset;
+  const char byte_order_mark = data.byte_order == std::endian::little ? 'I' : 'M';
 
-  ParseResult<ExifData> result{ExifData{}};
+  ParseResult<ParseLevel> result{state.level};
   Reader r{result.warnings};
-  r.data = buffer;
-  r.file_length = length;
-  if (auto error = read_exif(r, std::get<0>(result._v), ft, ftv)) {
+  r.data = tiff;
+  r.file_length = state.tiff_length;
+  r.file_begin = buffer;
+  r.byte_order = data.byte_order;
+  r.exif_data = &data;
+  std::optional<ParseError> error;
+  bool ok = run_with_mapping_fault_guard(buffer, length, [&] {
+    // This peek is the first touch of the mapping, so it can fault like the rest.
+    if (tiff[0] != byte_order_mark || tiff[1] != byte_order_mark) {
+      error = PARSE_ERROR(CORRUPT_DATA, "Buffer does not hold the TIFF structure that was parsed.", nullptr);
+      return;
+    }
+    error = tiff::upgrade_tiff(r, data, level);
+  });
+  if (!ok) {
+    error = mapping_fault_error();
+  }
+  if (error) {
     result._v = error.value();
+  } else {
+    result._v = state.level;
+  }
+  return result;
+}
+
+ParseResult<ParseLevel> upgrade(ExifData &data, ParseLevel level, const std::filesystem::path &path)
+{
+  size_t file_length;
+  char *buffer = map_file(path, &file_length);
+  ASSERT_OR_PARSE_ERROR(buffer != NULL, CANNOT_OPEN_FILE, "Cannot open file.", nullptr);
+
+  ParseResult<ParseLevel> result = upgrade(data, level, buffer, file_length);
+  unmap_file(buffer, file_length);
+  if (!result && is_mapping_fault(result.error()) && mapping_fault_policy() == MappingFaultPolicy::RETRY_WITH_PREAD) {
+    std::vector<char> contents;
+    ASSERT_OR_PARSE_ERROR(read_file_contents(path, contents), CANNOT_OPEN_FILE, "Cannot open file.", nullptr);
+    return upgrade(data, level, contents.data(), contents.size());
+  }
+  return result;
+}
+
+namespace {
+struct CompactHeader {
+  uint32_t fixed_size;   ///< Bytes of `ExifData` before `string_data`.
+  uint32_t inline_used;  ///< Bytes of `string_data` in use.
+  uint32_t spill_used;   ///< Bytes of all spill chunks together.
+  uint8_t makernote_index;  ///< Of the `makernote` variant, which is not taken from the raw bytes.
+  uint8_t dirty;
+  uint16_t num_images;
+};
+
+size_t fixed_size_of(const ExifData &data)
+{
+  return (const char *)data.string_data - (const char *)&data;
+}
+
+/** The unused image slots, which are left out of the fixed part. */
+std::pair<size_t, size_t> unused_images_of(const ExifData &data)
+{
+  const char *base = (const char *)&data;
+  return {(const char *)(data.images.data() + data.num_images) - base, (const char *)(data.images.data() + data.images.size()) - base};
+}
+}  // namespace
+
+size_t write_compact(const ExifData &data, std::vector<uint8_t> &output)
+{
+  CompactHeader header;
+  header.fixed_size = fixed_size_of(data);
+  header.inline_used = data.string_data_ptr;
+  header.spill_used = data.string_data_used() - data.string_data_ptr;
+  header.makernote_index = data.makernote.index();
+  header.dirty = data.dirty;
+  header.num_images = data.num_images;
+  auto [gap_begin, gap_end] = unused_images_of(data);
+  size_t gap = gap_end - gap_begin;
+
+  size_t start = output.size();
+  size_t total = sizeof(header) + header.fixed_size - gap + header.inline_used + header.spill_used;
+  // Laid out as the struct first, so that the CharData can be patched by offset.
+  output.resize(start + total + gap);
+  uint8_t *out = output.data() + start;
+  std::memcpy(out, &header, sizeof(header));
+  uint8_t *out_fixed = out + sizeof(header);
+  std::memcpy(out_fixed, &data, header.fixed_size);
+  uint8_t *dst = out_fixed + header.fixed_size;
+  std::memcpy(dst, data.string_data, header.inline_used);
+  dst += header.inline_used;
+  for (const ExifData::StringSpill *c = data.string_spill; c != nullptr; c = c->next) {
+    std::memcpy(dst, c->data(), c->used);
+    dst += c->used;
   }
+
+  if (header.spill_used > 0) {
+    // Spilled strings are addressed as if they followed the full inline buffer.
+    data.for_each_char_data([&](const CharData &cd) {
+      const char *ptr = cd.data();
+      uint32_t spill_pos = 0;
+      for (const ExifData::StringSpill *c = data.string_spill; c != nullptr; c = c->next) {
+        if (c->contains(ptr)) {
+          size_t pos = (const char *)&cd - (const char *)&data;
+          size_t target = header.fixed_size + sizeof(data.string_data) + spill_pos + (ptr - c->data());
+          alignas(CharData) uint8_t tmp[sizeof(CharData)];
+          std::memcpy(tmp, &cd, sizeof(CharData));
+          ((CharData *)tmp)->ptr_offset = int64_t(target) - int64_t(pos);
+          std::memcpy(out_fixed + pos, tmp, sizeof(CharData));
+          return;
+        }
+        spill_pos += c->used;
+      }
+    });
+  }
+  std::memmove(out_fixed + gap_begin, out_fixed + gap_end, total + gap - sizeof(header) - gap_end);
+  output.resize(start + total);
+  return total;
+}
+
+/** Sets `makernote` to its alternative `index`, with the bytes of that alternative at `src`. */
+template <size_t I = 1>
+void emplace_compact_makernote(ExifData &data, size_t index, const uint8_t *src)
+{
+  using Variant = decltype(ExifData::makernote);
+  if constexpr (I < std::variant_size_v<Variant>) {
+    if (index != I) {
+      return emplace_compact_makernote<I + 1>(data, index, src);
+    }
+    auto &mn = data.makernote.emplace<I>();
+    size_t offset = (const char *)&mn - (const char *)&data;
+    std::memcpy((void *)&mn, src + offset, sizeof(mn));
+  }
+}
+
+ParseResult<ExifData> read_compact(const uint8_t *buffer, size_t length)
+{
+  ParseResult<ExifData> result{std::in_place};
+  ExifData &data = result.value();
+
+  // Everything that decides how the rest is read is checked up front.
+  CompactHeader header;
+  ASSERT_OR_PARSE_ERROR(length >= sizeof(header), CORRUPT_DATA, "Compact data too small.", nullptr);
+  std::memcpy(&header, buffer, sizeof(header));
+  ASSERT_OR_PARSE_ERROR(
+    header.fixed_size == fixed_size_of(data), CORRUPT_DATA,
+    "Compact data written by a different build.", nullptr
+  );
+  ASSERT_OR_PARSE_ERROR(header.inline_used <= sizeof(data.string_data), CORRUPT_DATA, "Inline strings too long.", nullptr);
+  ASSERT_OR_PARSE_ERROR(header.num_images <= data.images.size(), CORRUPT_DATA, "Too many images.", nullptr);
+  ASSERT_OR_PARSE_ERROR(header.makernote_index < std::variant_size_v<decltype(data.makernote)>, CORRUPT_DATA, "Unknown MakerNote type.", nullptr);
+  ASSERT_OR_PARSE_ERROR((header.dirty & ~ExifData::DIRTY_ALL) == 0, CORRUPT_DATA, "Unknown dirty sections.", nullptr);
+
+  // The number of images tells how much of the fixed part was written.
+  data.num_images = header.num_images;
+  auto [gap_begin, gap_end] = unused_images_of(data);
+  size_t written_fixed = header.fixed_size - (gap_end - gap_begin);
+  ASSERT_OR_PARSE_ERROR(
+    uint64_t(length) >= sizeof(header) + written_fixed + uint64_t(header.inline_used) + header.spill_used,
+    CORRUPT_DATA, "Compact data truncated.", nullptr
+  );
+
+  // The MakerNote variant keeps its own index; only the bytes of the
+  // alternative in the header are taken.
+  const uint8_t *src = buffer + sizeof(header);
+  alignas(ExifData) uint8_t makernote[sizeof(data.makernote)];
+  std::memcpy(makernote, (void *)&data.makernote, sizeof(makernote));
+  std::memcpy((void *)&data, src, gap_begin);
+  std::memcpy((char *)&data + gap_end, src + gap_begin, header.fixed_size - gap_end);
+  std::memcpy((void *)&data.makernote, makernote, sizeof(makernote));
+  emplace_compact_makernote(data, header.makernote_index, src - (gap_end - gap_begin));
+  data.num_images = header.num_images;
+  data.dirty = header.dirty;
+  src += written_fixed;
+  ASSERT_OR_PARSE_ERROR(data.string_data_ptr == header.inline_used, CORRUPT_DATA, "Inconsistent string data size.", nullptr);
+  std::memcpy(data.string_data, src, header.inline_used);
+  src += header.inline_used;
+
+  // The spilled strings, back to back in one chunk.
+  const char *spilled = nullptr;
+  if (header.spill_used > 0) {
+    char *chunk = data.spill_string_area(header.spill_used);
+    std::memcpy(chunk, src, header.spill_used);
+    spilled = chunk;
+  }
+  size_t spill_start = header.fixed_size + sizeof(data.string_data);
+  bool out_of_bounds = false;
+  data.for_each_char_data([&](CharData &cd) {
+    if (cd.ptr_offset == 0) {
+      return;
+    }
+    size_t pos = (const char *)&cd - (const char *)&data;
+    int64_t target = int64_t(pos) + cd.ptr_offset;
+    if (target >= int64_t(spill_start) && target + cd.length <= int64_t(spill_start + header.spill_used)) {
+      cd.set(spilled + (target - spill_start), cd.length);
+    } else if (target < int64_t(header.fixed_size) || target + cd.length > int64_t(header.fixed_size + header.inline_used)) {
+      cd.set(nullptr, 0);
+      out_of_bounds = true;
+    }
+  });
+  ASSERT_OR_PARSE_ERROR(!out_of_bounds, CORRUPT_DATA, "String data out of bounds.", nullptr);
   return result;
 }
 
@@ -437,19 +999,19 @@ std::array<std::string_view, 8> resolve_lens_possibilities(const ExifData &data)
   std::array<std::string_view, 8> possible_lenses;
 
   auto &exif = data.exif;
-  if (exif.lens_model.is_set && exif.possible_lenses.value.num == 0) {
-    possible_lenses[0] = exif.lens_model.value.view();
+  if (exif.lens_model().is_set && exif.possible_lenses().value.num == 0) {
+    possible_lenses[0] = exif.lens_model().value.view();
     return possible_lenses;
   }
-  if (exif.possible_lenses && exif.possible_lenses.value.num >= 1) {
-    if (exif.possible_lenses.value.num == 1) {
-      possible_lenses[0] = exif.possible_lenses.value.values[0];
+  if (exif.possible_lenses() && exif.possible_lenses().value.num >= 1) {
+    if (exif.possible_lenses().value.num == 1) {
+      possible_lenses[0] = exif.possible_lenses().value.values[0];
       return possible_lenses;
     } else {
       // There are multiple options, let's see if the lens model actually tells us which
       // one.
-      if (exif.lens_model) {
-        auto [lmaker, lmodel] = normalize_maker_and_model(exif.lens_make.value.view(), exif.lens_model.value.view());
+      if (exif.lens_model()) {
+        auto [lmaker, lmodel] = normalize_maker_and_model(exif.lens_make().value.view(), exif.lens_model().value.view());
         LevenshteinCosts lsc{
           .deletion = 3,
           .insertion = 3,
@@ -458,9 +1020,9 @@ std::array<std::string_view, 8> resolve_lens_possibilities(const ExifData &data)
         };
         int best = 10000;
         int best_i = 0;
-        for (int i = 0; i < exif.possible_lenses.value.num; ++i) {
+        for (int i = 0; i < exif.possible_lenses().value.num; ++i) {
           auto [cmaker, cmodel] = normalize_maker_and_model(
-            {}, exif.possible_lenses.value.values[i]
+            {}, exif.possible_lenses().value.values[i]
           );
           int dist = levenshtein_distance(cmaker, lmaker, lsc) + levenshtein_distance(cmodel, lmodel, lsc);
           if (dist < best) {
@@ -469,14 +1031,14 @@ std::array<std::string_view, 8> resolve_lens_possibilities(const ExifData &data)
           }
         }
         if (best < 10) {
-          possible_lenses[0] = exif.possible_lenses.value.values[best_i];
+          possible_lenses[0] = exif.possible_lenses().value.values[best_i];
           return possible_lenses;
         }
       }
     }
 
-    for (int i = 0; i < exif.possible_lenses.value.num; ++i) {
-      possible_lenses[i] = exif.possible_lenses.value.values[i];
+    for (int i = 0; i < exif.possible_lenses().value.num; ++i) {
+      possible_lenses[i] = exif.possible_lenses().value.values[i];
     }
   }
   return possible_lenses;
@@ -27,7 +27,7 @@ x(0x0093, IFD_MAKERNOTE_NIKON, SHORT    , uint16_t   , nef_compression         ,
 x(0x0096, IFD_MAKERNOTE_NIKON, UNDEFINED, CharData   , linearization_table     , count_string    ) \
 x(0x0097, IFD_MAKERNOTE_NIKON, UNDEFINED, CharData   , color_balance           , count_string    ) \
 x(0x0098, IFD_MAKERNOTE_NIKON, UNDEFINED, CharData   , lens_data               , count_string    ) \
-x(0x00a7, IFD_MAKERNOTE_NIKON, UNDEFINED, uint32_t   , shutter_count           , count_scalar    )
+x(0x00a7, IFD_MAKERNOTE_NIKON, LONG     , uint32_t   , shutter_count           , count_scalar    )
 
 // clang-format on
 
@@ -45,6 +45,7 @@ NEXIF_MAKE_TAG_CMP;
 
 std::optional<ParseError> parse_makernote(Reader &r, ExifData &data)
 {
+  r.count_read(0, 2);
   if (r.data[0] == 'I' && r.data[1] == 'I') {
     r.byte_order = std::endian::little;
   } else if (r.data[0] == 'M' && r.data[1] == 'M') {
@@ -55,25 +56,23 @@ std::optional<ParseError> parse_makernote(Reader &r, ExifData &data)
 
   RETURN_IF_OPT_ERROR(r.seek(4));
   const uint32_t root_ifd_offset = r.read_u32();
-  DEBUG_PRINT("Root IFD at offset: %d", root_ifd_offset);
+  NEXIF_TRACE_MESSAGE("Root IFD at offset: %d", root_ifd_offset);
 
   NikonMakernote &mn = data.makernote.emplace<NikonMakernote>();
 
-  uint8_t lensdata_buffer[1024];
-  int lensdata_len{0};
-
   uint32_t ifd_offset = root_ifd_offset;
   while (ifd_offset) {
+    RETURN_IF_CANCELLED();
     RETURN_IF_OPT_ERROR(r.seek(ifd_offset));
     uint16_t num_entries = r.read_u16();
-    DEBUG_PRINT("IFD at offset: %d -> Num entries: %d", ifd_offset, num_entries);
-    Indenter indenter;
+    NEXIF_TRACE_IFD("Nikon", ifd_offset, num_entries);
+    STAP_PROBE3(neonexif, ifd__enter, "Nikon", ifd_offset, num_entries);
+    r.count_ifd(num_entries);
 
     for (int i = 0; i < num_entries; ++i) {
       // Read IFD entry.
       tiff::ifd_entry entry = tiff::read_ifd_entry(r);
-      const char *tag_str = to_str(entry.tag, IFD_MAKERNOTE_NIKON);
-      debug_print_ifd_entry(r, entry, tag_str);
+      NEXIF_TRACE_TAG(entry, IFD_MAKERNOTE_NIKON);
 
 #define PARSE_NIKON_TAG(_name) NEXIF_PARSE_TAG(mn, _name, entry, IFD_MAKERNOTE_NIKON)
 
@@ -81,7 +80,7 @@ std::optional<ParseError> parse_makernote(Reader &r, ExifData &data)
       // if (entry.tag == tag_version::TagId) {
       //   auto result = std::from_chars((const char*)entry.data, (const char*)entry.data + entry.size(), version);
       //   // TODO handle error?
-      //   DEBUG_PRINT("Nikon version: %d", version);
+      //   NEXIF_TRACE_MESSAGE("Nikon version: %d", version);
       // }
 
       PARSE_NIKON_TAG(iso);
@@ -101,17 +100,73 @@ std::optional<ParseError> parse_makernote(Reader &r, ExifData &data)
       PARSE_NIKON_TAG(shutter_count);
 
       if (entry.tag == tag_lens_data::TagId) {
+        // Decrypted and looked up in resolve_lens().
         uint32_t offset = entry.offset(r);
-        uint32_t size = std::min((int)sizeof(lensdata_buffer), entry.size());
-        if (auto view = r.data_view(offset, size); view) {
-          std::memcpy(lensdata_buffer, view.value().data(), size);
-          lensdata_len = size;
+        if (r.data_view(offset, entry.size())) {
+          data.parse_state.lens_data_offset = offset + 10;  // Relative to the "Nikon\0" header.
+          data.parse_state.lens_data_length = entry.size();
         }
       }
     }
 
     ifd_offset = r.read_u32();
-    DEBUG_PRINT("Next IFD offset: %d\n", ifd_offset);
+    NEXIF_TRACE_IFD_NEXT(ifd_offset);
+  }
+
+  // Copy over fields to their more general counterpart.
+  data.exif.lens_specification() = mn.lens_specification();
+
+  // Serial number canoncalize
+  if (mn.serial_number().is_set) {
+    data.exif.body_serial_number() = mn.serial_number().value.view();
+    data.exif.body_serial_number().parsed_from = mn.serial_number().parsed_from;
+  }
+
+  return std::nullopt;
+}
+
+void crypt_lens_data(uint8_t *lens_data, uint32_t length, std::string_view serial_number, uint32_t shutter_count)
+{
+  uint8_t *shutter_count_bytes = (uint8_t *)&shutter_count;
+  uint8_t key = shutter_count_bytes[0] ^ shutter_count_bytes[1] ^ shutter_count_bytes[2] ^ shutter_count_bytes[3];
+
+  uint32_t serial = 0;
+  for (char b : serial_number) {
+    serial *= 10;
+    serial += std::isdigit(b) ? (b - '0') : (b % 10);
+  }
+  NEXIF_TRACE_MESSAGE("serial: %d", serial);
+
+  uint8_t ci = xlat[0][serial & 0xff];
+  uint8_t cj = xlat[1][key];
+  uint8_t ck = 0x60;
+  for (uint32_t i = 4; i < length; ++i) {
+    cj += ci * ck++;
+    lens_data[i] ^= cj;
+  }
+}
+
+std::optional<ParseError> resolve_lens(Reader &r, ExifData &data)
+{
+  r.count_read(0, 2);
+  if (r.data[0] == 'I' && r.data[1] == 'I') {
+    r.byte_order = std::endian::little;
+  } else if (r.data[0] == 'M' && r.data[1] == 'M') {
+    r.byte_order = std::endian::big;
+  } else {
+    return PARSE_ERROR(CORRUPT_DATA, "Nikon header is not a TIFF file", "II or MM header not found");
+  }
+  RETURN_IF_CANCELLED();
+  NikonMakernote &mn = std::get<NikonMakernote>(data.makernote);
+
+  uint8_t lensdata_buffer[1024];
+  int lensdata_len{0};
+  if (data.parse_state.lens_data_length > 0) {
+    uint32_t offset = data.parse_state.lens_data_offset - 10;
+    uint32_t size = std::min<uint32_t>(sizeof(lensdata_buffer), data.parse_state.lens_data_length);
+    DECL_OR_RETURN(std::string_view, view, r.data_view(offset, size));
+    std::memcpy(lensdata_buffer, view.data(), size);
+    lensdata_len = size;
   }
 
   // Parse the lensdata buffer
@@ -124,40 +179,22 @@ std::optional<ParseError> parse_makernote(Reader &r, ExifData &data)
     lens_r.read_4bytes((uint8_t *)version_bytes);
     int version = 0;
     std::from_chars(version_bytes, version_bytes + 4, version);
-    DEBUG_PRINT("LensData version: %d\n", version);
+    NEXIF_TRACE_MESSAGE("LensData version: %d\n", version);
 
     /*
     for (int i = 0; i < lensdata_len; ++i) {
-      DEBUG_PRINT("%03d: %02x | '%c'", i, lensdata_buffer[i], lensdata_buffer[i]);
+      NEXIF_TRACE_MESSAGE("%03d: %02x | '%c'", i, lensdata_buffer[i], lensdata_buffer[i]);
     }
     */
 
     if (version >= 201) {
       // Decrypt with the reverse engineered algorithm.
-      if (mn.shutter_count.is_set && mn.serial_number.is_set) {
-        uint32_t shutter_count = mn.shutter_count.value;
-        uint8_t *shutter_count_bytes = (uint8_t *)&shutter_count;
-        uint8_t key = shutter_count_bytes[0] ^ shutter_count_bytes[1] ^ shutter_count_bytes[2] ^ shutter_count_bytes[3];
-
-        uint32_t serial;
-        auto serial_bytes = mn.serial_number.value.view();
-        for (char b : serial_bytes) {
-          serial *= 10;
-          serial += std::isdigit(b) ? (b - '0') : (b % 10);
-        }
-        DEBUG_PRINT("serial: %d", serial);
-
-        uint8_t ci = xlat[0][serial & 0xff];
-        uint8_t cj = xlat[1][key];
-        uint8_t ck = 0x60;
-        for (int i = 4; i < lensdata_len; ++i) {
-          cj += ci * ck++;
-          lensdata_buffer[i] ^= cj;
-        }
+      if (mn.shutter_count().is_set && mn.serial_number().is_set) {
+        crypt_lens_data(lensdata_buffer, lensdata_len, mn.serial_number().value.view(), mn.shutter_count().value);
 
         /*
         for (int i = 4; i < lensdata_len; ++i) {
-          DEBUG_PRINT("%03d: %02x | '%c'", i, lensdata_buffer[i], lensdata_buffer[i]);
+          NEXIF_TRACE_MESSAGE("%03d: %02x | '%c'", i, lensdata_buffer[i], lensdata_buffer[i]);
         }
         */
       } else {
@@ -211,14 +248,14 @@ std::optional<ParseError> parse_makernote(Reader &r, ExifData &data)
     }
 
     if (id_offset && id_offset < lensdata_len) {
-      mn.lens_mount = mount;
-      mn.lens_mount.parsed_from = tag_lens_data::TagId;
+      mn.lens_mount() = mount;
+      mn.lens_mount().parsed_from = tag_lens_data::TagId;
 
       if (mount == NikonMakernote::F_Mount) {
         if (id_offset + 6 < lensdata_len) {
           std::array<std::string_view, 8> cand_lenses;
           uint32_t num_cand = 0;
-          mn.f_mount_lens_identifier = std::array<uint8_t, 8>{
+          mn.f_mount_lens_identifier() = std::array<uint8_t, 8>{
             lensdata_buffer[id_offset + 0],
             lensdata_buffer[id_offset + 1],
             lensdata_buffer[id_offset + 2],
@@ -226,24 +263,26 @@ std::optional<ParseError> parse_makernote(Reader &r, ExifData &data)
             lensdata_buffer[id_offset + 4],
             lensdata_buffer[id_offset + 5],
             lensdata_buffer[id_offset + 6],
-            mn.lens_type.value_or(0),
+            mn.lens_type().value_or(0),
           };
 
           // Lookup lens id
-          for (NikonFMountLensID &lens : nikon_dslr_fmount_lenses) {
-            if (mn.f_mount_lens_identifier.value == lens.id) {
+          PhaseTimer timer(r.stats, &ParseStats::lens_lookup_ns, "lens_lookup");
+          for (const NikonFMountLensID &lens : nikon_dslr_fmount_lenses) {
+            if (mn.f_mount_lens_identifier().value == lens.id) {
               if (num_cand < 8) {
                 cand_lenses[num_cand++] = lens.name;
               }
             }
           }
+          timer.stop();
           if (num_cand == 1) {
-            data.exif.lens_model = data.store_string_data(cand_lenses[0]);
+            data.exif.lens_model() = data.store_string_data(cand_lenses[0]);
           }
 
           if (num_cand > 0) {
-            data.exif.possible_lenses = {cand_lenses, num_cand};
-            data.exif.possible_lenses.parsed_from = tag_lens_data::TagId;
+            data.exif.possible_lenses() = {cand_lenses, num_cand};
+            data.exif.possible_lenses().parsed_from = tag_lens_data::TagId;
           } else {
             r.warnings.push_back({
               .what = "Unknown F-mount lens identifier. Please report your lens to ExifTool and NeonEXIF.",
@@ -256,33 +295,32 @@ std::optional<ParseError> parse_makernote(Reader &r, ExifData &data)
         br.file_length = lensdata_len;
         br.byte_order = r.byte_order;
         RETURN_IF_OPT_ERROR(br.seek(id_offset));
-        mn.z_mount_lens_identifier = br.read_u16();
-        mn.z_mount_lens_identifier.parsed_from = tag_lens_data::TagId;
+        mn.z_mount_lens_identifier() = br.read_u16();
+        mn.z_mount_lens_identifier().parsed_from = tag_lens_data::TagId;
 
         // Lookup lens id
-        for (NikonZMountLensID &lens : nikon_mirrorless_zmount_lenses) {
-          if (mn.z_mount_lens_identifier.value == lens.id) {
-            data.exif.lens_model = data.store_string_data(lens.name);
+        PhaseTimer timer(r.stats, &ParseStats::lens_lookup_ns, "lens_lookup");
+        for (const NikonZMountLensID &lens : nikon_mirrorless_zmount_lenses) {
+          if (mn.z_mount_lens_identifier().value == lens.id) {
+            data.exif.lens_model() = data.store_string_data(lens.name);
             break;
           }
         }
-        if (!data.exif.lens_model.is_set) {
+        timer.stop();
+        if (!data.exif.lens_model().is_set) {
           r.warnings.push_back({
             .what = "Unknown Z-mount lens identifier. Please report your lens to ExifTool and NeonEXIF.",
           });
         }
       } else if (mount == NikonMakernote::One_Mount) {
-        data.exif.lens_model = data.store_string_data((const char *)&lensdata_buffer[id_offset]);
+        data.exif.lens_model() = data.store_string_data((const char *)&lensdata_buffer[id_offset]);
       }
     }
   }
 
-  // Copy over fields to their more general counterpart.
-  data.exif.lens_specification = mn.lens_specification;
-
   // Construct Lens name
-  if (!data.exif.lens_model && data.exif.lens_specification && mn.lens_type) {
-    uint8_t bits = mn.lens_type.value;
+  if (!data.exif.lens_model() && data.exif.lens_specification() && mn.lens_type()) {
+    uint8_t bits = mn.lens_type().value;
     char name[128];
     const char *prefix = "";
     char suffix[5]{0};
@@ -305,7 +343,7 @@ std::optional<ParseError> parse_makernote(Reader &r, ExifData &data)
       suffix[2] = 'V';
       suffix[3] = 'R';
     }
-    const auto &ls = data.exif.lens_specification;
+    const auto &ls = data.exif.lens_specification();
     if (ls.value[0] == ls.value[1]) {
       std::snprintf(
         name, sizeof(name), "%s%dmm f/%g%s",
@@ -336,13 +374,7 @@ std::optional<ParseError> parse_makernote(Reader &r, ExifData &data)
         );
       }
     }
-    data.exif.lens_model = data.store_string_data(name);
-  }
-
-  // Serial number canoncalize
-  if (mn.serial_number.is_set) {
-    data.exif.body_serial_number = mn.serial_number.value.view();
-    data.exif.body_serial_number.parsed_from = mn.serial_number.parsed_from;
+    data.exif.lens_model() = data.store_string_data(name);
   }
 
   return std::nullopt;
@@ -31,7 +31,7 @@ struct NikonFMountLensID {
   std::string_view name;
 };
 
-NikonFMountLensID nikon_dslr_fmount_lenses[] = {
+const NikonFMountLensID nikon_dslr_fmount_lenses[] = {
   {{0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x01}, "Manual Lens No CPU"sv},
   {{0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0xE1, 0x12}, "TC-17E II"sv},
   {{0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0xF1, 0x0C}, "TC-14E [II] or Sigma APO Tele Converter 1.4x EX DG or Kenko Teleplus PRO 300 DG 1.4x"sv},
@@ -658,7 +658,7 @@ struct NikonZMountLensID {
 };
 
 // clang-format off
-NikonZMountLensID nikon_mirrorless_zmount_lenses[] = {
+const NikonZMountLensID nikon_mirrorless_zmount_lenses[] = {
   {1    , "Nikkor Z 24-70mm f/4 S"sv},
   {2    , "Nikkor Z 14-30mm f/4 S"sv},
   {4    , "Nikkor Z 35mm f/1.8 S"sv},
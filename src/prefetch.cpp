@@ -0,0 +1,128 @@
+#include "neonexif/prefetch.hpp"
+#include "neonexif/exif_file.hpp"
+#include "neonexif/reader.hpp"
+
+#include <algorithm>
+#include <deque>
+
+#ifndef _WIN32
+#include <fcntl.h>
+#include <unistd.h>
+#endif
+
+namespace nexif {
+
+namespace {
+
+std::string profile_key(const ExifData &data)
+{
+  std::string key = to_str(data.file_type, data.file_type_variant);
+  key += ' ';
+  key += data.make().value.view();
+  key += ' ';
+  key += data.model().value.view();
+  return key;
+}
+
+/** Asks for runs of consecutive pages in one call each. */
+void advise_will_need(int fd, const vla<uint32_t, 64> &pages)
+{
+#ifdef POSIX_FADV_WILLNEED
+  std::array<uint32_t, 64> sorted = pages.values;
+  std::sort(sorted.begin(), sorted.begin() + pages.num);
+  for (uint32_t i = 0; i < pages.num;) {
+    uint32_t j = i + 1;
+    while (j < pages.num && sorted[j] == sorted[j - 1] + 1) {
+      ++j;
+    }
+    off_t offset = off_t(sorted[i]) << TouchedPages::PAGE_BITS;
+    off_t length = off_t(j - i) << TouchedPages::PAGE_BITS;
+    posix_fadvise(fd, offset, length, POSIX_FADV_WILLNEED);
+    i = j;
+  }
+#endif
+}
+
+}  // namespace
+
+void PrefetchingReader::read_all(std::span<const std::filesystem::path> paths, const Sink &sink, ParseLevel level)
+{
+  struct Upcoming {
+    int fd{-1};
+    Profile *predicted{nullptr};
+    vla<uint32_t, 64> prefetched;
+  };
+  std::deque<Upcoming> window;
+  size_t next_to_open = 0;
+
+  for (size_t i = 0; i < paths.size(); ++i) {
+    // Open, and prefetch, the files in the window.
+    for (; next_to_open < paths.size() && next_to_open <= i + _lookahead; ++next_to_open) {
+      Upcoming u;
+#ifndef _WIN32
+      u.fd = ::open(paths[next_to_open].c_str(), O_RDONLY | O_CLOEXEC);
+#endif
+      auto dir = _last_key_in_dir.find(paths[next_to_open].parent_path().string());
+      auto profile = _profiles.find(dir != _last_key_in_dir.end() ? dir->second : _last_key);
+      if (u.fd >= 0 && profile != _profiles.end()) {
+        u.predicted = &profile->second;
+        u.prefetched = profile->second.pages;
+        advise_will_need(u.fd, u.prefetched);
+      }
+      window.push_back(u);
+    }
+    Upcoming u = window.front();
+    window.pop_front();
+
+#ifndef _WIN32
+    auto file = u.fd >= 0 ? ExifFile::open(u.fd) : PARSE_ERROR(CANNOT_OPEN_FILE, "Cannot open file.", nullptr);
+#else
+    auto file = ExifFile::open(paths[i]);
+#endif
+    if (!file) {
+      _data.reset();
+      sink(i, _data, ParseStatus{.error = file.error()});
+      continue;
+    }
+
+    TouchedPages touched;
+    touched.begin = file.value().data();
+    touched.end = touched.begin + file.value().length();
+    touched_pages = &touched;
+    ParseStatus status = read_exif_into(_data, file.value().data(), file.value().length(), level);
+    touched_pages = nullptr;
+
+    if (u.predicted) {
+      ProfileStats &stats = u.predicted->stats;
+      stats.files++;
+      stats.prefetched_pages += u.prefetched.num;
+      stats.touched_pages += touched.pages.num;
+      for (uint32_t p = 0; p < touched.pages.num; ++p) {
+        auto begin = u.prefetched.values.begin(), end = begin + u.prefetched.num;
+        stats.hit_pages += std::find(begin, end, touched.pages.values[p]) != end;
+      }
+    }
+    if (status) {
+      // The latest layout wins: a profile follows firmware updates.
+      std::string key = profile_key(_data);
+      Profile &profile = _profiles[key];
+      profile.stats.key = key;
+      profile.pages = touched.pages;
+      _last_key_in_dir[paths[i].parent_path().string()] = key;
+      _last_key = std::move(key);
+    }
+    sink(i, _data, status);
+  }
+}
+
+std::vector<ProfileStats> PrefetchingReader::profile_stats() const
+{
+  std::vector<ProfileStats> result;
+  for (const auto &[key, profile] : _profiles) {
+    result.push_back(profile.stats);
+  }
+  std::sort(result.begin(), result.end(), [](const ProfileStats &a, const ProfileStats &b) { return a.key < b.key; });
+  return result;
+}
+
+}  // namespace nexif
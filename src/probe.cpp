@@ -0,0 +1,179 @@
+#include "neonexif/probe.hpp"
+#include "neonexif/reader.hpp"
+
+#include <algorithm>
+#include <cstring>
+#include <string_view>
+
+#ifndef _WIN32
+#include <cerrno>
+#include <fcntl.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#else
+#include <fstream>
+#endif
+
+namespace nexif {
+
+namespace {
+
+/** `read_exif()` rejects anything this small. */
+constexpr uint64_t MIN_PARSABLE_SIZE = 101;
+
+uint16_t u16(const uint8_t *p, std::endian order)
+{
+  return order == std::endian::little ? p[0] | p[1] << 8 : p[0] << 8 | p[1];
+}
+
+uint32_t u32(const uint8_t *p, std::endian order)
+{
+  return order == std::endian::little ? u16(p, order) | uint32_t(u16(p + 2, order)) << 16
+                                      : uint32_t(u16(p, order)) << 16 | u16(p + 2, order);
+}
+
+uint64_t u64(const uint8_t *p, std::endian order)
+{
+  return order == std::endian::little ? u32(p, order) | uint64_t(u32(p + 4, order)) << 32
+                                      : uint64_t(u32(p, order)) << 32 | u32(p + 4, order);
+}
+
+ProbeFormat format_of(FileType ft)
+{
+  switch (ft) {
+    case TIFF: return ProbeFormat::TIFF;
+    case CIFF: return ProbeFormat::CIFF;
+    case JPEG: return ProbeFormat::JPEG;
+    case FUJIFILM_RAF: return ProbeFormat::FUJIFILM_RAF;
+    case MRW: return ProbeFormat::MRW;
+    case SIGMA_FOVB: return ProbeFormat::SIGMA_FOVB;
+  }
+  return ProbeFormat::UNKNOWN;
+}
+
+/** Walks the JPEG segments in the head, looking for the Exif APP1 segment. */
+void jpeg_ranges(const uint8_t *p, ProbeResult &result)
+{
+  uint32_t offset = 2;
+  while (offset + 4 <= PROBE_SIZE) {
+    uint16_t marker = u16(p + offset, std::endian::big);
+    if ((marker & 0xff00) != 0xff00 || marker == 0xffda /* SOS */ || marker == 0xffd9 /* EOI */) {
+      return;  // No Exif data before the image data.
+    }
+    uint16_t length = u16(p + offset + 2, std::endian::big);
+    if (marker == 0xffe1 /* APP1 */) {
+      result.ranges.push_back({offset, uint64_t(length) + 2});
+      return;
+    }
+    offset += length + 2;
+  }
+  result.ranges.push_back({offset, 0});
+}
+
+}  // namespace
+
+ProbeResult probe(const char *head, size_t length, uint64_t file_size)
+{
+  ProbeResult result;
+  result.file_size = file_size;
+
+  // Zero padding keeps all reads below in bounds.
+  uint8_t p[PROBE_SIZE]{};
+  std::memcpy(p, head, std::min(length, PROBE_SIZE));
+  const char *c = (const char *)p;
+  if (length < 8) {
+    return result;
+  }
+
+  std::list<ParseWarning> warnings;
+  Reader r{warnings};
+  r.data = c;
+  r.file_length = PROBE_SIZE;
+  if (guess_file_type(r)) {
+    result.format = format_of(r.file_type);
+    result.parsable = file_size >= MIN_PARSABLE_SIZE;
+    result.file_type = r.file_type;
+    result.file_type_variant = r.file_type_variant;
+
+    switch (r.file_type) {
+      case TIFF:
+        result.ranges.push_back({u32(p + 4, r.byte_order), 0});
+        break;
+      case JPEG:
+        jpeg_ranges(p, result);
+        break;
+      case FUJIFILM_RAF:
+        result.ranges.push_back({0x54, 8});  // Offset and length of the embedded JPEG.
+        break;
+      case MRW:
+        result.ranges.push_back({0, 8 + uint64_t(u32(p + 4, std::endian::big))});
+        break;
+      case CIFF: {
+        // The root heap spans the rest of the file; its directory is at the end.
+        uint32_t header_length = u32(p + 2, c[0] == 'I' ? std::endian::little : std::endian::big);
+        if (header_length < file_size) {
+          result.ranges.push_back({header_length, file_size - header_length});
+        }
+        break;
+      }
+      case SIGMA_FOVB:
+        break;
+    }
+    return result;
+  }
+
+  using namespace std::string_view_literals;
+  std::string_view s{c, PROBE_SIZE};
+  if ((s.starts_with("II"sv) && p[2] == 43 && p[3] == 0) || (s.starts_with("MM"sv) && p[2] == 0 && p[3] == 43)) {
+    std::endian order = c[0] == 'I' ? std::endian::little : std::endian::big;
+    if (u16(p + 4, order) == 8) {
+      result.format = ProbeFormat::BIG_TIFF;
+      result.ranges.push_back({u64(p + 8, order), 0});
+    }
+  } else if (s.substr(4, 4) == "ftyp"sv) {
+    result.format = ProbeFormat::BMFF;
+    std::memcpy(result.brand, p + 8, 4);
+    result.ranges.push_back({u32(p, std::endian::big), 0});  // The box after `ftyp`.
+  } else if (s.starts_with("\x89PNG\r\n\x1a\n"sv)) {
+    result.format = ProbeFormat::PNG;
+  } else if (s.starts_with("RIFF"sv) && s.substr(8, 4) == "WEBP"sv) {
+    result.format = ProbeFormat::WEBP;
+  }
+  return result;
+}
+
+#ifndef _WIN32
+ParseResult<ProbeResult> probe(int fd)
+{
+  struct stat st;
+  ASSERT_OR_PARSE_ERROR(fstat(fd, &st) == 0, CANNOT_OPEN_FILE, "Cannot stat file.", nullptr);
+  char head[PROBE_SIZE];
+  ssize_t n;
+  do {
+    n = pread(fd, head, sizeof(head), 0);
+  } while (n < 0 && errno == EINTR);
+  ASSERT_OR_PARSE_ERROR(n >= 0, CANNOT_OPEN_FILE, "Cannot read file.", nullptr);
+  return probe(head, n, st.st_size);
+}
+
+ParseResult<ProbeResult> probe(const std::filesystem::path &path)
+{
+  int fd = open(path.c_str(), O_RDONLY | O_CLOEXEC);
+  ASSERT_OR_PARSE_ERROR(fd >= 0, CANNOT_OPEN_FILE, "Cannot open file.", nullptr);
+  ParseResult<ProbeResult> result = probe(fd);
+  close(fd);
+  return result;
+}
+#else
+ParseResult<ProbeResult> probe(const std::filesystem::path &path)
+{
+  std::ifstream in(path, std::ios::binary);
+  ASSERT_OR_PARSE_ERROR(in, CANNOT_OPEN_FILE, "Cannot open file.", nullptr);
+  char head[PROBE_SIZE];
+  in.read(head, sizeof(head));
+  std::error_code ec;
+  return probe(head, in.gcount(), std::filesystem::file_size(path, ec));
+}
+#endif
+
+}  // namespace nexif
@@ -0,0 +1,396 @@
+#include "neonexif/scan_tree.hpp"
+#include "neonexif/reader.hpp"
+#include "neonexif/timeline.hpp"
+
+#include <algorithm>
+#include <atomic>
+#include <condition_variable>
+#include <cstring>
+#include <deque>
+#include <memory>
+#include <mutex>
+#include <string_view>
+#include <thread>
+
+#ifndef _WIN32
+#include <dirent.h>
+#include <fcntl.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#endif
+#ifdef __linux__
+#include <sys/syscall.h>
+#endif
+
+namespace nexif {
+
+const std::vector<std::string> &default_scan_extensions()
+{
+  static const std::vector<std::string> extensions = {
+    ".3fr", ".arw", ".cr2", ".crw", ".dcr", ".dng", ".erf", ".iiq", ".jpeg", ".jpg", ".kdc", ".mrw", ".nef",
+    ".nrw", ".orf", ".pef", ".raf", ".rw2", ".rwl", ".sr2", ".srf", ".srw", ".tif", ".tiff", ".x3f",
+  };
+  return extensions;
+}
+
+namespace {
+
+bool has_extension(std::string_view name, const std::vector<std::string> &extensions)
+{
+  size_t dot = name.rfind('.');
+  if (dot == std::string_view::npos || name.length() - dot > 8) {
+    return false;
+  }
+  char ext[8];
+  size_t len = name.length() - dot;
+  for (size_t i = 0; i < len; ++i) {
+    ext[i] = std::tolower(uint8_t(name[dot + i]));
+  }
+  for (const std::string &e : extensions) {
+    if (e.length() == len && std::memcmp(e.data(), ext, len) == 0) {
+      return true;
+    }
+  }
+  return false;
+}
+
+void add_stats(ScanStats &total, const ScanStats &s)
+{
+  total.directories += s.directories;
+  total.entries += s.entries;
+  total.files += s.files;
+  total.rejected_by_extension += s.rejected_by_extension;
+  total.rejected_by_size += s.rejected_by_size;
+  total.rejected_by_magic += s.rejected_by_magic;
+  total.errors += s.errors;
+}
+
+#ifndef _WIN32
+/** Parents keep their descriptor open for their children up to this many. */
+constexpr int MAX_HELD_DIRECTORIES = 256;
+
+struct DirHandle {
+  int fd;
+  std::atomic<int> &held;
+
+  DirHandle(int fd, std::atomic<int> &held) : fd(fd), held(held) { held++; }
+  ~DirHandle()
+  {
+    ::close(fd);
+    held--;
+  }
+};
+
+struct PendingDir {
+  std::shared_ptr<DirHandle> parent;  ///< Null to open by path.
+  std::string name;                   ///< Relative to `parent`.
+  std::string path;
+};
+
+class Scanner {
+ public:
+  Scanner(const ScanOptions &options, const std::function<void(const ScannedFile &)> &sink) :
+    _options(options),
+    _extensions(options.extensions.empty() ? default_scan_extensions() : options.extensions),
+    _sink(sink)
+  {
+  }
+
+  ScanStats run(std::string root)
+  {
+    while (root.length() > 1 && root.back() == '/') {
+      root.pop_back();
+    }
+    _dirs.push_back({nullptr, root, root});
+
+    int num_sinks = _options.sink_threads > 0 ? _options.sink_threads : std::max(1u, std::thread::hardware_concurrency());
+    std::vector<std::thread> sinks;
+    for (int i = 0; i < num_sinks; ++i) {
+      sinks.emplace_back([this] { sink_loop(); });
+    }
+    std::vector<std::thread> walkers;
+    for (int i = 0; i < std::max(1, _options.walker_threads); ++i) {
+      walkers.emplace_back([this] { walk_loop(); });
+    }
+    for (std::thread &t : walkers) {
+      t.join();
+    }
+    {
+      std::lock_guard lock(_files_mutex);
+      _files_closed = true;
+    }
+    _files_not_empty.notify_all();
+    for (std::thread &t : sinks) {
+      t.join();
+    }
+    return _stats;
+  }
+
+ private:
+  const ScanOptions &_options;
+  const std::vector<std::string> &_extensions;
+  const std::function<void(const ScannedFile &)> &_sink;
+  std::atomic<int> _held_directories{0};
+
+  std::mutex _dirs_mutex;
+  std::condition_variable _dirs_changed;
+  std::deque<PendingDir> _dirs;  ///< FIFO: breadth-first.
+  int _busy_walkers{0};
+  ScanStats _stats;  ///< Guarded by `_dirs_mutex`.
+
+  std::mutex _files_mutex;
+  std::condition_variable _files_not_full;
+  std::condition_variable _files_not_empty;
+  std::deque<ScannedFile> _files;
+  bool _files_closed{false};
+
+  void walk_loop()
+  {
+    set_timeline_thread_name("scan walker");
+    ScanStats stats;
+    std::vector<PendingDir> subdirs;
+    for (;;) {
+      PendingDir dir;
+      {
+        std::unique_lock lock(_dirs_mutex);
+        _dirs_changed.wait(lock, [this] { return !_dirs.empty() || _busy_walkers == 0; });
+        if (_dirs.empty()) {
+          // Nobody is left to add more.
+          add_stats(_stats, stats);
+          _dirs_changed.notify_all();
+          return;
+        }
+        dir = std::move(_dirs.front());
+        _dirs.pop_front();
+        _busy_walkers++;
+      }
+
+      walk(dir, stats, subdirs);
+
+      bool notify;
+      {
+        std::lock_guard lock(_dirs_mutex);
+        for (PendingDir &d : subdirs) {
+          _dirs.push_back(std::move(d));
+        }
+        _busy_walkers--;
+        notify = !subdirs.empty() || _busy_walkers == 0;
+      }
+      if (notify) {
+        _dirs_changed.notify_all();
+      }
+      subdirs.clear();
+    }
+  }
+
+  void walk(PendingDir &dir, ScanStats &stats, std::vector<PendingDir> &subdirs)
+  {
+    TimelineSpan span("directory", dir.path);
+    constexpr int dir_flags = O_RDONLY | O_DIRECTORY | O_NOFOLLOW | O_CLOEXEC;
+    int fd = dir.parent ? openat(dir.parent->fd, dir.name.c_str(), dir_flags) : ::open(dir.path.c_str(), dir_flags);
+    dir.parent.reset();
+    if (fd < 0) {
+      stats.errors++;
+      return;
+    }
+    stats.directories++;
+    auto handle = std::make_shared<DirHandle>(fd, _held_directories);
+
+    auto on_entry = [&](const char *name, uint8_t type) {
+      if (name[0] == '.' && (name[1] == 0 || (name[1] == '.' && name[2] == 0))) {
+        return;
+      }
+      stats.entries++;
+      if (type == DT_UNKNOWN) {
+        struct stat st;
+        if (fstatat(fd, name, &st, AT_SYMLINK_NOFOLLOW) != 0) {
+          stats.errors++;
+          return;
+        }
+        type = S_ISDIR(st.st_mode) ? DT_DIR : S_ISREG(st.st_mode) ? DT_REG : DT_LNK;
+      }
+      if (type == DT_DIR) {
+        bool hold = _held_directories.load(std::memory_order_relaxed) < MAX_HELD_DIRECTORIES;
+        subdirs.push_back({hold ? handle : nullptr, name, dir.path + '/' + name});
+      } else if (type == DT_REG) {
+        visit_file(fd, name, dir.path, stats);
+      }
+    };
+
+#ifdef __linux__
+    struct linux_dirent64 {
+      uint64_t d_ino;
+      int64_t d_off;
+      unsigned short d_reclen;
+      unsigned char d_type;
+      char d_name[];
+    };
+    alignas(8) char buffer[32 * 1024];
+    for (;;) {
+      long n = syscall(SYS_getdents64, fd, buffer, sizeof(buffer));
+      if (n <= 0) {
+        if (n < 0) {
+          stats.errors++;
+        }
+        break;
+      }
+      for (long offset = 0; offset < n;) {
+        const linux_dirent64 *entry = (const linux_dirent64 *)(buffer + offset);
+        on_entry(entry->d_name, entry->d_type);
+        offset += entry->d_reclen;
+      }
+    }
+#else
+    int dup_fd = dup(fd);
+    DIR *d = dup_fd >= 0 ? fdopendir(dup_fd) : nullptr;
+    if (d == nullptr) {
+      stats.errors++;
+      return;
+    }
+    while (const dirent *entry = readdir(d)) {
+      on_entry(entry->d_name, entry->d_type);
+    }
+    closedir(d);
+#endif
+  }
+
+  void visit_file(int dir_fd, const char *name, const std::string &dir_path, ScanStats &stats)
+  {
+    if (!has_extension(name, _extensions)) {
+      stats.rejected_by_extension++;
+      return;
+    }
+    ScannedFile file;
+    if (_options.check_magic) {
+      TimelineSpan span("probe", name);
+      int fd = openat(dir_fd, name, O_RDONLY | O_NOFOLLOW | O_CLOEXEC);
+      ParseResult<ProbeResult> probed = fd >= 0 ? probe(fd) : PARSE_ERROR(CANNOT_OPEN_FILE, "Cannot open file.", nullptr);
+      if (fd >= 0) {
+        ::close(fd);
+      }
+      if (!probed) {
+        stats.errors++;
+        return;
+      }
+      file.probe = probed.value();
+      file.size = file.probe.file_size;
+    } else {
+      struct stat st;
+      if (fstatat(dir_fd, name, &st, AT_SYMLINK_NOFOLLOW) != 0) {
+        stats.errors++;
+        return;
+      }
+      file.size = st.st_size;
+    }
+    if (file.size < _options.min_file_size) {
+      stats.rejected_by_size++;
+      return;
+    }
+    if (_options.check_magic && !file.probe.parsable) {
+      stats.rejected_by_magic++;
+      return;
+    }
+    stats.files++;
+    file.path = dir_path + '/' + name;
+    push_file(std::move(file));
+  }
+
+  void push_file(ScannedFile &&file)
+  {
+    {
+      std::unique_lock lock(_files_mutex);
+      wait_timed(lock, _files_not_full, "wait_queue_full", [this] { return _files.size() < std::max<size_t>(1, _options.queue_capacity); });
+      _files.push_back(std::move(file));
+      if (timeline_enabled()) [[unlikely]] {
+        record_timeline_counter("scan_queued", _files.size());
+      }
+    }
+    _files_not_empty.notify_one();
+  }
+
+  void sink_loop()
+  {
+    set_timeline_thread_name("scan sink");
+    for (;;) {
+      ScannedFile file;
+      {
+        std::unique_lock lock(_files_mutex);
+        wait_timed(lock, _files_not_empty, "wait_queue_empty", [this] { return !_files.empty() || _files_closed; });
+        if (_files.empty()) {
+          return;
+        }
+        file = std::move(_files.front());
+        _files.pop_front();
+        if (timeline_enabled()) [[unlikely]] {
+          record_timeline_counter("scan_queued", _files.size());
+        }
+      }
+      _files_not_full.notify_one();
+      TimelineSpan span("file", file.path.native());
+      _sink(file);
+    }
+  }
+
+  /** Waits on `cv`, and puts the wait on the timeline, if it had to wait. */
+  template <typename Pred>
+  static void wait_timed(std::unique_lock<std::mutex> &lock, std::condition_variable &cv, const char *name, Pred ready)
+  {
+    if (ready()) {
+      return;
+    }
+    uint64_t begin_ns = timeline_enabled() ? timeline_now_ns() : 0;
+    cv.wait(lock, ready);
+    if (begin_ns) [[unlikely]] {
+      record_timeline_span(name, begin_ns, timeline_now_ns());
+    }
+  }
+};
+#endif
+
+}  // namespace
+
+ParseResult<ScanStats> scan_tree(
+  const std::filesystem::path &root,
+  const ScanOptions &options,
+  const std::function<void(const ScannedFile &)> &sink
+)
+{
+#ifndef _WIN32
+  Scanner scanner(options, sink);
+  ScanStats stats = scanner.run(root.string());
+#else
+  // Serial fallback.
+  ScanStats stats;
+  const std::vector<std::string> &extensions = options.extensions.empty() ? default_scan_extensions() : options.extensions;
+  std::error_code ec;
+  std::filesystem::recursive_directory_iterator it{root, ec}, end;
+  if (!ec) {
+    stats.directories++;
+  }
+  for (; !ec && it != end; it.increment(ec)) {
+    stats.entries++;
+    if (it->is_directory(ec)) {
+      stats.directories++;
+      continue;
+    }
+    if (!it->is_regular_file(ec)) {
+      continue;
+    }
+    if (!has_extension(it->path().filename().string(), extensions)) {
+      stats.rejected_by_extension++;
+      continue;
+    }
+    uint64_t size = it->file_size(ec);
+    if (size < options.min_file_size) {
+      stats.rejected_by_size++;
+      continue;
+    }
+    stats.files++;
+    sink({it->path(), size});
+  }
+#endif
+  ASSERT_OR_PARSE_ERROR(stats.directories > 0, CANNOT_OPEN_FILE, "Cannot open directory.", nullptr);
+  return stats;
+}
+
+}  // namespace nexif
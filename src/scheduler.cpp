@@ -0,0 +1,117 @@
+#include "neonexif/scheduler.hpp"
+#include "neonexif/reader.hpp"
+#include "neonexif/timeline.hpp"
+
+namespace nexif {
+
+CancellationScope::CancellationScope(const CancellationToken &token) : _previous(cancellation_flag)
+{
+  cancellation_flag = token.flag();
+}
+
+CancellationScope::~CancellationScope()
+{
+  cancellation_flag = _previous;
+}
+
+ParseScheduler::ParseScheduler(int num_threads, ParseLevel level) : _level(level)
+{
+  for (int i = 0; i < std::max(1, num_threads); ++i) {
+    _threads.emplace_back([this] { work(); });
+  }
+}
+
+ParseScheduler::~ParseScheduler()
+{
+  {
+    std::lock_guard lock(_mutex);
+    _stopping = true;
+  }
+  _work_cv.notify_all();
+  for (std::thread &t : _threads) {
+    t.join();
+  }
+}
+
+ParseScheduler::RequestId ParseScheduler::submit(std::filesystem::path path, Priority priority, Callback callback, CancellationToken token)
+{
+  RequestId id;
+  {
+    std::lock_guard lock(_mutex);
+    id = _next_id++;
+    _queues[int(priority)].emplace(id, Request{std::move(path), std::move(callback), std::move(token)});
+    if (timeline_enabled()) [[unlikely]] {
+      record_timeline_counter("scheduler_queued", _queues[0].size() + _queues[1].size());
+    }
+  }
+  _work_cv.notify_one();
+  return id;
+}
+
+bool ParseScheduler::promote(RequestId id)
+{
+  std::lock_guard lock(_mutex);
+  auto node = _queues[int(Priority::BACKGROUND)].extract(id);
+  if (node.empty()) {
+    return _queues[int(Priority::INTERACTIVE)].contains(id);
+  }
+  _queues[int(Priority::INTERACTIVE)].insert(std::move(node));
+  return true;
+}
+
+void ParseScheduler::wait_idle()
+{
+  std::unique_lock lock(_mutex);
+  _idle_cv.wait(lock, [this] { return _running == 0 && _queues[0].empty() && _queues[1].empty(); });
+}
+
+size_t ParseScheduler::num_queued(Priority priority) const
+{
+  std::lock_guard lock(_mutex);
+  return _queues[int(priority)].size();
+}
+
+void ParseScheduler::work()
+{
+  set_timeline_thread_name("scheduler worker");
+  ExifData data;
+  std::unique_lock lock(_mutex);
+  while (true) {
+    _work_cv.wait(lock, [this] { return _stopping || !_queues[0].empty() || !_queues[1].empty(); });
+    if (_stopping) {
+      break;
+    }
+    auto &queue = _queues[0].empty() ? _queues[1] : _queues[0];
+    auto node = queue.extract(queue.begin());
+    _running++;
+    const bool timeline = timeline_enabled();
+    if (timeline) [[unlikely]] {
+      record_timeline_counter("scheduler_queued", _queues[0].size() + _queues[1].size());
+    }
+    lock.unlock();
+
+    Request &request = node.mapped();
+    {
+      std::string path = timeline ? request.path.string() : std::string();
+      TimelineSpan span("file", path);
+      if (request.token.cancelled()) {
+        // Stale requests are skipped without touching the file.
+        data.reset();
+        request.callback(data, ParseStatus{.error = PARSE_ERROR(CANCELLED, "Parse was cancelled", nullptr)});
+      } else {
+        CancellationScope scope(request.token);
+        ParseStatus status = read_exif_into(data, request.path, _level);
+        request.callback(data, status);
+      }
+    }
+    node = {};
+
+    lock.lock();
+    _running--;
+    if (_running == 0 && _queues[0].empty() && _queues[1].empty()) {
+      _idle_cv.notify_all();
+    }
+  }
+}
+
+}  // namespace nexif
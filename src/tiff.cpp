@@ -1,6 +1,7 @@
 #include "neonexif/tiff.hpp"
 #include "neonexif/tiff_tags.hpp"
 #include "neonexif/reader.hpp"
+#include "neonexif/layout_cache.hpp"
 
 #include <cassert>
 #include <cstring>
@@ -10,9 +11,11 @@
 namespace nexif {
 namespace makernote::nikon {
 std::optional<ParseError> parse_makernote(Reader &r, ExifData &data);
+std::optional<ParseError> resolve_lens(Reader &r, ExifData &data);
 }
 namespace makernote::canon {
 std::optional<ParseError> parse_makernote(Reader &r, ExifData &data);
+std::optional<ParseError> resolve_lens(Reader &r, ExifData &data);
 }
 
 namespace tiff {
@@ -23,7 +26,7 @@ ifd_entry read_ifd_entry(Reader &r)
   e.tag = r.read_u16();
   e.type = (DType)r.read_u16();
   if (!(e.type >= DType::BYTE && e.type <= DType::DOUBLE)) {
-    r.warnings.emplace_back("Unknown IFD entry data type", nullptr);
+    LOG_WARNING(r, "Unknown IFD entry data type", nullptr);
   };
   e.count = r.read_u32();
   r.read_4bytes(e.data);
@@ -44,7 +47,7 @@ ParseResult<DateTime> parse_date_time(std::string_view str)
 {
   ASSERT_OR_PARSE_ERROR(str.length() >= 18, CORRUPT_DATA, "DateTime value not long enough", str.data());
   int Y, M, D, h, m, s;
-  DEBUG_PRINT("Date string: %.*s\n", int(str.length()), str.data());
+  NEXIF_TRACE_MESSAGE("Date string: %.*s\n", int(str.length()), str.data());
   std::sscanf(str.data(), "%04d:%02d:%02d %02d:%02d:%02d", &Y, &M, &D, &h, &m, &s);
   DateTime dt;
   dt.year = Y, dt.month = M, dt.day = D;
@@ -52,80 +55,6 @@ ParseResult<DateTime> parse_date_time(std::string_view str)
   return dt;
 }
 
-void debug_print_ifd_entry(Reader &r, const ifd_entry &e, const char *tag_name)
-{
-  if (enable_debug_print) {
-    constexpr size_t cap = 1024;
-    char buf[cap];
-    int len = 0;
-#define PRINT(args...) \
-  if (cap > len)       \
-  len += std::snprintf(buf + len, cap - len, ##args)
-    PRINT(
-      "IFD entry {0x%04x %-20s, %x:%-10s, %6d, %02x%02x%02x%02x} ",
-      e.tag, tag_name, (int)e.type, to_str(e.type), e.count,
-      e.data[0], e.data[1], e.data[2], e.data[3]
-    );
-    if (e.size() > 4) {
-      // offset!
-      PRINT("@0x%x -> ", e.offset(r));
-    }
-    if (e.count < 80) {
-      if (e.type == DType::ASCII) {
-        if (e.count <= 4) {
-          PRINT("\"%.*s\"", e.count, (const char *)e.data);
-        } else {
-          auto sv = r.data_view(e.offset(r), e.count);
-          if (sv) {
-            PRINT("\"%.*s\"", e.count, sv.value().data());
-          } else {
-            PRINT("[out of bounds]");
-          }
-        }
-      } else {
-        for (int i = 0; i < e.count; ++i) {
-#define PRINT_IF_TYPE(_etype, _ctype, _fmt, _args...)               \
-  if (e.type == _etype) {                                           \
-    ParseResult<_ctype> _r = fetch_entry_value<_ctype>(e, i, r);    \
-    if (_r) {                                                       \
-      _ctype v = _r.value();                                        \
-      PRINT(_fmt, ##_args);                                         \
-    } else {                                                        \
-      ParseError err = _r.error();                                  \
-      PRINT("[%s:%s:%s]", to_str(err.code), err.message, err.what); \
-    }                                                               \
-    continue;                                                       \
-  }
-          PRINT_IF_TYPE(DType::SHORT, uint16_t, "%u ", (unsigned)v);
-          PRINT_IF_TYPE(DType::SSHORT, int16_t, "%d ", (int)v)
-          PRINT_IF_TYPE(DType::BYTE, uint8_t, "0x%02x ", (int)v);
-          PRINT_IF_TYPE(DType::SBYTE, int8_t, "0x%02x ", (int)v)
-          PRINT_IF_TYPE(DType::UNDEFINED, uint8_t, "0x%02x ", (int)v);
-          PRINT_IF_TYPE(DType::LONG, uint32_t, "%u ", (unsigned)v);
-          PRINT_IF_TYPE(DType::SLONG, int32_t, "%d ", (int)v);
-          PRINT_IF_TYPE(DType::FLOAT, float, "%f ", v);
-          PRINT_IF_TYPE(DType::DOUBLE, double, "%f ", v);
-          PRINT_IF_TYPE(DType::RATIONAL, rational64u, "%u/%u ", v.num, v.denom);
-          PRINT_IF_TYPE(DType::SRATIONAL, rational64s, "%d/%d ", v.num, v.denom);
-
-          PRINT("[CORRUPT_DATA:Unknown DType]");
-          break;
-        }
-      }
-    } else {
-      PRINT(" (ommited)");
-    }
-#undef PRINT_IF_TYPE
-#undef PRINT
-    debug_print_fn(buf);
-  }
-}  // namespace tiff
-
-void debug_print_ifd_entry(Reader &r, const ifd_entry &e, const char *(*tag_to_str)(uint16_t tag))
-{
-  debug_print_ifd_entry(r, e, tag_to_str(e.tag));
-}
-
 const char *to_str(uint16_t tag, uint16_t ifd_bit)
 {
   NEXIF_ALL_IFD0_TAGS(NEXIF_TAG_TO_STR);
@@ -141,6 +70,7 @@ std::optional<ParseError> parse_subsectime_to_millis(Reader &r, const ifd_entry
     std::memcpy(buf, &entry.data, s);
   } else {
     std::memcpy(buf, r.data + entry.offset(r), std::min(int32_t(sizeof(buf)), s));
+    r.count_read(entry.offset(r), std::min(int32_t(sizeof(buf)), s));
   }
   buf[std::min(15, s)] = 0;
   int val = std::atoi(buf);
@@ -159,58 +89,151 @@ std::optional<ParseError> parse_subsectime_to_millis(Reader &r, const ifd_entry
   return std::nullopt;
 }
 
-ParseResult<bool> find_subifd(Reader &r, const ifd_entry &entry, const char *tag_str)
+ParseResult<bool> find_subifd(Reader &r, const ifd_entry &entry)
 {
   if (entry.tag == uint16_t(TagId::exif_offset)) {
-    ASSERT_OR_PARSE_ERROR(entry.type == DType::LONG, CORRUPT_DATA, "IFD EXIF type wrong", tag_str);
-    ASSERT_OR_PARSE_ERROR(entry.count == 1, CORRUPT_DATA, "Only one IDF EXIF offset expected", tag_str);
+    ASSERT_OR_PARSE_ERROR(entry.type == DType::LONG, CORRUPT_DATA, "IFD EXIF type wrong", "exif_offset");
+    ASSERT_OR_PARSE_ERROR(entry.count == 1, CORRUPT_DATA, "Only one IDF EXIF offset expected", "exif_offset");
     uint32_t offset = entry.offset(r);
-    DEBUG_PRINT("Found EXIF SubIFD offset: %d", offset);
+    NEXIF_TRACE_MESSAGE("Found EXIF SubIFD offset: %d", offset);
     r.subifd_refs.push_back({offset, 0, Reader::SubIFDRef::EXIF});
     return true;
   }
   if (entry.tag == uint16_t(TagId::sub_ifd_offset)) {
-    ASSERT_OR_PARSE_ERROR(entry.type == DType::LONG, CORRUPT_DATA, "SubIFD datatype wrong", tag_str);
+    ASSERT_OR_PARSE_ERROR(entry.type == DType::LONG, CORRUPT_DATA, "SubIFD datatype wrong", "sub_ifd_offset");
     for (int i = 0; i < entry.count; ++i) {
       DECL_OR_RETURN(uint32_t, offset, fetch_entry_value<uint32_t>(entry, i, r));
-      DEBUG_PRINT("Found SubIFD: %d", offset);
+      NEXIF_TRACE_MESSAGE("Found SubIFD: %d", offset);
       r.subifd_refs.push_back({offset, 0, Reader::SubIFDRef::OTHER});
     }
     return true;
   }
   if (entry.tag == uint16_t(TagId::makernote) || entry.tag == uint16_t(TagId::makernote_alt)) {
-    ASSERT_OR_PARSE_ERROR(entry.type == DType::UNDEFINED, CORRUPT_DATA, "MakerNote datatype wrong", tag_str);
+    ASSERT_OR_PARSE_ERROR(entry.type == DType::UNDEFINED, CORRUPT_DATA, "MakerNote datatype wrong", "makernote");
     uint32_t offset = entry.offset(r);
-    DEBUG_PRINT("Found MakerNote: offset=%d size=%d", offset, entry.count);
+    NEXIF_TRACE_MESSAGE("Found MakerNote: offset=%d size=%d", offset, entry.count);
     r.subifd_refs.push_back({offset, entry.count, Reader::SubIFDRef::MAKERNOTE});
     return true;
   }
   return false;
 }
-#define FIND_SUBIFDS()                                     \
-  {                                                        \
-    ParseResult<bool> pr = find_subifd(r, entry, tag_str); \
-    if (!pr) {                                             \
-      return pr.error();                                   \
-    } else if (pr.value()) {                               \
-      continue;                                            \
-    }                                                      \
+#define FIND_SUBIFDS()                            \
+  {                                               \
+    ParseResult<bool> pr = find_subifd(r, entry); \
+    if (!pr) {                                    \
+      return pr.error();                          \
+    } else if (pr.value()) {                      \
+      continue;                                   \
+    }                                             \
   }
 
-std::optional<ParseError> parse_exif_ifd(Reader &r, ExifData &data, uint32_t exif_offset, uint32_t *next_offset)
+namespace {
+
+uint64_t fnv1a(uint64_t hash, const char *data, size_t length)
 {
-  RETURN_IF_OPT_ERROR(r.seek(exif_offset));
+  for (size_t i = 0; i < length; ++i) {
+    hash = (hash ^ uint8_t(data[i])) * 0x100000001b3ull;
+  }
+  return hash;
+}
 
-  uint16_t num_entries = r.read_u16();
-  DEBUG_PRINT("Num EXIF IFD entries: %d", num_entries);
-  assert(num_entries < 1000);
-  Indenter indenter;
+constexpr uint64_t FNV_OFFSET_BASIS = 0xcbf29ce484222325ull;
+constexpr uint32_t IFD_ENTRY_SIZE = 12;
+
+/** Over the tag id and type of every entry; both are the first four bytes. */
+uint64_t tag_checksum(const char *entries, uint16_t num_entries)
+{
+  uint64_t hash = FNV_OFFSET_BASIS;
   for (int i = 0; i < num_entries; ++i) {
+    hash = fnv1a(hash, entries + i * IFD_ENTRY_SIZE, 4);
+  }
+  return hash;
+}
+
+/**
+ * Visits the entries of one IFD. When replaying a layout template, only the
+ * entries the parser used when the template was learned are visited. When
+ * recording one, the entries that turn out to be used are noted down: the
+ * loop body reports the ones that fell through all tag parsers.
+ */
+struct EntryWalk {
+  uint32_t entries_offset{0};
+  uint16_t num_entries{0};
+  const IfdLayout *replay{nullptr};
+  LayoutTemplate *recording{nullptr};
+  size_t recording_idx{0};
+
+  int num_visits() const
+  {
+    return replay ? int(replay->used_entries.size()) : num_entries;
+  }
+
+  /** Positions the reader at the entry of visit `k`. */
+  void visit(Reader &r, int k)
+  {
+    if (replay) {
+      r.ptr = entries_offset + IFD_ENTRY_SIZE * replay->used_entries[k];
+    } else if (recording) {
+      recording->ifds[recording_idx].used_entries.push_back(k);
+    }
+  }
+
+  void unused()
+  {
+    if (recording) {
+      recording->ifds[recording_idx].used_entries.pop_back();
+    }
+  }
+
+  /** Positions the reader at the offset of the next IFD. */
+  void finish(Reader &r)
+  {
+    r.ptr = entries_offset + IFD_ENTRY_SIZE * num_entries;
+  }
+};
+
+std::optional<ParseError> begin_entry_walk(Reader &r, uint32_t ifd_offset, EntryWalk &walk)
+{
+  RETURN_IF_OPT_ERROR(r.seek(ifd_offset));
+  walk.num_entries = r.read_u16();
+  walk.entries_offset = r.ptr;
+  r.count_ifd(walk.num_entries);
+  if (r.layout_replay == nullptr && r.layout_recording == nullptr) {
+    return std::nullopt;
+  }
+
+  bool in_bounds = uint64_t(walk.entries_offset) + IFD_ENTRY_SIZE * walk.num_entries + 4 <= r.file_length;
+  uint64_t checksum = in_bounds ? tag_checksum(r.data + walk.entries_offset, walk.num_entries) : 0;
+  if (r.layout_replay) {
+    const IfdLayout *layout = r.layout_replay->find(ifd_offset);
+    if (layout == nullptr || !in_bounds || layout->num_entries != walk.num_entries || layout->tag_checksum != checksum) {
+      r.layout_mismatch = true;
+      return PARSE_ERROR(CORRUPT_DATA, "IFD does not match the layout template", nullptr);
+    }
+    walk.replay = layout;
+  } else if (in_bounds) {
+    walk.recording = r.layout_recording;
+    walk.recording_idx = walk.recording->ifds.size();
+    walk.recording->ifds.push_back({ifd_offset, walk.num_entries, checksum, {}});
+  }
+  return std::nullopt;
+}
+
+}  // namespace
+
+std::optional<ParseError> parse_exif_ifd(Reader &r, ExifData &data, uint32_t exif_offset, uint32_t *next_offset)
+{
+  data.dirty |= ExifData::DIRTY_EXIF | ExifData::DIRTY_ROOT;  // SubSecTime goes into the root date_time.
+  EntryWalk walk;
+  RETURN_IF_OPT_ERROR(begin_entry_walk(r, exif_offset, walk));
+  NEXIF_TRACE_IFD("Exif", exif_offset, walk.num_entries);
+  STAP_PROBE3(neonexif, ifd__enter, "Exif", exif_offset, walk.num_entries);
+  assert(walk.num_entries < 1000);
+  for (int k = 0; k < walk.num_visits(); ++k) {
     // Read IFD entry.
+    walk.visit(r, k);
     ifd_entry entry = read_ifd_entry(r);
-    const char *tag_str = to_str(entry.tag, IFD_EXIF);
-    debug_print_ifd_entry(r, entry, tag_str);
-    Indenter indenter;
+    NEXIF_TRACE_TAG(entry, IFD_EXIF);
 
     FIND_SUBIFDS();
 
@@ -225,17 +248,17 @@ std::optional<ParseError> parse_exif_ifd(Reader &r, ExifData &data, uint32_t exi
     PARSE_EXIF_TAG(date_time_original);
     PARSE_EXIF_TAG(date_time_digitized);
     NEXIF_PARSE_TAG_CUSTOM(subsectime, IFD_EXIF, {
-      return parse_subsectime_to_millis(r, entry, &data.date_time.value.millis);
+      return parse_subsectime_to_millis(r, entry, &data.date_time().value.millis);
     });
     NEXIF_PARSE_TAG_CUSTOM(subsectime_original, IFD_EXIF, {
-      return parse_subsectime_to_millis(r, entry, &data.exif.date_time_original.value.millis);
+      return parse_subsectime_to_millis(r, entry, &data.exif.date_time_original().value.millis);
     });
     NEXIF_PARSE_TAG_CUSTOM(subsectime_digitized, IFD_EXIF, {
-      return parse_subsectime_to_millis(r, entry, &data.exif.date_time_digitized.value.millis);
+      return parse_subsectime_to_millis(r, entry, &data.exif.date_time_digitized().value.millis);
     });
     NEXIF_PARSE_TAG_CUSTOM(timezone_offset, IFD_EXIF, {
       DECL_OR_RETURN(int16_t, tz, fetch_entry_value<int16_t>(entry, 0, r));
-      data.exif.date_time_original.value.timezone_offset = tz;
+      data.exif.date_time_original().value.timezone_offset = tz;
       return std::nullopt;
     });
 
@@ -253,10 +276,12 @@ std::optional<ParseError> parse_exif_ifd(Reader &r, ExifData &data, uint32_t exi
     PARSE_EXIF_TAG(metadata_editing_software );
 
 #undef PARSE_EXIF_TAG
+    walk.unused();
   }
 
+  walk.finish(r);
   uint32_t next_ifd_offset = r.read_u32();
-  DEBUG_PRINT("Next IFD offset: %d\n", next_ifd_offset);
+  NEXIF_TRACE_IFD_NEXT(next_ifd_offset);
   *next_offset = next_ifd_offset;
 
   return std::nullopt;
@@ -264,23 +289,24 @@ std::optional<ParseError> parse_exif_ifd(Reader &r, ExifData &data, uint32_t exi
 
 std::optional<ParseError> parse_tiff_ifd(Reader &r, ExifData &data, uint32_t ifd_offset, ImageData *current_image, int16_t ifd_type, uint32_t *next_offset)
 {
-  RETURN_IF_OPT_ERROR(r.seek(ifd_offset));
-
-  uint16_t num_entries = r.read_u16();
-  DEBUG_PRINT("IFD at offset: %d -> Num entries: %d", ifd_offset, num_entries);
+  EntryWalk walk;
+  RETURN_IF_OPT_ERROR(begin_entry_walk(r, ifd_offset, walk));
+  NEXIF_TRACE_IFD(ifd_type & IFD_01 ? "TIFF" : "Sub", ifd_offset, walk.num_entries);
+  STAP_PROBE3(neonexif, ifd__enter, ifd_type & IFD_01 ? "TIFF" : "Sub", ifd_offset, walk.num_entries);
 
-  Indenter indenter;
+  if (ifd_type & IFD_01) {
+    data.dirty |= ExifData::DIRTY_ROOT | ExifData::DIRTY_EXIF;  // FocalLength can appear in both.
+  }
 
   // Dummy tags for reading purposes which will be post-processed.
   Tag<uint32_t> tag_subfile_type;
   Tag<uint16_t> tag_oldsubfile_type;
 
-  for (int i = 0; i < num_entries; ++i) {
+  for (int k = 0; k < walk.num_visits(); ++k) {
     // Read IFD entry.
+    walk.visit(r, k);
     ifd_entry entry = read_ifd_entry(r);
-    const char *tag_str = to_str(entry.tag, IFD_01);
-    debug_print_ifd_entry(r, entry, tag_str);
-    Indenter indenter;
+    NEXIF_TRACE_TAG(entry, IFD_01);
 
     FIND_SUBIFDS();
 
@@ -319,24 +345,22 @@ std::optional<ParseError> parse_tiff_ifd(Reader &r, ExifData &data, uint32_t ifd
 
     if (current_image != nullptr) {
 #define PARSE_IFD0_TAG(_name) NEXIF_PARSE_TAG((*current_image), _name, entry, IFD_01)
-      if (ifd_type & IFD_01) {
-        PARSE_IFD0_TAG(image_width);
-        PARSE_IFD0_TAG(image_height);
-        PARSE_IFD0_TAG(bits_per_sample);
-        PARSE_IFD0_TAG(compression);
-        PARSE_IFD0_TAG(photometric_interpretation);
-        PARSE_IFD0_TAG(orientation);
-        PARSE_IFD0_TAG(samples_per_pixel);
-        PARSE_IFD0_TAG(x_resolution);
-        PARSE_IFD0_TAG(y_resolution);
-        PARSE_IFD0_TAG(resolution_unit);
-        PARSE_IFD0_TAG(planar_configuration);
-        PARSE_IFD0_TAG(rows_per_strip);
-        PARSE_IFD0_TAG(strip_offsets);
-        PARSE_IFD0_TAG(strip_byte_counts);
-        PARSE_IFD0_TAG(data_offset);
-        PARSE_IFD0_TAG(data_length);
-      }
+      PARSE_IFD0_TAG(image_width);
+      PARSE_IFD0_TAG(image_height);
+      PARSE_IFD0_TAG(bits_per_sample);
+      PARSE_IFD0_TAG(compression);
+      PARSE_IFD0_TAG(photometric_interpretation);
+      PARSE_IFD0_TAG(orientation);
+      PARSE_IFD0_TAG(samples_per_pixel);
+      PARSE_IFD0_TAG(x_resolution);
+      PARSE_IFD0_TAG(y_resolution);
+      PARSE_IFD0_TAG(resolution_unit);
+      PARSE_IFD0_TAG(planar_configuration);
+      PARSE_IFD0_TAG(rows_per_strip);
+      PARSE_IFD0_TAG(strip_offsets);
+      PARSE_IFD0_TAG(strip_byte_counts);
+      PARSE_IFD0_TAG(data_offset);
+      PARSE_IFD0_TAG(data_length);
 #undef PARSE_IFD0_TAG
     }
     // clang-format on
@@ -347,6 +371,9 @@ std::optional<ParseError> parse_tiff_ifd(Reader &r, ExifData &data, uint32_t ifd
     if (auto result = parse_tag<tiff::tag_old_subfile_type>(r, tag_oldsubfile_type, entry); !result) {
       LOG_WARNING(r, result.error().message, result.error().what);
     }
+    if (entry.tag != uint16_t(TagId::subfile_type) && entry.tag != uint16_t(TagId::old_subfile_type)) {
+      walk.unused();
+    }
   }
 
   if (tag_subfile_type.is_set) {
@@ -361,8 +388,9 @@ std::optional<ParseError> parse_tiff_ifd(Reader &r, ExifData &data, uint32_t ifd
     }
   }
 
+  walk.finish(r);
   uint32_t next_ifd_offset = r.read_u32();
-  DEBUG_PRINT("Next IFD offset: %d\n", next_ifd_offset);
+  NEXIF_TRACE_IFD_NEXT(next_ifd_offset);
   *next_offset = next_ifd_offset;
 
   return std::nullopt;
@@ -370,31 +398,118 @@ std::optional<ParseError> parse_tiff_ifd(Reader &r, ExifData &data, uint32_t ifd
 
 std::optional<ParseError> parse_makernote(Reader &r, ExifData &data, uint32_t offset, uint32_t length)
 {
+  data.dirty |= ExifData::DIRTY_MAKERNOTE | ExifData::DIRTY_EXIF;
+  data.parse_state.makernote_offset = offset;
+  data.parse_state.makernote_length = length;
+  data.parse_state.lens_data_offset = 0;
+  data.parse_state.lens_data_length = 0;
+
   using namespace std::string_view_literals;
   std::string_view magic_nikon = "Nikon\0"sv;
+  r.count_read(offset, magic_nikon.length());
   if (std::memcmp(r.data + offset, magic_nikon.data(), magic_nikon.length()) == 0) {
     Reader mnr(r.warnings);
-    mnr.data = r.data + offset + 10;
-    mnr.file_length = length - 10;
+    r.nest_into(mnr, offset + 10, length - 10);
     mnr.exif_data = &data;
+    NEXIF_TRACE_MAKERNOTE("Nikon", offset, length);
+    STAP_PROBE3(neonexif, makernote, "Nikon", offset, length);
     return makernote::nikon::parse_makernote(mnr, data);
   }
 
-  if (data.make.value.view() == "Canon"sv) {
+  if (data.make().value.view() == "Canon"sv) {
     RETURN_IF_OPT_ERROR(r.seek(offset));
+    NEXIF_TRACE_MAKERNOTE("Canon", offset, length);
+    STAP_PROBE3(neonexif, makernote, "Canon", offset, length);
     return makernote::canon::parse_makernote(r, data);
   }
 
+  NEXIF_TRACE_MAKERNOTE("Unknown", offset, length);
+  STAP_PROBE3(neonexif, makernote, "Unknown", offset, length);
+
   for (int i = 0; i < std::min(16u, length); ++i) {
     uint8_t byte = r.data[offset + i];
-    DEBUG_PRINT(" MakerNote byte %02d: %02x '%c'", i, byte, std::isprint(byte) ? byte : '?');
+    NEXIF_TRACE_MESSAGE(" MakerNote byte %02d: %02x '%c'", i, byte, std::isprint(byte) ? byte : '?');
   }
 
   return PARSE_ERROR(UNKNOWN_FILE_TYPE, "MakerNote of unknown type", nullptr);
 }
 
-std::optional<ParseError> read_tiff(Reader &r, ExifData &data)
+std::optional<ParseError> resolve_makernote_lens(Reader &r, ExifData &data)
+{
+  const ParseState &state = data.parse_state;
+  std::optional<ParseError> error;
+  if (std::holds_alternative<NikonMakernote>(data.makernote)) {
+    ASSERT_OR_PARSE_ERROR(state.makernote_length > 10, CORRUPT_DATA, "Nikon MakerNote too small", nullptr);
+    Reader mnr(r.warnings);
+    r.nest_into(mnr, state.makernote_offset + 10, state.makernote_length - 10);
+    mnr.exif_data = &data;
+    error = makernote::nikon::resolve_lens(mnr, data);
+  } else if (std::holds_alternative<CanonMakernote>(data.makernote)) {
+    error = makernote::canon::resolve_lens(r, data);
+  }
+  STAP_PROBE2(neonexif, lens__resolve, data.makernote.index(), error ? int(error->code) : -1);
+  return error;
+}
+
+namespace {
+
+/**
+ * Parses the SubIFDs and records the location of the Exif IFDs and the
+ * MakerNote for the later parse levels.
+ */
+std::optional<ParseError> process_subifd_refs(Reader &r, ExifData &data)
+{
+  for (int i = 0; i < r.subifd_refs.num; ++i) {
+    auto &ref = r.subifd_refs.values[i];
+    if (ref.parsed) {
+      continue;
+    }
+    RETURN_IF_CANCELLED();
+    ref.parsed = true;
+    uint32_t next_offset = ref.offset;
+    switch (ref.type) {
+      case Reader::SubIFDRef::EXIF:
+        if (data.parse_state.exif_ifd_offsets.num < data.parse_state.exif_ifd_offsets.values.size()) {
+          data.parse_state.exif_ifd_offsets.push_back(ref.offset);
+        } else {
+          LOG_WARNING(r, "Not reading Exif IFD", "There are too many Exif IFDs");
+        }
+        break;
+      case Reader::SubIFDRef::OTHER:
+        do {
+          if (data.num_images >= data.images.size()) {
+            LOG_WARNING(r, "Not reading subIFD", "There are too many SubImages");
+            break;
+          }
+          ImageData *current_image = &data.images[data.num_images++];
+          if (auto error = parse_tiff_ifd(r, data, next_offset, current_image, IFD1, &next_offset)) {
+            if (r.strict_mode) {
+              return error;
+            } else {
+              LOG_WARNING(r, error->message, error->what);
+              break;
+            }
+          }
+        } while (next_offset != 0);
+        break;
+      case Reader::SubIFDRef::MAKERNOTE:
+        data.parse_state.makernote_offset = ref.offset;
+        data.parse_state.makernote_length = ref.length;
+        break;
+      case Reader::SubIFDRef::GPS:
+      case Reader::SubIFDRef::INTEROP:
+        // Unsupported!
+        NEXIF_TRACE_MESSAGE("Unsupported IFD type skipped: %d\n", ref.type);
+        break;
+    }
+  }
+  return std::nullopt;
+}
+
+std::optional<ParseError> walk_tiff(Reader &r, ExifData &data, ParseLevel level)
 {
+  PhaseTimer walk_timer(r.stats, &ParseStats::tiff_walk_ns, "read_tiff");
+  r.count_read(0, 2);
   if (r.data[0] == 'I' && r.data[1] == 'I') {
     r.byte_order = std::endian::little;
   } else if (r.data[0] == 'M' && r.data[1] == 'M') {
@@ -405,16 +520,17 @@ std::optional<ParseError> read_tiff(Reader &r, ExifData &data)
   data.byte_order = r.byte_order;
   RETURN_IF_OPT_ERROR(r.seek(4));
   const uint32_t root_ifd_offset = r.read_u32();
-  DEBUG_PRINT("root IFD offset: %d", root_ifd_offset);
+  NEXIF_TRACE_MESSAGE("root IFD offset: %d", root_ifd_offset);
 
   uint32_t ifd_offset = root_ifd_offset;
   uint16_t ifd_type = IFD0;
   for (int ifd_idx = 0;; ++ifd_idx) {
-    DEBUG_PRINT("move to IFD at offset: %d\n", ifd_offset);
+    RETURN_IF_CANCELLED();
+    NEXIF_TRACE_MESSAGE("move to IFD at offset: %d\n", ifd_offset);
     uint32_t next_ifd_offset;
 
     if (data.num_images >= data.images.size()) {
-      r.warnings.emplace_back("Not reading subIFD", "There are too many SubImages");
+      LOG_WARNING(r, "Not reading subIFD", "There are too many SubImages");
       break;
     }
 
@@ -432,60 +548,143 @@ std::optional<ParseError> read_tiff(Reader &r, ExifData &data)
     }
   }
 
-  for (int i = 0; i < r.subifd_refs.num; ++i) {
-    auto &ref = r.subifd_refs.values[i];
-    uint32_t next_offset = ref.offset;
-    switch (ref.type) {
-      case Reader::SubIFDRef::EXIF:
-        do {
-          if (auto error = parse_exif_ifd(r, data, next_offset, &next_offset)) {
-            if (r.strict_mode) {
-              return error;
-            } else {
-              r.warnings.emplace_back(error->message, error->what);
-              break;
-            }
-          }
-        } while (next_offset != 0);
-        ref.parsed = true;
-        break;
-      case Reader::SubIFDRef::OTHER:
-        do {
-          if (data.num_images >= data.images.size()) {
-            r.warnings.emplace_back("Not reading subIFD", "There are too many SubImages");
-            break;
-          }
-          ImageData *current_image = &data.images[data.num_images++];
-          if (auto error = parse_tiff_ifd(r, data, next_offset, current_image, ifd_type, &next_offset)) {
-            if (r.strict_mode) {
-              return error;
-            } else {
-              r.warnings.emplace_back(error->message, error->what);
-              break;
-            }
-          }
-        } while (next_offset != 0);
-        ref.parsed = true;
-        break;
-      case Reader::SubIFDRef::MAKERNOTE: {
-        if (auto error = parse_makernote(r, data, next_offset, ref.length)) {
+  RETURN_IF_OPT_ERROR(process_subifd_refs(r, data));
+  data.parse_state.level = ParseLevel::CORE;
+  walk_timer.stop();
+  return upgrade_tiff(r, data, level);
+}
+
+/**
+ * Identifies the layout of a file by its IFD0: the offset, and the tag, type
+ * and count of every entry. The values are left out, as they differ per shot.
+ */
+std::optional<uint64_t> ifd0_fingerprint(Reader &r)
+{
+  if (r.file_length < 8 || r.data[0] != r.data[1] || (r.data[0] != 'I' && r.data[0] != 'M')) {
+    return std::nullopt;
+  }
+  r.byte_order = r.data[0] == 'I' ? std::endian::little : std::endian::big;
+  r.ptr = 4;
+  uint32_t ifd_offset = r.read_u32();
+  if (uint64_t(ifd_offset) + 2 > r.file_length) {
+    return std::nullopt;
+  }
+  r.ptr = ifd_offset;
+  uint16_t num_entries = r.read_u16();
+  if (uint64_t(r.ptr) + IFD_ENTRY_SIZE * num_entries > r.file_length) {
+    return std::nullopt;
+  }
+  uint64_t hash = fnv1a(FNV_OFFSET_BASIS, r.data, 8);
+  hash = fnv1a(hash, r.data + ifd_offset, 2);
+  for (int i = 0; i < num_entries; ++i) {
+    hash = fnv1a(hash, r.data + r.ptr + i * IFD_ENTRY_SIZE, 8);
+  }
+  return hash;
+}
+
+}  // namespace
+
+std::optional<ParseError> read_tiff(Reader &r, ExifData &data, ParseLevel level)
+{
+  if (r.layout_session == nullptr) {
+    return walk_tiff(r, data, level);
+  }
+  std::optional<uint64_t> fingerprint = ifd0_fingerprint(r);
+  if (!fingerprint) {
+    return walk_tiff(r, data, level);
+  }
+
+  // The walks read the buffer, so the templates are held by the session.
+  LayoutSession &session = *r.layout_session;
+  if ((session.replay = session.cache->find(*fingerprint))) {
+    const ParseState state = data.parse_state;
+    const size_t num_warnings = r.warnings.size();
+    r.layout_replay = session.replay.get();
+    std::optional<ParseError> error = walk_tiff(r, data, level);
+    r.layout_replay = nullptr;
+    session.replay.reset();
+    if (!r.layout_mismatch) {
+      return error;
+    }
+    NEXIF_TRACE_MESSAGE("Layout template mismatch: falling back to the full walk");
+    session.cache->evict(*fingerprint);
+    r.layout_mismatch = false;
+    // Start over from the state `read_exif()` handed us.
+    data.reset();
+    data.parse_state.tiff_offset = state.tiff_offset;
+    data.parse_state.tiff_length = state.tiff_length;
+    r.warnings.erase(std::next(r.warnings.begin(), num_warnings), r.warnings.end());
+    r.subifd_refs = {};
+  }
+
+  session.recording = std::make_shared<LayoutTemplate>();
+  r.layout_recording = session.recording.get();
+  std::optional<ParseError> error = walk_tiff(r, data, level);
+  r.layout_recording = nullptr;
+  if (!error) {
+    session.cache->insert(*fingerprint, std::move(session.recording));
+  }
+  session.recording.reset();
+  return error;
+}
+
+std::optional<ParseError> upgrade_tiff(Reader &r, ExifData &data, ParseLevel level)
+{
+  ParseState &state = data.parse_state;
+
+#define CONTINUE_OR_RETURN_ERROR(_call)                     \
+  if (auto error = _call) {                                 \
+    if (r.strict_mode) {                                    \
+      return error;                                         \
+    } else {                                                \
+      LOG_WARNING(r, error->message, error->what);          \
+    }                                                       \
+  }
+
+  // Most errors below become warnings, so cancellation is checked out here
+  // too, between the IFDs and levels.
+  if (state.level < ParseLevel::STANDARD && level >= ParseLevel::STANDARD) {
+    PhaseTimer timer(r.stats, &ParseStats::exif_ifd_ns, "exif_ifd");
+    NEXIF_TRACE_MESSAGE("Parse level: %s", to_str(ParseLevel::STANDARD));
+    for (int i = 0; i < state.exif_ifd_offsets.num; ++i) {
+      uint32_t next_offset = state.exif_ifd_offsets.values[i];
+      do {
+        RETURN_IF_CANCELLED();
+        if (auto error = parse_exif_ifd(r, data, next_offset, &next_offset)) {
           if (r.strict_mode) {
             return error;
           } else {
-            r.warnings.emplace_back(error->message, error->what);
+            LOG_WARNING(r, error->message, error->what);
             break;
           }
         }
-        break;
-      }
-      case Reader::SubIFDRef::GPS:
-      case Reader::SubIFDRef::INTEROP:
-        // Unsupported!
-        DEBUG_PRINT("Unsupported IFD type skipped: %d\n", ref.type);
-        break;
+      } while (next_offset != 0);
     }
+    RETURN_IF_OPT_ERROR(process_subifd_refs(r, data));
+    state.level = ParseLevel::STANDARD;
+  }
+
+  if (state.level < ParseLevel::MAKERNOTE && level >= ParseLevel::MAKERNOTE) {
+    PhaseTimer timer(r.stats, &ParseStats::makernote_ns, "makernote");
+    RETURN_IF_CANCELLED();
+    NEXIF_TRACE_MESSAGE("Parse level: %s", to_str(ParseLevel::MAKERNOTE));
+    if (state.makernote_length > 0) {
+      CONTINUE_OR_RETURN_ERROR(parse_makernote(r, data, state.makernote_offset, state.makernote_length));
+      RETURN_IF_CANCELLED();
+    }
+    state.level = ParseLevel::MAKERNOTE;
+  }
+
+  if (state.level < ParseLevel::LENS_RESOLVED && level >= ParseLevel::LENS_RESOLVED) {
+    PhaseTimer timer(r.stats, &ParseStats::lens_resolve_ns, "lens_resolve");
+    RETURN_IF_CANCELLED();
+    NEXIF_TRACE_MESSAGE("Parse level: %s", to_str(ParseLevel::LENS_RESOLVED));
+    CONTINUE_OR_RETURN_ERROR(resolve_makernote_lens(r, data));
+    RETURN_IF_CANCELLED();
+    state.level = ParseLevel::LENS_RESOLVED;
   }
 
+#undef CONTINUE_OR_RETURN_ERROR
   return std::nullopt;
 }
 
@@ -558,7 +757,7 @@ size_t write_tiff_tag_string(IFD_Writer &w, const char *str, uint32_t length)
 }
 
 template <typename TagInfo>
-void write_tiff_tag(IFD_Writer &w, const Tag<typename TagInfo::cpp_type> &tag)
+void write_tiff_tag(IFD_Writer &w, TagView<typename TagInfo::cpp_type> tag)
 {
   if (tag.is_set) {
     using cppt = typename TagInfo::cpp_type;
@@ -574,7 +773,7 @@ void write_tiff_tag(IFD_Writer &w, const Tag<typename TagInfo::cpp_type> &tag)
         dt.hour, dt.minute, dt.second
       );
       if (num != 19) {
-        DEBUG_PRINT("Unexpected date time string length: %s (len = %d)", buffer, num);
+        NEXIF_TRACE_MESSAGE("Unexpected date time string length: %s (len = %d)", buffer, num);
       }
       write_tiff_tag_string<TagInfo>(w, buffer, num + 1);
       char buf_millis[4];
@@ -596,7 +795,7 @@ void write_tiff_tag(IFD_Writer &w, const Tag<typename TagInfo::cpp_type> &tag)
       }
     }
 
-    DEBUG_PRINT("Cannot write tag %04x with count %d", TagInfo::TagId, TagInfo::count_spec::cpp_count);
+    NEXIF_TRACE_MESSAGE("Cannot write tag %04x with count %d", TagInfo::TagId, TagInfo::count_spec::cpp_count);
   }
 }
 
@@ -661,7 +860,7 @@ void add_data_offset_to_non_inlined_values(IFD_Writer &w)
     if (required_bytes > 4) {
       uint32_t value_offset = ifd_entry_offset + (2 + 2 + 4);
       uint32_t offset = w.tags_writer.read_u32(value_offset);
-      DEBUG_PRINT("rewrite 0x%04x offset value: %u to %u", tag, offset, offset + w.data_offset);
+      NEXIF_TRACE_MESSAGE("rewrite 0x%04x offset value: %u to %u", tag, offset, offset + w.data_offset);
       w.tags_writer.overwrite(value_offset, offset + w.data_offset);
       num_adjusted++;
     }
@@ -678,15 +877,15 @@ size_t write_ifd(Writer &w, IFD_Writer &ifd_w)
     + sizeof(uint32_t)                            // offset to next ifd
     ;
   assert(ifd_w.num_tags_written * sizeof(ifd_entry) == ifd_w.tags.size());
-  DEBUG_PRINT(" ifd_offset: %u", ifd_w.ifd_offset);
-  DEBUG_PRINT("data_offset: %u", ifd_w.data_offset);
-  DEBUG_PRINT("tags_size  : %zu", ifd_w.tags.size());
-  DEBUG_PRINT("data_size  : %zu", ifd_w.data.size());
+  NEXIF_TRACE_MESSAGE(" ifd_offset: %u", ifd_w.ifd_offset);
+  NEXIF_TRACE_MESSAGE("data_offset: %u", ifd_w.data_offset);
+  NEXIF_TRACE_MESSAGE("tags_size  : %zu", ifd_w.tags.size());
+  NEXIF_TRACE_MESSAGE("data_size  : %zu", ifd_w.data.size());
   add_data_offset_to_non_inlined_values(ifd_w);
 
   w.write_u16(ifd_w.num_tags_written);
   w.write_all(ifd_w.tags);
-  DEBUG_PRINT("tags data size: %zu", ifd_w.tags.size());
+  NEXIF_TRACE_MESSAGE("tags data size: %zu", ifd_w.tags.size());
   auto next_ifd_offset_pos = w.write_u32(0);  // next-ifd
 
   w.write_all(ifd_w.data);
@@ -715,23 +914,23 @@ size_t write_tiff(Writer &w, const ExifData &data)
   OutstandingOffset outstanding_exif_offset;
 
   assert(root_ifd_offset == 8);
-  DEBUG_PRINT("root ifd offset: %u", root_ifd_offset);
+  NEXIF_TRACE_MESSAGE("root ifd offset: %u", root_ifd_offset);
   w.write_u32(root_ifd_offset);
 
   // Root IFD contains ExifIFD offset
   {
-    Indenter _;
+    NEXIF_TRACE_INDENT();
     IFD_Writer root_ifd{root_ifd_offset};
 
-    write_tiff_tag<tag_copyright>(root_ifd, data.copyright);
-    write_tiff_tag<tag_artist>(root_ifd, data.artist);
-    write_tiff_tag<tag_make>(root_ifd, data.make);
-    write_tiff_tag<tag_model>(root_ifd, data.model);
-    write_tiff_tag<tag_software>(root_ifd, data.software);
-    write_tiff_tag<tag_processing_software>(root_ifd, data.processing_software);
-    write_tiff_tag<tag_date_time>(root_ifd, data.date_time);
-    write_tiff_tag<tag_apex_aperture_value>(root_ifd, data.apex_aperture_value);
-    write_tiff_tag<tag_apex_shutter_speed_value>(root_ifd, data.apex_shutter_speed_value);
+    write_tiff_tag<tag_copyright>(root_ifd, data.copyright());
+    write_tiff_tag<tag_artist>(root_ifd, data.artist());
+    write_tiff_tag<tag_make>(root_ifd, data.make());
+    write_tiff_tag<tag_model>(root_ifd, data.model());
+    write_tiff_tag<tag_software>(root_ifd, data.software());
+    write_tiff_tag<tag_processing_software>(root_ifd, data.processing_software());
+    write_tiff_tag<tag_date_time>(root_ifd, data.date_time());
+    write_tiff_tag<tag_apex_aperture_value>(root_ifd, data.apex_aperture_value());
+    write_tiff_tag<tag_apex_shutter_speed_value>(root_ifd, data.apex_shutter_speed_value());
     outstanding_exif_offset = write_outstanding_tiff_offset_tag<tag_exif_offset>(root_ifd);
     write_ifd(w, root_ifd);
   }
@@ -740,33 +939,33 @@ size_t write_tiff(Writer &w, const ExifData &data)
   {
     exif_ifd_offset = w.current_in_tiff_pos();
     outstanding_exif_offset.set(w, exif_ifd_offset);
-    DEBUG_PRINT("exif ifd offset: %u", exif_ifd_offset);
-    Indenter _;
+    NEXIF_TRACE_MESSAGE("exif ifd offset: %u", exif_ifd_offset);
+    NEXIF_TRACE_INDENT();
     IFD_Writer exif_ifd{exif_ifd_offset};
     write_tiff_tag_scalar<tag_subfile_type>(exif_ifd, 1);
 
-    write_tiff_tag<tag_exposure_time>(exif_ifd, data.exif.exposure_time);
-    write_tiff_tag<tag_f_number>(exif_ifd, data.exif.f_number);
-    write_tiff_tag<tag_focal_length>(exif_ifd, data.exif.focal_length);
-    write_tiff_tag<tag_iso>(exif_ifd, data.exif.iso);
-    write_tiff_tag<tag_exposure_program>(exif_ifd, data.exif.exposure_program);
-    write_tiff_tag<tag_date_time_original>(exif_ifd, data.exif.date_time_original);
-    write_tiff_tag<tag_date_time_digitized>(exif_ifd, data.exif.date_time_digitized);
+    write_tiff_tag<tag_exposure_time>(exif_ifd, data.exif.exposure_time());
+    write_tiff_tag<tag_f_number>(exif_ifd, data.exif.f_number());
+    write_tiff_tag<tag_focal_length>(exif_ifd, data.exif.focal_length());
+    write_tiff_tag<tag_iso>(exif_ifd, data.exif.iso());
+    write_tiff_tag<tag_exposure_program>(exif_ifd, data.exif.exposure_program());
+    write_tiff_tag<tag_date_time_original>(exif_ifd, data.exif.date_time_original());
+    write_tiff_tag<tag_date_time_digitized>(exif_ifd, data.exif.date_time_digitized());
     // TODO: write subsec fields, and timezone offset
 
     // clang-format off
-    write_tiff_tag<tag_camera_owner_name         >(exif_ifd, data.exif.camera_owner_name          );
-    write_tiff_tag<tag_body_serial_number        >(exif_ifd, data.exif.body_serial_number         );
-    write_tiff_tag<tag_lens_specification        >(exif_ifd, data.exif.lens_specification         );
-    write_tiff_tag<tag_lens_make                 >(exif_ifd, data.exif.lens_make                  );
-    write_tiff_tag<tag_lens_model                >(exif_ifd, data.exif.lens_model                 );
-    write_tiff_tag<tag_lens_serial_number        >(exif_ifd, data.exif.lens_serial_number         );
-    write_tiff_tag<tag_image_title               >(exif_ifd, data.exif.image_title                );
-    write_tiff_tag<tag_photographer              >(exif_ifd, data.exif.photographer               );
-    write_tiff_tag<tag_image_editor              >(exif_ifd, data.exif.image_editor               );
-    write_tiff_tag<tag_raw_developing_software   >(exif_ifd, data.exif.raw_developing_software    );
-    write_tiff_tag<tag_image_editing_software    >(exif_ifd, data.exif.image_editing_software     );
-    write_tiff_tag<tag_metadata_editing_software >(exif_ifd, data.exif.metadata_editing_software  );
+    write_tiff_tag<tag_camera_owner_name         >(exif_ifd, data.exif.camera_owner_name()          );
+    write_tiff_tag<tag_body_serial_number        >(exif_ifd, data.exif.body_serial_number()         );
+    write_tiff_tag<tag_lens_specification        >(exif_ifd, data.exif.lens_specification()         );
+    write_tiff_tag<tag_lens_make                 >(exif_ifd, data.exif.lens_make()                  );
+    write_tiff_tag<tag_lens_model                >(exif_ifd, data.exif.lens_model()                 );
+    write_tiff_tag<tag_lens_serial_number        >(exif_ifd, data.exif.lens_serial_number()         );
+    write_tiff_tag<tag_image_title               >(exif_ifd, data.exif.image_title()                );
+    write_tiff_tag<tag_photographer              >(exif_ifd, data.exif.photographer()               );
+    write_tiff_tag<tag_image_editor              >(exif_ifd, data.exif.image_editor()               );
+    write_tiff_tag<tag_raw_developing_software   >(exif_ifd, data.exif.raw_developing_software()    );
+    write_tiff_tag<tag_image_editing_software    >(exif_ifd, data.exif.image_editing_software()     );
+    write_tiff_tag<tag_metadata_editing_software >(exif_ifd, data.exif.metadata_editing_software()  );
     // clang-format on
 
     write_ifd(w, exif_ifd);
@@ -0,0 +1,200 @@
+#include "neonexif/timeline.hpp"
+#include "atomic_file.hpp"
+#include "event_ring.hpp"
+
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <cstdarg>
+#include <cstring>
+#include <memory>
+#include <mutex>
+#include <vector>
+
+namespace nexif {
+
+namespace {
+
+struct Track {
+  int tid;
+  const char *name{nullptr};  ///< Guarded by the registry mutex.
+  EventRing<TimelineEvent, 16384> ring;
+};
+
+struct Registry {
+  std::atomic<bool> enabled{false};
+  std::mutex mutex;
+  std::vector<std::shared_ptr<Track>> tracks;
+  int next_tid{1};
+};
+
+Registry &registry()
+{
+  static Registry r;
+  return r;
+}
+
+thread_local const char *thread_name = nullptr;
+
+/** Created on the first event of a thread. Outlives the thread until drained. */
+Track &thread_track()
+{
+  thread_local std::shared_ptr<Track> track = [] {
+    auto track = std::make_shared<Track>();
+    Registry &reg = registry();
+    std::lock_guard lock(reg.mutex);
+    track->tid = reg.next_tid++;
+    track->name = thread_name;
+    reg.tracks.push_back(track);
+    return track;
+  }();
+  return *track;
+}
+
+/**
+ * Keeps the end of `text`, which tells paths apart better than the start.
+ * Cuts at the start of a UTF-8 code point, so the JSON stays valid UTF-8.
+ */
+void copy_detail(char (&dst)[56], std::string_view text)
+{
+  if (text.length() >= sizeof(dst)) {
+    size_t begin = text.length() - (sizeof(dst) - 1);
+    while (begin < text.length() && (uint8_t(text[begin]) & 0xc0) == 0x80) {
+      begin++;  // A continuation byte.
+    }
+    text = text.substr(begin);
+  }
+  std::memcpy(dst, text.data(), text.length());
+  dst[text.length()] = 0;
+}
+
+void append(std::string &out, const char *fmt, ...) __attribute__((format(printf, 2, 3)));
+void append(std::string &out, const char *fmt, ...)
+{
+  char buffer[256];
+  va_list args;
+  va_start(args, fmt);
+  int len = std::vsnprintf(buffer, sizeof(buffer), fmt, args);
+  va_end(args);
+  out.append(buffer, std::clamp(len, 0, int(sizeof(buffer)) - 1));
+}
+
+void append_json_string(std::string &out, const char *text)
+{
+  out += '"';
+  for (const char *c = text; *c; ++c) {
+    if (*c == '"' || *c == '\\') {
+      out += '\\';
+      out += *c;
+    } else if (uint8_t(*c) < 0x20) {
+      append(out, "\\u%04x", *c);
+    } else {
+      out += *c;
+    }
+  }
+  out += '"';
+}
+
+/** Microseconds, the unit of the format, with the nanoseconds as decimals. */
+void append_us(std::string &out, uint64_t ns)
+{
+  append(out, "%lu.%03lu", ns / 1000, ns % 1000);
+}
+
+}  // namespace
+
+void enable_timeline(bool enabled)
+{
+  registry().enabled.store(enabled, std::memory_order_relaxed);
+}
+
+bool timeline_enabled()
+{
+  return registry().enabled.load(std::memory_order_relaxed);
+}
+
+uint64_t timeline_now_ns()
+{
+  return std::chrono::duration_cast<std::chrono::nanoseconds>(std::chrono::steady_clock::now().time_since_epoch()).count();
+}
+
+void set_timeline_thread_name(const char *name)
+{
+  thread_name = name;
+  if (timeline_enabled()) {
+    Track &track = thread_track();
+    std::lock_guard lock(registry().mutex);
+    track.name = name;
+  }
+}
+
+void record_timeline_span(const char *name, uint64_t begin_ns, uint64_t end_ns, std::string_view detail)
+{
+  TimelineEvent e{.type = TimelineEventType::SPAN, .name = name, .begin_ns = begin_ns, .end_ns = end_ns};
+  copy_detail(e.detail, detail);
+  thread_track().ring.push(e);
+}
+
+void record_timeline_counter(const char *name, int64_t value)
+{
+  thread_track().ring.push({.type = TimelineEventType::COUNTER, .name = name, .begin_ns = timeline_now_ns(), .value = value});
+}
+
+std::string format_chrome_trace()
+{
+  std::string out = "{\"displayTimeUnit\":\"ns\",\"traceEvents\":[";
+  bool first = true;
+  auto begin_event = [&] {
+    out += first ? "\n" : ",\n";
+    first = false;
+  };
+
+  Registry &reg = registry();
+  std::lock_guard lock(reg.mutex);
+  uint64_t dropped = 0;
+  for (const std::shared_ptr<Track> &track : reg.tracks) {
+    begin_event();
+    append(out, "{\"name\":\"thread_name\",\"ph\":\"M\",\"pid\":1,\"tid\":%d,\"args\":{\"name\":", track->tid);
+    if (track->name) {
+      append_json_string(out, track->name);
+    } else {
+      append(out, "\"thread %d\"", track->tid);
+    }
+    out += "}}";
+
+    dropped += track->ring.drain([&](const TimelineEvent &e) {
+      begin_event();
+      out += "{\"name\":";
+      append_json_string(out, e.name);
+      if (e.type == TimelineEventType::SPAN) {
+        out += ",\"cat\":\"neonexif\",\"ph\":\"X\",\"ts\":";
+        append_us(out, e.begin_ns);
+        out += ",\"dur\":";
+        append_us(out, e.end_ns - std::min(e.begin_ns, e.end_ns));
+        append(out, ",\"pid\":1,\"tid\":%d", track->tid);
+        if (e.detail[0]) {
+          out += ",\"args\":{\"detail\":";
+          append_json_string(out, e.detail);
+          out += '}';
+        }
+      } else {
+        out += ",\"ph\":\"C\",\"ts\":";
+        append_us(out, e.begin_ns);
+        append(out, ",\"pid\":1,\"tid\":%d,\"args\":{\"value\":%ld}", track->tid, e.value);
+      }
+      out += '}';
+    });
+  }
+  // The tracks of threads that have exited are no longer needed once empty.
+  std::erase_if(reg.tracks, [](const std::shared_ptr<Track> &track) { return track.use_count() == 1 && track->ring.empty(); });
+
+  append(out, "\n],\"otherData\":{\"dropped_events\":%lu}}\n", dropped);
+  return out;
+}
+
+bool write_chrome_trace(const std::filesystem::path &path)
+{
+  return write_file_atomically(path, format_chrome_trace());
+}
+
+}  // namespace nexif
@@ -0,0 +1,137 @@
+#include "neonexif/trace.hpp"
+#include "neonexif/tiff.hpp"
+#include "event_ring.hpp"
+
+#include <chrono>
+#include <cstdarg>
+#include <memory>
+#include <mutex>
+#include <vector>
+
+namespace nexif {
+
+const char *to_str(TraceEventType t)
+{
+  switch (t) {
+    case TraceEventType::IFD_ENTER: return "IFD_ENTER";
+    case TraceEventType::IFD_EXIT: return "IFD_EXIT";
+    case TraceEventType::TAG: return "TAG";
+    case TraceEventType::WARNING: return "WARNING";
+    case TraceEventType::MAKERNOTE: return "MAKERNOTE";
+    case TraceEventType::MESSAGE: return "MESSAGE";
+  }
+  return "?";
+}
+
+namespace {
+
+using TraceRing = EventRing<TraceEvent, 4096>;
+
+struct Registry {
+  std::mutex mutex;
+  std::vector<std::shared_ptr<TraceRing>> rings;
+};
+
+Registry &registry()
+{
+  static Registry r;
+  return r;
+}
+
+/** Created on the first event of a thread. Outlives the thread until drained. */
+TraceRing &thread_ring()
+{
+  thread_local std::shared_ptr<TraceRing> ring = [] {
+    auto ring = std::make_shared<TraceRing>();
+    Registry &reg = registry();
+    std::lock_guard lock(reg.mutex);
+    reg.rings.push_back(ring);
+    return ring;
+  }();
+  return *ring;
+}
+
+/** Stamps the event, and puts it in the ring of this thread. */
+void push_trace_event(TraceEvent &e)
+{
+  e.time_ns = std::chrono::duration_cast<std::chrono::nanoseconds>(std::chrono::steady_clock::now().time_since_epoch()).count();
+  e.depth = uint8_t(std::clamp(parse_context->indent, 0, 255));
+  thread_ring().push(e);
+}
+
+}  // namespace
+
+void record_trace_event(TraceEvent e)
+{
+  push_trace_event(e);
+  if (parse_context->log) {
+    char line[256];
+    format_trace_event(e, line, sizeof(line));
+    parse_context->log(line);
+  }
+}
+
+void record_trace_message(const char *fmt, ...)
+{
+  char text[256];
+  va_list args;
+  va_start(args, fmt);
+  int len = std::vsnprintf(text, sizeof(text), fmt, args);
+  va_end(args);
+  len = std::clamp(len, 0, int(sizeof(text)) - 1);
+  while (len > 0 && text[len - 1] == '\n') {
+    text[--len] = 0;
+  }
+
+  TraceEvent e{.type = TraceEventType::MESSAGE};
+  std::snprintf(e.text, sizeof(e.text), "%s", text);
+  push_trace_event(e);
+  if (parse_context->log) {
+    // The live log gets the whole message, instead of what fits in the event.
+    char line[300];
+    std::snprintf(line, sizeof(line), "%*s%s", e.depth * 4, "", text);
+    parse_context->log(line);
+  }
+}
+
+int format_trace_event(const TraceEvent &e, char *buffer, size_t size)
+{
+  int indent = e.depth * 4;
+  switch (e.type) {
+    case TraceEventType::IFD_ENTER:
+      return std::snprintf(buffer, size, "%*s%s IFD at offset: %u -> Num entries: %u", indent, "", e.name, e.offset, e.count);
+    case TraceEventType::IFD_EXIT:
+      return std::snprintf(buffer, size, "%*sNext IFD offset: %u", indent, "", e.offset);
+    case TraceEventType::TAG: {
+      const char *name = e.tag_name ? e.tag_name(e.tag, e.ifd_bit) : nullptr;
+      tiff::DType dtype = tiff::DType(e.dtype);
+      return std::snprintf(
+        buffer, size, "%*sIFD entry {0x%04x %-20s, %x:%-10s, %6u, %02x%02x%02x%02x} at %u",
+        indent, "", e.tag, name ? name : "?", e.dtype, tiff::to_str(dtype), e.count,
+        e.data[0], e.data[1], e.data[2], e.data[3], e.offset
+      );
+    }
+    case TraceEventType::WARNING:
+      return std::snprintf(buffer, size, "%*sWarning: %s (what: %s)", indent, "", e.name, e.detail ? e.detail : "");
+    case TraceEventType::MAKERNOTE:
+      return std::snprintf(buffer, size, "%*s%s MakerNote at offset: %u (length %u)", indent, "", e.name, e.offset, e.count);
+    case TraceEventType::MESSAGE:
+      return std::snprintf(buffer, size, "%*s%s", indent, "", e.text);
+  }
+  return std::snprintf(buffer, size, "?");
+}
+
+uint64_t drain_trace_events(const std::function<void(const TraceEvent &)> &fn)
+{
+  Registry &reg = registry();
+  std::lock_guard lock(reg.mutex);
+  uint64_t dropped = 0;
+  for (const std::shared_ptr<TraceRing> &ring : reg.rings) {
+    dropped += ring->drain(fn);
+  }
+  // The rings of threads that have exited are no longer needed once empty.
+  std::erase_if(reg.rings, [](const std::shared_ptr<TraceRing> &ring) { return ring.use_count() == 1 && ring->empty(); });
+  return dropped;
+}
+
+}  // namespace nexif
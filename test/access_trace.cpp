@@ -0,0 +1,121 @@
+#include <cstdio>
+#include <fstream>
+#include <future>
+
+#include "neonexif/access_trace.hpp"
+#include "check.hpp"
+#include "sample_exif_data.hpp"
+
+int main(int argc, char **argv)
+{
+  namespace fs = std::filesystem;
+
+  // Overlapping and adjacent reads coalesce, in the order of the first read.
+  nexif::AccessTrace t;
+  t.add(0, 4);
+  t.add(4, 4);
+  t.add(100, 4);
+  t.add(50, 4);
+  t.add(8, 42);
+  t.add(102, 0);
+  CHECK(t.extents.size() == 2);
+  CHECK(t.extents.size() == 2 && t.extents[0].offset == 0 && t.extents[0].length == 54);
+  CHECK(t.extents.size() == 2 && t.extents[1].offset == 100 && t.extents[1].length == 4);
+  CHECK(t.num_reads == 6 && t.bytes() == 58);
+
+  // The reads of a parse, with offsets in the file.
+  std::vector<uint8_t> jpeg = generate_sample_jpeg(generate_sample_exif_data());
+  const char *buffer = (const char *)jpeg.data();
+  nexif::AccessTrace trace = nexif::trace_read_exif(buffer, jpeg.size());
+  CHECK(trace.file_type == nexif::JPEG && trace.file_size == jpeg.size());
+  CHECK(!trace.extents.empty() && trace.extents[0].offset == 0);
+  CHECK(trace.num_reads > trace.extents.size());
+  for (size_t i = 0; i < trace.extents.size(); ++i) {
+    const nexif::FileExtent &e = trace.extents[i];
+    CHECK(e.length > 0 && e.offset + e.length <= jpeg.size());
+    for (size_t j = i + 1; j < trace.extents.size(); ++j) {
+      const nexif::FileExtent &o = trace.extents[j];
+      CHECK(e.offset + e.length < o.offset || o.offset + o.length < e.offset);
+    }
+  }
+  nexif::ParseStats stats;
+  CHECK(nexif::read_exif(buffer, jpeg.size(), nullptr, nullptr, &stats));
+  CHECK(trace.bytes() <= stats.bytes_touched);
+  // Only while a scope is active.
+  nexif::AccessTrace unused;
+  {
+    nexif::AccessTraceScope scope(unused);
+  }
+  CHECK(nexif::read_exif(buffer, jpeg.size()));
+  CHECK(unused.num_reads == 0);
+
+  // The trace file round trips, and is checked when read.
+  fs::path dir = fs::temp_directory_path() / "neonexif_access_trace";
+  fs::remove_all(dir);
+  fs::create_directories(dir);
+  std::vector<nexif::AccessTrace> traces = {trace, t};
+  CHECK(nexif::write_access_traces(dir / "traces.nxat", traces));
+  auto read = nexif::read_access_traces(dir / "traces.nxat");
+  CHECK(read && read.value().size() == 2);
+  if (read && read.value().size() == 2) {
+    const nexif::AccessTrace &r = read.value()[0];
+    CHECK(r.file_type == trace.file_type && r.file_size == trace.file_size && r.num_reads == trace.num_reads);
+    CHECK(r.extents.size() == trace.extents.size());
+    for (size_t i = 0; i < r.extents.size() && i < trace.extents.size(); ++i) {
+      CHECK(r.extents[i].offset == trace.extents[i].offset && r.extents[i].length == trace.extents[i].length);
+    }
+  }
+  fs::resize_file(dir / "traces.nxat", fs::file_size(dir / "traces.nxat") - 1);
+  read = nexif::read_access_traces(dir / "traces.nxat");
+  CHECK(!read && read.error().code == nexif::ParseError::CORRUPT_DATA);
+  CHECK(!nexif::read_access_traces(dir / "missing.nxat"));
+
+  // The backends read the extents back to back.
+  fs::path file = dir / "sample.jpg";
+  {
+    std::ofstream out(file, std::ios::binary);
+    out.write(buffer, jpeg.size());
+  }
+  std::string expected;
+  for (const nexif::FileExtent &e : trace.extents) {
+    expected.append(buffer + e.offset, e.length);
+  }
+  std::vector<std::unique_ptr<nexif::IoBackend>> backends;
+  backends.push_back(nexif::make_thread_pool_backend(1));
+  if (auto uring = nexif::make_io_uring_backend()) {
+    backends.push_back(std::move(uring));
+  }
+  for (std::unique_ptr<nexif::IoBackend> &backend : backends) {
+    std::vector<nexif::FileExtent> extents = trace.extents;
+    extents.push_back({jpeg.size() - 10, 100});  // Cut off at the end of the file.
+    std::promise<nexif::FileRead> done;
+    backend->read_extents(file, extents, [&](nexif::FileRead &&r) { done.set_value(std::move(r)); });
+    nexif::FileRead r = done.get_future().get();
+    CHECK(!r.error && r.file_size == jpeg.size());
+    CHECK(std::string(r.data.begin(), r.data.end()) == expected + std::string(buffer + jpeg.size() - 10, 10));
+  }
+
+  // Replays, of many files.
+  std::vector<nexif::AccessTrace> many(20, trace);
+  std::vector<fs::path> files(20, file);
+  for (nexif::ReplayBackend backend : {nexif::ReplayBackend::MMAP, nexif::ReplayBackend::PREAD, nexif::ReplayBackend::IO_URING}) {
+    for (bool cold : {true, false}) {
+      auto result = nexif::replay_access_traces(many, files, backend, cold);
+      if (!result && backend == nexif::ReplayBackend::IO_URING) {
+        continue;
+      }
+      CHECK(result);
+      if (result) {
+        CHECK(result.value().files == 20 && result.value().bytes == 20 * trace.bytes());
+        CHECK(result.value().extents == 20 * trace.extents.size());
+      }
+    }
+  }
+  CHECK(!nexif::replay_access_traces(many, std::span(files).first(1), nexif::ReplayBackend::MMAP, false));
+  std::vector<fs::path> missing(20, dir / "missing.jpg");
+  CHECK(!nexif::replay_access_traces(many, missing, nexif::ReplayBackend::PREAD, false));
+
+  fs::remove_all(dir);
+
+  return check_summary();
+}
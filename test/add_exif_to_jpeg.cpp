@@ -21,7 +21,9 @@ int main(int argc, char **argv)
   };
   in.close();
 
-  nexif::enable_debug_print = true;
+  nexif::ParseContext context{.trace = nexif::TRACE_ALL, .log = nexif::default_debug_print};
+
+  nexif::ParseContextScope scope(context);
   nexif::ExifData exif_data = generate_sample_exif_data();
   std::vector<uint8_t> exif_binary = nexif::generate_exif_jpeg_binary_data(exif_data);
 
@@ -0,0 +1,110 @@
+#include <atomic>
+#include <chrono>
+#include <cstdio>
+#include <fstream>
+#include <thread>
+
+#include "neonexif/async.hpp"
+#include "check.hpp"
+#include "sample_exif_data.hpp"
+
+/** A coroutine that starts right away, and is not awaited by anyone. */
+struct Detached {
+  struct promise_type {
+    Detached get_return_object() { return {}; }
+    std::suspend_never initial_suspend() noexcept { return {}; }
+    std::suspend_never final_suspend() noexcept { return {}; }
+    void return_void() {}
+    void unhandled_exception() { std::abort(); }
+  };
+};
+
+struct Counters {
+  int outstanding{0};
+  int parsed{0};
+  int failed{0};
+  int wrong_thread{0};
+};
+
+Detached read_one(std::filesystem::path path, nexif::RunLoop &loop, nexif::IoBackend &backend, std::thread::id loop_thread, Counters &counters)
+{
+  nexif::ParseResult<nexif::ExifData> result = co_await nexif::async_read_exif(path, loop, nexif::ParseLevel::LENS_RESOLVED, backend);
+  counters.wrong_thread += std::this_thread::get_id() != loop_thread;
+  if (result && result.value().make().value.view() == "Nikon" && result.value().exif.iso().value == 1600) {
+    counters.parsed++;
+  } else {
+    counters.failed++;
+  }
+  if (--counters.outstanding == 0) {
+    loop.stop();
+  }
+}
+
+/** Starts `n` reads at once from the loop thread, and runs the loop until all are done. */
+double run_all(const std::vector<std::filesystem::path> &files, int n, nexif::IoBackend &backend, Counters &counters)
+{
+  nexif::RunLoop loop;
+  auto t0 = std::chrono::steady_clock::now();
+  counters.outstanding = n;
+  loop.post([&] {
+    for (int i = 0; i < n; ++i) {
+      read_one(files[i % files.size()], loop, backend, std::this_thread::get_id(), counters);
+    }
+  });
+  loop.run();
+  auto t1 = std::chrono::steady_clock::now();
+  return std::chrono::duration<double, std::milli>(t1 - t0).count();
+}
+
+int main(int argc, char **argv)
+{
+  namespace fs = std::filesystem;
+  fs::path dir = fs::temp_directory_path() / "neonexif_async";
+  fs::remove_all(dir);
+  fs::create_directories(dir);
+  std::vector<uint8_t> jpeg = generate_sample_jpeg(generate_sample_exif_data());
+  std::vector<fs::path> files;
+  for (int i = 0; i < 100; ++i) {
+    files.push_back(dir / ("IMG_" + std::to_string(i) + ".jpg"));
+    std::ofstream out(files.back(), std::ios::binary);
+    out.write((const char *)jpeg.data(), jpeg.size());
+  }
+
+  constexpr int N = 10000;
+  std::unique_ptr<nexif::IoBackend> pool = nexif::make_thread_pool_backend(4);
+  Counters counters;
+  double ms = run_all(files, N, *pool, counters);
+  std::printf("thread pool: %d awaits in %.1fms\n", N, ms);
+  CHECK(counters.parsed == N && counters.failed == 0 && counters.wrong_thread == 0);
+
+  if (std::unique_ptr<nexif::IoBackend> uring = nexif::make_io_uring_backend()) {
+    counters = {};
+    ms = run_all(files, N, *uring, counters);
+    std::printf("io_uring:    %d awaits in %.1fms\n", N, ms);
+    CHECK(counters.parsed == N && counters.failed == 0 && counters.wrong_thread == 0);
+
+    // Destroyed with reads in flight and waiting for room: each one completes.
+    std::atomic<int> completed{0}, cancelled{0};
+    uring = nexif::make_io_uring_backend(4);
+    for (int i = 0; i < 1000; ++i) {
+      uring->read(files[i % files.size()], 1 << 16, [&](nexif::FileRead &&read) {
+        completed++;
+        cancelled += read.error && read.error->code == nexif::ParseError::CANCELLED;
+      });
+    }
+    uring.reset();
+    std::printf("io_uring:    %d of %d reads cancelled at destruction\n", cancelled.load(), completed.load());
+    CHECK(completed == 1000);
+  } else {
+    std::printf("io_uring:    not available\n");
+  }
+
+  // Errors come back through the same path, on the default backend.
+  counters = {};
+  run_all({dir / "missing.jpg"}, 3, nexif::default_io_backend(), counters);
+  CHECK(counters.failed == 3 && counters.wrong_thread == 0);
+
+  fs::remove_all(dir);
+
+  return check_summary();
+}
@@ -0,0 +1,25 @@
+#pragma once
+
+#include <cstdio>
+
+/**
+ * The checks of the tests: a failed `CHECK` prints the condition and counts
+ * it, and `check_summary()` reports the count and makes it the exit code.
+ */
+inline int num_failures = 0;
+
+#define CHECK(_cond)                                           \
+  if (!(_cond)) {                                              \
+    std::printf("\033[31mCheck failed\033[0m: %s\n", #_cond); \
+    num_failures++;                                            \
+  }
+
+inline int check_summary()
+{
+  if (num_failures) {
+    std::printf("%d checks failed.\n", num_failures);
+    return 1;
+  }
+  std::printf("All checks passed.\n");
+  return 0;
+}
@@ -0,0 +1,115 @@
+#include <cstdio>
+#include <fstream>
+#include <string>
+#include <thread>
+#include <vector>
+
+#include "neonexif/neonexif.hpp"
+#include "neonexif/exif_file.hpp"
+#include "check.hpp"
+
+namespace {
+struct TiffBuilder {
+  std::vector<uint8_t> out;
+
+  void u16(uint16_t v) { out.insert(out.end(), {uint8_t(v), uint8_t(v >> 8)}); }
+  void u32(uint32_t v) { u16(v & 0xffff), u16(v >> 16); }
+  void entry(uint16_t tag, uint16_t type, uint32_t count, uint32_t value)
+  {
+    u16(tag), u16(type), u32(count), u32(value);
+  }
+};
+}  // namespace
+
+/**
+ * A little-endian TIFF with a 64x32 raw image in two strips (IFD0), and a
+ * preview of 16x8 pixels (IFD1), followed by the image data.
+ */
+static std::vector<uint8_t> generate_tiff()
+{
+  constexpr uint16_t LONG = 4;
+  constexpr uint32_t ifd0 = 8, ifd1 = ifd0 + 2 + 6 * 12 + 4, arrays = ifd1 + 2 + 5 * 12 + 4;
+  constexpr uint32_t strip0 = arrays + 16, strip1 = strip0 + 100, preview = strip1 + 60;
+  TiffBuilder b;
+  b.out = {'I', 'I', 42, 0};
+  b.u32(ifd0);
+
+  b.u16(6);
+  b.entry(0x00fe, LONG, 1, 0);
+  b.entry(0x0100, LONG, 1, 64);
+  b.entry(0x0101, LONG, 1, 32);
+  b.entry(0x0111, LONG, 2, arrays);
+  b.entry(0x0117, LONG, 2, arrays + 8);
+  b.entry(0x0131, 2, 4, 'N' | 'X' << 8 | 'F' << 16);  // Software, inline.
+  b.u32(ifd1);
+
+  b.u16(5);
+  b.entry(0x00fe, LONG, 1, 1);
+  b.entry(0x0100, LONG, 1, 16);
+  b.entry(0x0101, LONG, 1, 8);
+  b.entry(0x0201, LONG, 1, preview);
+  b.entry(0x0202, LONG, 1, 40);
+  b.u32(0);
+
+  b.u32(strip0), b.u32(strip1);
+  b.u32(100), b.u32(60);
+  b.out.resize(strip0, 0);
+  b.out.resize(strip1, 'a');
+  b.out.resize(preview, 'b');
+  b.out.resize(preview + 40, 'p');
+  return b.out;
+}
+
+int main(int argc, char **argv)
+{
+  std::vector<uint8_t> tiff = generate_tiff();
+  std::filesystem::path path = std::filesystem::temp_directory_path() / "neonexif_exif_file.tif";
+  {
+    std::ofstream out(path, std::ios::binary);
+    out.write((const char *)tiff.data(), tiff.size());
+  }
+
+  auto opened = nexif::ExifFile::open(path);
+  CHECK(opened);
+  if (opened) {
+    nexif::ExifFile file = std::move(opened.value());
+    CHECK(file.fd() >= 0);
+
+    // The ranges only need the core level.
+    auto previews = file.previews();
+    CHECK(file.exif().value().parse_state.level == nexif::ParseLevel::LENS_RESOLVED);
+    CHECK(previews.size() == 1);
+    if (previews.size() == 1) {
+      CHECK(previews[0].image_idx == 1);
+      CHECK(previews[0].width == 16 && previews[0].height == 8);
+      CHECK(file.bytes(previews[0].range) == std::string(40, 'p'));
+    }
+    auto raw = file.raw_ranges();
+    CHECK(raw.size() == 2);
+    if (raw.size() == 2) {
+      CHECK(file.bytes(raw[0]) == std::string(100, 'a'));
+      CHECK(file.bytes(raw[1]) == std::string(60, 'b'));
+    }
+    CHECK(file.bytes({tiff.size() - 1, 2}).empty());
+
+    // The handle, its mapping and its cached results move to another thread.
+    std::thread worker([f = std::move(file)]() mutable {
+      CHECK(f.exif() && f.exif().value().software().value.view() == "NXF");
+      CHECK(f.raw_ranges().size() == 2);
+      f.close();
+      CHECK(!f && f.fd() == -1 && f.previews().empty());
+    });
+    worker.join();
+    CHECK(!file);
+  }
+
+  // Not a file with Exif data: no ranges, but still an answer.
+  std::string garbage(200, 'x');
+  auto wrapped = nexif::ExifFile::wrap(garbage.data(), garbage.size());
+  CHECK(!wrapped.exif() && wrapped.exif().error().code == nexif::ParseError::UNKNOWN_FILE_TYPE);
+  CHECK(wrapped.previews().empty() && wrapped.raw_ranges().empty());
+
+  std::filesystem::remove(path);
+
+  return check_summary();
+}
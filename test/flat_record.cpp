@@ -0,0 +1,109 @@
+#include <cstdio>
+#include <fstream>
+#include <string>
+
+#include "neonexif/neonexif.hpp"
+#include "neonexif/exif_file.hpp"
+#include "neonexif/flat.hpp"
+#include "neonexif/intern_pool.hpp"
+#include "check.hpp"
+#include "sample_exif_data.hpp"
+
+static nexif::ExifData generate_record_data()
+{
+  nexif::ExifData data = generate_sample_exif_data();
+  data.exif.lens_model() = data.store_string_data(std::string(700, 'L'));  // Spills.
+  data.exif.possible_lenses() = nexif::vla<std::string_view, 8>{{"Lens A", "Lens B"}, 2};
+  nexif::CanonMakernote &mn = data.makernote.emplace<nexif::CanonMakernote>();
+  mn.lens_type() = 61182;
+  mn.internal_serial_number() = data.store_string_data("XA1234");
+  data.num_images = 1;
+  data.images[0].image_width() = 6000;
+  data.images[0].image_height() = 4000;
+  return data;
+}
+
+static void check_view(const nexif::FlatExifView &view)
+{
+  CHECK(view.make().is_set && view.make().value.view() == "Nikon");
+  CHECK(view.model().value.view() == "D750");
+  CHECK(view.artist().value.view() == "Martijn Courteaux");
+  CHECK(!view.color_matrix_1().is_set);
+  CHECK(view.date_time().value.monotonic() == nexif::DateTime(2025, 8, 26, 10, 00, 00, 129).monotonic());
+  CHECK(view.exif().iso().value == 1600);
+  CHECK(view.exif().raw_developing_software().value.view() == "NeonRAW");
+  CHECK(view.exif().lens_model().value.view() == std::string(700, 'L'));
+  CHECK(view.possible_lenses().num == 2 && view.possible_lenses().values[1] == "Lens B");
+  CHECK(view.num_images() == 1 && view.image(0).image_width().value == 6000);
+  CHECK(view.nikon_makernote() == nullptr);
+  CHECK(view.canon_makernote() && view.canon_makernote()->lens_type().value == 61182);
+  CHECK(view.canon_makernote() && view.canon_makernote()->internal_serial_number().value.view() == "XA1234");
+}
+
+int main(int argc, char **argv)
+{
+  std::vector<uint8_t> buffer;
+  buffer.push_back(1);  // Forces the record to be padded.
+  size_t offset = nexif::write_flat(generate_record_data(), buffer);
+  CHECK(offset == 8);
+  size_t size = buffer.size() - offset;
+
+  auto view = nexif::FlatExifView::open(buffer.data() + offset, size);
+  CHECK(view);
+  if (view) {
+    check_view(view.value());
+  }
+
+  // Position independent: view a copy of the bytes, through a mapped file.
+  std::filesystem::path path = std::filesystem::temp_directory_path() / "neonexif_flat_record.bin";
+  {
+    std::ofstream out(path, std::ios::binary);
+    out.write((const char *)buffer.data() + offset, size);
+  }
+  buffer.clear();
+  auto file = nexif::ExifFile::open(path);
+  CHECK(file);
+  if (file) {
+    auto mapped = nexif::FlatExifView::open(file.value().data(), file.value().length());
+    CHECK(mapped);
+    if (mapped) {
+      check_view(mapped.value());
+      nexif::InternPool lens_names;
+      nexif::ExifData data = mapped.value().to_exif_data(lens_names);
+      file.value().close();
+      CHECK(data.make().value.view() == "Nikon");
+      CHECK(data.exif.lens_model().value.view() == std::string(700, 'L'));
+      CHECK(data.exif.possible_lenses().value.values[0] == "Lens A");
+      CHECK(std::get<nexif::CanonMakernote>(data.makernote).internal_serial_number().value.view() == "XA1234");
+    }
+  }
+  std::filesystem::remove(path);
+
+  // More strings than one CharData can refer to, together.
+  {
+    nexif::ExifData big = generate_sample_exif_data();
+    big.make() = big.store_string_data(std::string(40000, 'M'));
+    big.model() = big.store_string_data(std::string(40000, 'm'));
+    std::vector<uint8_t> record;
+    nexif::write_flat(big, record);
+    auto big_view = nexif::FlatExifView::open(record.data(), record.size());
+    CHECK(big_view);
+    if (big_view) {
+      nexif::InternPool lens_names;
+      nexif::ExifData copy = big_view.value().to_exif_data(lens_names);
+      CHECK(copy.make().value.view() == std::string(40000, 'M'));
+      CHECK(copy.model().value.view() == std::string(40000, 'm'));
+      CHECK(copy.artist().value.view() == "Martijn Courteaux");
+    }
+  }
+
+  // Records of another schema version are skipped without further checks.
+  std::vector<uint8_t> stale;
+  nexif::write_flat(generate_sample_exif_data(), stale);
+  ((nexif::FlatHeader *)stale.data())->schema_version = nexif::FLAT_SCHEMA_VERSION + 1;
+  auto rejected = nexif::FlatExifView::open(stale.data(), stale.size());
+  CHECK(!rejected && rejected.error().code == nexif::ParseError::UNKNOWN_FILE_TYPE);
+  CHECK(!nexif::FlatExifView::open(stale.data(), sizeof(nexif::FlatHeader) - 1));
+
+  return check_summary();
+}
@@ -0,0 +1,34 @@
+#include <cstdio>
+#include <cstdlib>
+
+#include "synthetic_corpus.hpp"
+
+/**
+ * Writes the synthetic corpus into a directory, for the tests and benchmarks
+ * that take files:
+ *
+ *   generate_corpus <dir> [<max file size in bytes>]
+ */
+int main(int argc, char **argv)
+{
+  if (argc != 2 && argc != 3) {
+    std::printf("Usage: %s <dir> [<max file size in bytes>]\n", argv[0]);
+    return 1;
+  }
+  std::filesystem::path dir = argv[1];
+  uint64_t max_size = argc == 3 ? std::strtoull(argv[2], nullptr, 10) : UINT64_MAX;
+  std::error_code ec;
+  std::filesystem::create_directories(dir, ec);
+  if (ec) {
+    std::printf("Cannot create %s\n", dir.c_str());
+    return 1;
+  }
+  for (const synthetic::CorpusFile &f : synthetic::synthetic_corpus(max_size)) {
+    if (!synthetic::write_corpus_file(dir, f)) {
+      std::printf("Cannot write %s\n", (dir / f.name).c_str());
+      return 1;
+    }
+    std::printf("%s: %lu bytes\n", f.name.c_str(), f.size);
+  }
+  return 0;
+}
@@ -0,0 +1,76 @@
+#include <cstdio>
+#include <string>
+#include <thread>
+
+#include "neonexif/neonexif.hpp"
+#include "neonexif/intern_pool.hpp"
+#include "check.hpp"
+#include "sample_exif_data.hpp"
+
+int main(int argc, char **argv)
+{
+  nexif::InternPool pool;
+  CHECK(pool.find("Nikon") == nexif::InternPool::NONE);
+  uint32_t nikon = pool.intern("Nikon");
+  CHECK(nikon != nexif::InternPool::NONE);
+  CHECK(pool.intern(std::string("Nik") + "on") == nikon);
+  CHECK(pool.find("Nikon") == nikon);
+  CHECK(pool.str(nikon) == "Nikon");
+  CHECK(pool.intern("Canon") != nikon);
+  CHECK(pool.intern("") != nexif::InternPool::NONE);
+
+  // Many threads interning overlapping sets of strings must agree on the ids.
+  constexpr int num_threads = 8;
+  constexpr int num_strings = 5000;
+  std::vector<std::vector<uint32_t>> ids(num_threads, std::vector<uint32_t>(num_strings));
+  std::vector<std::thread> threads;
+  for (int t = 0; t < num_threads; ++t) {
+    threads.emplace_back([&, t]() {
+      for (int i = 0; i < num_strings; ++i) {
+        int s = (i * 7 + t * 131) % num_strings;
+        ids[t][s] = pool.intern("Lens model " + std::to_string(s));
+      }
+    });
+  }
+  for (auto &thread : threads) {
+    thread.join();
+  }
+  for (int s = 0; s < num_strings; ++s) {
+    for (int t = 1; t < num_threads; ++t) {
+      CHECK(ids[t][s] == ids[0][s]);
+    }
+    CHECK(pool.str(ids[0][s]) == "Lens model " + std::to_string(s));
+  }
+  CHECK(pool.size() == num_strings + 3);
+
+  // A full pool refuses new strings, but still finds the ones it holds.
+  {
+    nexif::InternPool small(32);
+    int refused = 0;
+    for (int s = 0; s < 1000; ++s) {
+      std::string str = "Lens model " + std::to_string(s);
+      uint32_t id = small.intern(str);
+      if (id == nexif::InternPool::NONE) {
+        refused++;
+        CHECK(small.find(str) == nexif::InternPool::NONE);
+      } else {
+        CHECK(small.str(id) == str);
+        CHECK(small.intern(str) == id);
+      }
+    }
+    CHECK(small.size() == 32);
+    CHECK(refused == 1000 - 32);
+  }
+
+  nexif::ExifData a = generate_sample_exif_data();
+  nexif::ExifData b = generate_sample_exif_data();
+  nexif::InternedStrings ia = nexif::intern_strings(a, pool);
+  nexif::InternedStrings ib = nexif::intern_strings(b, pool);
+  CHECK(ia.make == nikon);
+  CHECK(ia.make == ib.make);
+  CHECK(ia.model == ib.model);
+  CHECK(pool.str(ia.model) == "D750");
+  CHECK(ia.lens_model == nexif::InternPool::NONE);
+
+  return check_summary();
+}
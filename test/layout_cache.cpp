@@ -0,0 +1,83 @@
+#include <cstdio>
+#include <cstring>
+
+#include "neonexif/layout_cache.hpp"
+#include "check.hpp"
+#include "sample_exif_data.hpp"
+
+/** Renames the first entry with tag `from` into the unknown tag `to`. */
+static bool rename_tag(std::vector<uint8_t> &file, uint16_t from, uint16_t to)
+{
+  const uint8_t le[4] = {uint8_t(from), uint8_t(from >> 8), 2, 0};  // ASCII
+  const uint8_t be[4] = {uint8_t(from >> 8), uint8_t(from), 0, 2};
+  for (size_t i = 0; i + 4 <= file.size(); ++i) {
+    if (std::memcmp(&file[i], le, 4) == 0) {
+      file[i] = uint8_t(to), file[i + 1] = uint8_t(to >> 8);
+      return true;
+    }
+    if (std::memcmp(&file[i], be, 4) == 0) {
+      file[i] = uint8_t(to >> 8), file[i + 1] = uint8_t(to);
+      return true;
+    }
+  }
+  return false;
+}
+
+int main(int argc, char **argv)
+{
+  nexif::ParseContext context{.trace = getenv("NEONEXIF_DEBUG") ? nexif::TRACE_ALL : 0u, .log = nexif::default_debug_print};
+  nexif::ParseContextScope scope(context);
+
+  // The artist becomes a tag the parser does not know, to have an entry to skip.
+  std::vector<uint8_t> burst = generate_sample_jpeg(generate_sample_exif_data());
+  CHECK(rename_tag(burst, 0x013b, 0xc7ff));
+
+  nexif::ExifData reference;
+  CHECK(nexif::read_exif_into(reference, (const char *)burst.data(), burst.size()));
+  CHECK(!reference.artist().is_set);
+
+  nexif::LayoutCache cache;
+  nexif::ExifData data;
+  for (int shot = 0; shot < 3; ++shot) {
+    nexif::ParseStatus status = nexif::read_exif_into(data, (const char *)burst.data(), burst.size(), nexif::ParseLevel::LENS_RESOLVED, &cache);
+    CHECK(status);
+    CHECK(data.make().value.view() == "Nikon");
+    CHECK(data.model().value.view() == "D750");
+    CHECK(data.date_time().value.year == 2025 && data.date_time().value.day == 26);
+    CHECK(data.exif.date_time_original().value.millis == 420);
+    CHECK(data.exif.iso().is_set && data.exif.iso().value == 1600);
+    CHECK(data.exif.raw_developing_software().value.view() == "NeonRAW");
+    CHECK(data.num_images == reference.num_images);
+    CHECK(data.parse_state.exif_ifd_offsets.num == 1);
+  }
+  nexif::LayoutCacheStats stats = cache.stats();
+  CHECK(stats.misses == 1 && stats.hits == 2 && stats.mismatches == 0 && stats.templates == 1);
+
+  // A lower level replays part of the template.
+  CHECK(nexif::read_exif_into(data, (const char *)burst.data(), burst.size(), nexif::ParseLevel::CORE, &cache));
+  CHECK(data.make().value.view() == "Nikon");
+  CHECK(!data.exif.iso().is_set);
+  CHECK(cache.stats().hits == 3);
+
+  // Same IFD0, but a firmware update added a tag to the Exif IFD.
+  nexif::ExifData updated_data = generate_sample_exif_data();
+  updated_data.exif.lens_model() = updated_data.store_string_data("AF-S 24-70mm f/2.8G");
+  std::vector<uint8_t> updated = generate_sample_jpeg(updated_data);
+  CHECK(rename_tag(updated, 0x013b, 0xc7ff));
+  CHECK(nexif::read_exif_into(data, (const char *)updated.data(), updated.size(), nexif::ParseLevel::LENS_RESOLVED, &cache));
+  CHECK(data.exif.lens_model().value.view() == "AF-S 24-70mm f/2.8G");
+  CHECK(data.exif.iso().value == 1600);
+  CHECK(data.num_images == reference.num_images);
+  stats = cache.stats();
+  CHECK(stats.mismatches == 1 && stats.templates == 1);
+
+  // The new layout was learned in its place.
+  CHECK(nexif::read_exif_into(data, (const char *)updated.data(), updated.size(), nexif::ParseLevel::LENS_RESOLVED, &cache));
+  CHECK(data.exif.lens_model().value.view() == "AF-S 24-70mm f/2.8G");
+  CHECK(cache.stats().mismatches == 1);
+
+  cache.clear();
+  CHECK(cache.stats().templates == 0);
+
+  return check_summary();
+}
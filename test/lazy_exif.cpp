@@ -0,0 +1,107 @@
+#include <cstdio>
+#include <cstring>
+
+#include "neonexif/neonexif.hpp"
+#include "neonexif/lazy_exif.hpp"
+#include "check.hpp"
+#include "sample_exif_data.hpp"
+
+template <typename T>
+bool same_tag(nexif::TagView<T> a, nexif::TagView<T> b)
+{
+  if (a.is_set != b.is_set) {
+    return false;
+  }
+  if (!a.is_set) {
+    return true;
+  }
+  if constexpr (std::is_same_v<T, nexif::CharData>) {
+    return a.value.view() == b.value.view();
+  } else if constexpr (std::is_same_v<T, nexif::DateTime>) {
+    return a.value.monotonic() == b.value.monotonic();
+  } else {
+    return std::memcmp(&a.value, &b.value, sizeof(T)) == 0;
+  }
+}
+
+#define CHECK_FIELD(_full, _lazy_field, _name)                                  \
+  if (!same_tag(_full._name(), _lazy_field)) {                                  \
+    std::printf("\033[31mMismatch\033[0m between full and lazy parse: %s\n", #_name); \
+    num_failures++;                                                             \
+  }
+#define CHECK_TAG(_full, _lazy, _name) CHECK_FIELD(_full, _lazy._name(), _name)
+
+void compare(const char *what, const nexif::ExifData &full, nexif::LazyExif &lazy)
+{
+  std::printf("Comparing %s\n", what);
+  CHECK_TAG(full, lazy, make);
+  CHECK_TAG(full, lazy, model);
+  CHECK_TAG(full, lazy, software);
+  CHECK_TAG(full, lazy, artist);
+  CHECK_TAG(full, lazy, copyright);
+  CHECK_TAG(full, lazy, date_time);
+  CHECK_TAG(full, lazy, color_matrix_1);
+  CHECK_TAG(full, lazy, color_matrix_2);
+  CHECK_TAG(full, lazy, as_shot_neutral);
+  CHECK_TAG(full, lazy, apex_aperture_value);
+  CHECK_TAG(full.exif, lazy, exposure_time);
+  CHECK_TAG(full.exif, lazy, f_number);
+  CHECK_TAG(full.exif, lazy, iso);
+  CHECK_TAG(full.exif, lazy, focal_length);
+  CHECK_TAG(full.exif, lazy, date_time_original);
+  CHECK_TAG(full.exif, lazy, date_time_digitized);
+  CHECK_TAG(full.exif, lazy, raw_developing_software);
+  CHECK_TAG(full.exif, lazy, metadata_editing_software);
+  CHECK_TAG(full.exif, lazy, body_serial_number);
+  CHECK_TAG(full.exif, lazy, lens_specification);
+  CHECK_TAG(full.exif, lazy, lens_model);
+
+  if (full.num_images != lazy.num_images()) {
+    std::printf("\033[31mMismatch\033[0m in number of images: %d vs %d\n", full.num_images, lazy.num_images());
+    num_failures++;
+  } else {
+    for (int i = 0; i < full.num_images; ++i) {
+      const nexif::ImageData &img = lazy.image(i);
+      CHECK_FIELD(full.images[i], img.image_width(), image_width);
+      CHECK_FIELD(full.images[i], img.image_height(), image_height);
+      CHECK_FIELD(full.images[i], img.orientation(), orientation);
+      CHECK_FIELD(full.images[i], img.strip_offsets(), strip_offsets);
+    }
+  }
+  if (full.makernote.index() != lazy.makernote().index()) {
+    std::printf("\033[31mMismatch\033[0m in MakerNote type\n");
+    num_failures++;
+  }
+}
+
+int main(int argc, char **argv)
+{
+  nexif::ParseContext context{.trace = getenv("NEONEXIF_DEBUG") ? nexif::TRACE_ALL : 0u, .log = nexif::default_debug_print};
+  nexif::ParseContextScope scope(context);
+
+  std::vector<uint8_t> jpeg = generate_sample_jpeg(generate_sample_exif_data());
+  auto full = nexif::read_exif((const char *)jpeg.data(), jpeg.size());
+  if (!full) {
+    std::printf("Cannot parse sample JPEG: %s\n", full.error().message);
+    return 1;
+  }
+  auto lazy = nexif::read_exif_lazy(nexif::ExifFile::wrap((const char *)jpeg.data(), jpeg.size()));
+  if (!lazy) {
+    std::printf("Cannot index sample JPEG: %s\n", lazy.error().message);
+    return 1;
+  }
+  compare("sample JPEG", full.value(), lazy.value());
+
+  for (int i = 1; i < argc; ++i) {
+    auto full = nexif::read_exif(argv[i]);
+    auto lazy = nexif::read_exif_lazy(argv[i]);
+    if (bool(full) != bool(lazy)) {
+      std::printf("%s: full and lazy parse disagree on success\n", argv[i]);
+      num_failures++;
+    } else if (full) {
+      compare(argv[i], full.value(), lazy.value());
+    }
+  }
+
+  return check_summary();
+}
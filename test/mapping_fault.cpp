@@ -0,0 +1,144 @@
+#include <cstdio>
+#include <fstream>
+#include <string>
+#include <vector>
+
+#include "neonexif/neonexif.hpp"
+#include "neonexif/exif_file.hpp"
+#include "neonexif/layout_cache.hpp"
+#include "neonexif/mapping_guard.hpp"
+#include "check.hpp"
+
+constexpr uint32_t PAGE = 4096;
+constexpr uint32_t MODEL_OFFSET = PAGE;
+constexpr uint32_t EXIF_IFD = 2 * PAGE;
+constexpr char MODEL[] = "NIKON D750";
+
+/**
+ * A little-endian TIFF of three pages, with IFD0 on the first page, its Model
+ * on the second one, and the Exif IFD on the third one.
+ */
+static void write_tiff(const std::filesystem::path &path)
+{
+  std::vector<uint8_t> out = {'I', 'I', 42, 0};
+  auto u16 = [&](uint16_t v) { out.insert(out.end(), {uint8_t(v), uint8_t(v >> 8)}); };
+  auto u32 = [&](uint32_t v) { u16(v & 0xffff), u16(v >> 16); };
+  u32(8);
+  u16(2);
+  u16(0x0110), u16(2), u32(sizeof(MODEL)), u32(MODEL_OFFSET);
+  u16(0x8769), u16(4), u32(1), u32(EXIF_IFD);
+  u32(0);
+  out.resize(MODEL_OFFSET, 0);
+  out.insert(out.end(), MODEL, MODEL + sizeof(MODEL));
+  out.resize(EXIF_IFD, 0);
+  u16(1);
+  u16(0x8827), u16(3), u32(1), u32(200);  // ISO
+  u32(0);
+  out.resize(3 * PAGE, 0);
+
+  std::ofstream f(path, std::ios::binary | std::ios::trunc);
+  f.write((const char *)out.data(), out.size());
+}
+
+static void check_truncated_file(const std::filesystem::path &path, nexif::MappingFaultPolicy policy)
+{
+  nexif::set_mapping_fault_policy(policy);
+  bool retry = policy == nexif::MappingFaultPolicy::RETRY_WITH_PREAD;
+
+  // Truncated before the parse touches the file.
+  write_tiff(path);
+  {
+    auto file = nexif::ExifFile::open(path);
+    CHECK(file);
+    std::filesystem::resize_file(path, 0);
+    if (file) {
+      const auto &exif = file.value().exif();
+      CHECK(!exif);  // Either the fault, or an empty file.
+      CHECK(!exif && nexif::is_mapping_fault(exif.error()) != retry);
+      CHECK(file.value().length() == (retry ? 0 : 3 * PAGE));
+    }
+  }
+
+  // Truncated between two levels of the parse: the Exif IFD is gone.
+  write_tiff(path);
+  {
+    auto file = nexif::ExifFile::open(path);
+    CHECK(file);
+    if (file) {
+      const auto &core = file.value().exif(nexif::ParseLevel::CORE);
+      CHECK(core && core.value().model().value.view() == MODEL);
+      std::filesystem::resize_file(path, PAGE);
+
+      const auto &exif = file.value().exif(nexif::ParseLevel::STANDARD);
+      CHECK(exif && exif.value().model().value.view() == MODEL);
+      CHECK(exif && !exif.value().exif.iso().is_set);
+      CHECK(!exif.warnings.empty());
+      if (!exif.warnings.empty()) {
+        bool faulted = exif.warnings.back().msg == nexif::mapping_fault_error().message;
+        CHECK(faulted != retry);
+      }
+    }
+  }
+
+  // A buffer handed in by the caller is guarded as well.
+  write_tiff(path);
+  {
+    auto file = nexif::ExifFile::open(path);
+    CHECK(file);
+    std::filesystem::resize_file(path, PAGE);
+    if (file) {
+      auto result = nexif::read_exif(file.value().data(), file.value().length());
+      CHECK(!result && nexif::is_mapping_fault(result.error()));
+      nexif::ExifData data;
+      nexif::ParseStatus status = nexif::read_exif_into(data, file.value().data(), file.value().length());
+      CHECK(!status && nexif::is_mapping_fault(status.error.value()));
+
+      // The fault is on the Model, inside the trace scope of IFD0.
+      nexif::ParseContext context{.trace = nexif::TRACE_IFD};
+      nexif::ParseContextScope scope(context);
+      status = nexif::read_exif_into(data, file.value().data(), file.value().length());
+      CHECK(!status && context.indent == 0);
+    }
+  }
+
+  // With a layout cache, the fault hits a template being replayed, and then
+  // one being recorded. A template left behind by the jump shows up as a leak.
+  write_tiff(path);
+  {
+    auto file = nexif::ExifFile::open(path);
+    CHECK(file);
+    if (file) {
+      nexif::LayoutCache cache;
+      nexif::ExifData data;
+      nexif::ParseStatus status = nexif::read_exif_into(data, file.value().data(), file.value().length(), nexif::ParseLevel::STANDARD, &cache);
+      CHECK(status && data.exif.iso().value == 200);
+      CHECK(cache.stats().templates == 1);
+      std::filesystem::resize_file(path, PAGE);
+
+      status = nexif::read_exif_into(data, file.value().data(), file.value().length(), nexif::ParseLevel::STANDARD, &cache);
+      CHECK(!status && nexif::is_mapping_fault(status.error.value()));
+      CHECK(cache.stats().hits == 1);
+
+      nexif::LayoutCache empty_cache;
+      status = nexif::read_exif_into(data, file.value().data(), file.value().length(), nexif::ParseLevel::STANDARD, &empty_cache);
+      CHECK(!status && nexif::is_mapping_fault(status.error.value()));
+      CHECK(empty_cache.stats().templates == 0);
+    }
+  }
+}
+
+int main(int argc, char **argv)
+{
+  std::filesystem::path path = std::filesystem::temp_directory_path() / "neonexif_mapping_fault.tif";
+
+  write_tiff(path);
+  auto intact = nexif::read_exif(path);
+  CHECK(intact && intact.value().exif.iso().value == 200);
+
+  check_truncated_file(path, nexif::MappingFaultPolicy::FAIL);
+  check_truncated_file(path, nexif::MappingFaultPolicy::RETRY_WITH_PREAD);
+
+  std::filesystem::remove(path);
+
+  return check_summary();
+}
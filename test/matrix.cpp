@@ -1,11 +1,13 @@
 #include <cstdio>
 #include <chrono>
+#include <algorithm>
 
 #include "neonexif/neonexif.hpp"
+#include "neonexif/scan_tree.hpp"
 
-#define PRINT_MARK(_tag) std::printf("%s ", data._tag.is_set ? "\033[32mX\033[0m" : "\033[31m_\033[0m");
+#define PRINT_MARK(_tag) std::printf("%s ", data._tag().is_set ? "\033[32mX\033[0m" : "\033[31m_\033[0m");
 
-void print_mark_str(const nexif::Tag<nexif::CharData> &tag, int w)
+void print_mark_str(nexif::TagView<nexif::CharData> tag, int w)
 {
   if (tag.is_set) {
     size_t s = std::min(int(tag.value.length), w);
@@ -41,7 +43,8 @@ void print_col_header(int &col, int w, const char *title)
 
 int main(int argc, char **argv)
 {
-  nexif::enable_debug_print = getenv("NEONEXIF_DEBUG");
+  nexif::ParseContext context{.trace = getenv("NEONEXIF_DEBUG") ? nexif::TRACE_ALL : 0u, .log = nexif::default_debug_print};
+  nexif::ParseContextScope scope(context);
   if (argc != 2) {
     std::printf("Usage: %s <dir>\n", argv[0]);
     return 1;
@@ -72,39 +75,24 @@ int main(int argc, char **argv)
   print_col_header(col, 2, "as_shot_white_xy");
   print_col_header(col, 2, "analog_balance");
 
+  nexif::ExifData data;
   std::filesystem::path dir{argv[1]};
-  std::filesystem::recursive_directory_iterator end;
-  for (std::filesystem::recursive_directory_iterator it{dir}; it != end; ++it) {
-    std::filesystem::path file = *it;
-    if (std::filesystem::status(file).type() != std::filesystem::file_type::regular) {
-      continue;
-    }
-    size_t fs = std::filesystem::file_size(file);
-    if (fs < 20'000) {
-      continue;
-    }
-    if (file.filename() == "silvernode.thumb_db") {
-      continue;
-    }
-    std::string ext = file.extension().generic_string();
-    std::transform(ext.begin(), ext.end(), ext.begin(), [](uint8_t c) { return std::tolower(c); });
-    if (ext == ".exe" || ext == ".zip" || ext == ".7z") {
-      continue;
-    }
+  nexif::ScanOptions options;
+  options.min_file_size = 20'000;
+  options.sink_threads = 1;  // Keeps the rows whole, and `data` to one thread.
+  auto scanned = nexif::scan_tree(dir, options, [&](const nexif::ScannedFile &scanned) {
+    const std::filesystem::path &file = scanned.path;
     std::filesystem::path relpath = file.lexically_relative(dir);
 
     auto t0 = std::chrono::high_resolution_clock::now();
-    nexif::FileType ft;
-    nexif::FileTypeVariant ftv;
-    auto result = nexif::read_exif(file, &ft, &ftv);
+    nexif::ParseStatus status = nexif::read_exif_into(data, file);
     auto t1 = std::chrono::high_resolution_clock::now();
 
-    if (!result) {
-      auto err = result.error();
+    if (!status) {
+      auto err = status.error.value();
       std::printf("%s: Error %s: %s %s\n", relpath.c_str(), nexif::to_str(err.code), err.message, err.what);
-      continue;
+      return;
     }
-    auto data = result.value();
 
     PRINT_MARK(images[0].image_width);
     PRINT_MARK(images[0].image_height);
@@ -131,31 +119,31 @@ int main(int argc, char **argv)
 
     std::printf(" |  ");
 
-    print_mark_str(data.make, 20);
-    print_mark_str(data.model, 25);
-    print_mark_str(data.exif.body_serial_number, 14);
-    if (data.exif.possible_lenses.value.num) {
-      auto name = data.exif.possible_lenses.value.values[0];
+    print_mark_str(data.make(), 20);
+    print_mark_str(data.model(), 25);
+    print_mark_str(data.exif.body_serial_number(), 14);
+    if (data.exif.possible_lenses().value.num) {
+      auto name = data.exif.possible_lenses().value.values[0];
       std::printf(" \033[32m%-*.*s\033[0m", 42, std::min(42, int(name.size())), name.data());
-    } else if (data.exif.lens_model) {
-      //print_mark_str(data.exif.lens_make, 15);
-      print_mark_str(data.exif.lens_model, 42);
+    } else if (data.exif.lens_model()) {
+      //print_mark_str(data.exif.lens_make(), 15);
+      print_mark_str(data.exif.lens_model(), 42);
     } else {
       std::string_view n = "(null)";
       std::printf(" \033[31m%-*.*s\033[0m", 42, int(n.size()), n.data());
     }
-    print_mark_str(data.exif.lens_serial_number, 14);
+    print_mark_str(data.exif.lens_serial_number(), 14);
 
     std::printf("| ");
 
     if (const nexif::ImageData *img = data.full_resolution_image(true)) {
-      printf("%4d x %4d", img->image_width.value_or(0), img->image_height.value_or(0));
+      printf("%4d x %4d", img->image_width().value_or(0), img->image_height().value_or(0));
     } else {
       printf("\033[31mno full-res\033[0m");
     }
     std::printf(" | ");
 
-    if (auto &dt = data.exif.date_time_original; dt.is_set) {
+    if (auto dt = data.exif.date_time_original(); dt.is_set) {
       auto v = dt.value;
       printf(
         "%04d-%02d-%02d %02d:%02d:%02d.%03d+%03d",
@@ -169,8 +157,13 @@ int main(int argc, char **argv)
 
     double us = std::chrono::duration_cast<std::chrono::nanoseconds>(t1 - t0).count() * 1e-3;
     printf(" \033[34m%5.0fus\033[0m", us);
-    printf(" \033[2m\033[33m%8s\033[0m", nexif::to_str(ft, ftv));
+    printf(" \033[2m\033[33m%8s\033[0m", nexif::to_str(data.file_type, data.file_type_variant));
 
     printf("  %s\n", relpath.c_str());
+  });
+  if (!scanned) {
+    std::printf("Error: %s\n", scanned.error().message);
+    return 1;
   }
+  return 0;
 }
@@ -0,0 +1,112 @@
+#include <cstdio>
+#include <cstring>
+#include <fstream>
+#include <sstream>
+#include <thread>
+#include <vector>
+
+#include "neonexif/metrics.hpp"
+#include "check.hpp"
+#include "sample_exif_data.hpp"
+
+int main(int argc, char **argv)
+{
+  using nexif::LatencyHistogram;
+
+  // Buckets: exact at first, then within 1/16th of the value.
+  for (uint64_t v : {0ul, 1ul, 15ul, 16ul, 31ul, 32ul, 1000ul, 123456789ul, (1ul << 40) - 1}) {
+    int b = LatencyHistogram::bucket_of(v);
+    CHECK(LatencyHistogram::bucket_upper_bound(b) >= v);
+    CHECK(b == 0 || LatencyHistogram::bucket_upper_bound(b - 1) < v);
+    CHECK(LatencyHistogram::bucket_upper_bound(b) - v <= v / 16);
+  }
+  CHECK(LatencyHistogram::bucket_of(1ul << 50) == LatencyHistogram::NUM_BUCKETS - 1);
+
+  LatencyHistogram h;
+  CHECK(h.quantile(0.5) == 0);
+  for (uint64_t v = 1; v <= 100000; ++v) {
+    h.record(v);
+  }
+  for (double q : {0.5, 0.99, 0.999}) {
+    double expected = q * 100000;
+    CHECK(h.quantile(q) >= expected && h.quantile(q) <= expected * 1.07);
+  }
+  CHECK(h.quantile(1.0) >= 100000);
+  LatencyHistogram h2 = h;
+  h2.merge(h);
+  CHECK(h2.count == 200000 && h2.quantile(0.5) == h.quantile(0.5));
+
+  std::vector<uint8_t> jpeg = generate_sample_jpeg(generate_sample_exif_data());
+  std::vector<uint8_t> broken = jpeg;
+  broken[broken.size() / 2] ^= 0xff;
+  std::memset(broken.data(), 0, 4);  // No longer a JPEG.
+  auto parse = [](const std::vector<uint8_t> &file) { return nexif::read_exif((const char *)file.data(), file.size()); };
+
+  // Disabled, nothing is recorded.
+  CHECK(!nexif::metrics_enabled());
+  CHECK(parse(jpeg));
+  nexif::MetricsSnapshot snapshot = nexif::scrape_metrics();
+  CHECK(snapshot.series.empty() && snapshot.errors[nexif::ParseError::UNKNOWN_FILE_TYPE] == 0);
+
+  // Threads record into their own shards, and are still counted after they exit.
+  nexif::enable_metrics();
+  constexpr int NUM_THREADS = 8;
+  constexpr int NUM_PARSES = 500;
+  std::vector<std::thread> threads;
+  for (int t = 0; t < NUM_THREADS; ++t) {
+    threads.emplace_back([&, t] {
+      nexif::ExifData data;
+      for (int i = 0; i < NUM_PARSES; ++i) {
+        if (t % 2) {
+          CHECK(nexif::read_exif_into(data, (const char *)jpeg.data(), jpeg.size()));
+        } else {
+          CHECK(parse(jpeg));
+        }
+      }
+      CHECK(!parse(broken));
+    });
+    // Scrapes run concurrently with the parses.
+    nexif::scrape_metrics();
+  }
+  for (std::thread &t : threads) {
+    t.join();
+  }
+
+  // The batch API records every file as well.
+  std::vector<std::span<const char>> buffers(10, std::span<const char>((const char *)jpeg.data(), jpeg.size()));
+  buffers.push_back(std::span<const char>((const char *)broken.data(), broken.size()));
+  auto results = nexif::read_exif_many(buffers);
+  CHECK(results.size() == 11 && results[0] && !results[10]);
+  CHECK(!nexif::read_exif(std::filesystem::path("/nonexistent/file.jpg")));
+
+  snapshot = nexif::scrape_metrics();
+  const nexif::MetricsSnapshot::Series *series = snapshot.find(nexif::JPEG, nexif::STANDARD, "none");
+  CHECK(series != nullptr);
+  CHECK(snapshot.series.size() == 1);
+  if (series) {
+    CHECK(series->latency.count == NUM_THREADS * NUM_PARSES + 10);
+    CHECK(series->latency.quantile(0.5) > 0);
+    CHECK(series->latency.quantile(0.5) <= series->latency.quantile(0.999));
+    std::printf("p50 %.2fus, p99 %.2fus, p999 %.2fus\n", series->latency.quantile(0.5) * 1e-3, series->latency.quantile(0.99) * 1e-3, series->latency.quantile(0.999) * 1e-3);
+  }
+  CHECK(snapshot.errors[nexif::ParseError::UNKNOWN_FILE_TYPE] == NUM_THREADS + 1);
+  CHECK(snapshot.errors[nexif::ParseError::CANNOT_OPEN_FILE] == 1);
+
+  std::string text = nexif::format_prometheus(snapshot);
+  CHECK(text.find("# TYPE nexif_parse_duration_seconds summary\n") != std::string::npos);
+  CHECK(text.find("nexif_parse_duration_seconds{file_type=\"JPEG\",variant=\"standard\",vendor=\"none\",quantile=\"0.99\"} ") != std::string::npos);
+  CHECK(text.find("nexif_parse_duration_seconds_count{file_type=\"JPEG\",variant=\"standard\",vendor=\"none\"} 4010\n") != std::string::npos);
+  CHECK(text.find("nexif_parse_errors_total{code=\"unknown_file_type\"} 9\n") != std::string::npos);
+  CHECK(text.find("nexif_parse_errors_total{code=\"cancelled\"} 0\n") != std::string::npos);
+
+  std::filesystem::path path = std::filesystem::temp_directory_path() / "neonexif_metrics.prom";
+  CHECK(nexif::write_prometheus_file(path));
+  std::ifstream file(path);
+  std::stringstream contents;
+  contents << file.rdbuf();
+  CHECK(contents.str() == text);
+  CHECK(!std::filesystem::exists(path.string() + ".tmp"));
+  std::filesystem::remove(path);
+
+  return check_summary();
+}
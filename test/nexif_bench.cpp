@@ -0,0 +1,495 @@
+#include <algorithm>
+#include <chrono>
+#include <cmath>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <string>
+#include <vector>
+
+#include "neonexif/levenshtein.hpp"
+#include "check.hpp"
+#include "synthetic_corpus.hpp"
+
+/**
+ * Microbenchmarks of the hot kernels of parsing and writing, on the synthetic
+ * corpus, to measure every performance change against the same numbers:
+ *
+ *   nexif_bench [--filter <text>] [--samples <n>] [--sample-us <us>] [--warmup-ms <ms>] [--json <path>]
+ *
+ * Every benchmark is warmed up, which also finds how many operations make a
+ * sample last `--sample-us`, and then timed for `--samples` samples. Reported
+ * are the median time per operation and its median absolute deviation (MAD),
+ * which outliers from interrupts and frequency changes do not skew. With
+ * `--json`, the results are also written as JSON ("-" is stdout).
+ *
+ * Before it is timed, the result of every kernel is checked, so that a
+ * benchmark cannot measure a failing path.
+ */
+
+/** Keeps the compiler from optimizing away a result, or the computation of it. */
+template <typename T>
+inline void do_not_optimize(const T &value)
+{
+  asm volatile("" : : "g"(&value) : "memory");
+}
+
+struct Options {
+  const char *filter{nullptr};
+  const char *json{nullptr};
+  int samples{25};
+  uint64_t sample_ns{2'000'000};
+  uint64_t warmup_ns{50'000'000};
+};
+
+struct Result {
+  std::string name;
+  uint64_t ops_per_sample;
+  int samples;
+  double median_ns;  ///< Per operation.
+  double mad_ns;
+  double min_ns;
+};
+
+static double median(std::vector<double> v)
+{
+  std::sort(v.begin(), v.end());
+  size_t n = v.size();
+  return n % 2 ? v[n / 2] : (v[n / 2 - 1] + v[n / 2]) / 2;
+}
+
+struct Bench {
+  Options options;
+  std::vector<Result> results;
+
+  bool enabled(const std::string &name) const
+  {
+    return options.filter == nullptr || name.find(options.filter) != std::string::npos;
+  }
+
+  static uint64_t now_ns()
+  {
+    return std::chrono::duration_cast<std::chrono::nanoseconds>(std::chrono::steady_clock::now().time_since_epoch()).count();
+  }
+
+  template <typename Op>
+  static uint64_t time_ops(Op &op, uint64_t n)
+  {
+    uint64_t start = now_ns();
+    for (uint64_t i = 0; i < n; ++i) {
+      op();
+    }
+    return now_ns() - start;
+  }
+
+  template <typename Op>
+  void run(const std::string &name, Op &&op)
+  {
+    if (!enabled(name)) {
+      return;
+    }
+    // Warm up, doubling the operations per sample until one takes long enough.
+    uint64_t n = 1;
+    uint64_t warmup_end = now_ns() + options.warmup_ns;
+    while (true) {
+      uint64_t t = time_ops(op, n);
+      if (t >= options.sample_ns && now_ns() >= warmup_end) {
+        break;
+      }
+      if (t < options.sample_ns && n < (uint64_t(1) << 40)) {
+        n *= 2;
+      }
+    }
+
+    std::vector<double> ns_per_op(options.samples);
+    for (double &s : ns_per_op) {
+      s = double(time_ops(op, n)) / n;
+    }
+    double m = median(ns_per_op);
+    std::vector<double> deviations(ns_per_op.size());
+    for (size_t i = 0; i < ns_per_op.size(); ++i) {
+      deviations[i] = std::abs(ns_per_op[i] - m);
+    }
+    Result r{name, n, options.samples, m, median(deviations), *std::min_element(ns_per_op.begin(), ns_per_op.end())};
+    std::printf("%-44s %12.1f %10.1f %7.1f%% %12lu\n", r.name.c_str(), r.median_ns, r.mad_ns, m > 0 ? 100 * r.mad_ns / m : 0.0, r.ops_per_sample);
+    std::fflush(stdout);
+    results.push_back(r);
+  }
+
+  bool write_json(const char *path) const
+  {
+    FILE *f = std::strcmp(path, "-") == 0 ? stdout : std::fopen(path, "w");
+    if (f == nullptr) {
+      return false;
+    }
+    std::fprintf(f, "{\n  \"context\": {\"compiler\": \"%s\", \"assertions\": %s, \"samples\": %d, \"sample_ns\": %lu, \"warmup_ns\": %lu},\n", __VERSION__,
+#ifdef NDEBUG
+                 "false",
+#else
+                 "true",
+#endif
+                 options.samples, options.sample_ns, options.warmup_ns);
+    std::fprintf(f, "  \"benchmarks\": [");
+    for (size_t i = 0; i < results.size(); ++i) {
+      const Result &r = results[i];
+      std::fprintf(
+        f, "%s\n    {\"name\": \"%s\", \"ops_per_sample\": %lu, \"samples\": %d, \"median_ns\": %.3f, \"mad_ns\": %.3f, \"min_ns\": %.3f}",
+        i ? "," : "", r.name.c_str(), r.ops_per_sample, r.samples, r.median_ns, r.mad_ns, r.min_ns
+      );
+    }
+    std::fprintf(f, "\n  ]\n}\n");
+    return f == stdout ? std::fflush(f) == 0 : std::fclose(f) == 0;
+  }
+};
+
+static void init_reader(nexif::Reader &r, const char *data, size_t length, nexif::ExifData *exif_data)
+{
+  r.data = data;
+  r.file_length = length;
+  r.byte_order = data[0] == 'I' ? std::endian::little : std::endian::big;
+  r.exif_data = exif_data;
+}
+
+/**
+ * A TIFF file with one IFD that has an entry of every type the tag parsers
+ * handle, in the given byte order, read back into its entries.
+ */
+struct TagFile {
+  std::vector<uint8_t> bytes;
+  std::vector<nexif::tiff::ifd_entry> entries;
+
+  TagFile(std::endian byte_order)
+  {
+    using namespace nexif::tiff;
+    synthetic::TiffBuilder b{bytes, byte_order};
+    b.write_header();
+    std::vector<uint32_t> strips(32);
+    for (size_t i = 0; i < strips.size(); ++i) {
+      strips[i] = 4096 * (i + 1);
+    }
+    std::vector<uint16_t> camera_settings(46);
+    for (size_t i = 0; i < camera_settings.size(); ++i) {
+      camera_settings[i] = i * 7;
+    }
+    synthetic::Entry color_matrix = b.rationals(tag_color_matrix_1::TagId, {{7034, 10000}, {uint32_t(-1876), 10000}, {uint32_t(-618), 10000}, {uint32_t(-4625), 10000}, {12214, 10000}, {2654, 10000}, {uint32_t(-768), 10000}, {1573, 10000}, {6533, 10000}});
+    color_matrix.type = DType::SRATIONAL;
+    b.set_root(b.write_ifd({
+      b.shorts(0x0001, camera_settings),
+      b.longs(tag_image_width::TagId, {6032}),
+      b.shorts(tag_bits_per_sample::TagId, {8, 8, 8}),
+      b.ascii(tag_make::TagId, "NIKON CORPORATION"),
+      b.longs(tag_strip_offsets::TagId, strips),
+      b.shorts(tag_orientation::TagId, {1}),
+      b.rationals(tag_x_resolution::TagId, {{300, 1}}),
+      b.ascii(tag_date_time::TagId, "2025:07:18 12:10:22"),
+      std::move(color_matrix),
+    }));
+
+    std::list<nexif::ParseWarning> warnings;
+    nexif::Reader r{warnings};
+    init_reader(r, (const char *)bytes.data(), bytes.size(), nullptr);
+    CHECK(!r.seek(4));
+    CHECK(!r.seek(r.read_u32()));
+    uint16_t num = r.read_u16();
+    for (int i = 0; i < num; ++i) {
+      entries.push_back(read_ifd_entry(r));
+    }
+    CHECK(warnings.empty());
+  }
+
+  const nexif::tiff::ifd_entry &entry(uint16_t tag) const
+  {
+    return *std::find_if(entries.begin(), entries.end(), [&](const nexif::tiff::ifd_entry &e) { return e.tag == tag; });
+  }
+};
+
+static const char *order_name(std::endian byte_order)
+{
+  return byte_order == std::endian::little ? "le" : "be";
+}
+
+/** `parse_tag()` of one entry of the `TagFile`, into the tag `get_tag()` picks from an `ExifData`. */
+template <typename TagInfo, typename GetTag, typename Check>
+static void bench_parse_tag(Bench &bench, const char *type, const TagFile &file, std::endian byte_order, GetTag get_tag, Check check)
+{
+  std::string name = std::string("parse_tag/") + type + "/" + order_name(byte_order);
+  if (!bench.enabled(name)) {
+    return;
+  }
+  std::list<nexif::ParseWarning> warnings;
+  nexif::Reader r{warnings};
+  nexif::ExifData data;
+  init_reader(r, (const char *)file.bytes.data(), file.bytes.size(), &data);
+  const nexif::tiff::ifd_entry &entry = file.entry(TagInfo::TagId);
+
+  auto result = nexif::tiff::parse_tag<TagInfo>(r, get_tag(data), entry);
+  CHECK(result && result.value());
+  CHECK(get_tag(data).is_set && check(get_tag(data).value));
+  CHECK(warnings.empty());
+
+  bench.run(name, [&] {
+    data.string_data_ptr = 0;  // Reuse the string storage.
+    auto result = nexif::tiff::parse_tag<TagInfo>(r, get_tag(data), entry);
+    do_not_optimize(result);
+  });
+}
+
+/** `fetch_entry_value()` of every element of an array entry of the `TagFile`. */
+template <typename T>
+static void bench_fetch_array(Bench &bench, const char *type, const TagFile &file, std::endian byte_order, uint16_t tag, T expected_last)
+{
+  const nexif::tiff::ifd_entry &entry = file.entry(tag);
+  std::string name = std::string("fetch_entry_value/") + type + "[" + std::to_string(entry.count) + "]/" + order_name(byte_order);
+  if (!bench.enabled(name)) {
+    return;
+  }
+  std::list<nexif::ParseWarning> warnings;
+  nexif::Reader r{warnings};
+  init_reader(r, (const char *)file.bytes.data(), file.bytes.size(), nullptr);
+
+  auto last = nexif::tiff::fetch_entry_value<T>(entry, entry.count - 1, r);
+  CHECK(last && last.value() == expected_last);
+
+  bench.run(name, [&] {
+    T sum = 0;
+    for (int i = 0; i < int(entry.count); ++i) {
+      auto value = nexif::tiff::fetch_entry_value<T>(entry, i, r);
+      sum += value ? value.value() : 0;
+    }
+    do_not_optimize(sum);
+  });
+}
+
+/**
+ * `resolve_makernote_lens()` of a corpus file parsed up to the MakerNote.
+ * Resolving sets the lens, so every operation starts from a copy of the
+ * parsed data: `exif_data_copy` is that part of the time.
+ */
+static void bench_resolve_lens(Bench &bench, const std::string &name, const synthetic::CorpusFile &f)
+{
+  if (!bench.enabled(name)) {
+    return;
+  }
+  std::vector<char> bytes = synthetic::file_contents(f);
+  auto parsed = nexif::read_exif(bytes.data(), bytes.size(), nexif::ParseLevel::MAKERNOTE);
+  CHECK(parsed && !parsed.value().exif.lens_model().is_set);
+  if (!parsed) {
+    return;
+  }
+  const nexif::ExifData &pristine = parsed.value();
+  nexif::ExifData data;
+  std::list<nexif::ParseWarning> warnings;
+  nexif::Reader r{warnings};
+  init_reader(r, bytes.data() + pristine.parse_state.tiff_offset, pristine.parse_state.tiff_length, &data);
+
+  data = pristine;
+  CHECK(!nexif::tiff::resolve_makernote_lens(r, data));
+  CHECK(data.exif.lens_model().value.view() == f.lens_model);
+  CHECK(warnings.empty());
+
+  bench.run(name, [&] {
+    data = pristine;
+    auto error = nexif::tiff::resolve_makernote_lens(r, data);
+    do_not_optimize(error);
+  });
+}
+
+static void usage()
+{
+  std::printf("Usage: nexif_bench [--filter <text>] [--samples <n>] [--sample-us <us>] [--warmup-ms <ms>] [--json <path>]\n");
+}
+
+int main(int argc, char **argv)
+{
+  using namespace nexif::tiff;
+  Bench bench;
+  for (int i = 1; i < argc; ++i) {
+    std::string_view arg = argv[i];
+    if (i + 1 == argc) {
+      usage();
+      return 1;
+    }
+    if (arg == "--filter") {
+      bench.options.filter = argv[++i];
+    } else if (arg == "--samples") {
+      bench.options.samples = std::max(1, std::atoi(argv[++i]));
+    } else if (arg == "--sample-us") {
+      bench.options.sample_ns = std::strtoull(argv[++i], nullptr, 10) * 1000;
+    } else if (arg == "--warmup-ms") {
+      bench.options.warmup_ns = std::strtoull(argv[++i], nullptr, 10) * 1000000;
+    } else if (arg == "--json") {
+      bench.options.json = argv[++i];
+    } else {
+      usage();
+      return 1;
+    }
+  }
+
+#ifndef NDEBUG
+  std::printf("Assertions are enabled: this is not a Release build.\n");
+#endif
+  std::printf("%-44s %12s %10s %8s %12s\n", "benchmark", "median ns", "MAD ns", "MAD", "ops/sample");
+
+  std::vector<synthetic::CorpusFile> corpus = synthetic::synthetic_corpus(1024 * 1024);
+  auto corpus_file = [&](std::string_view name) -> const synthetic::CorpusFile & {
+    return *std::find_if(corpus.begin(), corpus.end(), [&](const synthetic::CorpusFile &f) { return f.name == name; });
+  };
+
+  // Detection, on one file of every container.
+  for (const char *name : {"jpeg_app0_app1.jpg", "nikon_d750.nef", "canon_eos_700d.cr2", "panasonic_dmc_fz1000.rw2", "fujifilm_x_t2.raf", "minolta_dimage_a200.mrw", "sigma_sd14.x3f"}) {
+    const synthetic::CorpusFile &f = corpus_file(name);
+    std::vector<char> bytes = synthetic::file_contents(f);
+    std::list<nexif::ParseWarning> warnings;
+    nexif::Reader r{warnings};
+    init_reader(r, bytes.data(), bytes.size(), nullptr);
+    CHECK(guess_file_type(r) && r.file_type == f.file_type && r.file_type_variant == f.file_type_variant);
+    bench.run(std::string("guess_file_type/") + name, [&] {
+      r.ptr = 0;
+      bool found = guess_file_type(r);
+      do_not_optimize(found);
+    });
+  }
+
+  // The IFD entries and the tag parsers, for both byte orders: big endian
+  // swaps every value.
+  for (std::endian byte_order : {std::endian::little, std::endian::big}) {
+    TagFile file(byte_order);
+    {
+      std::list<nexif::ParseWarning> warnings;
+      nexif::Reader r{warnings};
+      init_reader(r, (const char *)file.bytes.data(), file.bytes.size(), nullptr);
+      CHECK(!r.seek(4));
+      uint32_t first_entry = r.read_u32() + 2;
+      bench.run(std::string("read_ifd_entry/") + order_name(byte_order), [&] {
+        r.ptr = first_entry;
+        ifd_entry e = read_ifd_entry(r);
+        do_not_optimize(e);
+      });
+    }
+
+    // clang-format off
+    bench_parse_tag<tag_make>(bench, "ascii", file, byte_order,
+      [](nexif::ExifData &d) { return d.make(); },
+      [](const nexif::CharData &v) { return v.view() == "NIKON CORPORATION"; });
+    bench_parse_tag<tag_orientation>(bench, "short", file, byte_order,
+      [](nexif::ExifData &d) { return d.images[0].orientation(); },
+      [](nexif::Orientation v) { return v == nexif::Orientation(1); });
+    bench_parse_tag<tag_bits_per_sample>(bench, "short[3]", file, byte_order,
+      [](nexif::ExifData &d) { return d.images[0].bits_per_sample(); },
+      [](const auto &v) { return v.num == 3 && v.values[2] == 8; });
+    bench_parse_tag<tag_image_width>(bench, "long", file, byte_order,
+      [](nexif::ExifData &d) { return d.images[0].image_width(); },
+      [](uint32_t v) { return v == 6032; });
+    bench_parse_tag<tag_strip_offsets>(bench, "long[32]", file, byte_order,
+      [](nexif::ExifData &d) { return d.images[0].strip_offsets(); },
+      [](const auto &v) { return v.num == 32 && v.values[31] == 32 * 4096; });
+    bench_parse_tag<tag_x_resolution>(bench, "rational", file, byte_order,
+      [](nexif::ExifData &d) { return d.images[0].x_resolution(); },
+      [](const nexif::rational64u &v) { return v.num == 300 && v.denom == 1; });
+    bench_parse_tag<tag_color_matrix_1>(bench, "srational[9]", file, byte_order,
+      [](nexif::ExifData &d) { return d.color_matrix_1(); },
+      [](const auto &v) { return v.num == 9 && v.values[1].num == -1876; });
+    bench_parse_tag<tag_date_time>(bench, "datetime", file, byte_order,
+      [](nexif::ExifData &d) { return d.date_time(); },
+      [](const nexif::DateTime &v) { return v.year == 2025 && v.second == 22; });
+    // clang-format on
+
+    bench_fetch_array<uint16_t>(bench, "short", file, byte_order, 0x0001, 45 * 7);
+    bench_fetch_array<uint32_t>(bench, "long", file, byte_order, tag_strip_offsets::TagId, 32 * 4096);
+  }
+
+  {
+    auto dt = nexif::tiff::parse_date_time("2025:07:18 12:10:22");
+    CHECK(dt && dt.value().year == 2025 && dt.value().minute == 10);
+    bench.run("parse_date_time", [] {
+      auto dt = nexif::tiff::parse_date_time("2025:07:18 12:10:22");
+      do_not_optimize(dt);
+    });
+  }
+
+  // The lenses: the Nikon LensData cipher, and the lookups in the lens tables.
+  {
+    std::vector<uint8_t> lens_data = synthetic::noise(58, 1);
+    std::vector<uint8_t> plain = lens_data;
+    nexif::makernote::nikon::crypt_lens_data(lens_data.data(), lens_data.size(), "6012345", 21337);
+    CHECK(lens_data != plain);
+    bench.run("nikon/crypt_lens_data[58]", [&] {
+      nexif::makernote::nikon::crypt_lens_data(lens_data.data(), lens_data.size(), "6012345", 21337);
+      do_not_optimize(lens_data[57]);
+    });
+  }
+  {
+    nexif::ExifData data = generate_sample_exif_data();
+    bench.run("exif_data_copy", [&] {
+      nexif::ExifData copy = data;
+      do_not_optimize(copy);
+    });
+  }
+  bench_resolve_lens(bench, "nikon/resolve_lens/f_mount", corpus_file("nikon_d750.nef"));
+  bench_resolve_lens(bench, "nikon/resolve_lens/z_mount", corpus_file("nikon_z_7.nef"));
+  bench_resolve_lens(bench, "canon/resolve_lens", corpus_file("canon_eos_700d.cr2"));
+
+  {
+    nexif::LevenshteinCosts costs{.deletion = 3, .insertion = 3, .capitalizaton = 1, .substitution = 2};
+    std::string_view a = "AF-S Zoom-Nikkor 24-70mm f/2.8G ED";
+    std::string_view b = "AF-S Nikkor 24-70mm f/2.8E ED VR";
+    CHECK(nexif::levenshtein_distance(a, a, costs) == 0 && nexif::levenshtein_distance(a, b, costs) > 0);
+    bench.run("levenshtein_distance", [&] {
+      int d = nexif::levenshtein_distance(a, b, costs);
+      do_not_optimize(d);
+    });
+  }
+  {
+    static constexpr std::array<std::string_view, 8> candidates{
+      "AF-S Zoom-Nikkor 24-70mm f/2.8G ED",
+      "AF-S Nikkor 24-70mm f/2.8E ED VR",
+      "AF-S DX Zoom-Nikkor 17-55mm f/2.8G IF-ED",
+      "Tamron SP 24-70mm f/2.8 Di VC USD (A007)",
+    };
+    nexif::ExifData data;
+    data.exif.lens_model() = data.store_string_data("AF-S NIKKOR 24-70mm f/2.8E ED VR");
+    data.exif.possible_lenses() = {candidates, 4};
+    auto lenses = nexif::resolve_lens_possibilities(data);
+    CHECK(lenses[0] == candidates[1] && lenses[1].empty());
+    bench.run("resolve_lens_possibilities", [&] {
+      auto lenses = nexif::resolve_lens_possibilities(data);
+      do_not_optimize(lenses);
+    });
+  }
+
+  // Writing.
+  {
+    nexif::ExifData data = generate_sample_exif_data();
+    std::vector<uint8_t> out;
+    nexif::Writer w{out};
+    CHECK(write_tiff(w, data) > 0);
+    bench.run("write_tiff", [&] {
+      out.clear();
+      nexif::Writer w{out};
+      size_t size = write_tiff(w, data);
+      do_not_optimize(size);
+    });
+    CHECK(!generate_exif_jpeg_binary_data(data).empty());
+    bench.run("generate_exif_jpeg_binary_data", [&] {
+      std::vector<uint8_t> jpeg = generate_exif_jpeg_binary_data(data);
+      do_not_optimize(jpeg);
+    });
+  }
+
+  // And all of it: parsing every file of the corpus, into reused `ExifData`.
+  for (const synthetic::CorpusFile &f : corpus) {
+    std::vector<char> bytes = synthetic::file_contents(f);
+    nexif::ExifData data;
+    CHECK(nexif::read_exif_into(data, bytes.data(), bytes.size()));
+    bench.run("read_exif_into/" + f.name, [&] {
+      nexif::ParseStatus status = nexif::read_exif_into(data, bytes.data(), bytes.size());
+      do_not_optimize(status);
+    });
+  }
+
+  if (bench.options.json && !bench.write_json(bench.options.json)) {
+    std::printf("Cannot write %s\n", bench.options.json);
+    return 1;
+  }
+  return check_summary();
+}
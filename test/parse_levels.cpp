@@ -0,0 +1,77 @@
+#include <cstdio>
+#include <cstring>
+
+#include "neonexif/neonexif.hpp"
+#include "neonexif/exif_file.hpp"
+#include "check.hpp"
+#include "sample_exif_data.hpp"
+
+/** Parses at the CORE level, upgrades, and compares against a full parse. */
+void check_upgrade(const char *what, const char *buffer, size_t length)
+{
+  std::printf("Checking %s\n", what);
+  auto full = nexif::read_exif(buffer, length);
+  auto core = nexif::read_exif(buffer, length, nexif::ParseLevel::CORE);
+  CHECK(bool(full) == bool(core));
+  if (!full || !core) {
+    return;
+  }
+  nexif::ExifData &data = core.value();
+  CHECK(data.parse_state.level == nexif::ParseLevel::CORE);
+  CHECK(data.make().value.view() == full.value().make().value.view());
+  CHECK(!data.exif.exposure_time().is_set);
+  CHECK(data.makernote.index() == 0);
+
+  auto standard = nexif::upgrade(data, nexif::ParseLevel::STANDARD, buffer, length);
+  CHECK(standard && standard.value() == nexif::ParseLevel::STANDARD);
+  CHECK(data.makernote.index() == 0);
+
+  auto resolved = nexif::upgrade(data, nexif::ParseLevel::LENS_RESOLVED, buffer, length);
+  CHECK(resolved && resolved.value() == nexif::ParseLevel::LENS_RESOLVED);
+
+  const nexif::ExifData &ref = full.value();
+  CHECK(data.num_images == ref.num_images);
+  CHECK(data.exif.exposure_time().is_set == ref.exif.exposure_time().is_set);
+  CHECK(data.exif.exposure_time().value == ref.exif.exposure_time().value);
+  CHECK(data.exif.iso().value == ref.exif.iso().value);
+  CHECK(data.exif.date_time_original().value.monotonic() == ref.exif.date_time_original().value.monotonic());
+  CHECK(data.exif.metadata_editing_software().value.view() == ref.exif.metadata_editing_software().value.view());
+  CHECK(data.exif.lens_model().value.view() == ref.exif.lens_model().value.view());
+  CHECK(data.exif.body_serial_number().value.view() == ref.exif.body_serial_number().value.view());
+  CHECK(data.exif.possible_lenses().value.num == ref.exif.possible_lenses().value.num);
+  CHECK(data.makernote.index() == ref.makernote.index());
+}
+
+int main(int argc, char **argv)
+{
+  nexif::ParseContext context{.trace = getenv("NEONEXIF_DEBUG") ? nexif::TRACE_ALL : 0u, .log = nexif::default_debug_print};
+  nexif::ParseContextScope scope(context);
+
+  std::vector<uint8_t> jpeg = generate_sample_jpeg(generate_sample_exif_data());
+  check_upgrade("sample JPEG", (const char *)jpeg.data(), jpeg.size());
+
+  {
+    // An offset and length whose 32-bit sum wraps to inside the buffer.
+    auto core = nexif::read_exif((const char *)jpeg.data(), jpeg.size(), nexif::ParseLevel::CORE);
+    CHECK(bool(core));
+    if (core) {
+      nexif::ExifData data = core.value();
+      data.parse_state.tiff_offset = 0xfffffff0u;
+      data.parse_state.tiff_length = 0x20;
+      auto upgraded = nexif::upgrade(data, nexif::ParseLevel::STANDARD, (const char *)jpeg.data(), jpeg.size());
+      CHECK(!upgraded && upgraded.error().code == nexif::ParseError::CORRUPT_DATA);
+    }
+  }
+
+  for (int i = 1; i < argc; ++i) {
+    auto file = nexif::ExifFile::open(argv[i]);
+    if (!file) {
+      std::printf("Cannot open %s\n", argv[i]);
+      num_failures++;
+      continue;
+    }
+    check_upgrade(argv[i], file.value().data(), file.value().length());
+  }
+
+  return check_summary();
+}
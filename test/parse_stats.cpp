@@ -0,0 +1,72 @@
+#include <chrono>
+#include <cstdio>
+#include <cstring>
+
+#include "check.hpp"
+#include "sample_exif_data.hpp"
+
+/** Milliseconds for `n` parses of `file`, with or without stats. */
+double time_parses(const std::vector<uint8_t> &file, int n, bool with_stats)
+{
+  nexif::ParseStats stats;
+  auto t0 = std::chrono::steady_clock::now();
+  for (int i = 0; i < n; ++i) {
+    auto result = nexif::read_exif((const char *)file.data(), file.size(), nullptr, nullptr, with_stats ? &stats : nullptr);
+    CHECK(result);
+  }
+  auto t1 = std::chrono::steady_clock::now();
+  return std::chrono::duration<double, std::milli>(t1 - t0).count();
+}
+
+int main(int argc, char **argv)
+{
+  std::vector<uint8_t> jpeg = generate_sample_jpeg(generate_sample_exif_data());
+  const char *buffer = (const char *)jpeg.data();
+
+  nexif::ParseStats stats;
+  auto result = nexif::read_exif(buffer, jpeg.size(), nullptr, nullptr, &stats);
+  CHECK(result);
+  const nexif::ExifData &data = result.value();
+  const nexif::ParseState &state = data.parse_state;
+  CHECK(stats.detect_ns > 0);
+  CHECK(stats.tiff_walk_ns > 0);
+  CHECK(stats.exif_ifd_ns > 0);
+  CHECK(stats.lens_lookup_ns <= stats.lens_resolve_ns);
+  CHECK(stats.num_ifds == 2);  // IFD0 and the Exif IFD.
+  CHECK(stats.num_entries > 10);
+  CHECK(stats.bytes_touched >= stats.num_entries * 12);
+  // Offsets are of the whole file, not of the TIFF structure in it.
+  CHECK(stats.highest_offset > state.tiff_offset);
+  CHECK(stats.highest_offset <= state.tiff_offset + state.tiff_length);
+  CHECK(stats.string_bytes == data.string_data_used() && stats.string_bytes > 0);
+  CHECK(stats.num_warnings == 0);
+
+  // Only the levels that were parsed are timed, and the stats start over.
+  auto core = nexif::read_exif(buffer, jpeg.size(), nexif::ParseLevel::CORE, nullptr, nullptr, &stats);
+  CHECK(core);
+  CHECK(stats.tiff_walk_ns > 0);
+  CHECK(stats.exif_ifd_ns == 0 && stats.makernote_ns == 0 && stats.lens_resolve_ns == 0);
+  CHECK(stats.num_ifds == 1);
+
+  // Warnings are counted.
+  std::vector<uint8_t> broken = jpeg;
+  const uint8_t exif_ifd_le[] = {0x69, 0x87, 0x04, 0x00, 0x01, 0x00, 0x00, 0x00};
+  for (size_t p = 0; p + 12 <= broken.size(); ++p) {
+    if (!std::memcmp(&broken[p], exif_ifd_le, 8)) {
+      std::memset(&broken[p + 8], 0x7f, 4);
+      break;
+    }
+  }
+  auto lenient = nexif::read_exif((const char *)broken.data(), broken.size(), nullptr, nullptr, &stats);
+  CHECK(lenient && lenient.warnings.size() == 1);
+  CHECK(stats.num_warnings == 1);
+  CHECK(stats.num_ifds == 1);
+
+  constexpr int N = 20000;
+  time_parses(jpeg, N, false);
+  double without = time_parses(jpeg, N, false);
+  double with = time_parses(jpeg, N, true);
+  std::printf("%d parses: %.1fms without stats, %.1fms with stats\n", N, without, with);
+
+  return check_summary();
+}
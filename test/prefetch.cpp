@@ -0,0 +1,59 @@
+#include <cstdio>
+#include <fstream>
+#include <string>
+#include <vector>
+
+#include "neonexif/neonexif.hpp"
+#include "neonexif/prefetch.hpp"
+#include "check.hpp"
+#include "sample_exif_data.hpp"
+
+int main(int argc, char **argv)
+{
+  namespace fs = std::filesystem;
+  fs::path root = fs::temp_directory_path() / "neonexif_prefetch";
+  fs::remove_all(root);
+
+  // Two directories, each from another camera, with a missing file in between.
+  std::vector<fs::path> paths;
+  const char *models[] = {"D750", "Z6"};
+  for (const char *model : models) {
+    fs::create_directories(root / model);
+    nexif::ExifData data = generate_sample_exif_data();
+    data.model() = data.store_string_data(model);
+    std::vector<uint8_t> jpeg = generate_sample_jpeg(data);
+    for (int i = 0; i < 6; ++i) {
+      paths.push_back(root / model / ("img" + std::to_string(i) + ".jpg"));
+      std::ofstream out(paths.back(), std::ios::binary);
+      out.write((const char *)jpeg.data(), jpeg.size());
+    }
+    paths.push_back(root / model / "missing.jpg");
+  }
+
+  nexif::PrefetchingReader reader(4);
+  size_t next = 0;
+  reader.read_all(paths, [&](size_t idx, const nexif::ExifData &data, const nexif::ParseStatus &status) {
+    CHECK(idx == next++);
+    bool missing = paths[idx].filename() == "missing.jpg";
+    CHECK(bool(status) != missing);
+    if (status) {
+      CHECK(data.model().value.view() == paths[idx].parent_path().filename().string());
+    }
+  });
+  CHECK(next == paths.size());
+
+  std::vector<nexif::ProfileStats> stats = reader.profile_stats();
+  CHECK(stats.size() == 2);
+  if (stats.size() == 2) {
+    CHECK(stats[0].key == "JPEG Nikon D750" && stats[1].key == "JPEG Nikon Z6");
+    // Only the first file of each camera model was prefetched before its
+    // profile existed; the last D750 profile was used for the first Z6 files.
+    CHECK(stats[0].files > 0 && stats[1].files > 0);
+    CHECK(stats[1].hit_rate() == 1.0);
+    CHECK(stats[0].touched_pages > 0 && stats[0].hit_pages == stats[0].touched_pages);
+  }
+
+  fs::remove_all(root);
+
+  return check_summary();
+}
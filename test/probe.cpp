@@ -0,0 +1,78 @@
+#include <cstdio>
+#include <cstring>
+#include <fstream>
+#include <string>
+#include <vector>
+
+#include "neonexif/neonexif.hpp"
+#include "neonexif/probe.hpp"
+#include "check.hpp"
+#include "sample_exif_data.hpp"
+
+static nexif::ProbeResult probe_bytes(std::string_view head, uint64_t file_size = 1000)
+{
+  return nexif::probe(head.data(), head.size(), file_size);
+}
+
+int main(int argc, char **argv)
+{
+  using namespace std::string_view_literals;
+  using nexif::ProbeFormat;
+
+  // A JPEG with JFIF APP0 first: the Exif APP1 segment is found behind it.
+  std::vector<uint8_t> jpeg = generate_sample_jpeg(generate_sample_exif_data());
+  std::vector<uint8_t> app0 = {0xff, 0xe0, 0x00, 0x10, 'J', 'F', 'I', 'F', 0, 1, 1, 0, 0, 1, 0, 1, 0, 0};
+  jpeg.insert(jpeg.begin() + 2, app0.begin(), app0.end());
+  nexif::ProbeResult p = nexif::probe((const char *)jpeg.data(), nexif::PROBE_SIZE, jpeg.size());
+  CHECK(p.format == ProbeFormat::JPEG && p.parsable && p.file_type == nexif::JPEG);
+  CHECK(p.ranges.num == 1 && p.ranges.values[0].offset == 20);
+  CHECK(p.ranges.values[0].length == uint64_t(jpeg[22] << 8 | jpeg[23]) + 2);
+
+  p = probe_bytes("II*\0\x10\0\0\0"sv);
+  CHECK(p.format == ProbeFormat::TIFF && p.parsable && p.file_type_variant == nexif::STANDARD);
+  CHECK(p.ranges.num == 1 && p.ranges.values[0].offset == 16 && p.ranges.values[0].length == 0);
+  p = probe_bytes("IIU\0\x18\0\0\0"sv);
+  CHECK(p.parsable && p.file_type_variant == nexif::TIFF_RW2);
+  p = probe_bytes("IIRO\x08\0\0\0"sv);
+  CHECK(p.parsable && p.file_type_variant == nexif::TIFF_ORF);
+  p = probe_bytes("MM\0*\0\0\0\x08"sv, 50);
+  CHECK(p.format == ProbeFormat::TIFF && !p.parsable);  // Too small.
+  p = probe_bytes("II\x1a\0\0\0HEAPCCDR"sv);
+  CHECK(p.format == ProbeFormat::CIFF && p.parsable);
+  CHECK(p.ranges.num == 1 && p.ranges.values[0].offset == 26 && p.ranges.values[0].length == 1000 - 26);
+  p = probe_bytes("FUJIFILMCCD-RAW 0201"sv);
+  CHECK(p.format == ProbeFormat::FUJIFILM_RAF && p.parsable);
+  p = probe_bytes("\0MRM\0\0\x01\0"sv);
+  CHECK(p.format == ProbeFormat::MRW && p.ranges.values[0].length == 8 + 256);
+  p = probe_bytes("FOVb\0\0\0\0"sv);
+  CHECK(p.format == ProbeFormat::SIGMA_FOVB && p.parsable);
+
+  // Recognized, but not parsable.
+  p = probe_bytes("II+\0\x08\0\0\0\x20\0\0\0\0\0\0\0"sv);
+  CHECK(p.format == ProbeFormat::BIG_TIFF && !p.parsable && p.ranges.values[0].offset == 32);
+  p = probe_bytes("\0\0\0\x18" "ftypcrx \0\0\0\x01"sv);
+  CHECK(p.format == ProbeFormat::BMFF && !p.parsable && std::string_view(p.brand) == "crx ");
+  p = probe_bytes("\x89PNG\r\n\x1a\n\0\0\0\x0dIHDR"sv);
+  CHECK(p.format == ProbeFormat::PNG && !p.parsable);
+  p = probe_bytes("RIFF\0\x10\0\0WEBPVP8X"sv);
+  CHECK(p.format == ProbeFormat::WEBP && !p.parsable);
+  p = probe_bytes("%PDF-1.7\n"sv);
+  CHECK(p.format == ProbeFormat::UNKNOWN && !p.parsable);
+  p = probe_bytes("II*"sv, 3);
+  CHECK(p.format == ProbeFormat::UNKNOWN);
+
+  // Through a file, which is then parsed as the probe predicted.
+  std::filesystem::path path = std::filesystem::temp_directory_path() / "neonexif_probe.jpg";
+  {
+    std::ofstream out(path, std::ios::binary);
+    out.write((const char *)jpeg.data(), jpeg.size());
+  }
+  auto from_file = nexif::probe(path);
+  CHECK(from_file && from_file.value().format == ProbeFormat::JPEG && from_file.value().file_size == jpeg.size());
+  nexif::FileType ft;
+  CHECK(nexif::read_exif(path, &ft) && ft == from_file.value().file_type);
+  std::filesystem::remove(path);
+  CHECK(!nexif::probe(path));
+
+  return check_summary();
+}
@@ -0,0 +1,46 @@
+#include <cstdio>
+
+#include "neonexif/neonexif.hpp"
+#include "check.hpp"
+#include "sample_exif_data.hpp"
+
+int main(int argc, char **argv)
+{
+  nexif::ParseContext context{.trace = getenv("NEONEXIF_DEBUG") ? nexif::TRACE_ALL : 0u, .log = nexif::default_debug_print};
+  nexif::ParseContextScope scope(context);
+
+  std::vector<uint8_t> full_jpeg = generate_sample_jpeg(generate_sample_exif_data());
+
+  nexif::ExifData minimal;
+  minimal.make() = minimal.store_string_data("Canon");
+  minimal.model() = minimal.store_string_data("EOS 700D");
+  minimal.copyright() = minimal.store_string_data("Some copyright notice, long enough for a valid file");
+  std::vector<uint8_t> minimal_jpeg = generate_sample_jpeg(minimal);
+
+  // One output object, reused for every parse, as a worker loop would.
+  nexif::ExifData data;
+  for (int round = 0; round < 2; ++round) {
+    nexif::ParseStatus status = nexif::read_exif_into(data, (const char *)full_jpeg.data(), full_jpeg.size());
+    CHECK(status);
+    CHECK(data.file_type == nexif::JPEG);
+    CHECK(data.make().value.view() == "Nikon");
+    CHECK(data.exif.iso().is_set && data.exif.iso().value == 1600);
+    CHECK(data.exif.raw_developing_software().value.view() == "NeonRAW");
+
+    status = nexif::read_exif_into(data, (const char *)minimal_jpeg.data(), minimal_jpeg.size());
+    CHECK(status);
+    CHECK(data.make().value.view() == "Canon");
+    CHECK(data.model().value.view() == "EOS 700D");
+    CHECK(!data.artist().is_set);
+    CHECK(!data.date_time().is_set);
+    CHECK(!data.exif.iso().is_set);
+    CHECK(!data.exif.raw_developing_software().is_set);
+    CHECK(data.dirty != nexif::ExifData::DIRTY_ALL);
+  }
+
+  nexif::ParseStatus status = nexif::read_exif_into(data, (const char *)full_jpeg.data(), 50);
+  CHECK(!status);
+  CHECK(!data.make().is_set);
+
+  return check_summary();
+}
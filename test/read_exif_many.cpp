@@ -0,0 +1,90 @@
+#include <chrono>
+#include <cstdio>
+
+#include "neonexif/neonexif.hpp"
+#include "check.hpp"
+#include "sample_exif_data.hpp"
+
+int main(int argc, char **argv)
+{
+  nexif::ParseContext context{.trace = getenv("NEONEXIF_DEBUG") ? nexif::TRACE_ALL : 0u, .log = nexif::default_debug_print};
+  nexif::ParseContextScope scope(context);
+
+  std::vector<std::vector<uint8_t>> files;
+  files.push_back(generate_sample_jpeg(generate_sample_exif_data()));
+
+  nexif::ExifData minimal;
+  minimal.make() = minimal.store_string_data("Canon");
+  minimal.model() = minimal.store_string_data("EOS 700D");
+  minimal.copyright() = minimal.store_string_data("Some copyright notice, long enough for a valid file");
+  files.push_back(generate_sample_jpeg(minimal));
+
+  // The TIFF structure of the APP1 segment, without the JPEG around it.
+  std::vector<uint8_t> app1 = nexif::generate_exif_jpeg_binary_data(generate_sample_exif_data());
+  files.emplace_back(app1.begin() + 10, app1.end());
+
+  files.emplace_back(200, 0);                                   // Unknown file type.
+  files.emplace_back(files[0].begin(), files[0].begin() + 50);  // Too small.
+
+  std::vector<std::span<const char>> batch;
+  for (int i = 0; i < 2000; ++i) {
+    const std::vector<uint8_t> &f = files[(i * 7) % files.size()];
+    batch.emplace_back((const char *)f.data(), f.size());
+  }
+
+  std::vector<nexif::ParseResult<nexif::ExifData>> results = nexif::read_exif_many(batch);
+  CHECK(results.size() == batch.size());
+  for (size_t i = 0; i < batch.size(); ++i) {
+    nexif::ParseResult<nexif::ExifData> expected = nexif::read_exif(batch[i].data(), batch[i].size());
+    const nexif::ParseResult<nexif::ExifData> &result = results[i];
+    CHECK(bool(result) == bool(expected));
+    CHECK(result.warnings.size() == expected.warnings.size());
+    if (!result && !expected) {
+      CHECK(result.error().code == expected.error().code);
+    }
+    if (!result || !expected) {
+      continue;
+    }
+    const nexif::ExifData &a = result.value(), &b = expected.value();
+    CHECK(a.file_type == b.file_type);
+    CHECK(a.make().value.view() == b.make().value.view());
+    CHECK(a.model().value.view() == b.model().value.view());
+    CHECK(a.copyright().value.view() == b.copyright().value.view());
+    CHECK(a.exif.iso().is_set == b.exif.iso().is_set && a.exif.iso().value == b.exif.iso().value);
+    CHECK(a.exif.raw_developing_software().value.view() == b.exif.raw_developing_software().value.view());
+    CHECK(a.num_images == b.num_images);
+    CHECK(a.parse_state.level == b.parse_state.level);
+    CHECK(a.parse_state.tiff_offset == b.parse_state.tiff_offset);
+  }
+  CHECK(results[0] && results[0].value().exif.iso().value == 1600);
+  CHECK(results[1] && results[1].value().file_type == nexif::TIFF);
+  CHECK(!results[2] && results[2].error().code == nexif::ParseError::CORRUPT_DATA);
+  CHECK(results[3] && results[3].value().make().value.view() == "Canon");
+  CHECK(!results[4] && results[4].error().code == nexif::ParseError::UNKNOWN_FILE_TYPE);
+
+  results = nexif::read_exif_many(batch, nexif::ParseLevel::CORE);
+  CHECK(results[0] && results[0].value().make().value.view() == "Nikon");
+  CHECK(results[0] && !results[0].value().exif.iso().is_set);
+  CHECK(results[0] && results[0].value().parse_state.level == nexif::ParseLevel::CORE);
+
+  // Compare with the per-buffer loop, which also keeps all results; the best
+  // of a few rounds each.
+  using clock = std::chrono::steady_clock;
+  double best_loop = 1e30, best_batch = 1e30;
+  for (int round = 0; round < 5; ++round) {
+    auto t0 = clock::now();
+    std::vector<nexif::ParseResult<nexif::ExifData>> loop_results;
+    loop_results.reserve(batch.size());
+    for (std::span<const char> b : batch) {
+      loop_results.push_back(nexif::read_exif(b.data(), b.size()));
+    }
+    auto t1 = clock::now();
+    results = nexif::read_exif_many(batch);
+    auto t2 = clock::now();
+    best_loop = std::min(best_loop, std::chrono::duration<double, std::micro>(t1 - t0).count());
+    best_batch = std::min(best_batch, std::chrono::duration<double, std::micro>(t2 - t1).count());
+  }
+  std::printf("read_exif loop: %.3fus/file, read_exif_many: %.3fus/file\n", best_loop / batch.size(), best_batch / batch.size());
+
+  return check_summary();
+}
@@ -100,13 +100,13 @@ std::ostream &operator<<(std::ostream &o, const std::array<T, C> &array)
 
 #define print_tag(data, tag)                             \
   {                                                      \
+    auto _tag = data.tag();                              \
     std::printf(                                         \
       " -> \033[%dm%04x\033[0m \033[33m" #tag "\033[0m", \
-      data.tag.is_set ? 32 : 31, data.tag.parsed_from    \
+      _tag.is_set ? 32 : 31, _tag.parsed_from            \
     );                                                   \
-    if (data.tag.is_set) {                               \
-      using t = std::decay_t<decltype(data.tag.value)>;  \
-      std::cout << " = " << data.tag.value;              \
+    if (_tag.is_set) {                                   \
+      std::cout << " = " << _tag.value;                  \
     } else {                                             \
       std::cout << " \033[2m(not set)\033[0m";           \
     }                                                    \
@@ -136,11 +136,13 @@ void print_image(const nexif::ImageData &id)
 
 int main(int argc, char **argv)
 {
-  nexif::enable_debug_print = true;
+  nexif::ParseContext context{.trace = nexif::TRACE_ALL, .log = nexif::default_debug_print};
+  nexif::ParseContextScope scope(context);
   if (argc == 2) {
     std::printf("Reading %s\n", argv[1]);
     auto t0 = std::chrono::high_resolution_clock::now();
-    auto result = nexif::read_exif(std::filesystem::path(argv[1], std::filesystem::path::generic_format));
+    nexif::ParseStats stats;
+    auto result = nexif::read_exif(std::filesystem::path(argv[1], std::filesystem::path::generic_format), nullptr, nullptr, &stats);
     auto t1 = std::chrono::high_resolution_clock::now();
     if (result) {
       const nexif::ExifData &exif = result.value();
@@ -250,6 +252,15 @@ int main(int argc, char **argv)
     }
     double ms = std::chrono::duration_cast<std::chrono::nanoseconds>(t1 - t0).count() * 1e-6;
     std::printf("Time elapsed: %f ms\n", ms);
+    std::printf(
+      "Phases (us): detect %.1f, TIFF %.1f, Exif %.1f, MakerNote %.1f, lens %.1f (lookup %.1f)\n",
+      stats.detect_ns * 1e-3, stats.tiff_walk_ns * 1e-3, stats.exif_ifd_ns * 1e-3,
+      stats.makernote_ns * 1e-3, stats.lens_resolve_ns * 1e-3, stats.lens_lookup_ns * 1e-3
+    );
+    std::printf(
+      "Visited %u IFDs, %u entries. Read %lu bytes, up to offset %lu. Stored %lu string bytes.\n",
+      stats.num_ifds, stats.num_entries, stats.bytes_touched, stats.highest_offset, stats.string_bytes
+    );
   } else {
     printf("Usage: %s <filename>\n", argv[0]);
     return 1;
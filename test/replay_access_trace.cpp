@@ -0,0 +1,112 @@
+#include <cstdio>
+#include <cstring>
+#include <fstream>
+#include <random>
+
+#include "neonexif/access_trace.hpp"
+#include "neonexif/mappedfile.hpp"
+
+/**
+ * Records the bytes that parsing reads, and replays those reads as an I/O
+ * benchmark:
+ *
+ *   replay_access_trace record <traces.nxat> <files...>
+ *   replay_access_trace replay <traces.nxat> [<files...>]
+ *
+ * Without files, replay writes a file of the traced size, with random
+ * contents, for every trace, so that the traces alone are enough.
+ */
+int record(const char *out, int num_files, char **files)
+{
+  std::vector<nexif::AccessTrace> traces;
+  for (int i = 0; i < num_files; ++i) {
+    size_t length;
+    char *data = map_file(files[i], &length);
+    if (data == nullptr) {
+      std::printf("Cannot open %s\n", files[i]);
+      return 1;
+    }
+    traces.push_back(nexif::trace_read_exif(data, length));
+    unmap_file(data, length);
+    const nexif::AccessTrace &t = traces.back();
+    std::printf(
+      "%s: %s, %zu extents, %lu of %lu bytes, %lu reads\n",
+      files[i], nexif::to_str(t.file_type, t.file_type_variant), t.extents.size(), t.bytes(), t.file_size, t.num_reads
+    );
+  }
+  if (!nexif::write_access_traces(out, traces)) {
+    std::printf("Cannot write %s\n", out);
+    return 1;
+  }
+  return 0;
+}
+
+int replay(const char *in, int num_files, char **files)
+{
+  auto traces = nexif::read_access_traces(in);
+  if (!traces) {
+    std::printf("Cannot read %s: %s\n", in, traces.error().message);
+    return 1;
+  }
+
+  std::vector<std::filesystem::path> paths;
+  std::filesystem::path dir = std::filesystem::temp_directory_path() / "neonexif_replay";
+  if (num_files > 0) {
+    if (size_t(num_files) != traces.value().size()) {
+      std::printf("Need one file per trace, %zu\n", traces.value().size());
+      return 1;
+    }
+    paths.assign(files, files + num_files);
+  } else {
+    std::filesystem::create_directories(dir);
+    std::mt19937_64 rng(1);
+    std::vector<uint64_t> block(1 << 13);
+    for (size_t i = 0; i < traces.value().size(); ++i) {
+      paths.push_back(dir / ("file_" + std::to_string(i)));
+      std::ofstream out(paths.back(), std::ios::binary | std::ios::trunc);
+      for (uint64_t left = traces.value()[i].file_size; left > 0;) {
+        for (uint64_t &v : block) {
+          v = rng();
+        }
+        uint64_t n = std::min<uint64_t>(left, block.size() * sizeof(uint64_t));
+        out.write((const char *)block.data(), n);
+        left -= n;
+      }
+    }
+  }
+
+  std::printf("%-9s %-5s %8s %9s %10s %10s %12s\n", "backend", "cache", "files", "extents", "MiB", "ms", "us per file");
+  for (nexif::ReplayBackend backend : {nexif::ReplayBackend::MMAP, nexif::ReplayBackend::PREAD, nexif::ReplayBackend::IO_URING}) {
+    for (bool cold : {true, false}) {
+      auto result = nexif::replay_access_traces(traces.value(), paths, backend, cold);
+      if (!result) {
+        std::printf("%-9s %-5s %s\n", nexif::to_str(backend), cold ? "cold" : "warm", result.error().message);
+        continue;
+      }
+      const nexif::ReplayResult &r = result.value();
+      std::printf(
+        "%-9s %-5s %8lu %9lu %10.2f %10.2f %12.2f\n",
+        nexif::to_str(backend), cold ? "cold" : "warm", r.files, r.extents,
+        r.bytes / 1048576.0, r.ns * 1e-6, r.files ? r.ns * 1e-3 / r.files : 0.0
+      );
+    }
+  }
+
+  if (num_files == 0) {
+    std::filesystem::remove_all(dir);
+  }
+  return 0;
+}
+
+int main(int argc, char **argv)
+{
+  if (argc >= 3 && std::strcmp(argv[1], "record") == 0) {
+    return record(argv[2], argc - 3, argv + 3);
+  }
+  if (argc >= 3 && std::strcmp(argv[1], "replay") == 0) {
+    return replay(argv[2], argc - 3, argv + 3);
+  }
+  std::printf("Usage: %s record <traces.nxat> <files...>\n", argv[0]);
+  std::printf("       %s replay <traces.nxat> [<files...>]\n", argv[0]);
+  return 1;
+}
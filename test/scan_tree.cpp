@@ -0,0 +1,72 @@
+#include <cstdio>
+#include <fstream>
+#include <mutex>
+#include <set>
+#include <string>
+
+#include "neonexif/scan_tree.hpp"
+#include "check.hpp"
+
+static void write_file(const std::filesystem::path &path, std::string contents)
+{
+  contents.resize(std::max<size_t>(contents.size(), 128), 0);
+  std::ofstream out(path, std::ios::binary);
+  out.write(contents.data(), contents.size());
+}
+
+int main(int argc, char **argv)
+{
+  namespace fs = std::filesystem;
+  fs::path root = fs::temp_directory_path() / "neonexif_scan_tree";
+  fs::remove_all(root);
+
+  // 40 directories, three levels deep, each holding one of every kind of file.
+  std::set<std::string> expected;
+  for (int a = 0; a < 4; ++a) {
+    for (int b = 0; b < 10; ++b) {
+      fs::path dir = root / ("a" + std::to_string(a)) / ("b" + std::to_string(b));
+      fs::create_directories(dir);
+      write_file(dir / "raw.NEF", "II*\0");
+      write_file(dir / "photo.jpg", "\xff\xd8\xff\xe1");
+      write_file(dir / "fake.cr2", "not a raw file");
+      write_file(dir / "notes.txt", "II*\0");
+      expected.insert((dir / "raw.NEF").string());
+      expected.insert((dir / "photo.jpg").string());
+    }
+  }
+  fs::create_directory_symlink(root / "a0", root / "link");
+
+  std::mutex mutex;
+  std::set<std::string> found;
+  nexif::ScanOptions options;
+  options.sink_threads = 3;
+  options.queue_capacity = 2;  // Walkers have to wait for the sinks.
+  auto stats = nexif::scan_tree(root.string() + "/", options, [&](const nexif::ScannedFile &f) {
+    std::lock_guard lock(mutex);
+    CHECK(f.size == 128 && f.probe.parsable);
+    found.insert(f.path.string());
+  });
+  CHECK(stats);
+  CHECK(found == expected);
+  if (stats) {
+    const nexif::ScanStats &s = stats.value();
+    CHECK(s.directories == 1 + 4 + 40);
+    CHECK(s.entries == 4 + 1 + 40 + 40 * 4);
+    CHECK(s.files == 80);
+    CHECK(s.rejected_by_extension == 40);
+    CHECK(s.rejected_by_magic == 40);
+    CHECK(s.errors == 0);
+  }
+
+  options.check_magic = false;
+  options.extensions = {".txt"};
+  options.min_file_size = 129;
+  stats = nexif::scan_tree(root, options, [&](const nexif::ScannedFile &f) { CHECK(false); });
+  CHECK(stats && stats.value().rejected_by_size == 40);
+
+  CHECK(!nexif::scan_tree(root / "missing", options, [](const nexif::ScannedFile &) {}));
+
+  fs::remove_all(root);
+
+  return check_summary();
+}
@@ -0,0 +1,94 @@
+#include <cstdio>
+#include <fstream>
+#include <future>
+#include <mutex>
+#include <vector>
+
+#include "neonexif/scheduler.hpp"
+#include "check.hpp"
+#include "sample_exif_data.hpp"
+
+int main(int argc, char **argv)
+{
+  namespace fs = std::filesystem;
+  fs::path file = fs::temp_directory_path() / "neonexif_scheduler.jpg";
+  {
+    std::vector<uint8_t> jpeg = generate_sample_jpeg(generate_sample_exif_data());
+    std::ofstream out(file, std::ios::binary);
+    out.write((const char *)jpeg.data(), jpeg.size());
+  }
+
+  // A running parse stops at the next IFD.
+  {
+    nexif::CancellationToken token;
+    token.cancel();
+    nexif::CancellationScope scope(token);
+    auto result = nexif::read_exif(file);
+    CHECK(!result && result.error().code == nexif::ParseError::CANCELLED);
+  }
+  CHECK(nexif::read_exif(file));
+
+  std::mutex mutex;
+  std::vector<int> order;
+  auto record = [&](int tag) {
+    return [&, tag](const nexif::ExifData &data, const nexif::ParseStatus &status) {
+      std::lock_guard lock(mutex);
+      CHECK(status && data.make().value.view() == "Nikon");
+      order.push_back(tag);
+    };
+  };
+
+  // With the only worker held up, queue work in both classes.
+  {
+    nexif::ParseScheduler scheduler(1);
+    std::promise<void> started, release;
+    std::shared_future<void> released = release.get_future().share();
+    scheduler.submit(file, nexif::Priority::BACKGROUND, [&started, released](const nexif::ExifData &, const nexif::ParseStatus &) {
+      started.set_value();
+      released.wait();
+    });
+    started.get_future().wait();
+
+    std::vector<nexif::ParseScheduler::RequestId> background;
+    for (int i = 0; i < 5; ++i) {
+      background.push_back(scheduler.submit(file, nexif::Priority::BACKGROUND, record(100 + i)));
+    }
+    for (int i = 0; i < 3; ++i) {
+      scheduler.submit(file, nexif::Priority::INTERACTIVE, record(i));
+    }
+    CHECK(scheduler.promote(background[3]));  // Submitted before the interactive ones.
+    CHECK(!scheduler.promote(12345));
+    CHECK(scheduler.num_queued(nexif::Priority::INTERACTIVE) == 4);
+    release.set_value();
+    scheduler.wait_idle();
+    CHECK((order == std::vector<int>{103, 0, 1, 2, 100, 101, 102, 104}));
+  }
+
+  // Scrolling: 50k stale background requests are cancelled at once.
+  {
+    nexif::ParseScheduler scheduler(4);
+    nexif::CancellationToken scrolled_past;
+    std::atomic<int> cancelled{0}, parsed{0};
+    for (int i = 0; i < 50000; ++i) {
+      scheduler.submit(file, nexif::Priority::BACKGROUND, [&](const nexif::ExifData &, const nexif::ParseStatus &status) {
+        if (status) {
+          parsed++;
+        } else {
+          CHECK(status.error->code == nexif::ParseError::CANCELLED);
+          cancelled++;
+        }
+      }, scrolled_past);
+    }
+    scrolled_past.cancel();
+    order.clear();
+    scheduler.submit(file, nexif::Priority::INTERACTIVE, record(7));
+    scheduler.wait_idle();
+    CHECK(parsed + cancelled == 50000);
+    CHECK(cancelled > 0);
+    CHECK(order == std::vector<int>{7});
+  }
+
+  fs::remove(file);
+
+  return check_summary();
+}
@@ -0,0 +1,142 @@
+#include <cstdio>
+#include <string>
+
+#include "neonexif/neonexif.hpp"
+#include "check.hpp"
+#include "synthetic_corpus.hpp"
+
+/** Sample data with strings that do not fit in the inline buffer. */
+static nexif::ExifData generate_spilling_exif_data(const std::string &copyright, const std::string &artist)
+{
+  nexif::ExifData data = generate_sample_exif_data();
+  data.copyright() = data.store_string_data(copyright);
+  data.artist() = data.store_string_data(artist);
+  data.exif.lens_model() = data.store_string_data("AF-S NIKKOR 24-70mm f/2.8E ED VR");
+  return data;
+}
+
+static void check_strings(const nexif::ExifData &data, const std::string &copyright, const std::string &artist)
+{
+  CHECK(data.copyright().value.view() == copyright);
+  CHECK(data.artist().value.view() == artist);
+  CHECK(data.make().value.view() == "Nikon");
+  CHECK(data.exif.raw_developing_software().value.view() == "NeonRAW");
+  CHECK(data.exif.lens_model().value.view() == "AF-S NIKKOR 24-70mm f/2.8E ED VR");
+}
+
+int main(int argc, char **argv)
+{
+  nexif::ParseContext context{.trace = getenv("NEONEXIF_DEBUG") ? nexif::TRACE_ALL : 0u, .log = nexif::default_debug_print};
+  nexif::ParseContextScope scope(context);
+
+  std::string copyright(3000, 'c');
+  std::string artist(5000, 'a');
+
+  {
+    nexif::ExifData data = generate_spilling_exif_data(copyright, artist);
+    CHECK(data.string_spill != nullptr);
+    CHECK(data.string_data_used() > sizeof(data.string_data));
+    check_strings(data, copyright, artist);
+
+    nexif::ExifData copy = data;
+    nexif::ExifData moved = std::move(data);
+    data.reset();
+    check_strings(copy, copyright, artist);
+    check_strings(moved, copyright, artist);
+    CHECK(copy.copyright().value.data() != moved.copyright().value.data());
+
+    copy.reset();
+    CHECK(!copy.copyright().is_set);
+    CHECK(copy.string_data_used() == 0);
+    check_strings(moved, copyright, artist);
+  }
+
+  // Parse a file whose strings spill.
+  std::vector<uint8_t> jpeg = generate_sample_jpeg(generate_spilling_exif_data(copyright, artist));
+  auto result = nexif::read_exif((const char *)jpeg.data(), jpeg.size());
+  CHECK(result);
+  if (result) {
+    check_strings(result.value(), copyright, artist);
+  }
+
+  // A string longer than a CharData can refer to is truncated, with a warning.
+  {
+    using namespace nexif::tiff;
+    std::vector<uint8_t> tiff;
+    synthetic::TiffBuilder b{tiff, std::endian::little};
+    b.write_header();
+    b.set_root(b.write_ifd(b.camera_entries("Nikon", std::string(70000, 'm'))));
+    auto long_result = nexif::read_exif((const char *)tiff.data(), tiff.size());
+    CHECK(long_result);
+    if (long_result) {
+      CHECK(long_result.value().model().value.view() == std::string(nexif::CharData::MAX_LENGTH, 'm'));
+      CHECK(long_result.value().artist().value.view() == "NeonEXIF");
+      CHECK(long_result.warnings.size() == 1);
+    }
+    nexif::ExifData data;
+    CHECK(data.store_string_data(std::string(70000, 'a')).length() == nexif::CharData::MAX_LENGTH);
+  }
+
+  // Compact serialization, with and without spilled strings.
+  std::vector<uint8_t> compact;
+  size_t small_size = nexif::write_compact(generate_sample_exif_data(), compact);
+  size_t large_size = nexif::write_compact(result.value(), compact);
+  CHECK(small_size + large_size == compact.size());
+  std::printf("sizeof(ExifData): %zu, compact sample: %zu\n", sizeof(nexif::ExifData), small_size);
+
+  auto small = nexif::read_compact(compact.data(), small_size);
+  CHECK(small);
+  if (small) {
+    CHECK(small.value().artist().value.view() == "Martijn Courteaux");
+    CHECK(small.value().exif.iso().value == 1600);
+  }
+  auto large = nexif::read_compact(compact.data() + small_size, large_size);
+  CHECK(large);
+  if (large) {
+    check_strings(large.value(), copyright, artist);
+  }
+  CHECK(!nexif::read_compact(compact.data(), small_size - 1));
+
+  // A corrupt header is rejected before anything is built from it: the
+  // MakerNote type, the dirty sections and the number of images.
+  for (auto [offset, value] : std::initializer_list<std::pair<int, uint8_t>>{{12, 200}, {13, 0x80}, {14, 6}}) {
+    std::vector<uint8_t> corrupt(compact.begin(), compact.begin() + small_size);
+    corrupt[offset] = value;
+    CHECK(!nexif::read_compact(corrupt.data(), corrupt.size()));
+  }
+
+  // With a MakerNote.
+  {
+    synthetic::CorpusFile nef = synthetic::nikon_f_mount_file();
+    const std::vector<uint8_t> &bytes = nef.extents[0].second;
+    auto parsed = nexif::read_exif((const char *)bytes.data(), bytes.size());
+    CHECK(parsed && std::holds_alternative<nexif::NikonMakernote>(parsed.value().makernote));
+    if (parsed) {
+      std::vector<uint8_t> blob;
+      nexif::write_compact(parsed.value(), blob);
+      auto read = nexif::read_compact(blob.data(), blob.size());
+      CHECK(read && std::holds_alternative<nexif::NikonMakernote>(read.value().makernote));
+      if (read) {
+        const nexif::NikonMakernote &mn = std::get<nexif::NikonMakernote>(read.value().makernote);
+        CHECK(mn.serial_number().value.view() == std::get<nexif::NikonMakernote>(parsed.value().makernote).serial_number().value.view());
+        CHECK(read.value().exif.lens_model().value.view() == nef.lens_model);
+      }
+    }
+  }
+
+  // More spilled strings than a single string can hold.
+  {
+    nexif::ExifData data = generate_spilling_exif_data(std::string(40000, 'c'), std::string(40000, 'a'));
+    data.software() = data.store_string_data(std::string(40000, 's'));
+    std::vector<uint8_t> big;
+    nexif::write_compact(data, big);
+    auto read = nexif::read_compact(big.data(), big.size());
+    CHECK(read);
+    if (read) {
+      check_strings(read.value(), std::string(40000, 'c'), std::string(40000, 'a'));
+      CHECK(read.value().software().value.view() == std::string(40000, 's'));
+    }
+  }
+
+  return check_summary();
+}
@@ -0,0 +1,75 @@
+#include <cstdio>
+#include <cstdlib>
+
+#include "check.hpp"
+#include "synthetic_corpus.hpp"
+
+/** Usage: synthetic_corpus [<max size in bytes of the files to write and parse>] */
+int main(int argc, char **argv)
+{
+  namespace fs = std::filesystem;
+  uint64_t max_size = argc > 1 ? std::strtoull(argv[1], nullptr, 10) : UINT64_MAX;
+  fs::path dir = fs::temp_directory_path() / "neonexif_synthetic_corpus";
+  fs::remove_all(dir);
+  fs::create_directories(dir);
+
+  // The same bytes on every run.
+  std::vector<synthetic::CorpusFile> corpus = synthetic::synthetic_corpus();
+  std::vector<synthetic::CorpusFile> again = synthetic::synthetic_corpus();
+  CHECK(corpus.size() == 15 && again.size() == corpus.size());
+  for (size_t i = 0; i < std::min(corpus.size(), again.size()); ++i) {
+    CHECK(corpus[i].extents == again[i].extents);
+  }
+  CHECK(synthetic::synthetic_corpus(1024 * 1024).size() == 12);
+
+  // The LensData cipher is its own inverse, and leaves the version alone.
+  std::vector<uint8_t> lens_data = synthetic::noise(64, 1);
+  std::vector<uint8_t> enciphered = lens_data;
+  nexif::makernote::nikon::crypt_lens_data(enciphered.data(), enciphered.size(), "6012345", 21337);
+  CHECK(enciphered != lens_data && std::equal(lens_data.begin(), lens_data.begin() + 4, enciphered.begin()));
+  nexif::makernote::nikon::crypt_lens_data(enciphered.data(), enciphered.size(), "6012345", 21337);
+  CHECK(enciphered == lens_data);
+
+  for (const synthetic::CorpusFile &f : corpus) {
+    if (f.size > max_size) {
+      continue;
+    }
+    int failures_before = num_failures;
+    CHECK(synthetic::write_corpus_file(dir, f));
+    CHECK(fs::file_size(dir / f.name) == f.size);
+
+    nexif::ParseStats stats;
+    auto result = nexif::read_exif(dir / f.name, nullptr, nullptr, &stats);
+    if (!result) {
+      std::printf("%s: %s\n", f.name.c_str(), result.error().message);
+      CHECK(result);
+      continue;
+    }
+    const nexif::ExifData &data = result.value();
+    CHECK(data.file_type == f.file_type);
+    CHECK(data.file_type_variant == f.file_type_variant);
+    CHECK(data.make().value.view() == f.make);
+    CHECK(data.model().value.view() == f.model);
+    CHECK(data.num_images == f.num_images);
+    CHECK(data.exif.iso().value == f.iso);
+    if (!f.lens_model.empty()) {
+      CHECK(data.exif.lens_model().value.view() == f.lens_model);
+    }
+    if (f.name == "ifd_overflow.tif") {
+      CHECK(!result.warnings.empty());
+    } else {
+      CHECK(result.warnings.empty());
+    }
+    if (f.name.starts_with("size_")) {
+      // The IFDs are at the end.
+      CHECK(stats.highest_offset >= f.size - 4096);
+    }
+    if (num_failures > failures_before) {
+      std::printf("After %s.\n", f.name.c_str());
+    }
+  }
+
+  fs::remove_all(dir);
+
+  return check_summary();
+}
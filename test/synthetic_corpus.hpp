@@ -0,0 +1,715 @@
+#include <cstring>
+#include <filesystem>
+#include <fstream>
+#include <optional>
+#include <string>
+#include <string_view>
+#include <vector>
+
+#include "neonexif/neonexif.hpp"
+#include "neonexif/reader.hpp"
+#include "neonexif/tiff.hpp"
+#include "neonexif/tiff_tags.hpp"
+#include "sample_exif_data.hpp"
+
+/**
+ * A corpus of synthetic files, one of every container and layout the parsers
+ * know, so that the tests and benchmarks run without downloading samples:
+ *
+ *  - JPEG with an APP0 (JFIF) and an APP1 (Exif) segment;
+ *  - NEF-style TIFF with SubIFDs and a Nikon MakerNote of which the LensData
+ *    is enciphered, for an F-mount (big endian) and a Z-mount (little endian);
+ *  - CR2-style TIFF with a chain of four IFDs and a Canon MakerNote with
+ *    CameraSettings and CameraInfo;
+ *  - RW2-style TIFF; RAF, MRW and FOVb containers;
+ *  - a tree of SubIFDs, and one with more images than `ExifData` holds;
+ *  - TIFF files from 10 KB to 4 GB, with the IFDs at the end. Above 1 MB the
+ *    image data is a hole: they are sparse files.
+ *
+ * Everything is derived from fixed seeds: the files are the same on every run
+ * and platform. Each file lists what parsing it should find.
+ */
+
+namespace synthetic {
+
+using nexif::tiff::DType;
+
+/** Deterministic filler for image data (xorshift32). */
+inline void fill_noise(uint8_t *dst, size_t length, uint32_t seed)
+{
+  uint32_t x = seed | 1;
+  for (size_t i = 0; i < length; ++i) {
+    x ^= x << 13;
+    x ^= x >> 17;
+    x ^= x << 5;
+    dst[i] = uint8_t(x >> 24);
+  }
+}
+
+inline std::vector<uint8_t> noise(size_t length, uint32_t seed)
+{
+  std::vector<uint8_t> bytes(length);
+  fill_noise(bytes.data(), length, seed);
+  return bytes;
+}
+
+/** An IFD entry. A value of over 4 bytes goes after the IFD, unless it is already in the file at `offset`. */
+struct Entry {
+  uint16_t tag;
+  DType type;
+  uint32_t count;
+  std::vector<uint8_t> value{};  ///< In the byte order of the file.
+  std::optional<uint32_t> offset{};
+};
+
+/**
+ * Lays out a TIFF structure through a `nexif::Writer`. An IFD is written
+ * before the IFDs that point to it, so that every offset is known by the time
+ * it is written: the root IFD comes last, and the header is patched to it.
+ */
+struct TiffBuilder {
+  std::vector<uint8_t> &out;
+  std::endian byte_order;
+  uint32_t base{0};  ///< The TIFF offset of `out[0]`: nonzero for the end of a larger file.
+  nexif::Writer w{out};
+  size_t root_pos{0};
+
+  uint32_t offset() const { return base + w.current_in_tiff_pos(); }
+
+  template <typename T>
+  T to_file_order(T v) const
+  {
+    return byte_order == std::endian::native ? v : nexif::byteswap(v);
+  }
+
+  template <typename T>
+  void put(std::vector<uint8_t> &dst, T v) const
+  {
+    v = to_file_order(v);
+    const uint8_t *bytes = (const uint8_t *)&v;
+    dst.insert(dst.end(), bytes, bytes + sizeof(T));
+  }
+
+  template <typename T>
+  size_t write(T v)
+  {
+    return w.write(to_file_order(v));
+  }
+
+  template <typename T>
+  void overwrite(size_t pos, T v)
+  {
+    w.overwrite(pos, to_file_order(v));
+  }
+
+  /** The byte order mark, the magic number and a placeholder for the root IFD offset. */
+  void write_header(uint16_t magic = 42)
+  {
+    char mark = byte_order == std::endian::little ? 'I' : 'M';
+    w.write_u8(mark);
+    w.write_u8(mark);
+    write(magic);
+    root_pos = write(uint32_t(0));
+  }
+
+  void set_root(uint32_t ifd_offset) { overwrite(root_pos, ifd_offset); }
+
+  void align()
+  {
+    if (w.pos % 2) {
+      w.write_u8(0);
+    }
+  }
+
+  uint32_t write_data(const std::vector<uint8_t> &bytes)
+  {
+    align();
+    uint32_t pos = offset();
+    w.write_all(bytes);
+    return pos;
+  }
+
+  /** Writes an IFD, sorted by tag, with the values that do not fit in the entries after it. */
+  uint32_t write_ifd(std::vector<Entry> entries, uint32_t next_ifd = 0)
+  {
+    std::stable_sort(entries.begin(), entries.end(), [](const Entry &a, const Entry &b) { return a.tag < b.tag; });
+    align();
+    uint32_t ifd_offset = offset();
+    uint32_t value_offset = ifd_offset + 2 + 12 * entries.size() + 4;
+    write(uint16_t(entries.size()));
+    for (const Entry &e : entries) {
+      write(e.tag);
+      write(uint16_t(e.type));
+      write(e.count);
+      if (e.offset) {
+        write(e.offset.value());
+      } else if (e.value.size() > 4) {
+        write(value_offset);
+        value_offset += (e.value.size() + 1) & ~size_t(1);
+      } else {
+        uint8_t inline_value[4]{};
+        std::memcpy(inline_value, e.value.data(), e.value.size());
+        w.write(inline_value);
+      }
+    }
+    write(next_ifd);
+    for (const Entry &e : entries) {
+      if (!e.offset && e.value.size() > 4) {
+        write_data(e.value);
+      }
+    }
+    return ifd_offset;
+  }
+
+  // clang-format off
+  Entry ascii(uint16_t tag, std::string_view s) const
+  {
+    Entry e{tag, DType::ASCII, uint32_t(s.length() + 1)};
+    e.value.assign(s.begin(), s.end());
+    e.value.push_back(0);
+    return e;
+  }
+  Entry bytes(uint16_t tag, DType type, std::vector<uint8_t> value) const
+  {
+    return {tag, type, uint32_t(value.size()), std::move(value)};
+  }
+  Entry shorts(uint16_t tag, const std::vector<uint16_t> &values) const
+  {
+    Entry e{tag, DType::SHORT, uint32_t(values.size())};
+    for (uint16_t v : values) put(e.value, v);
+    return e;
+  }
+  Entry longs(uint16_t tag, const std::vector<uint32_t> &values) const
+  {
+    Entry e{tag, DType::LONG, uint32_t(values.size())};
+    for (uint32_t v : values) put(e.value, v);
+    return e;
+  }
+  Entry rationals(uint16_t tag, const std::vector<std::pair<uint32_t, uint32_t>> &values) const
+  {
+    Entry e{tag, DType::RATIONAL, uint32_t(values.size())};
+    for (auto [num, denom] : values) { put(e.value, num); put(e.value, denom); }
+    return e;
+  }
+  /** Points to data that was already written, such as a MakerNote IFD. */
+  Entry at(uint16_t tag, DType type, uint32_t count, uint32_t offset) const
+  {
+    return {tag, type, count, {}, offset};
+  }
+  // clang-format on
+
+  /** The tags of an image: its size, format and where its data is. */
+  std::vector<Entry> image_entries(uint32_t subfile_type, uint32_t width, uint32_t height, uint16_t bits, uint16_t compression, uint32_t data_offset, uint32_t data_length) const
+  {
+    using namespace nexif::tiff;
+    return {
+      longs(tag_subfile_type::TagId, {subfile_type}),
+      longs(tag_image_width::TagId, {width}),
+      longs(tag_image_height::TagId, {height}),
+      shorts(tag_bits_per_sample::TagId, {bits}),
+      shorts(tag_compression::TagId, {compression}),
+      shorts(tag_photometric_interpretation::TagId, {uint16_t(subfile_type ? 2 : 32803)}),  // RGB or CFA
+      longs(tag_strip_offsets::TagId, {data_offset}),
+      shorts(tag_samples_per_pixel::TagId, {uint16_t(subfile_type ? 3 : 1)}),
+      longs(tag_rows_per_strip::TagId, {height}),
+      longs(tag_strip_byte_counts::TagId, {data_length}),
+    };
+  }
+
+  /** The tags of IFD0 that describe the camera. */
+  std::vector<Entry> camera_entries(std::string_view make, std::string_view model) const
+  {
+    using namespace nexif::tiff;
+    return {
+      ascii(tag_make::TagId, make),
+      ascii(tag_model::TagId, model),
+      shorts(tag_orientation::TagId, {1}),
+      ascii(tag_software::TagId, "Ver.1.10"),
+      ascii(tag_date_time::TagId, "2025:07:18 12:10:22"),
+      ascii(tag_artist::TagId, "NeonEXIF"),
+    };
+  }
+
+  std::vector<Entry> exif_entries(std::optional<Entry> makernote = std::nullopt) const
+  {
+    using namespace nexif::tiff;
+    std::vector<Entry> entries{
+      rationals(tag_exposure_time::TagId, {{1, 250}}),
+      rationals(tag_f_number::TagId, {{28, 10}}),
+      shorts(tag_iso::TagId, {400}),
+      ascii(tag_date_time_original::TagId, "2025:07:18 12:10:22"),
+      rationals(tag_focal_length::TagId, {{50, 1}}),
+    };
+    if (makernote) {
+      entries.push_back(std::move(makernote.value()));
+    }
+    return entries;
+  }
+};
+
+/** A file of the corpus, and what parsing it should find. */
+struct CorpusFile {
+  std::string name;
+  uint64_t size{0};  ///< Zeros between the extents.
+  std::vector<std::pair<uint64_t, std::vector<uint8_t>>> extents{};
+
+  nexif::FileType file_type{nexif::TIFF};
+  nexif::FileTypeVariant file_type_variant{nexif::STANDARD};
+  std::string make{};
+  std::string model{};
+  std::string lens_model{};  ///< Empty if there is none.
+  int num_images{1};
+  uint16_t iso{400};  ///< 1600 in the Exif data of `generate_sample_exif_data()`.
+};
+
+inline CorpusFile corpus_file(std::string name, std::vector<uint8_t> bytes)
+{
+  CorpusFile f{.name = std::move(name), .size = bytes.size()};
+  f.extents.push_back({0, std::move(bytes)});
+  return f;
+}
+
+/** The Exif APP1 segment of `generate_exif_jpeg_binary_data()`, for a camera. */
+inline std::vector<uint8_t> exif_app1(const char *make, const char *model)
+{
+  nexif::ExifData data = generate_sample_exif_data();
+  data.make() = data.store_string_data(make);
+  data.model() = data.store_string_data(model);
+  return nexif::generate_exif_jpeg_binary_data(data);
+}
+
+inline std::vector<uint8_t> jpeg_with_app1(const std::vector<uint8_t> &app1, size_t scan_length, uint32_t seed)
+{
+  std::vector<uint8_t> jpeg;
+  jpeg.reserve(2 + app1.size() + 10 + scan_length + 2);
+  jpeg.push_back(0xff);
+  jpeg.push_back(0xd8);
+  jpeg.insert(jpeg.end(), app1.begin(), app1.end());
+  // Start of scan, with the entropy-coded data.
+  for (uint8_t b : {0xff, 0xda, 0x00, 0x08, 0x01, 0x01, 0x00, 0x00, 0x3f, 0x00}) {
+    jpeg.push_back(b);
+  }
+  std::vector<uint8_t> scan = noise(scan_length, seed);
+  jpeg.insert(jpeg.end(), scan.begin(), scan.end());
+  jpeg.push_back(0xff);
+  jpeg.push_back(0xd9);
+  return jpeg;
+}
+
+inline CorpusFile jpeg_file()
+{
+  std::vector<uint8_t> app0_app1{
+    0xff, 0xe0, 0x00, 0x10, 'J', 'F', 'I', 'F', 0,  // APP0, JFIF 1.02, 72 dpi, no thumbnail
+    0x01, 0x02, 0x01, 0x00, 0x48, 0x00, 0x48, 0x00, 0x00,
+  };
+  std::vector<uint8_t> app1 = generate_exif_jpeg_binary_data(generate_sample_exif_data());
+  app0_app1.insert(app0_app1.end(), app1.begin(), app1.end());
+  CorpusFile f = corpus_file("jpeg_app0_app1.jpg", jpeg_with_app1(app0_app1, 12 * 1024, 1));
+  f.file_type = nexif::JPEG;
+  f.iso = 1600;
+  f.make = "Nikon";
+  f.model = "D750";
+  return f;
+}
+
+/**
+ * A Nikon MakerNote of type 3: "Nikon\0", the version, and a TIFF structure
+ * of its own. The LensData is enciphered with the serial number and shutter
+ * count, as from version 0201.
+ */
+inline std::vector<uint8_t> nikon_makernote(std::endian byte_order, const char *lens_data_version, std::vector<uint8_t> lens_data, uint8_t lens_type, const std::vector<std::pair<uint32_t, uint32_t>> &lens_specification)
+{
+  const char *serial_number = "6012345";
+  uint32_t shutter_count = 21337;
+  std::memcpy(lens_data.data(), lens_data_version, 4);
+  nexif::makernote::nikon::crypt_lens_data(lens_data.data(), lens_data.size(), serial_number, shutter_count);
+
+  std::vector<uint8_t> makernote{'N', 'i', 'k', 'o', 'n', 0, 0x02, 0x10, 0x00, 0x00};
+  TiffBuilder b{makernote, byte_order};
+  b.w.tiff_base_offset = makernote.size();  // Offsets are relative to the TIFF header.
+  b.write_header();
+  b.set_root(b.write_ifd({
+    b.bytes(0x0001, DType::UNDEFINED, {'0', '2', '1', '0'}),  // Version
+    b.ascii(0x001d, serial_number),
+    b.bytes(0x0083, DType::BYTE, {lens_type}),
+    b.rationals(0x0084, lens_specification),
+    b.bytes(0x0098, DType::UNDEFINED, std::move(lens_data)),
+    b.longs(0x00a7, {shutter_count}),
+  }));
+  return makernote;
+}
+
+/** IFD0 with a thumbnail, and SubIFDs for the raw data and a JPEG preview. */
+inline CorpusFile nef_file(std::string name, std::endian byte_order, const char *model, std::vector<uint8_t> makernote, uint32_t seed)
+{
+  using namespace nexif::tiff;
+  std::vector<uint8_t> out;
+  TiffBuilder b{out, byte_order};
+  b.write_header();
+  uint32_t thumbnail = b.write_data(noise(80 * 60 * 3, seed));
+  uint32_t raw = b.write_data(noise(32 * 1024, seed + 1));
+  uint32_t preview = b.write_data(jpeg_with_app1({}, 4 * 1024, seed + 2));
+  uint32_t preview_length = b.offset() - preview;
+
+  uint32_t raw_ifd = b.write_ifd(b.image_entries(0, 6032, 4032, 14, 34713, raw, 32 * 1024));
+  std::vector<Entry> preview_entries{
+    b.longs(tag_subfile_type::TagId, {1}),
+    b.shorts(tag_compression::TagId, {6}),
+    b.longs(tag_data_offset::TagId, {preview}),
+    b.longs(tag_data_length::TagId, {preview_length}),
+  };
+  uint32_t preview_ifd = b.write_ifd(preview_entries);
+  uint32_t exif_ifd = b.write_ifd(b.exif_entries(b.bytes(tag_makernote::TagId, DType::UNDEFINED, std::move(makernote))));
+
+  std::vector<Entry> ifd0 = b.image_entries(1, 80, 60, 8, 1, thumbnail, 80 * 60 * 3);
+  for (Entry &e : b.camera_entries("NIKON CORPORATION", model)) {
+    ifd0.push_back(std::move(e));
+  }
+  ifd0.push_back(b.longs(tag_sub_ifd_offset::TagId, {raw_ifd, preview_ifd}));
+  ifd0.push_back(b.longs(tag_exif_offset::TagId, {exif_ifd}));
+  b.set_root(b.write_ifd(std::move(ifd0)));
+
+  CorpusFile f = corpus_file(std::move(name), std::move(out));
+  f.make = "NIKON CORPORATION";
+  f.model = model;
+  f.num_images = 3;
+  return f;
+}
+
+inline CorpusFile nikon_f_mount_file()
+{
+  // LensData 0204: the lens ID at 12, of an AF-S 24-70mm f/2.8G.
+  std::vector<uint8_t> lens_data = noise(33, 10);
+  const uint8_t lens_id[7]{0x93, 0x48, 0x37, 0x5c, 0x24, 0x24, 0x95};
+  std::memcpy(&lens_data[12], lens_id, sizeof(lens_id));
+  std::vector<uint8_t> makernote = nikon_makernote(std::endian::big, "0204", std::move(lens_data), 0x06, {{24, 1}, {70, 1}, {28, 10}, {28, 10}});
+  CorpusFile f = nef_file("nikon_d750.nef", std::endian::big, "NIKON D750", std::move(makernote), 11);
+  f.lens_model = "AF-S Zoom-Nikkor 24-70mm f/2.8G ED";
+  return f;
+}
+
+inline CorpusFile nikon_z_mount_file()
+{
+  // LensData 0800: a 16-bit lens ID at 48, of a Z 24-70mm f/4 S.
+  std::vector<uint8_t> lens_data = noise(58, 20);
+  lens_data[48] = 1;
+  lens_data[49] = 0;
+  std::vector<uint8_t> makernote = nikon_makernote(std::endian::little, "0800", std::move(lens_data), 0x80, {{24, 1}, {70, 1}, {40, 10}, {40, 10}});
+  CorpusFile f = nef_file("nikon_z_7.nef", std::endian::little, "NIKON Z 7", std::move(makernote), 21);
+  f.lens_model = "Nikkor Z 24-70mm f/4 S";
+  return f;
+}
+
+/**
+ * The CR2 header and its chain of four IFDs: the preview, the thumbnail, a
+ * small RGB image and the raw data. The MakerNote is a bare IFD, with offsets
+ * relative to the TIFF header.
+ */
+inline CorpusFile canon_file()
+{
+  using namespace nexif::tiff;
+  std::vector<uint8_t> out;
+  TiffBuilder b{out, std::endian::little};
+  b.write_header();
+  b.w.write_string("CR\x02\x00", 4);
+  size_t raw_ifd_pos = b.write(uint32_t(0));
+
+  uint32_t preview = b.write_data(jpeg_with_app1({}, 6 * 1024, 30));
+  uint32_t preview_length = b.offset() - preview;
+  uint32_t thumbnail = b.write_data(jpeg_with_app1({}, 2 * 1024, 31));
+  uint32_t thumbnail_length = b.offset() - thumbnail;
+  uint32_t rgb = b.write_data(noise(40 * 30 * 3 * 2, 32));
+  uint32_t raw = b.write_data(noise(32 * 1024, 33));
+
+  uint32_t ifd3 = b.write_ifd(b.image_entries(0, 5208, 3476, 14, 6, raw, 32 * 1024));
+  b.overwrite(raw_ifd_pos, ifd3);
+  uint32_t ifd2 = b.write_ifd(b.image_entries(1, 40, 30, 16, 1, rgb, 40 * 30 * 3 * 2), ifd3);
+  uint32_t ifd1 = b.write_ifd({
+    b.longs(tag_data_offset::TagId, {thumbnail}),
+    b.longs(tag_data_length::TagId, {thumbnail_length}),
+  }, ifd2);
+
+  // CameraSettings: the lens type, the focal range in units of 1 mm, and the
+  // apertures in APEX units of 1/32 EV (f/4 and f/22).
+  std::vector<uint16_t> camera_settings(46);
+  camera_settings[0] = 2 * camera_settings.size();
+  camera_settings[22] = 237;
+  camera_settings[23] = 105;
+  camera_settings[24] = 24;
+  camera_settings[25] = 1;
+  camera_settings[26] = 4 * 32;
+  camera_settings[27] = 8 * 32 + 29;
+  // CameraInfo of the 700D: the lens type at 295, big endian.
+  std::vector<uint8_t> camera_info = noise(1536, 34);
+  camera_info[295] = 0;
+  camera_info[296] = 237;
+  uint32_t makernote = b.write_ifd({
+    b.shorts(0x0001, camera_settings),
+    b.ascii(0x0009, "NeonEXIF"),
+    b.longs(0x000c, {123456789}),
+    b.bytes(0x000d, DType::UNDEFINED, std::move(camera_info)),
+  });
+  uint32_t makernote_length = b.offset() - makernote;
+  uint32_t exif_ifd = b.write_ifd(b.exif_entries(b.at(tag_makernote::TagId, DType::UNDEFINED, makernote_length, makernote)));
+
+  std::vector<Entry> ifd0 = b.camera_entries("Canon", "Canon EOS 700D");
+  ifd0.push_back(b.longs(tag_strip_offsets::TagId, {preview}));
+  ifd0.push_back(b.longs(tag_strip_byte_counts::TagId, {preview_length}));
+  ifd0.push_back(b.longs(tag_exif_offset::TagId, {exif_ifd}));
+  b.set_root(b.write_ifd(std::move(ifd0), ifd1));
+
+  CorpusFile f = corpus_file("canon_eos_700d.cr2", std::move(out));
+  f.make = "Canon";
+  f.model = "Canon EOS 700D";
+  f.lens_model = "Canon EF 24-105mm f/4L IS USM";
+  f.num_images = 4;
+  return f;
+}
+
+/** The TIFF magic number of Panasonic's RW2. */
+inline CorpusFile panasonic_file()
+{
+  using namespace nexif::tiff;
+  std::vector<uint8_t> out;
+  TiffBuilder b{out, std::endian::little};
+  b.write_header(0x55);
+  uint32_t raw = b.write_data(noise(32 * 1024, 40));
+  uint32_t exif_ifd = b.write_ifd(b.exif_entries());
+  std::vector<Entry> ifd0 = b.image_entries(0, 5488, 3664, 12, 34316, raw, 32 * 1024);
+  for (Entry &e : b.camera_entries("Panasonic", "DMC-FZ1000")) {
+    ifd0.push_back(std::move(e));
+  }
+  ifd0.push_back(b.longs(tag_exif_offset::TagId, {exif_ifd}));
+  b.set_root(b.write_ifd(std::move(ifd0)));
+
+  CorpusFile f = corpus_file("panasonic_dmc_fz1000.rw2", std::move(out));
+  f.file_type_variant = nexif::TIFF_RW2;
+  f.make = "Panasonic";
+  f.model = "DMC-FZ1000";
+  return f;
+}
+
+/** The RAF header points (big endian, at 0x54) to a JPEG with the Exif data. */
+inline CorpusFile fujifilm_file()
+{
+  std::vector<uint8_t> raf(0x94);
+  std::memcpy(&raf[0], "FUJIFILMCCD-RAW 0201FF383501X-T2", 32);
+  std::memcpy(&raf[0x3c], "0100", 4);
+  std::vector<uint8_t> jpeg = jpeg_with_app1(exif_app1("FUJIFILM", "X-T2"), 8 * 1024, 50);
+  std::vector<uint8_t> cfa = noise(16 * 1024, 51);
+  auto put_be32 = [&](size_t pos, uint32_t v) {
+    v = std::endian::native == std::endian::big ? v : nexif::byteswap(v);
+    std::memcpy(&raf[pos], &v, 4);
+  };
+  put_be32(0x54, raf.size());
+  put_be32(0x58, jpeg.size());
+  put_be32(0x64, raf.size() + jpeg.size());
+  put_be32(0x68, cfa.size());
+  raf.insert(raf.end(), jpeg.begin(), jpeg.end());
+  raf.insert(raf.end(), cfa.begin(), cfa.end());
+
+  CorpusFile f = corpus_file("fujifilm_x_t2.raf", std::move(raf));
+  f.file_type = nexif::FUJIFILM_RAF;
+  f.iso = 1600;
+  f.make = "FUJIFILM";
+  f.model = "X-T2";
+  return f;
+}
+
+/** The MRM header holds blocks; the TTW block is a big-endian TIFF structure. */
+inline CorpusFile minolta_file()
+{
+  using namespace nexif::tiff;
+  std::vector<uint8_t> tiff;
+  TiffBuilder t{tiff, std::endian::big};
+  t.write_header();
+  uint32_t exif_ifd = t.write_ifd(t.exif_entries());
+  std::vector<Entry> ifd0 = t.camera_entries("Minolta Co., Ltd.", "DiMAGE A200");
+  ifd0.push_back(t.longs(tag_exif_offset::TagId, {exif_ifd}));
+  t.set_root(t.write_ifd(std::move(ifd0)));
+  t.align();
+
+  std::vector<uint8_t> mrw;
+  TiffBuilder b{mrw, std::endian::big};
+  auto block = [&](uint32_t tag, const std::vector<uint8_t> &contents) {
+    b.write(tag);
+    b.write(uint32_t(contents.size()));
+    b.w.write_all(contents);
+  };
+  b.w.write_string("\0MRM", 4);
+  size_t header_length_pos = b.write(uint32_t(0));
+  block(0x00505244, noise(24, 60));  // PRD: the sensor size and format.
+  block(0x00574247, noise(12, 61));  // WBG: the white balance.
+  block(0x00545457, tiff);           // TTW
+  b.overwrite(header_length_pos, uint32_t(mrw.size() - 8));
+  b.w.write_all(noise(16 * 1024, 62));
+
+  CorpusFile f = corpus_file("minolta_dimage_a200.mrw", std::move(mrw));
+  f.file_type = nexif::MRW;
+  f.make = "Minolta Co., Ltd.";
+  f.model = "DiMAGE A200";
+  return f;
+}
+
+/** FOVb: the Exif data is found by its "Exif\0\0" header, after the image data. */
+inline CorpusFile sigma_file()
+{
+  std::vector<uint8_t> x3f{'F', 'O', 'V', 'b', 0x00, 0x00, 0x02, 0x00};
+  std::vector<uint8_t> image = noise(8 * 1024, 70);
+  x3f.insert(x3f.end(), image.begin(), image.end());
+  std::vector<uint8_t> app1 = exif_app1("SIGMA", "SIGMA SD14");
+  x3f.insert(x3f.end(), app1.begin() + 4, app1.end());  // Without the marker and length.
+
+  CorpusFile f = corpus_file("sigma_sd14.x3f", std::move(x3f));
+  f.file_type = nexif::SIGMA_FOVB;
+  f.iso = 1600;
+  f.make = "SIGMA";
+  f.model = "SIGMA SD14";
+  return f;
+}
+
+/**
+ * IFD0 -> IFD1, with SubIFDs below IFD0, one of which has a SubIFD itself.
+ * With `overflow`, there are more images than `ExifData::images` holds.
+ */
+inline CorpusFile subifd_tree_file(bool overflow)
+{
+  using namespace nexif::tiff;
+  std::vector<uint8_t> out;
+  TiffBuilder b{out, std::endian::little};
+  b.write_header();
+  uint32_t data = b.write_data(noise(4 * 1024, overflow ? 80 : 81));
+  auto image = [&](uint32_t subfile_type, uint32_t width, uint32_t next_ifd = 0, std::vector<uint32_t> sub_ifds = {}) {
+    std::vector<Entry> entries = b.image_entries(subfile_type, width, width * 2 / 3, 8, 1, data, 1024);
+    if (!sub_ifds.empty()) {
+      entries.push_back(b.longs(tag_sub_ifd_offset::TagId, sub_ifds));
+    }
+    return b.write_ifd(std::move(entries), next_ifd);
+  };
+  uint32_t nested = image(1, 48);
+  uint32_t raw = image(0, 6000, 0, {nested});
+  uint32_t preview = image(1, 1024);
+  std::vector<uint32_t> sub_ifds{raw, preview};
+  uint32_t ifd1 = image(1, 160);
+  if (overflow) {
+    sub_ifds.push_back(image(1, 512));
+    ifd1 = image(1, 160, image(1, 120));
+  }
+  uint32_t exif_ifd = b.write_ifd(b.exif_entries());
+
+  std::vector<Entry> ifd0 = b.image_entries(1, 256, 171, 8, 1, data, 1024);
+  for (Entry &e : b.camera_entries("NeonEXIF", overflow ? "IFD Overflow" : "SubIFD Tree")) {
+    ifd0.push_back(std::move(e));
+  }
+  ifd0.push_back(b.longs(tag_sub_ifd_offset::TagId, sub_ifds));
+  ifd0.push_back(b.longs(tag_exif_offset::TagId, {exif_ifd}));
+  b.set_root(b.write_ifd(std::move(ifd0), ifd1));
+
+  CorpusFile f = corpus_file(overflow ? "ifd_overflow.tif" : "subifd_tree.tif", std::move(out));
+  f.make = "NeonEXIF";
+  f.model = overflow ? "IFD Overflow" : "SubIFD Tree";
+  f.num_images = 5;
+  return f;
+}
+
+/**
+ * A TIFF file of `size` bytes: the header, one strip of image data up to the
+ * last 4 KB, and the IFDs in those. Up to 1 MB, the strip is filled; above,
+ * it is a hole.
+ */
+inline CorpusFile sized_file(const char *name, const char *model, uint64_t size)
+{
+  using namespace nexif::tiff;
+  uint64_t tail_offset = size - 4096;
+  std::vector<uint8_t> tail;
+  TiffBuilder b{tail, std::endian::little, uint32_t(tail_offset)};
+  uint32_t exif_ifd = b.write_ifd(b.exif_entries());
+  uint32_t strip_length = tail_offset - 8;
+  std::vector<Entry> ifd0 = b.image_entries(0, 64, strip_length / (64 * 2), 16, 1, 8, strip_length);
+  for (Entry &e : b.camera_entries("NeonEXIF", model)) {
+    ifd0.push_back(std::move(e));
+  }
+  ifd0.push_back(b.longs(tag_exif_offset::TagId, {exif_ifd}));
+  uint32_t root_ifd = b.write_ifd(std::move(ifd0));
+
+  std::vector<uint8_t> head;
+  TiffBuilder h{head, std::endian::little};
+  h.write_header();
+  h.set_root(root_ifd);
+  if (size <= 1024 * 1024) {
+    std::vector<uint8_t> strip = noise(strip_length, size);
+    head.insert(head.end(), strip.begin(), strip.end());
+  }
+
+  CorpusFile f{.name = name, .size = size};
+  f.extents.push_back({0, std::move(head)});
+  f.extents.push_back({tail_offset, std::move(tail)});
+  f.make = "NeonEXIF";
+  f.model = model;
+  return f;
+}
+
+/** The whole corpus, without the files larger than `max_size`. */
+inline std::vector<CorpusFile> synthetic_corpus(uint64_t max_size = UINT64_MAX)
+{
+  std::vector<CorpusFile> files{
+    jpeg_file(),
+    nikon_f_mount_file(),
+    nikon_z_mount_file(),
+    canon_file(),
+    panasonic_file(),
+    fujifilm_file(),
+    minolta_file(),
+    sigma_file(),
+    subifd_tree_file(false),
+    subifd_tree_file(true),
+  };
+  const struct {
+    const char *name;
+    const char *model;
+    uint64_t size;
+  } sizes[] = {
+    {"size_10k.tif", "10 KB", 10 * 1024},
+    {"size_1m.tif", "1 MB", 1024 * 1024},
+    {"size_100m.tif", "100 MB", 100 * 1024 * 1024},
+    {"size_1g.tif", "1 GB", 1024 * 1024 * 1024},
+    {"size_4g.tif", "4 GB", 4ull * 1024 * 1024 * 1024},
+  };
+  for (const auto &s : sizes) {
+    if (s.size <= max_size) {
+      files.push_back(sized_file(s.name, s.model, s.size));
+    }
+  }
+  return files;
+}
+
+/** The bytes of the file, with its holes filled in. */
+inline std::vector<char> file_contents(const CorpusFile &f)
+{
+  std::vector<char> bytes(f.size);
+  for (const auto &[offset, extent] : f.extents) {
+    std::memcpy(bytes.data() + offset, extent.data(), extent.size());
+  }
+  return bytes;
+}
+
+/** Writes the file into `dir`, with holes between the extents where the file system has them. */
+inline bool write_corpus_file(const std::filesystem::path &dir, const CorpusFile &f)
+{
+  std::filesystem::path path = dir / f.name;
+  {
+    std::ofstream out(path, std::ios::binary | std::ios::trunc);
+    for (const auto &[offset, bytes] : f.extents) {
+      out.seekp(offset);
+      out.write((const char *)bytes.data(), bytes.size());
+    }
+    if (!out) {
+      return false;
+    }
+  }
+  std::error_code ec;
+  std::filesystem::resize_file(path, f.size, ec);
+  return !ec;
+}
+
+}  // namespace synthetic
@@ -0,0 +1,118 @@
+#include <atomic>
+#include <cstring>
+#include <cstdio>
+#include <thread>
+#include <vector>
+
+#include "neonexif/layout_cache.hpp"
+#include "check.hpp"
+#include "synthetic_corpus.hpp"
+
+/** Runs the parsers on the same buffers from 64 threads; meant for a ThreadSanitizer build. */
+int main()
+{
+  // Every container and makernote of the synthetic corpus, and a file cut
+  // short in its Exif data.
+  std::vector<std::vector<char>> files;
+  for (const synthetic::CorpusFile &f : synthetic::synthetic_corpus(1024 * 1024)) {
+    files.push_back(synthetic::file_contents(f));
+  }
+  files.emplace_back(files[0].begin(), files[0].begin() + 50);
+
+  struct Expected {
+    bool ok;
+    std::string make;
+    size_t num_warnings;
+  };
+  std::vector<Expected> expected;
+  for (const std::vector<char> &f : files) {
+    auto result = nexif::read_exif(f.data(), f.size());
+    expected.push_back({bool(result), result ? std::string(result.value().make().value.view()) : "", result.warnings.size()});
+  }
+
+  constexpr int NUM_THREADS = 64;
+  constexpr int NUM_ROUNDS = 50;
+  nexif::LayoutCache layout_cache;
+  std::atomic<int> mismatches{0}, parses{0};
+  std::vector<std::thread> threads;
+  for (int t = 0; t < NUM_THREADS; ++t) {
+    threads.emplace_back([&, t] {
+      // Half the threads log, each to their own sink.
+      int num_lines = 0;
+      nexif::ParseContext context;
+      if (t % 2) {
+        context.trace = nexif::TRACE_ALL;
+        context.log = [&num_lines](const char *) { num_lines++; };
+      }
+      nexif::ParseContextScope scope(context);
+
+      nexif::ExifData data;
+      for (int round = 0; round < NUM_ROUNDS; ++round) {
+        size_t i = (t + round) % files.size();
+        const char *buffer = files[i].data();
+        size_t length = files[i].size();
+        bool ok;
+        size_t num_warnings;
+        switch (round % 3) {
+          case 0: {
+            auto result = nexif::read_exif(buffer, length);
+            ok = bool(result);
+            num_warnings = result.warnings.size();
+            if (ok) {
+              ok = result.value().make().value.view() == expected[i].make;
+            }
+          } break;
+          case 1: {
+            nexif::ParseStatus status = nexif::read_exif_into(data, buffer, length, nexif::ParseLevel::LENS_RESOLVED, &layout_cache);
+            ok = bool(status) && data.make().value.view() == expected[i].make;
+            num_warnings = status.warnings.size();
+          } break;
+          default: {
+            nexif::ParseStatus status = nexif::read_exif_into(data, buffer, length, nexif::ParseLevel::CORE);
+            if (status) {
+              auto upgraded = nexif::upgrade(data, nexif::ParseLevel::LENS_RESOLVED, buffer, length);
+              ok = upgraded && upgraded.value() == nexif::ParseLevel::LENS_RESOLVED;
+              num_warnings = status.warnings.size() + upgraded.warnings.size();
+            } else {
+              ok = false;
+              num_warnings = status.warnings.size();
+            }
+          } break;
+        }
+        if (ok != expected[i].ok || num_warnings != expected[i].num_warnings || context.indent != 0) {
+          mismatches++;
+        }
+        parses++;
+      }
+      if (t % 2 && NEXIF_TRACING) {
+        CHECK(num_lines > 0);
+      }
+    });
+  }
+  for (std::thread &t : threads) {
+    t.join();
+  }
+  CHECK(parses == NUM_THREADS * NUM_ROUNDS);
+  CHECK(mismatches == 0);
+
+  // Options are per thread as well. An Exif IFD pointer out of bounds is a
+  // warning, or an error in strict mode.
+  std::vector<char> broken = files[0];
+  const uint8_t exif_ifd_le[] = {0x69, 0x87, 0x04, 0x00, 0x01, 0x00, 0x00, 0x00};
+  const uint8_t exif_ifd_be[] = {0x87, 0x69, 0x00, 0x04, 0x00, 0x00, 0x00, 0x01};
+  for (size_t p = 0; p + 12 <= broken.size(); ++p) {
+    if (!std::memcmp(&broken[p], exif_ifd_le, 8) || !std::memcmp(&broken[p], exif_ifd_be, 8)) {
+      std::memset(&broken[p + 8], 0x7f, 4);
+      break;
+    }
+  }
+  auto lenient = nexif::read_exif(broken.data(), broken.size());
+  CHECK(lenient && !lenient.warnings.empty());
+  nexif::ParseContext strict{.strict_mode = true};
+  std::thread([&] {
+    nexif::ParseContextScope scope(strict);
+    CHECK(!nexif::read_exif(broken.data(), broken.size()));
+  }).join();
+
+  return check_summary();
+}
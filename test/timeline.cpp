@@ -0,0 +1,243 @@
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <fstream>
+#include <future>
+#include <sstream>
+#include <string>
+#include <vector>
+
+#include "neonexif/async.hpp"
+#include "neonexif/scan_tree.hpp"
+#include "neonexif/scheduler.hpp"
+#include "neonexif/timeline.hpp"
+#include "check.hpp"
+#include "sample_exif_data.hpp"
+
+/** An event of the trace, which has one per line. */
+struct Event {
+  std::string name;
+  std::string ph;
+  std::string detail;  ///< Or the thread name, for "M".
+  double ts{0};
+  double dur{0};
+  int tid{0};
+};
+
+std::string string_field(const std::string &line, const char *key)
+{
+  size_t pos = line.find(key);
+  if (pos == std::string::npos) {
+    return {};
+  }
+  pos += std::strlen(key);
+  return line.substr(pos, line.find('"', pos) - pos);
+}
+
+double number_field(const std::string &line, const char *key)
+{
+  size_t pos = line.find(key);
+  return pos == std::string::npos ? -1 : std::strtod(line.c_str() + pos + std::strlen(key), nullptr);
+}
+
+std::vector<Event> parse_trace(const std::string &json)
+{
+  std::vector<Event> events;
+  std::istringstream in(json);
+  std::string line;
+  while (std::getline(in, line)) {
+    if (line.rfind("{\"name\":", 0) != 0) {
+      continue;
+    }
+    Event e;
+    e.name = string_field(line, "{\"name\":\"");
+    e.ph = string_field(line, "\"ph\":\"");
+    e.detail = e.ph == "M" ? string_field(line, "\"args\":{\"name\":\"") : string_field(line, "\"detail\":\"");
+    e.ts = number_field(line, "\"ts\":");
+    e.dur = number_field(line, "\"dur\":");
+    e.tid = int(number_field(line, "\"tid\":"));
+    events.push_back(e);
+  }
+  return events;
+}
+
+int count(const std::vector<Event> &events, const char *name, const char *ph = "X")
+{
+  int n = 0;
+  for (const Event &e : events) {
+    n += e.name == name && e.ph == ph;
+  }
+  return n;
+}
+
+/** Whether every span of `name` lies within a span of `parent`, on the same thread. */
+bool nested_in(const std::vector<Event> &events, const char *name, const char *parent)
+{
+  for (const Event &e : events) {
+    if (e.name != name || e.ph != "X") {
+      continue;
+    }
+    bool found = false;
+    for (const Event &p : events) {
+      found |= p.name == parent && p.ph == "X" && p.tid == e.tid && p.ts <= e.ts && e.ts + e.dur <= p.ts + p.dur;
+    }
+    if (!found) {
+      return false;
+    }
+  }
+  return true;
+}
+
+std::string thread_name(const std::vector<Event> &events, int tid)
+{
+  for (const Event &e : events) {
+    if (e.ph == "M" && e.tid == tid) {
+      return e.detail;
+    }
+  }
+  return {};
+}
+
+int main(int argc, char **argv)
+{
+  namespace fs = std::filesystem;
+  std::vector<uint8_t> jpeg = generate_sample_jpeg(generate_sample_exif_data());
+  const char *buffer = (const char *)jpeg.data();
+  fs::path dir = fs::temp_directory_path() / "neonexif_timeline";
+  fs::remove_all(dir);
+  fs::create_directories(dir / "sub");
+  for (const char *name : {"a.jpg", "b.jpg", "sub/c.jpg"}) {
+    std::ofstream out(dir / name, std::ios::binary);
+    out.write(buffer, jpeg.size());
+  }
+
+  // Disabled, nothing is recorded.
+  CHECK(!nexif::timeline_enabled());
+  CHECK(nexif::read_exif(buffer, jpeg.size()));
+  std::string json = nexif::format_chrome_trace();
+  CHECK(json.rfind("{\"displayTimeUnit\":\"ns\",\"traceEvents\":[", 0) == 0);
+  CHECK(parse_trace(json).empty());
+
+  nexif::enable_timeline();
+
+  // The phases of a parse.
+  nexif::ParseStats stats;
+  CHECK(nexif::read_exif(buffer, jpeg.size(), nullptr, nullptr, &stats));
+  std::vector<Event> events = parse_trace(nexif::format_chrome_trace());
+  for (const char *phase : {"guess_file_type", "locate_tiff", "read_tiff", "exif_ifd", "lens_resolve"}) {
+    CHECK(count(events, phase) == 1);
+  }
+  CHECK(stats.detect_ns > 0 && stats.exif_ifd_ns > 0);
+  CHECK(count(events, "thread_name", "M") == 1);
+  double end = 0;
+  for (const Event &e : events) {
+    if (e.ph == "X") {
+      CHECK(e.ts >= end && e.dur >= 0);  // One after the other.
+      end = e.ts + e.dur;
+    }
+  }
+  // The events were taken out.
+  CHECK(parse_trace(nexif::format_chrome_trace()).size() == 1);
+
+  // The scheduler: a track per worker, with a file span around the phases.
+  {
+    nexif::ParseScheduler scheduler(2);
+    for (int i = 0; i < 10; ++i) {
+      scheduler.submit(dir / "a.jpg", nexif::Priority::BACKGROUND, [](const nexif::ExifData &, const nexif::ParseStatus &status) { CHECK(status); });
+    }
+    scheduler.wait_idle();
+  }
+  events = parse_trace(nexif::format_chrome_trace());
+  CHECK(count(events, "file") == 10);
+  CHECK(count(events, "read_tiff") == 10);
+  CHECK(nested_in(events, "read_tiff", "file"));
+  CHECK(nested_in(events, "exif_ifd", "file"));
+  CHECK(count(events, "scheduler_queued", "C") == 20);
+  for (const Event &e : events) {
+    if (e.name == "file") {
+      CHECK(e.detail.ends_with("a.jpg"));
+      CHECK(thread_name(events, e.tid) == "scheduler worker");
+    }
+  }
+
+  // The batch API: a span per group, and per file and stage.
+  std::vector<std::span<const char>> buffers(40, std::span<const char>(buffer, jpeg.size()));
+  CHECK(nexif::read_exif_many(buffers).size() == 40);
+  events = parse_trace(nexif::format_chrome_trace());
+  CHECK(count(events, "group") == 2);
+  CHECK(count(events, "guess_file_type") == 40 && count(events, "read_tiff") == 40);
+  CHECK(nested_in(events, "file", "group"));
+  CHECK(nested_in(events, "guess_file_type", "file"));
+  CHECK(nested_in(events, "lens_resolve", "file"));
+  int first_file = 0;
+  for (const Event &e : events) {
+    first_file += e.name == "file" && e.detail == "#0";
+  }
+  CHECK(first_file == 6);  // Once for every stage.
+
+  // The crawler.
+  nexif::ScanOptions options;
+  options.walker_threads = 2;
+  options.sink_threads = 2;
+  auto scanned = nexif::scan_tree(dir, options, [](const nexif::ScannedFile &f) { CHECK(nexif::read_exif(f.path)); });
+  CHECK(scanned && scanned.value().files == 3);
+  events = parse_trace(nexif::format_chrome_trace());
+  CHECK(count(events, "directory") == 2);
+  CHECK(count(events, "probe") == 3);
+  CHECK(count(events, "file") == 3);
+  CHECK(count(events, "scan_queued", "C") == 6);
+  CHECK(nested_in(events, "read_tiff", "file"));
+  for (const Event &e : events) {
+    if (e.name == "directory") {
+      CHECK(thread_name(events, e.tid) == "scan walker");
+    } else if (e.name == "file") {
+      CHECK(thread_name(events, e.tid) == "scan sink");
+    }
+  }
+
+  // The reads of the thread pool.
+  {
+    std::unique_ptr<nexif::IoBackend> pool = nexif::make_thread_pool_backend(1);
+    std::promise<nexif::FileRead> done;
+    pool->read(dir / "b.jpg", 4096, [&](nexif::FileRead &&r) { done.set_value(std::move(r)); });
+    CHECK(!done.get_future().get().error);
+  }
+  events = parse_trace(nexif::format_chrome_trace());
+  CHECK(count(events, "read") == 1);
+  for (const Event &e : events) {
+    if (e.name == "read") {
+      CHECK(e.detail.ends_with("b.jpg") && thread_name(events, e.tid) == "io worker");
+    }
+  }
+
+  // A long detail keeps its end, cut at the start of a code point.
+  std::string accents = "x";
+  for (int i = 0; i < 40; ++i) {
+    accents += "\u00e9";
+  }
+  nexif::record_timeline_span("utf8", 0, 1, accents);
+  events = parse_trace(nexif::format_chrome_trace());
+  CHECK(count(events, "utf8") == 1);
+  for (const Event &e : events) {
+    if (e.name == "utf8") {
+      CHECK(e.detail == accents.substr(accents.length() - 54));
+    }
+  }
+
+  // To a file, with the events since the last one.
+  CHECK(nexif::read_exif(buffer, jpeg.size()));
+  CHECK(nexif::write_chrome_trace(dir / "timeline.json"));
+  std::ifstream file(dir / "timeline.json");
+  std::stringstream contents;
+  contents << file.rdbuf();
+  CHECK(count(parse_trace(contents.str()), "read_tiff") == 1);
+  CHECK(contents.str().ends_with("],\"otherData\":{\"dropped_events\":0}}\n"));
+  CHECK(!fs::exists(dir / "timeline.json.tmp"));
+
+  nexif::enable_timeline(false);
+  CHECK(nexif::read_exif(buffer, jpeg.size()));
+  CHECK(count(parse_trace(nexif::format_chrome_trace()), "read_tiff") == 0);
+  fs::remove_all(dir);
+
+  return check_summary();
+}
@@ -0,0 +1,109 @@
+#include <cstdio>
+#include <cstring>
+#include <string>
+#include <thread>
+#include <vector>
+
+#include "neonexif/trace.hpp"
+#include "check.hpp"
+#include "sample_exif_data.hpp"
+
+std::vector<nexif::TraceEvent> drain(uint64_t *dropped = nullptr)
+{
+  std::vector<nexif::TraceEvent> events;
+  uint64_t d = nexif::drain_trace_events([&](const nexif::TraceEvent &e) { events.push_back(e); });
+  if (dropped) {
+    *dropped = d;
+  }
+  return events;
+}
+
+int count(const std::vector<nexif::TraceEvent> &events, nexif::TraceEventType type)
+{
+  return std::count_if(events.begin(), events.end(), [type](const nexif::TraceEvent &e) { return e.type == type; });
+}
+
+int main()
+{
+  if (!NEXIF_TRACING) {
+    std::printf("Tracing is compiled out.\n");
+    return 0;
+  }
+
+  std::vector<uint8_t> jpeg = generate_sample_jpeg(generate_sample_exif_data());
+  auto parse = [&](const std::vector<uint8_t> &file) { return nexif::read_exif((const char *)file.data(), file.size()); };
+
+  // Without a context, or with no categories, nothing is recorded.
+  CHECK(parse(jpeg));
+  {
+    nexif::ParseContext context;
+    nexif::ParseContextScope scope(context);
+    CHECK(parse(jpeg));
+  }
+  CHECK(drain().empty());
+
+  // Only the enabled categories are recorded, and formatted when read.
+  {
+    nexif::ParseContext context{.trace = nexif::TRACE_IFD | nexif::TRACE_TAG};
+    nexif::ParseContextScope scope(context);
+    CHECK(parse(jpeg));
+    CHECK(context.indent == 0);
+  }
+  std::vector<nexif::TraceEvent> events = drain();
+  CHECK(count(events, nexif::TraceEventType::IFD_ENTER) == 2);  // IFD0 and the Exif IFD.
+  CHECK(count(events, nexif::TraceEventType::IFD_EXIT) == 2);
+  CHECK(count(events, nexif::TraceEventType::TAG) > 10);
+  CHECK(count(events, nexif::TraceEventType::MESSAGE) == 0);
+  bool found_make = false;
+  uint64_t last_time = 0;
+  for (const nexif::TraceEvent &e : events) {
+    CHECK(e.time_ns >= last_time);
+    last_time = e.time_ns;
+    if (e.type == nexif::TraceEventType::TAG) {
+      CHECK(e.depth == 1);
+    }
+    if (e.type == nexif::TraceEventType::TAG && e.tag == 0x010f) {
+      char line[256];
+      nexif::format_trace_event(e, line, sizeof(line));
+      found_make = std::strstr(line, "0x010f make") != nullptr;
+    }
+  }
+  CHECK(found_make);
+
+  // Warnings, from another thread, and passed to the live log too.
+  std::vector<uint8_t> broken = jpeg;
+  const uint8_t exif_ifd_le[] = {0x69, 0x87, 0x04, 0x00, 0x01, 0x00, 0x00, 0x00};
+  for (size_t p = 0; p + 12 <= broken.size(); ++p) {
+    if (!std::memcmp(&broken[p], exif_ifd_le, 8)) {
+      std::memset(&broken[p + 8], 0x7f, 4);
+      break;
+    }
+  }
+  std::vector<std::string> lines;
+  std::thread([&] {
+    nexif::ParseContext context{.trace = nexif::TRACE_WARNING, .log = [&](const char *line) { lines.push_back(line); }};
+    nexif::ParseContextScope scope(context);
+    auto result = parse(broken);
+    CHECK(result && result.warnings.size() == 1);
+  }).join();
+  events = drain();
+  CHECK(events.size() == 1 && events[0].type == nexif::TraceEventType::WARNING);
+  CHECK(lines.size() == 1 && lines[0].starts_with("Warning: "));
+
+  // A full ring drops the newest events, and counts them.
+  {
+    nexif::ParseContext context{.trace = nexif::TRACE_ALL};
+    nexif::ParseContextScope scope(context);
+    for (int i = 0; i < 200; ++i) {
+      CHECK(parse(jpeg));
+    }
+  }
+  uint64_t dropped = 0;
+  events = drain(&dropped);
+  CHECK(events.size() == 4096);
+  CHECK(dropped > 0);
+  CHECK(count(events, nexif::TraceEventType::MESSAGE) > 0);
+  CHECK(drain(&dropped).empty() && dropped == 0);
+
+  return check_summary();
+}
@@ -0,0 +1,150 @@
+#include <cstdio>
+#include <cstring>
+#include <elf.h>
+#include <fstream>
+#include <set>
+#include <sstream>
+#include <string>
+#include <vector>
+
+#include "neonexif/neonexif.hpp"
+#include "neonexif/sdt.h"
+#include "check.hpp"
+#include "sample_exif_data.hpp"
+
+struct Probe {
+  std::string provider;
+  std::string name;
+  std::string args;
+  uint64_t location{0};
+  uint64_t base{0};
+};
+
+std::string read_file(const char *path)
+{
+  std::ifstream file(path, std::ios::binary);
+  std::stringstream contents;
+  contents << file.rdbuf();
+  return contents.str();
+}
+
+/** The probes in the `.note.stapsdt` section of a 64-bit ELF file. */
+void find_probes(std::string_view elf, std::vector<Probe> &probes)
+{
+  if (elf.size() < sizeof(Elf64_Ehdr) || std::memcmp(elf.data(), ELFMAG, SELFMAG) != 0 || elf[EI_CLASS] != ELFCLASS64) {
+    return;
+  }
+  Elf64_Ehdr eh;
+  std::memcpy(&eh, elf.data(), sizeof(eh));
+  auto section = [&](int i) {
+    Elf64_Shdr sh;
+    std::memcpy(&sh, elf.data() + eh.e_shoff + i * sizeof(Elf64_Shdr), sizeof(sh));
+    return sh;
+  };
+  Elf64_Shdr names = section(eh.e_shstrndx);
+  for (int i = 0; i < eh.e_shnum; ++i) {
+    Elf64_Shdr sh = section(i);
+    if (sh.sh_type != SHT_NOTE || std::strcmp(elf.data() + names.sh_offset + sh.sh_name, ".note.stapsdt") != 0) {
+      continue;
+    }
+    for (uint64_t pos = sh.sh_offset; pos + sizeof(Elf64_Nhdr) <= sh.sh_offset + sh.sh_size;) {
+      Elf64_Nhdr nh;
+      std::memcpy(&nh, elf.data() + pos, sizeof(nh));
+      const char *owner = elf.data() + pos + sizeof(nh);
+      const char *desc = owner + ((nh.n_namesz + 3) & ~3u);
+      if (nh.n_type == 3 && std::strcmp(owner, "stapsdt") == 0) {
+        Probe p;
+        std::memcpy(&p.location, desc, 8);
+        std::memcpy(&p.base, desc + 8, 8);
+        const char *strings = desc + 24;
+        p.provider = strings;
+        p.name = strings + p.provider.length() + 1;
+        p.args = strings + p.provider.length() + p.name.length() + 2;
+        probes.push_back(p);
+      }
+      pos += sizeof(nh) + ((nh.n_namesz + 3) & ~3u) + ((nh.n_descsz + 3) & ~3u);
+    }
+  }
+}
+
+/** The probes of all objects in an `ar` archive. */
+std::vector<Probe> find_probes_in_archive(const std::string &archive)
+{
+  std::vector<Probe> probes;
+  if (archive.rfind("!<arch>\n", 0) != 0) {
+    return probes;
+  }
+  for (size_t pos = 8; pos + 60 <= archive.size();) {
+    size_t size = std::stoul(archive.substr(pos + 48, 10));
+    find_probes(std::string_view(archive).substr(pos + 60, size), probes);
+    pos += 60 + size + (size & 1);
+  }
+  return probes;
+}
+
+// The base of the notes, as linked into this executable.
+extern "C" const char stapsdt_base __asm__("_.stapsdt.base");
+
+int main()
+{
+  if (!NEXIF_USDT) {
+    std::printf("USDT probes are compiled out.\n");
+    return 0;
+  }
+
+  // Every probe is in the library.
+  std::vector<Probe> probes = find_probes_in_archive(read_file(NEXIF_LIBRARY));
+  std::set<std::string> names;
+  for (const Probe &p : probes) {
+    CHECK(p.provider == "neonexif");
+    names.insert(p.name);
+  }
+  for (const char *name : {"parse__start", "parse__done", "ifd__enter", "makernote", "lens__resolve", "warning"}) {
+    CHECK(names.contains(name));
+  }
+
+  // The arguments: file type and variant, the error code (signed), the length and the warnings.
+  std::vector<Probe> linked;
+  find_probes(read_file("/proc/self/exe"), linked);
+  std::set<std::string> linked_names;
+  std::set<uint64_t> locations;
+  int num_done = 0;
+  for (const Probe &p : linked) {
+    linked_names.insert(p.name);
+    locations.insert(p.location);
+    if (p.name == "parse__done") {
+      num_done++;
+      std::istringstream args(p.args);
+      std::vector<std::string> sizes;
+      for (std::string arg; args >> arg;) {
+        sizes.push_back(arg.substr(0, arg.find('@')));
+      }
+      CHECK(sizes.size() == 5);
+      CHECK(sizes.size() == 5 && sizes[2] == "-4" && sizes[3] == "8" && sizes[4] == "8");
+    }
+  }
+  CHECK(num_done > 0);
+  CHECK(linked_names == names);
+  CHECK(locations.size() == linked.size() && !locations.contains(0));
+
+  // Each probe site is a nop, at the address in the note once corrected for
+  // where the executable was loaded.
+#if defined(__x86_64__) || defined(__aarch64__)
+  for (const Probe &p : linked) {
+    CHECK(p.base != 0);
+    const uint8_t *site = (const uint8_t *)&stapsdt_base + (p.location - p.base);
+#if defined(__x86_64__)
+    CHECK(site[0] == 0x90);
+#else
+    CHECK(std::memcmp(site, "\x1f\x20\x03\xd5", 4) == 0);
+#endif
+  }
+#endif
+
+  // And parsing runs over them.
+  std::vector<uint8_t> jpeg = generate_sample_jpeg(generate_sample_exif_data());
+  CHECK(nexif::read_exif((const char *)jpeg.data(), jpeg.size()));
+
+  std::printf("%zu probes.\n", linked.size());
+  return check_summary();
+}